@@ -28,6 +28,7 @@
 #include "pch.h"
 #include "FileBuffer.h"
 #include "ConvertWideString.h"
+#include "GzipCache.h"
 #include "gzip.h"
 
 unsigned long g_streaming_limit = STREAMING_LIMIT;
@@ -559,6 +560,11 @@ FileBuffer::operator=(FileBuffer& p_orig)
 bool
 FileBuffer::ZipBuffer()
 {
+  // Files are compressed from disk, and the result is cached
+  if(!m_fileName.IsEmpty())
+  {
+    return ZipFile();
+  }
   unsigned size = (unsigned) GetLength();
 
   // Do not ZIP the buffer under the compression limit
@@ -568,42 +574,218 @@ FileBuffer::ZipBuffer()
     return false;
   }
 
+  // Too big for the body cache: compress the parts as one stream
+  if(GetHasBufferParts() && size > GZIPCACHE_BODY_MAX)
+  {
+    return ZipParts();
+  }
+
   // First see if we must defragment the buffer
   if(Defragment() == false)
   {
     return false;
   }
 
-  // Be sure we have the file in the buffer
-  if(!m_fileName.IsEmpty())
+  // Generated body: seen this one before?
+  XString admit;
+  GzipVariant* variant = g_gzipCache.FindBody(m_buffer,m_binaryLength,admit);
+  if(variant)
   {
-    if(ReadFile())
+    SetZipped(variant);
+    variant->DropReference();
+    return true;
+  }
+
+  // Compress in-memory with ZLib to a 'gzip' buffer for HTTP
+  // But only if it stays within our share of the processors
+  if(!g_gzipCache.StartCompression())
+  {
+    return false;
+  }
+  uint8_t* zipped = nullptr;
+  size_t   length = 0;
+  bool     result = gzip_compress_buffer(m_buffer,m_binaryLength,zipped,length);
+  g_gzipCache.EndCompression();
+
+  if(result)
+  {
+    if(!admit.IsEmpty())
     {
-      m_fileName.Empty();
+      uchar* copy = alloc_new uchar[length + 2];
+      memcpy(copy,zipped,length + 2);
+      variant = alloc_new GzipVariant(copy,length);
+      g_gzipCache.StoreBody(admit,m_buffer,m_binaryLength,variant);
+      variant->DropReference();
     }
-    else
+    delete [] m_buffer;
+    m_buffer       = reinterpret_cast<uchar*>(zipped);
+    m_binaryLength = length;
+  }
+  return result;
+}
+
+// GZIP the buffer parts in one stream, without defragmenting them first
+bool
+FileBuffer::ZipParts()
+{
+  std::vector<std::pair<void*,size_t>> parts;
+  for(const auto& part : m_parts)
+  {
+    parts.push_back(std::make_pair(part.m_buffer,part.m_length));
+  }
+  if(!g_gzipCache.StartCompression())
+  {
+    return false;
+  }
+  uint8_t* zipped = nullptr;
+  size_t   length = 0;
+  bool     result = gzip_compress_parts(parts,zipped,length);
+  g_gzipCache.EndCompression();
+
+  if(result)
+  {
+    Reset();
+    m_buffer       = reinterpret_cast<uchar*>(zipped);
+    m_binaryLength = length;
+  }
+  return result;
+}
+
+// GZIP a file: from the cache, from a '.gz' sibling on disk
+// or by streaming compression of the file into the cache directory.
+// A big result is sent from the cache directory, not from memory
+bool
+FileBuffer::ZipFile()
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if(!GetFileAttributesEx(m_fileName,GetFileExInfoStandard,&data))
+  {
+    return false;
+  }
+  ULONGLONG size = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+  if(size < g_compress_limit || size > g_streaming_limit)
+  {
+    return false;
+  }
+
+  GzipVariant* variant = g_gzipCache.FindFile(m_fileName,size,data.ftLastWriteTime);
+  if(!variant)
+  {
+    variant = ReadZipSibling(data.ftLastWriteTime);
+    if(!variant)
+    {
+      // Compressed before in the cache directory, or compress it now
+      XString cacheFile = g_gzipCache.CacheFile(m_fileName);
+      WIN32_FILE_ATTRIBUTE_DATA cache;
+      if(!GetFileAttributesEx(cacheFile,GetFileExInfoStandard,&cache) ||
+         CompareFileTime(&cache.ftLastWriteTime,&data.ftLastWriteTime) < 0)
+      {
+        if(!ZipToCache(cacheFile,size) ||
+           !GetFileAttributesEx(cacheFile,GetFileExInfoStandard,&cache))
+        {
+          return false;
+        }
+      }
+      if(cache.nFileSizeHigh || cache.nFileSizeLow > GZIPCACHE_BODY_MAX)
+      {
+        // Too big for memory: send the compressed file from disk
+        m_fileName = cacheFile;
+        return true;
+      }
+      variant = ReadZipped(cacheFile,data.ftLastWriteTime);
+    }
+    if(!variant)
     {
       return false;
     }
+    g_gzipCache.StoreFile(m_fileName,size,data.ftLastWriteTime,variant);
   }
+  SetZipped(variant);
+  variant->DropReference();
+  m_fileName.Empty();
+  return true;
+}
 
-  // Compress in-memory with ZLib to a 'gzip' buffer for HTTP
-  std::vector<uint8_t> out_data;
-  if(gzip_compress_memory(m_buffer,m_binaryLength,out_data))
+// Compress the file in fixed size blocks into a new cache file
+// Written under a temporary name, so no one sees a half written file
+bool
+FileBuffer::ZipToCache(const XString& p_cacheFile,ULONGLONG p_size)
+{
+  if(!g_gzipCache.StartCompression())
   {
-    m_binaryLength = out_data.size();
-  
-    delete [] m_buffer;
-    m_buffer = alloc_new uchar[m_binaryLength + 2];
-    for(size_t ind = 0;ind < m_binaryLength; ++ind)
+    return false;
+  }
+  XString temporary;
+  temporary.Format(_T("%s.%lu.tmp"),p_cacheFile.GetString(),GetCurrentThreadId());
+
+  bool   result = false;
+  size_t length = 0;
+  HANDLE output = CreateFile(temporary,GENERIC_WRITE,0,NULL,CREATE_ALWAYS,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+  if(output != INVALID_HANDLE_VALUE)
+  {
+    if(OpenFile(true))
     {
-      (reinterpret_cast<uint8_t *>(m_buffer))[ind] = out_data[ind];
+      result = gzip_compress_file(m_file,(size_t)p_size,output,length);
+      CloseFile();
     }
-    m_buffer[m_binaryLength    ] = 0;
-    m_buffer[m_binaryLength + 1] = 0;
-    return true;
+    CloseHandle(output);
   }
-  return false;
+  g_gzipCache.EndCompression();
+
+  // Fails if an older version is still being sent
+  if(result && !MoveFileEx(temporary,p_cacheFile,MOVEFILE_REPLACE_EXISTING))
+  {
+    result = false;
+  }
+  DeleteFile(temporary);
+  return result;
+}
+
+// Pre-compressed 'file.ext.gz' next to the file, but not older than the file
+GzipVariant*
+FileBuffer::ReadZipSibling(const FILETIME& p_time)
+{
+  return ReadZipped(m_fileName + _T(".gz"),p_time);
+}
+
+// Read a compressed file that is not older than the file itself
+GzipVariant*
+FileBuffer::ReadZipped(const XString& p_zipFile,const FILETIME& p_time)
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if(!GetFileAttributesEx(p_zipFile,GetFileExInfoStandard,&data) || data.nFileSizeHigh)
+  {
+    return nullptr;
+  }
+  if(CompareFileTime(&data.ftLastWriteTime,&p_time) < 0)
+  {
+    return nullptr;
+  }
+  FileBuffer zipped(p_zipFile);
+  if(!zipped.ReadFile())
+  {
+    return nullptr;
+  }
+  // Take over the buffer of the sibling
+  GzipVariant* variant = alloc_new GzipVariant(zipped.m_buffer,zipped.m_binaryLength);
+  zipped.m_buffer       = nullptr;
+  zipped.m_binaryLength = 0;
+  return variant;
+}
+
+// Our own copy of the cached variant
+void
+FileBuffer::SetZipped(GzipVariant* p_variant)
+{
+  if(m_buffer)
+  {
+    delete [] m_buffer;
+  }
+  m_binaryLength = p_variant->m_length;
+  m_buffer = alloc_new uchar[m_binaryLength + 2];
+  memcpy(m_buffer,p_variant->m_data,m_binaryLength);
+  m_buffer[m_binaryLength    ] = 0;
+  m_buffer[m_binaryLength + 1] = 0;
 }
 
 // GunZIP the contents of the buffer
@@ -669,6 +851,31 @@ FileBuffer::Defragment()
   return true;
 }
 
+// GZIP the next chunk of a response. The stream carries the compression
+// state from chunk to chunk. No lower limit (as in ZipBuffer) here:
+// a small chunk still profits from the dictionary of the former chunks.
+bool
+FileBuffer::ZipChunk(GzipStream* p_stream,bool p_final)
+{
+  if(!m_fileName.IsEmpty() || !Defragment())
+  {
+    return false;
+  }
+  uint8_t* zipped = nullptr;
+  size_t   length = 0;
+  if(!p_stream->Compress(m_buffer,m_binaryLength,p_final,zipped,length))
+  {
+    return false;
+  }
+  if(m_buffer)
+  {
+    delete [] m_buffer;
+  }
+  m_buffer       = reinterpret_cast<uchar*>(zipped);
+  m_binaryLength = length;
+  return true;
+}
+
 #define CHUNKED_OVERHEAD 20
 
 // Chunked encoding of the primary memory buffer
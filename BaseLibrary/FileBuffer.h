@@ -28,6 +28,9 @@
 #pragma once
 #include <vector>
 
+class GzipVariant;
+class GzipStream;
+
 // Max streaming serialize/de-serialize limit
 // Files bigger than this can only be putted/gotten by indirect file references
 // This is also the streaming limit for OData / REST interfaces
@@ -112,12 +115,22 @@ public:
   bool    ZipBuffer();
   // GunZIP the contents of the buffer
   bool    UnZipBuffer();
+  // GZIP the next chunk of a streaming compressed response
+  bool    ZipChunk(GzipStream* p_stream,bool p_final);
   // Chunked encoding of the primary memory buffer
   bool    ChunkedEncoding(bool p_final);
 
 private:
   // Defragment the buffer
   bool    Defragment();
+  // GZIP the buffer parts in one stream
+  bool    ZipParts();
+  // GZIP a file, from the cache or from disk
+  bool    ZipFile();
+  bool    ZipToCache(const XString& p_cacheFile,ULONGLONG p_size);
+  GzipVariant* ReadZipSibling(const FILETIME& p_time);
+  GzipVariant* ReadZipped(const XString& p_zipFile,const FILETIME& p_time);
+  void    SetZipped(GzipVariant* p_variant);
 
   // Data contents of the HTTP buffer
   XString  m_fileName;     // File to receive/send
@@ -0,0 +1,317 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: GzipCache.cpp
+//
+// BaseLibrary: Indispensable general objects and functions
+// 
+// Created: 2014-2025 ir. W.E. Huisman
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "GzipCache.h"
+#include "AutoCritical.h"
+
+unsigned long g_compress_share = COMPRESS_SHARE;
+
+// The one and only cache of the process
+GzipCache g_gzipCache;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// GZIP VARIANT
+//
+//////////////////////////////////////////////////////////////////////////
+
+GzipVariant::GzipVariant(uchar* p_data,size_t p_length)
+            :m_data(p_data)
+            ,m_length(p_length)
+{
+}
+
+GzipVariant::~GzipVariant()
+{
+  delete [] m_data;
+  if(m_original)
+  {
+    delete [] m_original;
+  }
+}
+
+void
+GzipVariant::AddReference()
+{
+  InterlockedIncrement(&m_references);
+}
+
+void
+GzipVariant::DropReference()
+{
+  if(InterlockedDecrement(&m_references) == 0)
+  {
+    delete this;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// GZIP CACHE
+//
+//////////////////////////////////////////////////////////////////////////
+
+GzipCache::GzipCache()
+{
+  InitializeCriticalSection(&m_lock);
+}
+
+GzipCache::~GzipCache()
+{
+  Reset();
+  DeleteCriticalSection(&m_lock);
+}
+
+GzipVariant*
+GzipCache::FindFile(const XString& p_path,ULONGLONG p_size,const FILETIME& p_time)
+{
+  return Find(FileKey(p_path,p_size,p_time));
+}
+
+void
+GzipCache::StoreFile(const XString& p_path,ULONGLONG p_size,const FILETIME& p_time,GzipVariant* p_variant)
+{
+  Store(FileKey(p_path,p_size,p_time),p_variant);
+}
+
+// One cache file per path, in "%TEMP%\MarlinGzip\"
+// It is only valid if it is not older than the file itself
+XString
+GzipCache::CacheFile(const XString& p_path)
+{
+  { AutoCritSec lock(&m_lock);
+    if(m_directory.IsEmpty())
+    {
+      TCHAR temp[MAX_PATH + 1] = _T("");
+      GetTempPath(MAX_PATH,temp);
+      m_directory = XString(temp) + _T("MarlinGzip\\");
+      CreateDirectory(m_directory,NULL);
+    }
+  }
+  XString path(p_path);
+  path.MakeLower();
+  ULONGLONG hash = 0;
+  BodyKey(reinterpret_cast<const uchar*>(path.GetString()),path.GetLength() * sizeof(TCHAR),hash);
+
+  XString name;
+  name.Format(_T("%s%016llx.gz"),m_directory.GetString(),hash);
+  return name;
+}
+
+GzipVariant*
+GzipCache::FindBody(const uchar* p_data,size_t p_length,XString& p_admit)
+{
+  p_admit.Empty();
+  if(p_length > GZIPCACHE_BODY_MAX)
+  {
+    return nullptr;
+  }
+  ULONGLONG hash = 0;
+  XString key = BodyKey(p_data,p_length,hash);
+
+  GzipVariant* variant = Find(key);
+  if(variant)
+  {
+    // The hash is no proof: the body must be the same
+    if(variant->m_size == p_length && memcmp(variant->m_original,p_data,p_length) == 0)
+    {
+      return variant;
+    }
+    variant->DropReference();
+    return nullptr;
+  }
+
+  // Only worth keeping if we see it for the second time
+  AutoCritSec lock(&m_lock);
+  if(m_seen.erase(hash))
+  {
+    p_admit = key;
+  }
+  else
+  {
+    if(m_seen.size() >= GZIPCACHE_CANDIDATES)
+    {
+      m_seen.clear();
+    }
+    m_seen[hash] = true;
+  }
+  return nullptr;
+}
+
+void
+GzipCache::StoreBody(const XString& p_key,const uchar* p_data,size_t p_length,GzipVariant* p_variant)
+{
+  p_variant->m_original = alloc_new uchar[p_length];
+  p_variant->m_size     = p_length;
+  memcpy(p_variant->m_original,p_data,p_length);
+  Store(p_key,p_variant);
+}
+
+void
+GzipCache::Reset()
+{
+  AutoCritSec lock(&m_lock);
+
+  for(auto& variant : m_variants)
+  {
+    variant.second->DropReference();
+  }
+  m_variants.clear();
+  m_order.clear();
+  m_seen.clear();
+  m_memory = 0;
+}
+
+// Never more threads compressing than the share of the processors
+bool
+GzipCache::StartCompression()
+{
+  static LONG processors = 0;
+  if(processors == 0)
+  {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    processors = (LONG)info.dwNumberOfProcessors;
+  }
+  LONG maximum = (LONG)(processors * g_compress_share / 100);
+  if(maximum < 1)
+  {
+    maximum = 1;
+  }
+  if(InterlockedIncrement(&m_compressing) > maximum)
+  {
+    InterlockedDecrement(&m_compressing);
+    return false;
+  }
+  return true;
+}
+
+void
+GzipCache::EndCompression()
+{
+  InterlockedDecrement(&m_compressing);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// PRIVATE
+//
+//////////////////////////////////////////////////////////////////////////
+
+XString
+GzipCache::FileKey(const XString& p_path,ULONGLONG p_size,const FILETIME& p_time)
+{
+  XString key;
+  key.Format(_T("%s|%llx|%lx%08lx"),p_path.GetString(),p_size,p_time.dwHighDateTime,p_time.dwLowDateTime);
+  key.MakeLower();
+  return key;
+}
+
+// FNV-1a, but a 64 bits word at the time
+XString
+GzipCache::BodyKey(const uchar* p_data,size_t p_length,ULONGLONG& p_hash)
+{
+  ULONGLONG hash  = 14695981039346656037ULL;
+  size_t    words = p_length / sizeof(ULONGLONG);
+  for(size_t index = 0;index < words; ++index)
+  {
+    ULONGLONG word;
+    memcpy(&word,p_data + index * sizeof(ULONGLONG),sizeof(ULONGLONG));
+    hash ^= word;
+    hash *= 1099511628211ULL;
+  }
+  for(size_t index = words * sizeof(ULONGLONG);index < p_length; ++index)
+  {
+    hash ^= p_data[index];
+    hash *= 1099511628211ULL;
+  }
+  p_hash = hash;
+
+  XString key;
+  key.Format(_T("#%016llx|%zx"),hash,p_length);
+  return key;
+}
+
+GzipVariant*
+GzipCache::Find(const XString& p_key)
+{
+  AutoCritSec lock(&m_lock);
+
+  GzipVariants::iterator it = m_variants.find(p_key);
+  if(it == m_variants.end())
+  {
+    ++m_misses;
+    return nullptr;
+  }
+  ++m_hits;
+  it->second->AddReference();
+  return it->second;
+}
+
+// The cache takes its own reference on the variant
+void
+GzipCache::Store(const XString& p_key,GzipVariant* p_variant)
+{
+  size_t size = p_variant->m_length + p_variant->m_size;
+  if(size > GZIPCACHE_MEMORY / 4)
+  {
+    // Would push out too many others
+    return;
+  }
+  AutoCritSec lock(&m_lock);
+
+  // Drop the oldest variants until the new one fits
+  while(m_memory + size > GZIPCACHE_MEMORY && !m_order.empty())
+  {
+    GzipVariants::iterator it = m_variants.find(m_order.front());
+    if(it != m_variants.end())
+    {
+      m_memory -= it->second->m_length + it->second->m_size;
+      it->second->DropReference();
+      m_variants.erase(it);
+    }
+    m_order.pop_front();
+  }
+
+  p_variant->AddReference();
+  m_memory += size;
+
+  GzipVariants::iterator it = m_variants.find(p_key);
+  if(it != m_variants.end())
+  {
+    // Another thread was first
+    m_memory -= it->second->m_length + it->second->m_size;
+    it->second->DropReference();
+    it->second = p_variant;
+  }
+  else
+  {
+    m_variants.insert(std::make_pair(p_key,p_variant));
+    m_order.push_back(p_key);
+  }
+}
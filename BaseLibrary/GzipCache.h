@@ -0,0 +1,130 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: GzipCache.h
+//
+// BaseLibrary: Indispensable general objects and functions
+// 
+// Created: 2014-2025 ir. W.E. Huisman
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include <unordered_map>
+#include <deque>
+
+// Total bytes of compressed variants kept in memory
+#define GZIPCACHE_MEMORY      (64*1024*1024)
+// Generated bodies above this size are never cached
+// Compressed files above this size are sent from the cache directory
+#define GZIPCACHE_BODY_MAX    (1024*1024)
+// Number of body hashes remembered for the 'seen twice' admission
+#define GZIPCACHE_CANDIDATES  4096
+// Default percentage of the processors that may be compressing at once
+#define COMPRESS_SHARE        50
+
+// Percentage of the processors for compression
+// Can be set through the Marlin.config reading of the HTTPServer
+extern unsigned long g_compress_share;  // = COMPRESS_SHARE;
+
+// One gzip'ed variant of a file or a generated body
+class GzipVariant
+{
+public:
+  GzipVariant(uchar* p_data,size_t p_length);
+
+  void    AddReference();
+  void    DropReference();
+
+  uchar*  m_data;                   // Compressed bytes (owned)
+  size_t  m_length;                 // Compressed length
+  uchar*  m_original { nullptr };   // Generated body: the uncompressed bytes
+  size_t  m_size     { 0       };   // Uncompressed length
+
+private:
+ ~GzipVariant();
+  volatile LONG m_references { 1 };
+};
+
+struct GzipHash
+{
+  size_t operator()(const XString& p_key) const
+  {
+    return std::hash<std::stdstring>()(p_key);
+  }
+};
+
+using GzipVariants = std::unordered_map<XString,GzipVariant*,GzipHash>;
+using GzipOrder    = std::deque<XString>;
+using GzipSeen     = std::unordered_map<ULONGLONG,bool>;
+
+// Cache of compressed responses, so the same bytes are not compressed
+// again on every hit of a static file (key: path, size and modification
+// time) or of a repeated generated body (key: hash, and a full compare).
+// A generated body is only kept the second time it is seen.
+// The oldest variants are dropped when the memory budget is exceeded.
+// Also bounds the compression work: no more threads compress at the
+// same time than the share of the processors allows.
+// Files are compressed into the cache directory on disk, so a big file
+// is never compressed in memory as a whole.
+class GzipCache
+{
+public:
+  GzipCache();
+ ~GzipCache();
+
+  // Find the variant of a file. Call 'DropReference' on the result
+  GzipVariant* FindFile (const XString& p_path,ULONGLONG p_size,const FILETIME& p_time);
+  void         StoreFile(const XString& p_path,ULONGLONG p_size,const FILETIME& p_time,GzipVariant* p_variant);
+  // Find the variant of a generated body. Call 'DropReference' on the result
+  // p_admit gets the key to store the body with, or is empty if not worth it
+  GzipVariant* FindBody (const uchar* p_data,size_t p_length,XString& p_admit);
+  void         StoreBody(const XString& p_key,const uchar* p_data,size_t p_length,GzipVariant* p_variant);
+  void         Reset();
+  // Compressed cache file of a file on disk (in the cache directory)
+  XString      CacheFile(const XString& p_path);
+
+  // Bounding the compression work
+  bool         StartCompression();
+  void         EndCompression();
+
+  // GETTERS
+  ULONGLONG    GetHits()   { return m_hits;   }
+  ULONGLONG    GetMisses() { return m_misses; }
+  size_t       GetMemory() { return m_memory; }
+
+private:
+  XString      FileKey(const XString& p_path,ULONGLONG p_size,const FILETIME& p_time);
+  XString      BodyKey(const uchar* p_data,size_t p_length,ULONGLONG& p_hash);
+  GzipVariant* Find (const XString& p_key);
+  void         Store(const XString& p_key,GzipVariant* p_variant);
+
+  GzipVariants  m_variants;
+  GzipOrder     m_order;              // Oldest first
+  GzipSeen      m_seen;               // Bodies seen once
+  XString       m_directory;          // Cache directory for the compressed files
+  size_t        m_memory      { 0 };
+  ULONGLONG     m_hits        { 0 };
+  ULONGLONG     m_misses      { 0 };
+  volatile LONG m_compressing { 0 };
+  CRITICAL_SECTION m_lock;
+};
+
+// The one and only cache of the process
+extern GzipCache g_gzipCache;
@@ -29,11 +29,13 @@
 #include "HTTPMessage.h"
 #include "SOAPMessage.h"
 #include "JSONMessage.h"
+#include "JSONWriter.h"
 #include "CrackURL.h"
 #include "Base64.h"
 #include "Crypto.h"
 #include "HTTPTime.h"
 #include "MultiPartBuffer.h"
+#include "gzip.h"
 #include <xutility>
 #include <string>
 
@@ -274,7 +276,23 @@ HTTPMessage::operator=(const JSONMessage& p_msg)
   XString charset = DecodeCharsetAndEncoding(p_msg.GetEncoding(),m_contentType,_T("application/json"));
 
   // Set body 
-  ConstructBodyFromString(p_msg.GetJsonMessage(),charset,p_msg.GetSendBOM());
+#ifdef _UNICODE
+  if(charset.CompareNoCase(_T("utf-8")) == 0)
+  {
+    // Serialize straight into the body, without the text of the message in between
+    JSONWriter writer(p_msg.GetWhitespace(),p_msg.GetExponentialFormat());
+    size_t length = writer.WriteUTF8(p_msg.GetValue(),m_buffer,p_msg.GetSendBOM());
+
+    XString cl;
+    cl.Format(_T("%zu"),length);
+    DelHeader(_T("Content-Length"));
+    AddHeader(_T("Content-Length"),cl);
+  }
+  else
+#endif
+  {
+    ConstructBodyFromString(p_msg.GetJsonMessage(),charset,p_msg.GetSendBOM());
+  }
 
   // Make sure we have a server name for host headers
   CheckServer();
@@ -384,6 +402,11 @@ HTTPMessage::~HTTPMessage()
     CloseHandle(m_token);
     m_token = NULL;
   }
+  if(m_gzipStream)
+  {
+    delete m_gzipStream;
+    m_gzipStream = nullptr;
+  }
 }
 
 // Recycle the object for usage in a return message
@@ -730,6 +753,18 @@ HTTPMessage::SetCookiePairs(const XString& p_cookies)
   }
 }
 
+// Streaming compression of the chunks of this response
+// The message takes ownership of the stream
+void
+HTTPMessage::SetGzipStream(GzipStream* p_stream)
+{
+  if(m_gzipStream && m_gzipStream != p_stream)
+  {
+    delete m_gzipStream;
+  }
+  m_gzipStream = p_stream;
+}
+
 void 
 HTTPMessage::SetExtension(const XString& p_ext,bool p_reparse /*= true*/)
 { 
@@ -102,6 +102,7 @@ class   FileBuffer;
 class   HTTPServer;
 class   HTTPSite;
 class   MultiPartBuffer;
+class   GzipStream;
 
 class HTTPMessage
 {
@@ -155,6 +156,7 @@ public:
   void SetSystemTime(SYSTEMTIME p_time)         { m_systemtime         = p_time;      }
   void SetHasBeenAnswered()                     { m_request            = NULL;        }
   void SetChunkNumber(int p_chunk)              { m_chunkNumber        = p_chunk;     }
+  void SetGzipStream(GzipStream* p_stream);
   void SetXMLHttpRequest(boolean p_value)       { m_XMLHttpRequest     = p_value;     }
   void SetExtension(const XString& p_ext,bool p_reparse = true);
   void SetReadBuffer(bool p_read,size_t p_length = 0);
@@ -216,6 +218,7 @@ public:
   const Cookies&      GetCookies() const        { return m_cookies;                   }
   const Routing&      GetRouting() const        { return m_routing;                   }
   unsigned            GetChunkNumber() const    { return m_chunkNumber;               }
+  GzipStream*         GetGzipStream() const     { return m_gzipStream;                }
   boolean             GetXMLHttpRequest() const { return m_XMLHttpRequest;            }
 
   XString             GetBody() const;
@@ -296,6 +299,7 @@ private:
   bool                m_readBuffer    { false   };                    // HTTP content still to be read
   size_t              m_contentLength { 0       };                    // Total content to read for the message
   unsigned            m_chunkNumber   { 0       };                    // Chunk number in case of transfer-encoding: chunked
+  GzipStream*         m_gzipStream    { nullptr };                    // Compression state of the chunks (owned)
   FileBuffer          m_buffer;                                       // Body or file buffer
   Cookies             m_cookies;                                      // Cookies
   XString             m_url;                                          // Full URL to service
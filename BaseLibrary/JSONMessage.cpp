@@ -28,6 +28,7 @@
 #include "pch.h"
 #include "JSONMessage.h"
 #include "JSONParser.h"
+#include "JSONWriter.h"
 #include "XMLParser.h"
 #include "HTTPMessage.h"
 #include "ConvertWideString.h"
@@ -38,6 +39,17 @@ JSONvalue::JSONvalue()
 {
 }
 
+JSONvalue::JSONvalue(const JSONvalue& p_other)
+{
+  CopyValue(p_other);
+}
+
+// Moving takes over the value. The other node is left empty
+JSONvalue::JSONvalue(JSONvalue&& p_other) noexcept
+{
+  *this = std::move(p_other);
+}
+
 JSONvalue::JSONvalue(const JSONvalue* p_other)
 {
   *this = *p_other;
@@ -75,8 +87,7 @@ JSONvalue::JSONvalue(const bool p_value)
 
 JSONvalue::~JSONvalue()
 {
-  m_array .clear();
-  m_object.clear();
+  Clear();
 }
 
 JSONvalue&
@@ -87,103 +98,76 @@ JSONvalue::operator=(const JSONvalue& p_other)
   {
     return *this;
   }
-  // Copy values
-  m_type      = p_other.m_type;
-  m_string    = p_other.m_string;
-  m_constant  = p_other.m_constant;
-  m_intNumber = p_other.m_intNumber;
-  m_bcdNumber = p_other.m_bcdNumber;
-  m_mark      = p_other.m_mark;
-  // Copy objects
-  m_array.clear();
-  m_object.clear();
-  std::copy(p_other.m_object.begin(),p_other.m_object.end(),back_inserter(m_object));
-  std::copy(p_other.m_array .begin(),p_other.m_array .end(),back_inserter(m_array));
+  // Copy into a new value first: the other may be a part of our value
+  JSONvalue copy(p_other);
+  *this = std::move(copy);
+  return *this;
+}
 
+JSONvalue&
+JSONvalue::operator=(JSONvalue&& p_other) noexcept
+{
+  if(&p_other == this)
+  {
+    return *this;
+  }
+  Clear();
+  switch(p_other.m_type)
+  {
+    case JsonType::JDT_const:       m_constant  = p_other.m_constant;  break;
+    case JsonType::JDT_number_int:  m_intNumber = p_other.m_intNumber; break;
+    case JsonType::JDT_string:      m_string    = p_other.m_string;    break;
+    case JsonType::JDT_number_bcd:  m_bcdNumber = p_other.m_bcdNumber; break;
+    case JsonType::JDT_array:       m_array     = p_other.m_array;     break;
+    case JsonType::JDT_object:      m_object    = p_other.m_object;    break;
+  }
+  m_type = p_other.m_type;
+  m_mark = p_other.m_mark;
+  // The other one no longer owns the value
+  p_other.m_type     = JsonType::JDT_const;
+  p_other.m_constant = JsonConst::JSON_NONE;
   return *this;
 }
 
 JSONvalue& 
 JSONvalue::operator=(const XString& p_other)
 {
-  m_type      = JsonType::JDT_string;
-  m_constant  = JsonConst::JSON_NONE;
-  m_string    = p_other;
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_array.clear();
-  m_object.clear();
-
+  SetValue(p_other);
   return *this;
 }
 
 JSONvalue& 
 JSONvalue::operator=(LPCTSTR p_other)
 {
-  m_type      = JsonType::JDT_string;
-  m_constant  = JsonConst::JSON_NONE;
-  m_string    = p_other;
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_array.clear();
-  m_object.clear();
-
+  SetValue(p_other);
   return *this;
 }
 
 JSONvalue& 
 JSONvalue::operator=(const int& p_other)
 {
-  m_type      = JsonType::JDT_number_int;
-  m_constant  = JsonConst::JSON_NONE;
-  m_intNumber = p_other;
-  m_bcdNumber.Zero();
-  m_string.Empty();
-  m_array.clear();
-  m_object.clear();
-
+  SetValue(p_other);
   return *this;
 }
 
 JSONvalue& 
 JSONvalue::operator=(const bcd& p_other)
 {
-  m_type      = JsonType::JDT_number_bcd;
-  m_constant  = JsonConst::JSON_NONE;
-  m_intNumber = 0;
-  m_bcdNumber = p_other;
-  m_string.Empty();
-  m_array.clear();
-  m_object.clear();
-
+  SetValue(p_other);
   return *this;
 }
 
 JSONvalue& 
 JSONvalue::operator=(JsonConst& p_other)
 {
-  m_type      = JsonType::JDT_const;
-  m_constant  = p_other;
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_string.Empty();
-  m_array.clear();
-  m_object.clear();
-
+  SetValue(p_other);
   return *this;
 }
 
 JSONvalue& 
 JSONvalue::operator=(const bool& p_other)
 {
-  m_type      = JsonType::JDT_const;
-  m_constant  = p_other ? JsonConst::JSON_TRUE : JsonConst::JSON_FALSE;
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_string.Empty();
-  m_array.clear();
-  m_object.clear();
-
+  SetValue(p_other ? JsonConst::JSON_TRUE : JsonConst::JSON_FALSE);
   return *this;
 }
 
@@ -192,12 +176,16 @@ void
 JSONvalue::SetDatatype(JsonType p_type)
 {
   // Clear the values
-  m_object.clear();
-  m_array .clear();
-  m_string.Empty();
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_constant = JsonConst::JSON_NONE;
+  Clear();
+  switch(p_type)
+  {
+    case JsonType::JDT_const:       m_constant  = JsonConst::JSON_NONE;   break;
+    case JsonType::JDT_number_int:  m_intNumber = 0;                      break;
+    case JsonType::JDT_string:      m_string    = alloc_new XString();    break;
+    case JsonType::JDT_number_bcd:  m_bcdNumber = alloc_new bcd();        break;
+    case JsonType::JDT_array:       m_array     = alloc_new JSONarray();  break;
+    case JsonType::JDT_object:      m_object    = alloc_new JSONobject(); break;
+  }
   // Remember our type
   m_type = p_type;
 }
@@ -205,94 +193,69 @@ JSONvalue::SetDatatype(JsonType p_type)
 void
 JSONvalue::SetValue(const XString& p_value)
 {
-  m_string = p_value;
+  if(m_type == JsonType::JDT_string)
+  {
+    *m_string = p_value;
+    return;
+  }
+  // The value may be our own string
+  XString* value = alloc_new XString(p_value);
+  Clear();
+  m_string = value;
   m_type   = JsonType::JDT_string;
-  // Clear the rest
-  m_array .clear();
-  m_object.clear();
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_constant = JsonConst::JSON_NONE;
 }
 
 void
 JSONvalue::SetValue(LPCTSTR p_value)
 {
-  m_string = p_value;
-  m_type   = JsonType::JDT_string;
-  // Clear the rest
-  m_array .clear();
-  m_object.clear();
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_constant = JsonConst::JSON_NONE;
+  SetValue(XString(p_value));
 }
 
 void
 JSONvalue::SetValue(JsonConst p_value)
 {
-  m_type = JsonType::JDT_const;
+  Clear();
   m_constant = p_value;
-  // Clear the rest
-  m_array.clear();
-  m_object.clear();
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_string.Empty();
 }
 
 void        
 JSONvalue::SetValue(JSONobject p_value)
 {
-  m_type = JsonType::JDT_object;
-  m_object.clear();
-  std::copy(p_value.begin(),p_value.end(),back_inserter(m_object));
-  // Clear the rest
-  m_array.clear();
-  m_string.Empty();
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_constant = JsonConst::JSON_NONE;
+  JSONobject* object = alloc_new JSONobject(std::move(p_value));
+  Clear();
+  m_object = object;
+  m_type   = JsonType::JDT_object;
 }
 
 void
 JSONvalue::SetValue(JSONarray p_value)
 {
-  m_type = JsonType::JDT_array;
-  m_array.clear();
-  std::copy(p_value.begin(),p_value.end(),back_inserter(m_array));
-  // Clear the rest
-  m_object.clear();
-  // m_string.Empty();
-  m_intNumber = 0;
-  m_bcdNumber.Zero();
-  m_constant = JsonConst::JSON_NONE;
+  JSONarray* array = alloc_new JSONarray(std::move(p_value));
+  Clear();
+  m_array = array;
+  m_type  = JsonType::JDT_array;
 }
 
 void
 JSONvalue::SetValue(int p_value)
 {
-  m_type = JsonType::JDT_number_int;
+  Clear();
   m_intNumber = p_value;
-  m_bcdNumber.Zero();
-  // Clear the rest
-  m_object.clear();
-  m_array.clear();
-  m_string.Empty();
-  m_constant = JsonConst::JSON_NONE;
+  m_type      = JsonType::JDT_number_int;
 }
 
 void
 JSONvalue::SetValue(const bcd& p_value)
 {
-  m_type = JsonType::JDT_number_bcd;
-  m_bcdNumber = p_value;
-  m_intNumber = 0;
-  // Clear the rest
-  m_object.clear();
-  m_array.clear();
-  m_string.Empty();
-  m_constant = JsonConst::JSON_NONE;
+  if(m_type == JsonType::JDT_number_bcd)
+  {
+    *m_bcdNumber = p_value;
+    return;
+  }
+  bcd* value = alloc_new bcd(p_value);
+  Clear();
+  m_bcdNumber = value;
+  m_type      = JsonType::JDT_number_bcd;
 }
 
 void
@@ -301,6 +264,72 @@ JSONvalue::SetMark(bool p_mark)
   m_mark = p_mark;
 }
 
+XString
+JSONvalue::GetString() const
+{
+  if(m_type == JsonType::JDT_string)
+  {
+    return *m_string;
+  }
+  return XString();
+}
+
+int
+JSONvalue::GetNumberInt() const
+{
+  if(m_type == JsonType::JDT_number_int)
+  {
+    return m_intNumber;
+  }
+  return 0;
+}
+
+bcd
+JSONvalue::GetNumberBcd() const
+{
+  if(m_type == JsonType::JDT_number_bcd)
+  {
+    return *m_bcdNumber;
+  }
+  return bcd();
+}
+
+JsonConst
+JSONvalue::GetConstant() const
+{
+  if(m_type == JsonType::JDT_const)
+  {
+    return m_constant;
+  }
+  return JsonConst::JSON_NONE;
+}
+
+// A node of another type becomes an empty array (as in SetDatatype)
+// so anything added to it is part of the node.
+// Check the type first if the node must not change!
+JSONarray&
+JSONvalue::GetArray()
+{
+  if(m_type != JsonType::JDT_array)
+  {
+    SetDatatype(JsonType::JDT_array);
+  }
+  return *m_array;
+}
+
+// A node of another type becomes an empty object (as in SetDatatype)
+// so anything added to it is part of the node.
+// Check the type first if the node must not change!
+JSONobject&
+JSONvalue::GetObject()
+{
+  if(m_type != JsonType::JDT_object)
+  {
+    SetDatatype(JsonType::JDT_object);
+  }
+  return *m_object;
+}
+
 void
 JSONvalue::Empty()
 {
@@ -326,7 +355,7 @@ JSONvalue::Add(JSONvalue& p_value)
 {
   if(m_type == JsonType::JDT_array)
   {
-    m_array.push_back(p_value);
+    m_array->push_back(p_value);
     return;
   }
   throw StdException(_T("JSONvalue can only be added to a JSON array!"));
@@ -337,83 +366,18 @@ JSONvalue::Add(JSONpair& p_value)
 {
   if(m_type == JsonType::JDT_object)
   {
-    m_object.push_back(p_value);
+    m_object->push_back(p_value);
     return;
   }
   throw StdException(_T("JSONpair can only be added to a JSON object!"));
 }
 
+// Serializing in one pass by the JSONWriter
 XString
 JSONvalue::GetAsJsonString(bool p_white,unsigned p_level /*=0*/,bool p_exponential /*= false*/)
 {
-  XString result;
-  XString separ,less;
-  XString newln = p_white ? _T("\n") : _T("");
-
-  if(p_white)
-  {
-    for(unsigned ind = 0;ind < p_level; ++ind)
-    {
-      less   = separ;
-      separ += _T("\t");
-    }
-  }
-
-  switch(m_type)
-  {
-    case JsonType::JDT_const:       switch(m_constant)
-                                    {
-                                      case JsonConst::JSON_NONE:  return _T("");
-                                      case JsonConst::JSON_NULL:  return _T("null");
-                                      case JsonConst::JSON_FALSE: return _T("false");
-                                      case JsonConst::JSON_TRUE:  return _T("true");
-                                    }
-                                    break;
-    case JsonType::JDT_string:      return XMLParser::PrintJsonString(m_string);
-    case JsonType::JDT_number_int:  result.Format(_T("%d"),m_intNumber);
-                                    break;
-    case JsonType::JDT_number_bcd:  result = m_bcdNumber.AsString(p_exponential ? bcd::Format::Engineering : bcd::Format::Bookkeeping,false,0);
-                                    break;
-    case JsonType::JDT_array:       result = XString(_T("[")) + newln;
-                                    for(unsigned ind = 0;ind < m_array.size();++ind)
-                                    {
-                                      result += separ;
-                                      result += m_array[ind].GetAsJsonString(p_white,p_level+1,p_exponential);
-                                      if(ind < m_array.size() - 1)
-                                      {
-                                        result += _T(",");
-                                      }
-                                      result += newln;
-                                    }
-                                    result += separ;
-                                    result += _T("]");
-                                    break;
-    case JsonType::JDT_object:      result = less + _T("{") + newln;
-                                    for(unsigned ind = 0; ind < m_object.size(); ++ind)
-                                    {
-                                      // Check for empty object
-                                      if(m_object.size() == 1 && m_object[0].m_name.IsEmpty() &&
-                                         m_object[0].m_value.GetDataType() == JsonType::JDT_const &&
-                                         m_object[0].m_value.GetConstant() == JsonConst::JSON_NONE)
-                                      {
-                                        break;
-                                      }
-                                      result += separ;
-                                      result += p_white ? _T("\t") : _T("");
-                                      result += XMLParser::PrintJsonString(m_object[ind].m_name);
-                                      result += _T(":");
-                                      result += m_object[ind].m_value.GetAsJsonString(p_white,p_level+1,p_exponential).TrimLeft('\t');
-                                      if(ind < m_object.size() - 1)
-                                      {
-                                        result += _T(",");
-                                      }
-                                      result += newln;
-                                    }
-                                    result += separ;
-                                    result += _T("}");
-                                    break;
-  }
-  return result;
+  JSONWriter writer(p_white,p_exponential);
+  return writer.GetText(*this,p_level);
 }
 
 // Getting the value from an JSONarray
@@ -424,9 +388,9 @@ JSONvalue::operator[](int p_index)
   {
     throw StdException(_T("JSON array index used on a non-array node!"));
   }
-  if(p_index >= 0 && p_index < (int)m_array.size())
+  if(p_index >= 0 && p_index < (int)m_array->size())
   {
-    return m_array[p_index];
+    return (*m_array)[p_index];
   }
   throw StdException(_T("JSON array index out of bounds!"));
 }
@@ -439,12 +403,12 @@ JSONvalue::operator[](const XString& p_name)
   {
     throw StdException(_T("JSON object index used on an non-object node"));
   }
-  for(auto& pair : m_object)
+  // Through the name index: the value can change, but not the name
+  const JSONobject& object = *m_object;
+  int position = object.FindName(p_name);
+  if(position >= 0)
   {
-    if(pair.m_name.Compare(p_name) == 0)
-    {
-      return pair.m_value;
-    }
+    return const_cast<JSONvalue&>(object[position].m_value);
   }
   throw StdException(_T("JSON object index not found!"));
 }
@@ -474,7 +438,7 @@ JSONvalue::JsonReplaceObject(const XString& p_namePattern
                             ,int&           p_number
                             ,bool           p_caseSensitive /*=true*/)
 {
-  for(auto& pair : m_object)
+  for(auto& pair : *m_object)
   {
     switch(pair.GetDataType())
     {
@@ -512,7 +476,7 @@ JSONvalue::JsonReplaceArray(const XString& p_namePattern
                            ,int&           p_number
                            ,bool           p_caseSensitive /*=true*/)
 {
-  for(auto& value : m_array)
+  for(auto& value : *m_array)
   {
     if(value.GetDataType() == JsonType::JDT_object ||
        value.GetDataType() == JsonType::JDT_array  )
@@ -522,6 +486,39 @@ JSONvalue::JsonReplaceArray(const XString& p_namePattern
   }
 }
 
+// Free the value, leaving an empty constant
+void
+JSONvalue::Clear()
+{
+  switch(m_type)
+  {
+    case JsonType::JDT_string:      delete m_string;    break;
+    case JsonType::JDT_number_bcd:  delete m_bcdNumber; break;
+    case JsonType::JDT_array:       delete m_array;     break;
+    case JsonType::JDT_object:      delete m_object;    break;
+    default:                        break;
+  }
+  m_type     = JsonType::JDT_const;
+  m_constant = JsonConst::JSON_NONE;
+}
+
+// Take a copy of the value of another node (deep copy)
+void
+JSONvalue::CopyValue(const JSONvalue& p_other)
+{
+  switch(p_other.m_type)
+  {
+    case JsonType::JDT_const:       m_constant  = p_other.m_constant;                      break;
+    case JsonType::JDT_number_int:  m_intNumber = p_other.m_intNumber;                     break;
+    case JsonType::JDT_string:      m_string    = alloc_new XString(*p_other.m_string);    break;
+    case JsonType::JDT_number_bcd:  m_bcdNumber = alloc_new bcd(*p_other.m_bcdNumber);     break;
+    case JsonType::JDT_array:       m_array     = alloc_new JSONarray(*p_other.m_array);   break;
+    case JsonType::JDT_object:      m_object    = alloc_new JSONobject(*p_other.m_object); break;
+  }
+  m_type = p_other.m_type;
+  m_mark = p_other.m_mark;
+}
+
 // JSONvalues can be stored elsewhere. Use the reference mechanism to add/drop references
 // With the drop of the last reference, the object WILL destroy itself
 
@@ -600,6 +597,13 @@ JSONpair::JSONpair(const XString& p_name,const JsonConst p_value)
 }
 
 
+// Moving a pair takes over the name and the value
+JSONpair::JSONpair(JSONpair&& p_other) noexcept
+         :m_value(std::move(p_other.m_value))
+{
+  m_name.swap(p_other.m_name);
+}
+
 JSONpair& 
 JSONpair::operator=(const JSONpair& p_other)
 {
@@ -608,6 +612,251 @@ JSONpair::operator=(const JSONpair& p_other)
   return *this;
 }
 
+JSONpair&
+JSONpair::operator=(JSONpair&& p_other) noexcept
+{
+  m_name.swap(p_other.m_name);
+  m_value = std::move(p_other.m_value);
+  return *this;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// JSONobject and the index of its names
+//
+//////////////////////////////////////////////////////////////////////////
+
+// FNV-1a hash of a name
+static unsigned
+HashName(const XString& p_name)
+{
+  unsigned hash    = 2166136261U;
+  LPCTSTR  pointer = p_name.GetString();
+  for(int ind = 0;ind < p_name.GetLength(); ++ind)
+  {
+    hash ^= static_cast<unsigned>(pointer[ind]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+// Open addressing table of the names of an object, with linear probing.
+// Holds the hash and the position of the first pair of each name. The
+// names themselves stay in the pairs, so a hit is always compared.
+// Made at a generation of the object: only then it is current.
+class JSONkeyIndex
+{
+public:
+  explicit JSONkeyIndex(const JSONobject& p_object,size_t p_generation);
+
+  int     Find(const JSONobject& p_object,const XString& p_name) const;
+  size_t  GetGeneration() const { return m_generation; }
+
+  // Replaced, but maybe still read: chained until the object is free
+  JSONkeyIndex* m_next { nullptr };
+
+private:
+  typedef struct _keySlot
+  {
+    unsigned m_hash;
+    unsigned m_position;    // Position of the pair + 1. Zero if the slot is free
+  }
+  KeySlot;
+
+  std::vector<KeySlot> m_slots;
+  size_t               m_mask       { 0 };
+  size_t               m_generation { 0 };
+};
+
+JSONkeyIndex::JSONkeyIndex(const JSONobject& p_object,size_t p_generation)
+             :m_generation(p_generation)
+{
+  // At most half full
+  size_t pairs = p_object.size();
+  size_t size  = 32;
+  while(size < 2 * pairs)
+  {
+    size *= 2;
+  }
+  m_slots.resize(size,KeySlot { 0, 0 });
+  m_mask = size - 1;
+
+  for(size_t position = 0;position < pairs; ++position)
+  {
+    const XString& name = p_object[position].m_name;
+    unsigned hash = HashName(name);
+    size_t   slot = hash & m_mask;
+    while(m_slots[slot].m_position)
+    {
+      // Double names: only the first one is found
+      if(m_slots[slot].m_hash == hash && p_object[m_slots[slot].m_position - 1].m_name.Compare(name) == 0)
+      {
+        break;
+      }
+      slot = (slot + 1) & m_mask;
+    }
+    if(m_slots[slot].m_position == 0)
+    {
+      m_slots[slot].m_hash     = hash;
+      m_slots[slot].m_position = static_cast<unsigned>(position + 1);
+    }
+  }
+}
+
+int
+JSONkeyIndex::Find(const JSONobject& p_object,const XString& p_name) const
+{
+  unsigned hash = HashName(p_name);
+  size_t   slot = hash & m_mask;
+  while(m_slots[slot].m_position)
+  {
+    if(m_slots[slot].m_hash == hash)
+    {
+      int position = static_cast<int>(m_slots[slot].m_position - 1);
+      if(p_object[position].m_name.Compare(p_name) == 0)
+      {
+        return position;
+      }
+    }
+    slot = (slot + 1) & m_mask;
+  }
+  return -1;
+}
+
+// A copy has no index: it is made again when needed
+JSONobject::JSONobject(const JSONobject& p_other)
+           :m_pairs(p_other.m_pairs)
+{
+}
+
+// Moving keeps the index: the positions stay the same
+JSONobject::JSONobject(JSONobject&& p_other) noexcept
+           :m_pairs(std::move(p_other.m_pairs))
+{
+  m_generation.store(p_other.m_generation.load());
+  m_index.store(p_other.m_index.exchange(nullptr));
+}
+
+JSONobject::~JSONobject()
+{
+  DropIndex();
+}
+
+JSONobject&
+JSONobject::operator=(const JSONobject& p_other)
+{
+  if(this != &p_other)
+  {
+    DropIndex();
+    m_pairs = p_other.m_pairs;
+  }
+  return *this;
+}
+
+JSONobject&
+JSONobject::operator=(JSONobject&& p_other) noexcept
+{
+  if(this != &p_other)
+  {
+    DropIndex();
+    m_pairs = std::move(p_other.m_pairs);
+    m_generation.store(p_other.m_generation.load());
+    m_index.store(p_other.m_index.exchange(nullptr));
+  }
+  return *this;
+}
+
+void
+JSONobject::swap(JSONobject& p_other)
+{
+  DropIndex();
+  p_other.DropIndex();
+  m_pairs.swap(p_other.m_pairs);
+}
+
+// Position of the first pair with this name, or -1 if not found.
+// Small objects are simply scanned. Big ones get their index now, or
+// again after a non-const access to the pairs.
+int
+JSONobject::FindName(const XString& p_name) const
+{
+  if(m_pairs.size() < JSON_KEYINDEX_THRESHOLD)
+  {
+    return ScanName(p_name);
+  }
+  m_readers.fetch_add(1);
+  size_t        generation = m_generation.load();
+  JSONkeyIndex* index      = m_index.load();
+  if(index == nullptr || index->GetGeneration() != generation)
+  {
+    index = RenewIndex(index,generation);
+  }
+  int position = index ? index->Find(*this,p_name) : ScanName(p_name);
+  m_readers.fetch_sub(1);
+  return position;
+}
+
+// Only a lookup that is on its own replaces the index, so there is never
+// more than one at work here. With other lookups busy, this one scans.
+// Lookups that came in before the switch may still read the old index:
+// it is put aside until a lookup finds itself alone again.
+JSONkeyIndex*
+JSONobject::RenewIndex(JSONkeyIndex* p_old,size_t p_generation) const
+{
+  if(m_readers.load() != 1)
+  {
+    return nullptr;
+  }
+  DeleteRetired();
+
+  JSONkeyIndex* made = alloc_new JSONkeyIndex(*this,p_generation);
+  m_index.store(made);
+  if(p_old)
+  {
+    if(m_readers.load() == 1)
+    {
+      delete p_old;
+    }
+    else
+    {
+      p_old->m_next = m_retired;
+      m_retired     = p_old;
+    }
+  }
+  return made;
+}
+
+void
+JSONobject::DeleteRetired() const
+{
+  while(m_retired)
+  {
+    JSONkeyIndex* next = m_retired->m_next;
+    delete m_retired;
+    m_retired = next;
+  }
+}
+
+int
+JSONobject::ScanName(const XString& p_name) const
+{
+  for(size_t position = 0;position < m_pairs.size(); ++position)
+  {
+    if(m_pairs[position].m_name.Compare(p_name) == 0)
+    {
+      return static_cast<int>(position);
+    }
+  }
+  return -1;
+}
+
+void
+JSONobject::DeleteIndex()
+{
+  delete m_index.exchange(nullptr);
+  DeleteRetired();
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // JSONMessage object
@@ -923,6 +1172,7 @@ JSONMessage::Reset(bool p_resetURL /*= false*/)
 
   // Set empty value
   m_value = alloc_new JSONvalue();
+  ResetLookupCache();
 
   m_incoming = false;
   // Reset error
@@ -1088,6 +1338,7 @@ bool
 JSONMessage::ParseMessage(XString p_message)
 {
   JSONParser parser(this);
+  ResetLookupCache();
 
   // Starting the parser, preserving it's whitespace state
   parser.ParseMessage(p_message,m_whitespace);
@@ -1203,11 +1454,23 @@ JSONMessage::SaveFile(const XString& p_fileName)
 JSONvalue*
 JSONMessage::FindValue(XString p_name,bool p_recurse /*=true*/,bool p_object /*= false*/,JsonType* p_type /*=nullptr*/)
 {
+  if(m_lookupCache && p_recurse)
+  {
+    JSONvalue* object = nullptr;
+    JSONpair*  pair   = FindCached(p_name,p_type,&object);
+    if(pair)
+    {
+      return p_object ? object : &pair->m_value;
+    }
+    return nullptr;
+  }
   // Find from the root value
   return FindValue(m_value,p_name,p_recurse,p_object,p_type);
 }
 
 // Finding the first value with this name AFTER the p_from value
+// The pairs are read through const references, so the indexes of the
+// names of the objects stay current.
 JSONvalue* 
 JSONMessage::FindValue(JSONvalue* p_from,XString p_name,bool p_recurse /*=true*/,bool p_object /*=false*/,JsonType* p_type /*= nullptr*/)
 {
@@ -1217,12 +1480,25 @@ JSONMessage::FindValue(JSONvalue* p_from,XString p_name,bool p_recurse /*=true*/
     return nullptr;
   }
 
+  // Search the whole tree
+  if(p_recurse)
+  {
+    std::vector<unsigned> path;
+    JSONvalue* object = nullptr;
+    JSONpair*  pair   = FindPath(p_from,p_name,p_type,&object,path);
+    if(pair)
+    {
+      return p_object ? object : &pair->m_value;
+    }
+    return nullptr;
+  }
+
   // Recurse through an array
   if(p_from->GetDataType() == JsonType::JDT_array)
   {
     for(auto& val : p_from->GetArray())
     {
-      JSONvalue* value = FindValue(&val,p_name,p_recurse,p_object,p_type);
+      JSONvalue* value = FindValue(&val,p_name,false,p_object,p_type);
       if(value)
       {
         return value;
@@ -1230,11 +1506,19 @@ JSONMessage::FindValue(JSONvalue* p_from,XString p_name,bool p_recurse /*=true*/
     }
   }
 
-  // Recurse through an object
+  // Only this object: go to the first pair of this name directly
   if(p_from->GetDataType() == JsonType::JDT_object)
   {
-    for(auto& val : p_from->GetObject())
+    const JSONobject& object = p_from->GetObject();
+    int position = object.FindName(p_name);
+    if(position < 0)
     {
+      return nullptr;
+    }
+    for(size_t ind = position;ind < object.size(); ++ind)
+    {
+      JSONpair& val = const_cast<JSONpair&>(object[ind]);
+
       // Stopping at this element
       if(val.m_name.Compare(p_name) == 0)
       {
@@ -1248,30 +1532,32 @@ JSONMessage::FindValue(JSONvalue* p_from,XString p_name,bool p_recurse /*=true*/
           return &val.m_value;
         }
       }
-      // Recurse for array and object
-      if(p_recurse)
-      {
-        if(val.m_value.GetDataType() == JsonType::JDT_array ||
-           val.m_value.GetDataType() == JsonType::JDT_object)
-        {
-          JSONvalue* value = FindValue(&val.m_value,p_name,true,p_object,p_type);
-          if(value)
-          {
-            return value;
-          }
-        }
-      }
     }
   }
   return nullptr;
 }
 
+// A pair that is handed out can be renamed: that is a change of its object
+static JSONpair*
+HandOutPair(JSONvalue* p_object,const JSONpair* p_pair)
+{
+  JSONobject&       object = p_object->GetObject();
+  const JSONobject& pairs  = object;
+  return &object[p_pair - &pairs[0]];
+}
+
 // Finding the first name/value pair of this name
 JSONpair*
 JSONMessage::FindPair(XString p_name,bool p_recursief /*= true*/)
 {
   if(m_value)
   {
+    if(m_lookupCache && p_recursief)
+    {
+      JSONvalue* object = nullptr;
+      JSONpair*  pair   = FindCached(p_name,nullptr,&object);
+      return pair ? HandOutPair(object,pair) : nullptr;
+    }
     return FindPair(m_value,p_name,p_recursief);
   }
   return nullptr;
@@ -1281,37 +1567,178 @@ JSONMessage::FindPair(XString p_name,bool p_recursief /*= true*/)
 JSONpair* 
 JSONMessage::FindPair(JSONvalue* p_value,XString p_name,bool p_recursief /*= true*/)
 {
-  if(p_value && p_value->GetDataType() == JsonType::JDT_object)
+  if(p_value == nullptr)
+  {
+    return nullptr;
+  }
+  if(p_recursief)
+  {
+    std::vector<unsigned> path;
+    JSONvalue* object = nullptr;
+    JSONpair*  pair   = FindPath(p_value,p_name,nullptr,&object,path);
+    return pair ? HandOutPair(object,pair) : nullptr;
+  }
+  if(p_value->GetDataType() == JsonType::JDT_object)
   {
-    for(auto& pair : p_value->GetObject())
+    JSONobject& object = p_value->GetObject();
+    int position = object.FindName(p_name);
+    return position >= 0 ? &object[position] : nullptr;
+  }
+  return nullptr;
+}
+
+// Cache the recursive lookups by name from the root. On by default.
+// A cached path is followed and checked on every use, so it never leads
+// to a value that is gone or has another name. All changes through the
+// JSONMessage empty the cache. But if you change the values yourself,
+// a pair before the cached one can get the name, e.g. by a rename to a
+// name that is already there. The cache keeps finding the later pair:
+// reset the cache to find the first one again.
+// Misses are not cached: that is where names get added.
+void
+JSONMessage::SetLookupCache(bool p_cache)
+{
+  CritSection lock(m_lookupLock);
+  m_lookupCache = p_cache;
+  m_lookups.clear();
+}
+
+void
+JSONMessage::ResetLookupCache()
+{
+  CritSection lock(m_lookupLock);
+  m_lookups.clear();
+}
+
+JSONpair*
+JSONMessage::FindCached(const XString& p_name,JsonType* p_type,JSONvalue** p_object)
+{
+  XString key;
+  key.Format(_T("%d:"),p_type ? static_cast<int>(*p_type) : 0);
+  key += p_name;
+
+  // Lookups can come from more threads at once
+  CritSection lock(m_lookupLock);
+
+  JSONLookups::iterator it = m_lookups.find(key);
+  if(it != m_lookups.end())
+  {
+    JSONpair* pair = FollowPath(it->second,p_object);
+    if(pair && pair->m_name.Compare(p_name) == 0 &&
+      (p_type == nullptr || *p_type == pair->m_value.GetDataType()))
     {
-      if(pair.m_name.Compare(p_name) == 0)
+      return pair;
+    }
+    m_lookups.erase(it);
+  }
+
+  // Search the document and remember where we found it.
+  std::vector<unsigned> path;
+  JSONpair* pair = FindPath(m_value,p_name,p_type,p_object,path);
+  if(pair)
+  {
+    m_lookups[key].swap(path);
+  }
+  return pair;
+}
+
+// Go down from the root along the positions. The last one is the pair.
+JSONpair*
+JSONMessage::FollowPath(const std::vector<unsigned>& p_path,JSONvalue** p_object)
+{
+  JSONvalue* value = m_value;
+  for(size_t ind = 0;ind < p_path.size(); ++ind)
+  {
+    unsigned position = p_path[ind];
+    if(value->GetDataType() == JsonType::JDT_array)
+    {
+      JSONarray& array = value->GetArray();
+      if(position >= array.size() || ind == p_path.size() - 1)
+      {
+        return nullptr;
+      }
+      value = &array[position];
+    }
+    else if(value->GetDataType() == JsonType::JDT_object)
+    {
+      const JSONobject& object = value->GetObject();
+      if(position >= object.size())
       {
-        return &pair;
+        return nullptr;
       }
-      if(p_recursief)
+      JSONpair* pair = const_cast<JSONpair*>(&object[position]);
+      if(ind == p_path.size() - 1)
       {
-        JSONpair* found = FindPair(&(pair.m_value),p_name,true);
-        if(found)
+        if(p_object)
         {
-          return found;
+          *p_object = value;
         }
+        return pair;
       }
+      value = &pair->m_value;
+    }
+    else
+    {
+      return nullptr;
     }
   }
-  if(p_recursief && p_value && (p_value->GetDataType() == JsonType::JDT_array))
+  return nullptr;
+}
+
+// The recursive search of FindValue and FindPair, recording the
+// positions of all arrays and objects on the way down. The index of the
+// names is used at every level.
+JSONpair*
+JSONMessage::FindPath(JSONvalue* p_from,const XString& p_name,JsonType* p_type,JSONvalue** p_object,std::vector<unsigned>& p_path)
+{
+  if(p_from->GetDataType() == JsonType::JDT_array)
   {
-    for(auto& val : p_value->GetArray())
+    JSONarray& array = p_from->GetArray();
+    for(unsigned ind = 0;ind < array.size(); ++ind)
     {
-      if(val.GetDataType() == JsonType::JDT_object ||
-         val.GetDataType() == JsonType::JDT_array  )
+      p_path.push_back(ind);
+      JSONpair* pair = FindPath(&array[ind],p_name,p_type,p_object,p_path);
+      if(pair)
       {
-        JSONpair* pair = FindPair(&val,p_name,true);
-        if(pair)
+        return pair;
+      }
+      p_path.pop_back();
+    }
+  }
+  else if(p_from->GetDataType() == JsonType::JDT_object)
+  {
+    // Pairs before the first one of this name are only searched for
+    // their arrays and objects. Without that name: only those.
+    const JSONobject& object = p_from->GetObject();
+    unsigned first = 0;
+    if(object.size() >= JSON_KEYINDEX_THRESHOLD)
+    {
+      int position = object.FindName(p_name);
+      first = position >= 0 ? static_cast<unsigned>(position) : static_cast<unsigned>(object.size());
+    }
+    for(unsigned ind = 0;ind < object.size(); ++ind)
+    {
+      JSONpair* pair = const_cast<JSONpair*>(&object[ind]);
+      p_path.push_back(ind);
+      if(ind >= first && pair->m_name.Compare(p_name) == 0 &&
+        (p_type == nullptr || *p_type == pair->m_value.GetDataType()))
+      {
+        if(p_object)
         {
-          return pair;
+          *p_object = p_from;
+        }
+        return pair;
+      }
+      if(pair->m_value.GetDataType() == JsonType::JDT_array ||
+         pair->m_value.GetDataType() == JsonType::JDT_object)
+      {
+        JSONpair* found = FindPath(&pair->m_value,p_name,p_type,p_object,p_path);
+        if(found)
+        {
+          return found;
         }
       }
+      p_path.pop_back();
     }
   }
   return nullptr;
@@ -1339,6 +1766,7 @@ JSONMessage::DeletePair(JSONvalue* p_value,XString p_name)
       if(it->m_name.Compare(p_name) == 0)
       {
         p_value->GetObject().erase(it);
+        ResetLookupCache();
         return true;
       }
       bool deleted = DeletePair(&(it->m_value),p_name);
@@ -1382,6 +1810,7 @@ JSONMessage::DeletePair(JSONvalue* p_value,JSONvalue* p_base /*= nullptr*/)
       if(&(it->m_value) == p_value)
       {
         p_base->GetObject().erase(it);
+        ResetLookupCache();
         return true;
       }
       bool deleted = DeletePair(p_value,&(it->m_value));
@@ -1398,6 +1827,7 @@ JSONMessage::DeletePair(JSONvalue* p_value,JSONvalue* p_base /*= nullptr*/)
       if(&(*it) == p_value)
       {
         p_base->GetArray().erase(it);
+        ResetLookupCache();
         return true;
       }
       if(it->GetDataType() == JsonType::JDT_object ||
@@ -1513,6 +1943,7 @@ JSONMessage::AddNamedObject(XString p_name,const JSONobject& p_object,bool p_for
   JSONpair* insert = FindPair(p_name);
   if (!insert)
   {
+    ResetLookupCache();
     JSONpair pair(p_name,JsonType::JDT_object);
     m_value->Add(pair);
 
@@ -1522,6 +1953,7 @@ JSONMessage::AddNamedObject(XString p_name,const JSONobject& p_object,bool p_for
   else
   {
     JSONvalue* here = FindValue(p_name,true,true);
+    ResetLookupCache();
 
     // Add to the found pair of the same name
     if(p_forceArray && here->GetObject().size() == 1)
@@ -1564,6 +1996,7 @@ JSONMessage::JsonReplace(XString p_namePattern,XString p_tofind,XString p_replac
       p_tofind.MakeLower();
     }
     m_value->JsonReplace(p_namePattern,p_tofind,p_replace,number,p_caseSensitive);
+    ResetLookupCache();
   }
   return number;
 }
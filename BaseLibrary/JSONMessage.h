@@ -30,17 +30,24 @@
 #include "HTTPMessage.h"
 #include "XMLMessage.h"
 #include "Routing.h"
+#include "AutoCritical.h"
 #include "http.h"
 #include <vector>
+#include <map>
+#include <atomic>
 #include <xstring>
 
 // Forward declaration
 class HTTPSite;
 class JSONvalue;
 class JSONpair;
+class JSONobject;
+class JSONkeyIndex;
 class JSONParser;
 class JSONParserSOAP;
 class JSONPointer;
+class JSONWriter;
+class JSONReader;
 
 // The JSON constants
 //
@@ -65,14 +72,23 @@ enum class JsonType
 };
 
 using JSONarray  = std::vector<JSONvalue>;
-using JSONobject = std::vector<JSONpair>;
+
+// Number of pairs from which an object gets an index of its names
+constexpr size_t JSON_KEYINDEX_THRESHOLD = 16;
 
 // The general JSON value
+// A node holds only one value at a time: a tagged union of the type and the
+// value. Small values (int, constant) live in the node itself. Strings,
+// bcd numbers, arrays and objects are held by a pointer. So a node is 24
+// bytes, and moving a node (e.g. when an array grows) never copies the
+// value itself.
 //
 class JSONvalue
 {
 public:
   JSONvalue();
+  JSONvalue(const JSONvalue& p_other);
+  JSONvalue(JSONvalue&& p_other) noexcept;
   explicit JSONvalue(const JSONvalue* p_other);
   explicit JSONvalue(const JsonType   p_type);
   explicit JSONvalue(const JsonConst  p_value);
@@ -95,13 +111,13 @@ public:
 
   // GETTERS
   JsonType    GetDataType()  const { return m_type;     }
-  XString     GetString()    const { return m_string;   }
-  int         GetNumberInt() const { return m_intNumber;}
-  bcd         GetNumberBcd() const { return m_bcdNumber;}
-  JsonConst   GetConstant()  const { return m_constant; }
+  XString     GetString()    const;
+  int         GetNumberInt() const;
+  bcd         GetNumberBcd() const;
+  JsonConst   GetConstant()  const;
   bool        GetMark()      const { return m_mark;     }
-  JSONarray&  GetArray()           { return m_array;    }
-  JSONobject& GetObject()          { return m_object;   }
+  JSONarray&  GetArray();     // Converts a node of another type!
+  JSONobject& GetObject();    // Converts a node of another type!
   XString     GetAsJsonString(bool p_white,unsigned p_level = 0,bool p_exponential = false);
 
   // FUNCTIONS
@@ -122,6 +138,7 @@ public:
 
   // Assignment of another value
   JSONvalue&  operator=(const JSONvalue&  p_other);
+  JSONvalue&  operator=(JSONvalue&&       p_other) noexcept;
   JSONvalue&  operator=(const XString&    p_other);
   JSONvalue&  operator=(      LPCTSTR p_other);
   JSONvalue&  operator=(const int&        p_other);
@@ -139,6 +156,11 @@ public:
   void        DropReference();
 
 private:
+  // Free the value, leaving an empty constant
+  void        Clear();
+  // Take a copy of the value of another node
+  void        CopyValue(const JSONvalue& p_other);
+
   void        JsonReplaceObject(const XString& p_namePattern
                                ,const XString& p_tofind
                                ,const XString& p_replace
@@ -150,20 +172,26 @@ private:
                                ,int&           p_number
                                ,bool           p_caseSensitive);
 
-  // JSONPointer may have access to the objects
+  // JSONPointer, JSONWriter and JSONReader may have access to the objects
   friend     JSONPointer;
+  friend     JSONWriter;
+  friend     JSONReader;
 
   // What's in there: the data type
   JsonType   m_type       { JsonType::JDT_const };
-  // Depending on m_type: one of these
-  XString    m_string;
-  int        m_intNumber  { 0 };
-  bcd        m_bcdNumber;
-  JSONarray  m_array;
-  JSONobject m_object;
-  JsonConst  m_constant   { JsonConst::JSON_NONE };
   // Externally referenced
   long       m_references { 0 };   
+  // Depending on m_type: one of these
+  // The pointers are never NULL for their type
+  union
+  {
+    JsonConst   m_constant { JsonConst::JSON_NONE };
+    int         m_intNumber;
+    XString*    m_string;
+    bcd*        m_bcdNumber;
+    JSONarray*  m_array;
+    JSONobject* m_object;
+  };
   bool       m_mark       { false };
 };
 
@@ -173,6 +201,8 @@ class JSONpair
 {
 public:
   JSONpair() = default;
+  JSONpair(const JSONpair& p_other) = default;
+  JSONpair(JSONpair&& p_other) noexcept;
   explicit JSONpair(const XString& p_name);
   explicit JSONpair(const XString& p_name,const JsonType    p_type);
   explicit JSONpair(const XString& p_name,const JSONvalue&  p_value);
@@ -192,7 +222,7 @@ public:
   void        SetValue(const XString&    p_value) { m_value.SetValue(p_value);   }
   void        SetValue(LPCTSTR           p_value) { m_value.SetValue(p_value);   }
   void        SetValue(JsonConst         p_value) { m_value.SetValue(p_value);   }
-  void        SetValue(const JSONobject& p_value) { m_value.SetValue(p_value);   }
+  void        SetValue(const JSONobject& p_value);
   void        SetValue(const JSONarray&  p_value) { m_value.SetValue(p_value);   }
   void        SetValue(int               p_value) { m_value.SetValue(p_value);   }
   void        SetValue(const bcd&        p_value) { m_value.SetValue(p_value);   }
@@ -211,8 +241,109 @@ public:
   void        Add(JSONpair& p_value)  { m_value.Add(p_value); }
 
   JSONpair&   operator=(const JSONpair&);
+  JSONpair&   operator=(JSONpair&&) noexcept;
+};
+
+// Objects are the pairs in their order.
+// A big object also gets a hashed index of its names, made by the first
+// lookup by name. The pairs are private, so every change goes through
+// the object:
+// - Adding, removing or replacing pairs drops the index. Those changes
+//   need the object for themselves, as with any vector.
+// - Non-const access to a pair can rename it. That makes the index old,
+//   but does not free it: readers may still be using it.
+// A lookup with a current index is trusted, a hit as well as a miss. An
+// old index is made again by the next lookup. The first pair of a name in
+// the order of the object is found, also if a pair is renamed to a name
+// that is already there.
+//
+class JSONobject
+{
+public:
+  using Pairs          = std::vector<JSONpair>;
+  using value_type     = JSONpair;
+  using size_type      = Pairs::size_type;
+  using iterator       = Pairs::iterator;
+  using const_iterator = Pairs::const_iterator;
+
+  JSONobject() = default;
+  JSONobject(const JSONobject& p_other);
+  JSONobject(JSONobject&& p_other) noexcept;
+ ~JSONobject();
+
+  // Position of the first pair with this name, or -1 if not found
+  int         FindName(const XString& p_name) const;
+
+  // Reading the pairs
+  size_t          size()  const                     { return m_pairs.size();        }
+  bool            empty() const                     { return m_pairs.empty();       }
+  const JSONpair& operator[](size_t p_index) const  { return m_pairs[p_index];      }
+  const JSONpair& at(size_t p_index) const          { return m_pairs.at(p_index);   }
+  const JSONpair& front() const                     { return m_pairs.front();       }
+  const JSONpair& back()  const                     { return m_pairs.back();        }
+  const_iterator  begin() const                     { return m_pairs.begin();       }
+  const_iterator  end()   const                     { return m_pairs.end();         }
+  const_iterator  cbegin() const                    { return m_pairs.cbegin();      }
+  const_iterator  cend()   const                    { return m_pairs.cend();        }
+
+  // Access to the pairs: a name can be changed, so the index gets old
+  JSONpair&       operator[](size_t p_index)        { Touch(); return m_pairs[p_index];    }
+  JSONpair&       at(size_t p_index)                { Touch(); return m_pairs.at(p_index); }
+  JSONpair&       front()                           { Touch(); return m_pairs.front();     }
+  JSONpair&       back()                            { Touch(); return m_pairs.back();      }
+  iterator        begin()                           { Touch(); return m_pairs.begin();     }
+  iterator        end()                             { Touch(); return m_pairs.end();       }
+
+  // Adding, removing or replacing pairs: the index is dropped
+  void        clear()                            { DropIndex(); m_pairs.clear();                 }
+  void        pop_back()                         { DropIndex(); m_pairs.pop_back();              }
+  void        reserve(size_t p_size)             { m_pairs.reserve(p_size);                      }
+  void        resize(size_t p_size)              { DropIndex(); m_pairs.resize(p_size);          }
+  void        push_back(const JSONpair& p_pair)  { DropIndex(); m_pairs.push_back(p_pair);       }
+  void        push_back(JSONpair&& p_pair)       { DropIndex(); m_pairs.push_back(std::move(p_pair)); }
+  iterator    erase(const_iterator p_where)      { DropIndex(); return m_pairs.erase(p_where);   }
+  iterator    erase(const_iterator p_first,const_iterator p_last) { DropIndex(); return m_pairs.erase(p_first,p_last); }
+  void        swap(JSONobject& p_other);
+  template<typename... ARGS>
+  JSONpair&   emplace_back(ARGS&&... p_args)     { DropIndex(); m_pairs.emplace_back(std::forward<ARGS>(p_args)...); return m_pairs.back(); }
+  template<typename... ARGS>
+  iterator    emplace(const_iterator p_where,ARGS&&... p_args) { DropIndex(); return m_pairs.emplace(p_where,std::forward<ARGS>(p_args)...); }
+  template<typename... ARGS>
+  iterator    insert (const_iterator p_where,ARGS&&... p_args) { DropIndex(); return m_pairs.insert (p_where,std::forward<ARGS>(p_args)...); }
+  template<typename... ARGS>
+  void        assign(ARGS&&... p_args)           { DropIndex(); m_pairs.assign(std::forward<ARGS>(p_args)...); }
+
+  JSONobject& operator=(const JSONobject& p_other);
+  JSONobject& operator=(JSONobject&& p_other) noexcept;
+
+private:
+  void          Touch()     { m_generation.fetch_add(1); }
+  void          DropIndex() { if(m_index.load(std::memory_order_relaxed) || m_retired) DeleteIndex(); }
+  void          DeleteIndex();
+  void          DeleteRetired() const;
+  JSONkeyIndex* RenewIndex(JSONkeyIndex* p_old,size_t p_generation) const;
+  int           ScanName(const XString& p_name) const;
+
+  Pairs         m_pairs;
+  // Made by a lookup, so it can be made while others are reading
+  mutable std::atomic<JSONkeyIndex*> m_index      { nullptr };
+  // Counts the non-const accesses to the pairs
+  std::atomic<size_t>                m_generation { 0 };
+  // Lookups busy with the index
+  mutable std::atomic<long>          m_readers    { 0 };
+  // Replaced indexes, still read by lookups at the time
+  mutable JSONkeyIndex*              m_retired    { nullptr };
 };
 
+inline void
+JSONpair::SetValue(const JSONobject& p_value)
+{
+  m_value.SetValue(p_value);
+}
+
+// Cached lookups: name -> positions from the root down to the pair
+using JSONLookups = std::map<XString,std::vector<unsigned>>;
+
 //////////////////////////////////////////////////////////////////////////
 //
 // This is the JSON message
@@ -259,6 +390,9 @@ public:
   bool            DeletePair(JSONvalue* p_value,JSONvalue* p_base = nullptr);
   bool            DeletePair(XString p_name);
   bool            DeletePair(JSONvalue* p_value,XString p_name);
+  // Cache of the recursive lookups by name from the root
+  void            SetLookupCache(bool p_cache);
+  void            ResetLookupCache();
 
   // GETTERS
   XString         GetJsonMessage() const;
@@ -293,6 +427,7 @@ public:
   const Routing&  GetRouting() const       { return m_routing;               }
   XString         GetExtension() const     { return m_cracked.GetExtension();}
   bool            GetExponentialFormat() const       { return m_exponential; }
+  bool            GetLookupCache() const   { return m_lookupCache;           }
   XString         GetHeader(XString p_name);
   XString         GetRoute(int p_index);
   XString         GetContentType() const;
@@ -343,6 +478,10 @@ private:
   bool    ParseURL(XString p_url);
   // Re-parse URL after setting a part of the URL
   void    ReparseURL();
+  // Lookups by name through the cache
+  JSONpair*  FindCached(const XString& p_name,JsonType* p_type,JSONvalue** p_object);
+  JSONpair*  FollowPath(const std::vector<unsigned>& p_path,JSONvalue** p_object);
+  static JSONpair* FindPath(JSONvalue* p_from,const XString& p_name,JsonType* p_type,JSONvalue** p_object,std::vector<unsigned>& p_path);
 
   // The message is contained in a JSON value
   JSONvalue*      m_value;
@@ -381,4 +520,8 @@ private:
   long            m_references  { 0 };                          // Externally referenced
   Routing         m_routing;                                    // Routing information from HTTP
   XString         m_extension;                                  // Extension of the resource (derived from URL)
+  // Lookups
+  bool            m_lookupCache { true  };                      // Cache the recursive lookups by name
+  JSONLookups     m_lookups;                                    // Name -> path to the first pair
+  Critical        m_lookupLock;                                 // Lookups from more threads at once
 };
@@ -30,6 +30,23 @@
 #include "XMLParser.h"
 #include "ConvertWideString.h"
 
+// Strings are scanned in blocks of 16 bytes where SSE2 is always present
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define JSON_SCAN_SSE2
+#ifdef _UNICODE
+#define JSON_SCAN_SET(ch)  _mm_set1_epi16(ch)
+#define JSON_SCAN_EQ(a,b)  _mm_cmpeq_epi16(a,b)
+#else
+#define JSON_SCAN_SET(ch)  _mm_set1_epi8(ch)
+#define JSON_SCAN_EQ(a,b)  _mm_cmpeq_epi8(a,b)
+#endif
+#endif
+
+// JSON whitespace. The same set as 'isspace' in the "C" locale
+#define JSON_SPACE(ch) ((ch) == ' ' || ((ch) >= '\t' && (ch) <= '\r'))
+#define JSON_DIGIT(ch) ((ch) >= '0' && (ch) <= '9')
+
 JSONParser::JSONParser(JSONMessage* p_message)
            :m_message(p_message)
 {
@@ -37,10 +54,6 @@ JSONParser::JSONParser(JSONMessage* p_message)
 
 JSONParser::~JSONParser()
 {
-  if(m_scanString)
-  {
-    delete[] m_scanString;
-  }
 }
 
 void
@@ -70,15 +83,11 @@ JSONParser::ParseMessage(const XString& p_message,bool& p_whitespace)
 
   // Initializing the parser
   m_pointer    = reinterpret_cast<_TUCHAR*>(const_cast<PTCHAR>(p_message.GetString()));
+  m_end        = m_pointer + p_message.GetLength();
   m_valPointer = m_message->m_value;
   m_lines      = 1;
   m_objects    = 0;
 
-  // Allocate scanning buffer
-  // Individual string cannot be larger than this
-  m_scanLength = p_message.GetLength();
-  m_scanString = alloc_new _TUCHAR[(size_t)m_scanLength + 1];
-
   // See if we have an empty message string
   SkipWhitespace();
   if(p_message.IsEmpty())
@@ -111,7 +120,7 @@ JSONParser::ParseMessage(const XString& p_message,bool& p_whitespace)
 void
 JSONParser::SkipWhitespace()
 {
-  while(isspace(*m_pointer))
+  while(JSON_SPACE(*m_pointer))
   {
     if(*m_pointer == '\n')
     {
@@ -176,11 +185,11 @@ JSONParser::ParseConstant()
 }
 
 // Gets me a string
+// Runs of plain text are taken in one go. Only the quote, the escapes
+// and the newlines (line counting) are handled one character at a time.
 XString
 JSONParser::GetString()
 {
-  _TUCHAR* buffer = m_scanString;
-
   // Check that we have a string now
   if(*m_pointer != '\"')
   {
@@ -188,8 +197,19 @@ JSONParser::GetString()
   }
   ++m_pointer;
 
-  while(*m_pointer && *m_pointer != '\"')
+  XString result;
+  while(true)
   {
+    _TUCHAR* plain = ScanPlainText(m_pointer,m_end);
+    if(plain > m_pointer)
+    {
+      result.Append(reinterpret_cast<LPCTSTR>(m_pointer),static_cast<int>(plain - m_pointer));
+      m_pointer = plain;
+    }
+    if(*m_pointer == 0 || *m_pointer == '\"')
+    {
+      break;
+    }
     // See if we must do an escape
     if(*m_pointer == '\\')
     {
@@ -197,24 +217,25 @@ JSONParser::GetString()
       _TUCHAR ch = *m_pointer++;
       switch(ch)
       {
-        case '\"': *buffer++ = '\"'; break;
-        case '\\': *buffer++ = '\\'; break;
-        case '/':  *buffer++ = '/';  break;
-        case 'b':  *buffer++ = '\b'; break;
-        case 'f':  *buffer++ = '\f'; break;
-        case 'n':  *buffer++ = '\n'; break;
-        case 'r':  *buffer++ = '\r'; break;
-        case 't':  *buffer++ = '\t'; break;
-        case 'u':  *buffer++ = UnicodeChar(); 
+        case '\"': result.AppendChar('\"'); break;
+        case '\\': result.AppendChar('\\'); break;
+        case '/':  result.AppendChar('/');  break;
+        case 'b':  result.AppendChar('\b'); break;
+        case 'f':  result.AppendChar('\f'); break;
+        case 'n':  result.AppendChar('\n'); break;
+        case 'r':  result.AppendChar('\r'); break;
+        case 't':  result.AppendChar('\t'); break;
+        case 'u':  result.AppendChar(UnicodeChar()); 
                    break;
         default:   SetError(JsonError::JE_IllString,_T("Ill formed string. Illegal escape sequence."));
-                   *buffer++ = ch;
+                   result.AppendChar(ch);
                    break;
       }
     }
     else
     {
-      *buffer++ = ValueChar();
+      // Newline within the string
+      result.AppendChar(ValueChar());
     }
   }
   // Skip past string's ending
@@ -226,10 +247,46 @@ JSONParser::GetString()
   {
     SetError(JsonError::JE_StringEnding,_T("String found without an ending quote!"));
   }
+  return result;
+}
 
-  // Getting the string
-  *buffer = 0;
-  return XString((LPCTSTR)m_scanString);
+// Find the first character of a string that needs attention: the ending
+// quote, an escape, a newline or the terminator. Blocks are only read
+// as long as they lie completely within the message.
+_TUCHAR*
+JSONParser::ScanPlainText(_TUCHAR* p_pointer,const _TUCHAR* p_end)
+{
+#ifdef JSON_SCAN_SSE2
+  constexpr int perBlock = sizeof(__m128i) / sizeof(_TUCHAR);
+
+  const __m128i quote   = JSON_SCAN_SET('\"');
+  const __m128i escape  = JSON_SCAN_SET('\\');
+  const __m128i newline = JSON_SCAN_SET('\n');
+  const __m128i ending  = _mm_setzero_si128();
+
+  while(p_end - p_pointer >= perBlock)
+  {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_pointer));
+    __m128i found = _mm_or_si128(_mm_or_si128(JSON_SCAN_EQ(block,quote)  ,JSON_SCAN_EQ(block,escape))
+                                ,_mm_or_si128(JSON_SCAN_EQ(block,newline),JSON_SCAN_EQ(block,ending)));
+    int mask = _mm_movemask_epi8(found);
+    if(mask)
+    {
+      unsigned long bit = 0;
+      _BitScanForward(&bit,static_cast<unsigned long>(mask));
+      return p_pointer + bit / sizeof(_TUCHAR);
+    }
+    p_pointer += perBlock;
+  }
+#else
+  UNREFERENCED_PARAMETER(p_end);
+#endif
+  // Scalar: the rest of the message (and always stops on the terminator)
+  while(*p_pointer && *p_pointer != '\"' && *p_pointer != '\\' && *p_pointer != '\n')
+  {
+    ++p_pointer;
+  }
+  return p_pointer;
 }
 
 // Conversion of xdigit to a numeric value
@@ -326,6 +383,7 @@ JSONParser::ParseArray()
   ++m_pointer;
   SkipWhitespace();
   m_valPointer->SetDatatype(JsonType::JDT_array);
+  JSONarray& array = m_valPointer->GetArray();
 
   // Loop through all array values
   int elements = 0;
@@ -341,12 +399,11 @@ JSONParser::ParseArray()
 
     // Array is not empty
     // Put array element extra in the array
-    JSONvalue value;
-    m_valPointer->GetArray().push_back(value);
+    array.emplace_back();
 
     // Put value pointer on the stack and parse an array value
     JSONvalue* workPointer = m_valPointer;
-    m_valPointer = &m_valPointer->GetArray().back();
+    m_valPointer = &array.back();
     ParseLevel();
     m_valPointer = workPointer;
 
@@ -381,14 +438,14 @@ JSONParser::ParseObject()
   ++m_pointer;
   SkipWhitespace();
   m_valPointer->SetDatatype(JsonType::JDT_object);
+  JSONobject& object = m_valPointer->GetObject();
 
   // Loop through all object values
   int elements = 0;
   while(*m_pointer)
   {
-    JSONpair value;
-    m_valPointer->GetObject().push_back(value);
-    JSONpair& pair = m_valPointer->GetObject().back();
+    object.emplace_back();
+    JSONpair& pair = object.back();
 
     // Check for an empty object
     if(*m_pointer == '}' && elements == 0)
@@ -400,7 +457,7 @@ JSONParser::ParseObject()
 
     // Parse the name string;
     XString name = GetString();
-    pair.m_name = name;
+    pair.m_name.swap(name);
 
     SkipWhitespace();
     if(*m_pointer != ':')
@@ -439,7 +496,7 @@ bool
 JSONParser::ParseNumber()
 {
   // See if we must parse a number
-  if(*m_pointer != '-' && !isdigit(*m_pointer))
+  if(*m_pointer != '-' && !JSON_DIGIT(*m_pointer))
   {
     return false;
   }
@@ -459,7 +516,7 @@ JSONParser::ParseNumber()
   }
 
   // Finding the integer part
-  while(*m_pointer && isdigit(*m_pointer))
+  while(JSON_DIGIT(*m_pointer))
   {
     number *= 10; // JSON is always in radix 10!
     number += (*m_pointer - '0');
@@ -475,9 +532,24 @@ JSONParser::ParseNumber()
       ++m_pointer;
       type = JsonType::JDT_number_bcd;
       bcdNumber = number;
-      bcd decimPart(1);
 
-      while(*m_pointer && isdigit(*m_pointer))
+      // Gather up to 18 decimals in an integer: one division instead of one per digit
+      // The result is the same: the decimals are exact within the bcd precision
+      __int64 decimals = 0;
+      __int64 divisor  = 1;
+      while(JSON_DIGIT(*m_pointer) && divisor < 1000000000000000000LL)
+      {
+        decimals = decimals * 10 + (*m_pointer - '0');
+        divisor *= 10;
+        ++m_pointer;
+      }
+      if(decimals)
+      {
+        bcdNumber += bcd(decimals) / bcd(divisor);
+      }
+      // Beyond that: digit by digit
+      bcd decimPart(divisor);
+      while(JSON_DIGIT(*m_pointer))
       {
         decimPart *= 10;
         bcdNumber += ((bcd)(*m_pointer - '0')) / decimPart;
@@ -500,7 +572,7 @@ JSONParser::ParseNumber()
       }
 
       // Find all exponential digits
-      while(*m_pointer && isdigit(*m_pointer))
+      while(JSON_DIGIT(*m_pointer))
       {
         exponent *= 10;
         exponent += (*m_pointer - '0');
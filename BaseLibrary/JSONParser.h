@@ -60,6 +60,8 @@ private:
   void    SetError(JsonError p_error,LPCTSTR p_text,bool p_throw = true);
   void    SkipWhitespace();
   XString GetString();
+  // Find the next quote, escape, newline or end of the string
+  static _TUCHAR* ScanPlainText(_TUCHAR* p_pointer,const _TUCHAR* p_end);
   // Get a character from message including '& translation'
   _TUCHAR ValueChar();
   _TUCHAR XDigitToValue(int ch);
@@ -76,11 +78,10 @@ private:
 protected:
   JSONMessage* m_message    { nullptr };  // Receiving the errors for the parse
   _TUCHAR*     m_pointer    { nullptr };  // Pointer in string to parse
+  _TUCHAR*     m_end        { nullptr };  // End of the string to parse
   JSONvalue*   m_valPointer { nullptr };  // Currently parsing value
   unsigned     m_lines      { 0 };        // Lines parsed
   unsigned     m_objects    { 0 };        // Objects/arrays parsed
-  _TUCHAR*     m_scanString { nullptr };  // Temporary buffer to scan one string
-  int          m_scanLength { 0 };        // Max length of a string to scan
 };
 
 // Parsing a SOAPMessage to a JSON Message
@@ -640,23 +640,28 @@ JSONPath::EvaluateFilter(Relation relation)
       for(int index = 0; index < (int)m_searching->GetArray().size(); index++)
       {
         bool contains(false);
-        for(JSONpair pair : m_searching->GetArray().at(index).GetObject())
+        JSONvalue& element = m_searching->GetArray().at(index);
+        // Elements that are no object have no names, and are left as they are
+        if(element.GetDataType() == JsonType::JDT_object)
         {
-          if(pair.m_name.Compare(relation.leftSide) == 0)
+          for(JSONpair pair : element.GetObject())
           {
-            if(EvaluateFilterClause(relation,pair.m_value))
+            if(pair.m_name.Compare(relation.leftSide) == 0)
             {
-              m_results.push_back(&m_searching->GetArray().at(index));
-              m_status = JPStatus::JP_Match_array;
-            };
-          }
-          else if(relation.leftSide.IsEmpty() && !relation.rightSide.IsEmpty())
-          {
-            if(relation.clause.Compare(_T("!")) == 0 || relation.clause.Compare(_T("~")) == 0)
+              if(EvaluateFilterClause(relation,pair.m_value))
+              {
+                m_results.push_back(&m_searching->GetArray().at(index));
+                m_status = JPStatus::JP_Match_array;
+              };
+            }
+            else if(relation.leftSide.IsEmpty() && !relation.rightSide.IsEmpty())
             {
-              if(pair.m_name.Compare(relation.rightSide) == 0)
+              if(relation.clause.Compare(_T("!")) == 0 || relation.clause.Compare(_T("~")) == 0)
               {
-                contains = true;
+                if(pair.m_name.Compare(relation.rightSide) == 0)
+                {
+                  contains = true;
+                }
               }
             }
           }
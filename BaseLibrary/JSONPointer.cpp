@@ -293,7 +293,7 @@ JSONPointer::PresetFromJsonValue()
   m_type = m_value->GetDataType();
   switch (m_type)
   {
-    case JsonType::JDT_string:      m_string     = &(m_value->m_string);
+    case JsonType::JDT_string:      m_string     = m_value->m_string;
                                     m_status     = JPStatus::JP_Match_string;
                                     break;
     case JsonType::JDT_const:       m_constant   = &(m_value->m_constant);
@@ -302,13 +302,13 @@ JSONPointer::PresetFromJsonValue()
     case JsonType::JDT_number_int:  m_number_int = &(m_value->m_intNumber);
                                     m_status     = JPStatus::JP_Match_number_int;
                                     break;
-    case JsonType::JDT_number_bcd:  m_number_bcd = &(m_value->m_bcdNumber);
+    case JsonType::JDT_number_bcd:  m_number_bcd = m_value->m_bcdNumber;
                                     m_status     = JPStatus::JP_Match_number_bcd;
                                     break;
-    case JsonType::JDT_object:      m_object     = &(m_value->m_object);
+    case JsonType::JDT_object:      m_object     = m_value->m_object;
                                     m_status     = JPStatus::JP_Match_object;
                                     break;
-    case JsonType::JDT_array:       m_array      = &(m_value->m_array);
+    case JsonType::JDT_array:       m_array      = m_value->m_array;
                                     m_status     = JPStatus::JP_Match_array;
                                     break;
   }
@@ -413,13 +413,13 @@ JSONPointer::ParseLevel(XString& p_parsing)
   // Check for value == object and token is identifier
   else if(m_value->GetDataType() == JsonType::JDT_object)
   {
-    for(auto& pair : m_value->GetObject())
+    // Through the name index of the object
+    const JSONobject& object = m_value->GetObject();
+    int position = object.FindName(token);
+    if(position >= 0)
     {
-      if(pair.m_name.Compare(token) == 0)
-      {
-        m_value = &(pair.m_value);
-        return true;
-      }
+      m_value = const_cast<JSONvalue*>(&object[position].m_value);
+      return true;
     }
     // Token-not-found-in-object error
   }
@@ -0,0 +1,743 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: JSONReader.cpp
+//
+// BaseLibrary: Indispensable general objects and functions
+// 
+// Created: 2014-2025 ir. W.E. Huisman
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "JSONReader.h"
+#include "FileBuffer.h"
+#include "ConvertWideString.h"
+
+// JSON whitespace. The same set as in the JSONParser
+#define JSON_SPACE(ch) ((ch) == ' ' || ((ch) >= '\t' && (ch) <= '\r'))
+#define JSON_DIGIT(ch) ((ch) >= '0' && (ch) <= '9')
+
+JSONReader::JSONReader()
+           :m_maxToken(g_streaming_limit)
+{
+}
+
+JSONReader::~JSONReader()
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// INPUT
+//
+//////////////////////////////////////////////////////////////////////////
+
+void
+JSONReader::Feed(const uchar* p_buffer,size_t p_length)
+{
+  Compact();
+  m_input.insert(m_input.end(),p_buffer,p_buffer + p_length);
+}
+
+void
+JSONReader::Feed(const FileBuffer& p_buffer)
+{
+  m_source = &p_buffer;
+  m_part   = 0;
+  m_offset = 0;
+}
+
+void
+JSONReader::Finish()
+{
+  m_finished = true;
+}
+
+// Take the next slice of the FileBuffer.
+// Running out of the buffer counts as progress once: tokens at the
+// very end of the text can only be completed after that.
+bool
+JSONReader::MoreInput()
+{
+  while(m_source)
+  {
+    uchar* buffer = nullptr;
+    size_t length = 0;
+    bool   found  = false;
+
+    if(m_source->GetHasBufferParts())
+    {
+      found = m_source->GetBufferPart(m_part,buffer,length);
+    }
+    else if(m_part == 0)
+    {
+      m_source->GetBuffer(buffer,length);
+      found = true;
+    }
+    if(!found)
+    {
+      m_source = nullptr;
+      return true;
+    }
+    if(m_offset < length)
+    {
+      size_t slice = length - m_offset;
+      if(slice > JSONREADER_SLICE)
+      {
+        slice = JSONREADER_SLICE;
+      }
+      Compact();
+      m_input.insert(m_input.end(),buffer + m_offset,buffer + m_offset + slice);
+      m_offset += slice;
+      return true;
+    }
+    // Next part of the buffer
+    ++m_part;
+    m_offset = 0;
+  }
+  return false;
+}
+
+// Drop what is already read. What is left is a part of a token at most
+void
+JSONReader::Compact()
+{
+  if(m_pos)
+  {
+    m_input.erase(m_input.begin(),m_input.begin() + m_pos);
+    m_pos = 0;
+  }
+}
+
+void
+JSONReader::CheckTokenSize(size_t p_start)
+{
+  if(m_input.size() - p_start > m_maxToken)
+  {
+    SetError(JsonError::JE_StreamingLimit,_T("String or number larger than the streaming limit"));
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// PULLING THE EVENTS
+//
+//////////////////////////////////////////////////////////////////////////
+
+JsonEvent
+JSONReader::Next()
+{
+  if(m_last == JsonEvent::JR_Error)
+  {
+    return m_last;
+  }
+  m_result = &m_scalar;
+
+  try
+  {
+    JsonEvent event = JsonEvent::JR_NeedMore;
+    while(true)
+    {
+      if(!ReadEvent(event))
+      {
+        if(MoreInput())
+        {
+          continue;
+        }
+        return m_last = NoInput();
+      }
+      if(!m_build.empty())
+      {
+        // Collecting: the event goes into the tree
+        Build(event);
+        if(m_build.empty())
+        {
+          m_result = &m_tree;
+          return m_last = JsonEvent::JR_Value;
+        }
+        continue;
+      }
+      if(m_skip)
+      {
+        // Skipping: until the end of the object/array
+        if(m_stack.size() < m_skip)
+        {
+          m_skip = 0;
+        }
+        continue;
+      }
+      return m_last = event;
+    }
+  }
+  catch(JsonError& /*error*/)
+  {
+    // Error text already set
+  }
+  return m_last = JsonEvent::JR_Error;
+}
+
+void
+JSONReader::Collect()
+{
+  if(m_last == JsonEvent::JR_StartObject || m_last == JsonEvent::JR_StartArray)
+  {
+    m_tree.SetDatatype(m_last == JsonEvent::JR_StartObject ? JsonType::JDT_object : JsonType::JDT_array);
+    m_build.push_back(&m_tree);
+  }
+}
+
+void
+JSONReader::Skip()
+{
+  if(m_last == JsonEvent::JR_StartObject || m_last == JsonEvent::JR_StartArray)
+  {
+    m_skip = m_stack.size();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// PRIVATE
+//
+//////////////////////////////////////////////////////////////////////////
+
+// One event from the input.
+// Returns false if the input runs out before the event is complete. What
+// has been read up to then is kept in the state, so we can simply call
+// again when there is more input.
+bool
+JSONReader::ReadEvent(JsonEvent& p_event)
+{
+  // Skip an UTF-8 BOM at the start
+  if(!m_started)
+  {
+    if(m_input.size() - m_pos < 3 && (!m_finished || m_source))
+    {
+      return false;
+    }
+    if(m_input.size() - m_pos >= 3 && m_input[m_pos] == 0xEF && m_input[m_pos + 1] == 0xBB && m_input[m_pos + 2] == 0xBF)
+    {
+      m_pos += 3;
+    }
+    m_started = true;
+  }
+
+  while(true)
+  {
+    while(m_pos < m_input.size() && JSON_SPACE(m_input[m_pos]))
+    {
+      if(m_input[m_pos] == '\n')
+      {
+        ++m_lines;
+      }
+      ++m_pos;
+    }
+    if(m_pos == m_input.size())
+    {
+      return false;
+    }
+
+    uchar ch = m_input[m_pos];
+    switch(m_expect)
+    {
+      case Expect::Done:      SetError(JsonError::JE_ExtraText,_T("Extra text after the JSON message"));
+                              break;
+      case Expect::Colon:     if(ch != ':')
+                              {
+                                SetError(JsonError::JE_ObjNameSep,_T("Object's name-value separator ':' is missing!"));
+                              }
+                              ++m_pos;
+                              m_expect = Expect::Value;
+                              continue;
+      case Expect::Separator: if(m_stack.back() == '{')
+                              {
+                                if(ch == '}')
+                                {
+                                  EndContainer();
+                                  p_event = JsonEvent::JR_EndObject;
+                                  return true;
+                                }
+                                if(ch != ',')
+                                {
+                                  SetError(JsonError::JE_ObjectElement,_T("Object element separator ',' expected!"));
+                                }
+                                m_expect = Expect::Key;
+                              }
+                              else
+                              {
+                                if(ch == ']')
+                                {
+                                  EndContainer();
+                                  p_event = JsonEvent::JR_EndArray;
+                                  return true;
+                                }
+                                if(ch != ',')
+                                {
+                                  SetError(JsonError::JE_ArrayElement,_T("Array element separator ',' expected!"));
+                                }
+                                m_expect = Expect::Value;
+                              }
+                              ++m_pos;
+                              continue;
+      case Expect::FirstKey:  if(ch == '}')
+                              {
+                                EndContainer();
+                                p_event = JsonEvent::JR_EndObject;
+                                return true;
+                              }
+                              // Fall through
+      case Expect::Key:       if(ch != '\"')
+                              {
+                                SetError(JsonError::JE_NoString,_T("String expected but not found!"));
+                              }
+                              if(!ReadString(m_key))
+                              {
+                                return false;
+                              }
+                              m_expect = Expect::Colon;
+                              p_event  = JsonEvent::JR_Key;
+                              return true;
+      case Expect::FirstValue:if(ch == ']')
+                              {
+                                EndContainer();
+                                p_event = JsonEvent::JR_EndArray;
+                                return true;
+                              }
+                              // Fall through
+      case Expect::Value:     if(ch == '{' || ch == '[')
+                              {
+                                m_stack.push_back((char)ch);
+                                ++m_pos;
+                                m_expect = (ch == '{') ? Expect::FirstKey : Expect::FirstValue;
+                                p_event  = (ch == '{') ? JsonEvent::JR_StartObject : JsonEvent::JR_StartArray;
+                                return true;
+                              }
+                              if(ch == '\"')
+                              {
+                                // Read straight into the string of the value
+                                if(m_scalar.m_type != JsonType::JDT_string)
+                                {
+                                  m_scalar.SetDatatype(JsonType::JDT_string);
+                                }
+                                if(!ReadString(*m_scalar.m_string))
+                                {
+                                  return false;
+                                }
+                              }
+                              else if(ch == '-' || JSON_DIGIT(ch))
+                              {
+                                if(!ReadNumber())
+                                {
+                                  return false;
+                                }
+                              }
+                              else if(!ReadConstant())
+                              {
+                                return false;
+                              }
+                              AfterValue();
+                              p_event = JsonEvent::JR_Value;
+                              return true;
+    }
+  }
+}
+
+// Read a string, starting at the opening quote.
+// First find the closing quote. If it is not there yet, remember how far
+// we got, so a long string is scanned only once while the input comes in.
+bool
+JSONReader::ReadString(XString& p_string)
+{
+  const uchar* input = m_input.data();
+  size_t start = m_pos;
+  size_t size  = m_input.size();
+  size_t scan  = start + 1 + m_scanned;
+
+  while(scan < size)
+  {
+    uchar ch = input[scan];
+    if(ch == '\"')
+    {
+      DecodeString(input + start + 1,input + scan,p_string);
+      m_scanned = 0;
+      m_pos     = scan + 1;
+      return true;
+    }
+    if(ch == '\\')
+    {
+      if(scan + 1 == size)
+      {
+        // Escape is split: see it again next time
+        break;
+      }
+      ++scan;
+    }
+    ++scan;
+  }
+  if(m_finished && !m_source)
+  {
+    SetError(JsonError::JE_StringEnding,_T("String found without an ending quote!"));
+  }
+  CheckTokenSize(start);
+  m_scanned = scan - start - 1;
+  return false;
+}
+
+// Read a number. Small integers are done right here.
+// Decimals, exponents and big numbers go to the bcd.
+bool
+JSONReader::ReadNumber()
+{
+  const uchar* input = m_input.data();
+  size_t start = m_pos;
+  size_t scan  = m_pos;
+  size_t size  = m_input.size();
+
+  while(scan < size && (JSON_DIGIT(input[scan]) || input[scan] == '-' || input[scan] == '+' ||
+                        input[scan] == '.'      || input[scan] == 'e' || input[scan] == 'E'))
+  {
+    ++scan;
+  }
+  if(scan == size && (!m_finished || m_source))
+  {
+    // The number may go on in the next part of the input
+    CheckTokenSize(start);
+    return false;
+  }
+
+  const uchar* pointer  = input + start;
+  const uchar* end      = input + scan;
+  bool         negative = (*pointer == '-');
+  if(negative)
+  {
+    ++pointer;
+  }
+  if(pointer == end || !JSON_DIGIT(*pointer))
+  {
+    SetError(JsonError::JE_UnknownString,_T("Non conforming JSON message text"));
+  }
+
+  // Integer part: at most 18 digits always fit
+  const uchar* digits = pointer;
+  __int64      number = 0;
+  while(pointer < end && JSON_DIGIT(*pointer) && pointer - digits < 18)
+  {
+    number = number * 10 + (*pointer - '0');
+    ++pointer;
+  }
+
+  if(pointer == end)
+  {
+    if(negative)
+    {
+      number = -number;
+    }
+    if(number > MAXINT32 || number < MININT32)
+    {
+      m_scalar.SetValue(bcd(number));
+    }
+    else
+    {
+      m_scalar.SetValue(static_cast<int>(number));
+    }
+  }
+  else
+  {
+    XString text;
+    for(const uchar* character = input + start;character < end;++character)
+    {
+      text.AppendChar(*character);
+    }
+    m_scalar.SetValue(bcd(text.GetString()));
+  }
+  m_pos = scan;
+  return true;
+}
+
+// Read null, true or false. Like the JSONParser, not case sensitive
+bool
+JSONReader::ReadConstant()
+{
+  const char* text  = nullptr;
+  JsonConst   value = JsonConst::JSON_NONE;
+  switch(tolower(m_input[m_pos]))
+  {
+    case 'n': text = "null";  value = JsonConst::JSON_NULL;  break;
+    case 't': text = "true";  value = JsonConst::JSON_TRUE;  break;
+    case 'f': text = "false"; value = JsonConst::JSON_FALSE; break;
+    default:  SetError(JsonError::JE_UnknownString,_T("Non conforming JSON message text"));
+              break;
+  }
+  size_t length = strlen(text);
+  if(m_input.size() - m_pos < length)
+  {
+    if(m_finished && !m_source)
+    {
+      SetError(JsonError::JE_UnknownString,_T("Non conforming JSON message text"));
+    }
+    return false;
+  }
+  for(size_t ind = 0;ind < length; ++ind)
+  {
+    if(tolower(m_input[m_pos + ind]) != text[ind])
+    {
+      SetError(JsonError::JE_UnknownString,_T("Non conforming JSON message text"));
+    }
+  }
+  m_scalar.SetValue(value);
+  m_pos += length;
+  return true;
+}
+
+void
+JSONReader::AfterValue()
+{
+  m_expect = m_stack.empty() ? Expect::Done : Expect::Separator;
+}
+
+void
+JSONReader::EndContainer()
+{
+  ++m_pos;
+  m_stack.pop_back();
+  AfterValue();
+}
+
+// Out of input in between two events
+JsonEvent
+JSONReader::NoInput()
+{
+  if(!m_finished || m_source)
+  {
+    return JsonEvent::JR_NeedMore;
+  }
+  if(m_expect == Expect::Done || m_stack.empty())
+  {
+    // Complete (or just whitespace, as with the JSONParser)
+    return JsonEvent::JR_End;
+  }
+  if(m_stack.back() == '{')
+  {
+    SetError(JsonError::JE_ObjectElement,_T("Object not closed before the end of the message"));
+  }
+  SetError(JsonError::JE_ArrayElement,_T("Array not closed before the end of the message"));
+  return JsonEvent::JR_Error;
+}
+
+// Decode the text of a string: the escapes and the UTF-8
+void
+JSONReader::DecodeString(const uchar* p_begin,const uchar* p_end,XString& p_string)
+{
+  p_string.Empty();
+  p_string.Preallocate(static_cast<int>(p_end - p_begin));
+#ifndef _UNICODE
+  bool convert = false;
+#endif
+
+  const uchar* pointer = p_begin;
+  while(pointer < p_end)
+  {
+    unsigned ch = *pointer++;
+    if(ch == '\\')
+    {
+      // The scan made sure the escape is complete
+      ch = *pointer++;
+      switch(ch)
+      {
+        case '\"': // Fall through
+        case '\\': // Fall through
+        case '/':  break;
+        case 'b':  ch = '\b'; break;
+        case 'f':  ch = '\f'; break;
+        case 'n':  ch = '\n'; break;
+        case 'r':  ch = '\r'; break;
+        case 't':  ch = '\t'; break;
+        case 'u':  ch = 0;
+                   for(int ind = 0;ind < 4; ++ind)
+                   {
+                     if(pointer == p_end || !isxdigit(*pointer))
+                     {
+                       SetError(JsonError::JE_Unicode4Chars,_T("Unicode escape consists of 4 hex characters"));
+                     }
+                     int digit = *pointer++;
+                     ch = ch * 16 + (digit <= '9' ? digit - '0' : (digit | 0x20) - 'a' + 10);
+                   }
+#ifdef _UNICODE
+                   // An UTF-16 code unit: just as we store it
+                   p_string.AppendChar(static_cast<TCHAR>(ch));
+#else
+                   // To UTF-8, with the surrogate pairs joined
+                   if(ch >= 0xD800 && ch < 0xDC00 && p_end - pointer >= 6 && pointer[0] == '\\' && pointer[1] == 'u')
+                   {
+                     unsigned low = 0;
+                     for(int ind = 2;ind < 6 && isxdigit(pointer[ind]); ++ind)
+                     {
+                       int digit = pointer[ind];
+                       low = low * 16 + (digit <= '9' ? digit - '0' : (digit | 0x20) - 'a' + 10);
+                     }
+                     if(low >= 0xDC00 && low < 0xE000)
+                     {
+                       ch = 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00);
+                       pointer += 6;
+                     }
+                   }
+                   AppendUTF8(p_string,ch);
+                   convert = true;
+#endif
+                   continue;
+        default:   SetError(JsonError::JE_IllString,_T("Ill formed string. Illegal escape sequence."));
+                   break;
+      }
+      p_string.AppendChar(static_cast<TCHAR>(ch));
+    }
+    else if(ch < 0x80)
+    {
+      if(ch == '\n')
+      {
+        ++m_lines;
+      }
+      p_string.AppendChar(static_cast<TCHAR>(ch));
+    }
+    else
+    {
+#ifdef _UNICODE
+      // UTF-8 sequence to UTF-16. Anything ill formed becomes U+FFFD
+      int follow = (ch >= 0xF0) ? 3 : (ch >= 0xE0) ? 2 : (ch >= 0xC2) ? 1 : 0;
+      unsigned code = (follow == 3) ? (ch & 0x07) : (follow == 2) ? (ch & 0x0F) : (ch & 0x1F);
+      if(follow == 0 || ch > 0xF4 || p_end - pointer < follow)
+      {
+        code = 0xFFFD;
+      }
+      else
+      {
+        for(int ind = 0;ind < follow; ++ind)
+        {
+          if((pointer[ind] & 0xC0) != 0x80)
+          {
+            code = 0xFFFD;
+            follow = ind;
+            break;
+          }
+          code = (code << 6) | (pointer[ind] & 0x3F);
+        }
+        pointer += follow;
+      }
+      if(code >= 0x10000 && code != 0xFFFD)
+      {
+        code -= 0x10000;
+        p_string.AppendChar(static_cast<TCHAR>(0xD800 + (code >> 10)));
+        p_string.AppendChar(static_cast<TCHAR>(0xDC00 + (code & 0x3FF)));
+      }
+      else
+      {
+        p_string.AppendChar(static_cast<TCHAR>(code));
+      }
+#else
+      // Converted as a whole at the end
+      p_string.AppendChar(static_cast<TCHAR>(ch));
+      convert = true;
+#endif
+    }
+  }
+#ifndef _UNICODE
+  if(convert)
+  {
+    p_string = DecodeStringFromTheWire(p_string);
+  }
+#endif
+}
+
+#ifndef _UNICODE
+void
+JSONReader::AppendUTF8(XString& p_string,unsigned p_code)
+{
+  if(p_code < 0x80)
+  {
+    p_string.AppendChar(static_cast<TCHAR>(p_code));
+  }
+  else if(p_code < 0x800)
+  {
+    p_string.AppendChar(static_cast<TCHAR>(0xC0 | (p_code >> 6)));
+    p_string.AppendChar(static_cast<TCHAR>(0x80 | (p_code & 0x3F)));
+  }
+  else if(p_code < 0x10000)
+  {
+    p_string.AppendChar(static_cast<TCHAR>(0xE0 | (p_code >> 12)));
+    p_string.AppendChar(static_cast<TCHAR>(0x80 | ((p_code >> 6) & 0x3F)));
+    p_string.AppendChar(static_cast<TCHAR>(0x80 | (p_code & 0x3F)));
+  }
+  else
+  {
+    p_string.AppendChar(static_cast<TCHAR>(0xF0 | (p_code >> 18)));
+    p_string.AppendChar(static_cast<TCHAR>(0x80 | ((p_code >> 12) & 0x3F)));
+    p_string.AppendChar(static_cast<TCHAR>(0x80 | ((p_code >> 6) & 0x3F)));
+    p_string.AppendChar(static_cast<TCHAR>(0x80 | (p_code & 0x3F)));
+  }
+}
+#endif
+
+// Collecting: put the event into the tree
+void
+JSONReader::Build(JsonEvent p_event)
+{
+  switch(p_event)
+  {
+    case JsonEvent::JR_StartObject: // Fall through
+    case JsonEvent::JR_StartArray:  {
+                                      JSONvalue* child = BuildChild();
+                                      child->SetDatatype(p_event == JsonEvent::JR_StartObject ? JsonType::JDT_object : JsonType::JDT_array);
+                                      m_build.push_back(child);
+                                    }
+                                    break;
+    case JsonEvent::JR_Value:       *BuildChild() = std::move(m_scalar);
+                                    break;
+    case JsonEvent::JR_EndObject:   // Fall through
+    case JsonEvent::JR_EndArray:    m_build.pop_back();
+                                    break;
+    default:                        // The key is used by the next child
+                                    break;
+  }
+}
+
+// New element in the array, or new pair in the object that is being built.
+// The parent does not grow while the child is built, so the child stays put
+JSONvalue*
+JSONReader::BuildChild()
+{
+  JSONvalue* parent = m_build.back();
+  if(parent->m_type == JsonType::JDT_array)
+  {
+    parent->m_array->emplace_back();
+    return &parent->m_array->back();
+  }
+  parent->m_object->emplace_back();
+  JSONpair& pair = parent->m_object->back();
+  pair.m_name.swap(m_key);
+  return &pair.m_value;
+}
+
+void
+JSONReader::SetError(JsonError p_error,LPCTSTR p_text)
+{
+  m_error = p_error;
+  m_errorText.Format(_T("ERROR [%d] on line [%u] "),p_error,m_lines);
+  m_errorText += p_text;
+  throw p_error;
+}
@@ -0,0 +1,177 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: JSONReader.h
+//
+// BaseLibrary: Indispensable general objects and functions
+// 
+// Created: 2014-2025 ir. W.E. Huisman
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include "JSONMessage.h"
+#include "JSONParser.h"
+#include <vector>
+
+class FileBuffer;
+
+// Input is taken from a FileBuffer in slices of this size
+constexpr size_t JSONREADER_SLICE = 64 * 1024;
+
+// Events of the incremental JSON reader
+enum class JsonEvent
+{
+  JR_NeedMore       // All input is used: Feed more or call Finish
+ ,JR_StartObject
+ ,JR_EndObject
+ ,JR_StartArray
+ ,JR_EndArray
+ ,JR_Key            // Name of the next pair in an object: GetKey()
+ ,JR_Value          // A value, or a collected object/array: GetValue()
+ ,JR_End            // The JSON text is complete
+ ,JR_Error          // See GetError() and GetErrorText()
+};
+
+// Pull parser for JSON texts (UTF-8) that are too big for a JSONMessage.
+// The input is fed in parts of any size as it arrives. Only the part that
+// is not yet read is kept, so the memory use does not depend on the size
+// of the text, but on the biggest string or number in it.
+// Objects and arrays are reported as events. Any one of them can be
+// collected into a JSONvalue as a whole: e.g. the elements of a big array
+//
+//   JSONReader reader;
+//   reader.Feed(*message->GetFileBuffer());
+//   reader.Finish();
+//   JsonEvent event = reader.Next();        // JR_StartArray
+//   while((event = reader.Next()) == JsonEvent::JR_StartObject)
+//   {
+//     reader.Collect();
+//     if(reader.Next() == JsonEvent::JR_Value)
+//     {
+//       Import(reader.GetValue());
+//     }
+//   }
+//
+class JSONReader
+{
+public:
+  JSONReader();
+ ~JSONReader();
+
+  // INPUT
+
+  // Add the next part of the text. The bytes are copied
+  void        Feed(const uchar* p_buffer,size_t p_length);
+  // Read from the parts of the buffer, as far as needed for the next event.
+  // The buffer must stay alive while the reader is in use
+  void        Feed(const FileBuffer& p_buffer);
+  // No more input will come after what was fed
+  void        Finish();
+
+  // PULLING THE EVENTS
+
+  // Read up to the next event
+  JsonEvent   Next();
+  // After JR_StartObject or JR_StartArray: read the whole object/array into
+  // a JSONvalue. The inner events are not reported: the next event is a JR_Value
+  void        Collect();
+  // After JR_StartObject or JR_StartArray: skip the whole object/array.
+  // The next event is the one after its end
+  void        Skip();
+
+  // SETTERS
+
+  // Maximum size of one string or number in the text (default the streaming limit)
+  void        SetMaximumToken(size_t p_maximum) { m_maxToken = p_maximum; }
+
+  // GETTERS
+
+  // Name of the pair of JR_Key
+  const XString& GetKey() const   { return m_key;       }
+  // Value of JR_Value. It may be moved out of the reader
+  JSONvalue&  GetValue()          { return *m_result;   }
+  // Current nesting of objects and arrays
+  unsigned    GetDepth() const    { return (unsigned)m_stack.size(); }
+  unsigned    GetLines() const    { return m_lines;     }
+  JsonError   GetError() const    { return m_error;     }
+  XString     GetErrorText()const { return m_errorText; }
+
+private:
+  // What the grammar expects next
+  enum class Expect
+  {
+    Value           // Any value
+   ,FirstValue      // A value or the end of an empty array
+   ,FirstKey        // A name or the end of an empty object
+   ,Key             // The name of a pair
+   ,Colon           // Separator between name and value
+   ,Separator       // ',' or the end of the object/array
+   ,Done            // Only whitespace after the text
+  };
+
+  // Reading the next event from the input. False if the input runs out
+  bool        ReadEvent(JsonEvent& p_event);
+  bool        ReadString(XString& p_string);
+  bool        ReadNumber();
+  bool        ReadConstant();
+  void        AfterValue();
+  void        EndContainer();
+  // End of the available input
+  JsonEvent   NoInput();
+  // Get the next slice of the FileBuffer. False if there is none
+  bool        MoreInput();
+  void        Compact();
+  void        CheckTokenSize(size_t p_start);
+  // Decoding of the text of a string (without the quotes)
+  void        DecodeString(const uchar* p_begin,const uchar* p_end,XString& p_string);
+#ifndef _UNICODE
+  static void AppendUTF8(XString& p_string,unsigned p_code);
+#endif
+  // Building a collected object/array
+  void        Build(JsonEvent p_event);
+  JSONvalue*  BuildChild();
+  void        SetError(JsonError p_error,LPCTSTR p_text);
+
+  // Input
+  std::vector<uchar> m_input;                         // Bytes not yet read
+  size_t       m_pos       { 0 };                     // Read position in m_input
+  size_t       m_scanned   { 0 };                     // Part of a string already scanned
+  const FileBuffer* m_source { nullptr };             // Buffer to read from
+  unsigned     m_part      { 0 };                     // Part of the buffer
+  size_t       m_offset    { 0 };                     // Position in that part
+  bool         m_finished  { false };                 // No more input will come
+  bool         m_started   { false };                 // BOM check done
+  size_t       m_maxToken  { 0 };
+  // Grammar
+  Expect       m_expect    { Expect::Value };
+  std::vector<char> m_stack;                          // '{' or '[' per level
+  unsigned     m_lines     { 1 };
+  // Results
+  XString      m_key;
+  JSONvalue    m_scalar;                              // Last value read
+  JSONvalue    m_tree;                                // Collected object/array
+  JSONvalue*   m_result    { &m_scalar };
+  JsonEvent    m_last      { JsonEvent::JR_NeedMore }; // Last event reported
+  std::vector<JSONvalue*> m_build;                    // Collecting: the open objects/arrays
+  size_t       m_skip      { 0 };                     // Skipping: down to this depth
+  // Errors
+  JsonError    m_error     { (JsonError)0 };
+  XString      m_errorText;
+};
@@ -0,0 +1,350 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: JSONWriter.cpp
+//
+// BaseLibrary: Indispensable general objects and functions
+// 
+// Created: 2014-2025 ir. W.E. Huisman
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "JSONWriter.h"
+#include "FileBuffer.h"
+
+JSONWriter::JSONWriter(bool p_whitespace,bool p_exponential)
+           :m_white(p_whitespace)
+           ,m_exponential(p_exponential)
+{
+}
+
+JSONWriter::~JSONWriter()
+{
+  if(m_chunk)
+  {
+    delete [] m_chunk;
+  }
+}
+
+// Serialize to text, starting at a level (for the indentation)
+XString
+JSONWriter::GetText(const JSONvalue& p_value,unsigned p_level /*= 0*/)
+{
+  m_text.Empty();
+  WriteValue(p_value,p_level,true);
+
+  // Hand over the text without copying it
+  XString result;
+  result.swap(m_text);
+  return result;
+}
+
+#ifdef _UNICODE
+
+// Serialize as UTF-8 into the buffer.
+// Small results end up in the buffer in one go. Bigger ones become a
+// chain of buffer parts, so the whole text is never in memory twice.
+size_t
+JSONWriter::WriteUTF8(const JSONvalue& p_value,FileBuffer& p_buffer,bool p_withBOM)
+{
+  m_utf8   = true;
+  m_buffer = &p_buffer;
+  m_chunk  = alloc_new uchar[JSONWRITER_CHUNK];
+  m_used   = 0;
+  m_total  = 0;
+  m_parts  = false;
+  p_buffer.Reset();
+
+  if(p_withBOM)
+  {
+    PutByte(0xEF);
+    PutByte(0xBB);
+    PutByte(0xBF);
+  }
+  WriteValue(p_value,0,true);
+
+  if(m_parts)
+  {
+    if(m_used)
+    {
+      FlushChunk();
+    }
+  }
+  else
+  {
+    p_buffer.SetBuffer(m_chunk,m_used);
+    m_total = m_used;
+  }
+  delete [] m_chunk;
+  m_chunk  = nullptr;
+  m_buffer = nullptr;
+  m_utf8   = false;
+  return m_total;
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//
+// PRIVATE
+//
+//////////////////////////////////////////////////////////////////////////
+
+// One value. Objects are preceded by one tab less than their level,
+// except when they are the value of a pair (p_lead = false).
+void
+JSONWriter::WriteValue(const JSONvalue& p_value,unsigned p_level,bool p_lead)
+{
+  switch(p_value.m_type)
+  {
+    case JsonType::JDT_const:       switch(p_value.m_constant)
+                                    {
+                                      case JsonConst::JSON_NONE:  break;
+                                      case JsonConst::JSON_NULL:  Put(_T("null"), 4); break;
+                                      case JsonConst::JSON_FALSE: Put(_T("false"),5); break;
+                                      case JsonConst::JSON_TRUE:  Put(_T("true"), 4); break;
+                                    }
+                                    break;
+    case JsonType::JDT_string:      WriteString(*p_value.m_string);
+                                    break;
+    case JsonType::JDT_number_int:  WriteNumber(p_value.m_intNumber);
+                                    break;
+    case JsonType::JDT_number_bcd:  {
+                                      XString number = p_value.m_bcdNumber->AsString(m_exponential ? bcd::Format::Engineering : bcd::Format::Bookkeeping,false,0);
+                                      Put(number.GetString(),number.GetLength());
+                                    }
+                                    break;
+    case JsonType::JDT_array:       {
+                                      const JSONarray& array = *p_value.m_array;
+                                      Put('[');
+                                      WriteNewline();
+                                      for(size_t ind = 0;ind < array.size();++ind)
+                                      {
+                                        WriteTabs(p_level);
+                                        WriteValue(array[ind],p_level + 1,true);
+                                        if(ind < array.size() - 1)
+                                        {
+                                          Put(',');
+                                        }
+                                        WriteNewline();
+                                      }
+                                      WriteTabs(p_level);
+                                      Put(']');
+                                    }
+                                    break;
+    case JsonType::JDT_object:      {
+                                      const JSONobject& object = *p_value.m_object;
+                                      if(p_lead && p_level > 0)
+                                      {
+                                        WriteTabs(p_level - 1);
+                                      }
+                                      Put('{');
+                                      WriteNewline();
+                                      for(size_t ind = 0;ind < object.size();++ind)
+                                      {
+                                        // Check for empty object
+                                        if(object.size() == 1 && object[0].m_name.IsEmpty() &&
+                                           object[0].m_value.GetDataType() == JsonType::JDT_const &&
+                                           object[0].m_value.GetConstant() == JsonConst::JSON_NONE)
+                                        {
+                                          break;
+                                        }
+                                        WriteTabs(p_level + 1);
+                                        WriteString(object[ind].m_name);
+                                        Put(':');
+                                        WriteValue(object[ind].m_value,p_level + 1,false);
+                                        if(ind < object.size() - 1)
+                                        {
+                                          Put(',');
+                                        }
+                                        WriteNewline();
+                                      }
+                                      WriteTabs(p_level);
+                                      Put('}');
+                                    }
+                                    break;
+  }
+}
+
+// Quoted string with the JSON escapes.
+// Runs of characters without an escape are written in one go
+void
+JSONWriter::WriteString(const XString& p_string)
+{
+  LPCTSTR text   = p_string.GetString();
+  size_t  length = p_string.GetLength();
+  size_t  begin  = 0;
+
+  Put('\"');
+  for(size_t ind = 0;ind < length; ++ind)
+  {
+    TCHAR escape = 0;
+    switch(text[ind])
+    {
+      case '\"': escape = '\"'; break;
+      case '\\': escape = '\\'; break;
+      case '\b': escape = 'b';  break;
+      case '\f': escape = 'f';  break;
+      case '\n': escape = 'n';  break;
+      case '\r': escape = 'r';  break;
+      case '\t': escape = 't';  break;
+      default:   continue;
+    }
+    Put(text + begin,ind - begin);
+    Put('\\');
+    Put(escape);
+    begin = ind + 1;
+  }
+  Put(text + begin,length - begin);
+  Put('\"');
+}
+
+// Integer without the formatting functions of the runtime
+void
+JSONWriter::WriteNumber(int p_number)
+{
+  TCHAR    buffer[12];
+  TCHAR*   pointer = buffer + 12;
+  unsigned number  = p_number < 0 ? 0U - static_cast<unsigned>(p_number) : static_cast<unsigned>(p_number);
+  do
+  {
+    *--pointer = static_cast<TCHAR>('0' + number % 10);
+    number /= 10;
+  }
+  while(number);
+
+  if(p_number < 0)
+  {
+    *--pointer = '-';
+  }
+  Put(pointer,buffer + 12 - pointer);
+}
+
+void
+JSONWriter::WriteTabs(unsigned p_tabs)
+{
+  if(m_white)
+  {
+    while(p_tabs--)
+    {
+      Put('\t');
+    }
+  }
+}
+
+void
+JSONWriter::WriteNewline()
+{
+  if(m_white)
+  {
+    Put('\n');
+  }
+}
+
+void
+JSONWriter::Put(TCHAR p_char)
+{
+#ifdef _UNICODE
+  if(m_utf8)
+  {
+    if(p_char < 0x80)
+    {
+      PutByte(static_cast<uchar>(p_char));
+    }
+    else
+    {
+      Put(&p_char,1);
+    }
+    return;
+  }
+#endif
+  m_text.AppendChar(p_char);
+}
+
+void
+JSONWriter::Put(LPCTSTR p_text,size_t p_length)
+{
+#ifdef _UNICODE
+  if(m_utf8)
+  {
+    // Encoding UTF-16 to UTF-8
+    for(size_t ind = 0;ind < p_length; ++ind)
+    {
+      unsigned ch = p_text[ind];
+      if(ch < 0x80)
+      {
+        PutByte(static_cast<uchar>(ch));
+        continue;
+      }
+      if(ch < 0x800)
+      {
+        PutByte(static_cast<uchar>(0xC0 | (ch >> 6)));
+        PutByte(static_cast<uchar>(0x80 | (ch & 0x3F)));
+        continue;
+      }
+      if(ch >= 0xD800 && ch <= 0xDBFF && ind + 1 < p_length &&
+         p_text[ind + 1] >= 0xDC00 && p_text[ind + 1] <= 0xDFFF)
+      {
+        // Surrogate pair
+        ch = 0x10000 + ((ch - 0xD800) << 10) + (p_text[++ind] - 0xDC00);
+        PutByte(static_cast<uchar>(0xF0 |  (ch >> 18)));
+        PutByte(static_cast<uchar>(0x80 | ((ch >> 12) & 0x3F)));
+        PutByte(static_cast<uchar>(0x80 | ((ch >>  6) & 0x3F)));
+        PutByte(static_cast<uchar>(0x80 |  (ch        & 0x3F)));
+        continue;
+      }
+      if(ch >= 0xD800 && ch <= 0xDFFF)
+      {
+        // Lone surrogate: the replacement character (as WideCharToMultiByte)
+        ch = 0xFFFD;
+      }
+      PutByte(static_cast<uchar>(0xE0 |  (ch >> 12)));
+      PutByte(static_cast<uchar>(0x80 | ((ch >>  6) & 0x3F)));
+      PutByte(static_cast<uchar>(0x80 |  (ch        & 0x3F)));
+    }
+    return;
+  }
+#endif
+  m_text.Append(p_text,static_cast<int>(p_length));
+}
+
+#ifdef _UNICODE
+
+void
+JSONWriter::PutByte(uchar p_byte)
+{
+  if(m_used == JSONWRITER_CHUNK)
+  {
+    FlushChunk();
+  }
+  m_chunk[m_used++] = p_byte;
+}
+
+// The chunk goes to the next buffer part
+void
+JSONWriter::FlushChunk()
+{
+  m_buffer->AddBuffer(m_chunk,m_used);
+  m_total += m_used;
+  m_used   = 0;
+  m_parts  = true;
+}
+
+#endif
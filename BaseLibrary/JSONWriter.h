@@ -0,0 +1,78 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: JSONWriter.h
+//
+// BaseLibrary: Indispensable general objects and functions
+// 
+// Created: 2014-2025 ir. W.E. Huisman
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include "JSONMessage.h"
+
+// Size of one output chunk when writing UTF-8 to a FileBuffer
+constexpr size_t JSONWRITER_CHUNK = 64 * 1024;
+
+// Serializing a tree of JSONvalue's in one pass.
+// Tokens are written straight to the output: no string per node, and no
+// copying of the text of the subtrees into their parents.
+// The output is the same as it always was, including the whitespace layout.
+//
+class JSONWriter
+{
+public:
+  JSONWriter(bool p_whitespace,bool p_exponential);
+ ~JSONWriter();
+
+  // Serialize to text, starting at a level (for the indentation)
+  XString GetText(const JSONvalue& p_value,unsigned p_level = 0);
+#ifdef _UNICODE
+  // Serialize as UTF-8 into the buffer (chunks of JSONWRITER_CHUNK)
+  // Returns the total length in bytes
+  size_t  WriteUTF8(const JSONvalue& p_value,FileBuffer& p_buffer,bool p_withBOM);
+#endif
+
+private:
+  void    WriteValue (const JSONvalue& p_value,unsigned p_level,bool p_lead);
+  void    WriteString(const XString& p_string);
+  void    WriteNumber(int p_number);
+  void    WriteTabs  (unsigned p_tabs);
+  void    WriteNewline();
+  // Output of text
+  void    Put(TCHAR p_char);
+  void    Put(LPCTSTR p_text,size_t p_length);
+#ifdef _UNICODE
+  void    PutByte(uchar p_byte);
+  void    FlushChunk();
+#endif
+
+  bool        m_white       { false   };  // Pretty printing
+  bool        m_exponential { false   };  // Numbers in exponential format
+  // Output to text
+  XString     m_text;
+  // Output to UTF-8 chunks
+  bool        m_utf8        { false   };
+  FileBuffer* m_buffer      { nullptr };
+  uchar*      m_chunk       { nullptr };
+  size_t      m_used        { 0       };  // Bytes used in the current chunk
+  size_t      m_total       { 0       };  // Bytes written in total
+  bool        m_parts       { false   };  // Chunks already flushed to the buffer
+};
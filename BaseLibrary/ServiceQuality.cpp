@@ -164,6 +164,7 @@ ServiceQuality::ParseOption(const XString& p_option)
       option.m_value = value;
     }
   }
-  // Add to options
-  m_options.insert(std::make_pair(percent,option));
+  // Add to options. Before the options of the same quality, as the
+  // preferences are read from the back of the map to the front.
+  m_options.insert(m_options.lower_bound(percent),std::make_pair(percent,option));
 }
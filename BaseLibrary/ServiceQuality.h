@@ -41,7 +41,8 @@ public:
   XString m_value;
 };
 
-using QOptionMap = std::map<int,QualityOption>;
+// Options with the same quality are all retained, in the order of the header
+using QOptionMap = std::multimap<int,QualityOption>;
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -137,8 +137,19 @@ XString::AnsiToOem()
 void 
 XString::Append(LPCTSTR p_string,int p_length)
 {
-  stdstring str(p_string);
-  append(str.substr(0,p_length));
+  // At most n chars, but never past the end of the string
+  // Does not scan the rest of a (possibly very long) string
+  if(p_length < 0)
+  {
+    append(p_string);
+    return;
+  }
+  int length = 0;
+  while(length < p_length && p_string[length])
+  {
+    ++length;
+  }
+  append(p_string,length);
 }
 
 // Append a formatted string
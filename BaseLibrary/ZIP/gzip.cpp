@@ -98,6 +98,154 @@ bool gzip_compress_memory(void *in_data,size_t in_data_size,std::vector<uint8_t>
   return true;
 }
 
+// Start a deflate stream with the gzip header and trailer
+static bool gzip_start_stream(z_stream& strm)
+{
+  memset(&strm,0,sizeof(z_stream));
+
+  int windowBits = 15;
+  int GZIP_ENCODING = 16;
+
+  return deflateInit2(&strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,
+                      windowBits | GZIP_ENCODING,8,
+                      Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+// Start a gzip stream and allocate the output buffer for the worst case
+static bool gzip_start_buffer(z_stream& strm,size_t in_data_size,uint8_t*& out_data,size_t& out_bound)
+{
+  if(!gzip_start_stream(strm))
+  {
+    return false;
+  }
+  out_bound      = deflateBound(&strm,(uLong)in_data_size);
+  out_data       = alloc_new uint8_t[out_bound + 2];
+  strm.next_out  = out_data;
+  strm.avail_out = (uInt)out_bound;
+  return true;
+}
+
+// Finish the stream. The buffer was big enough: Z_STREAM_END is guaranteed
+static bool gzip_end_buffer(z_stream& strm,uint8_t*& out_data,size_t out_bound,size_t& out_size)
+{
+  int res = deflate(&strm,Z_FINISH);
+  deflateEnd(&strm);
+  if(res != Z_STREAM_END)
+  {
+    delete [] out_data;
+    out_data = nullptr;
+    return false;
+  }
+  out_size = out_bound - strm.avail_out;
+  out_data[out_size    ] = 0;
+  out_data[out_size + 1] = 0;
+  return true;
+}
+
+bool gzip_compress_buffer(void *in_data,size_t in_data_size,uint8_t*& out_data,size_t& out_size)
+{
+  z_stream strm;
+  size_t   bound = 0;
+  if(!gzip_start_buffer(strm,in_data_size,out_data,bound))
+  {
+    return false;
+  }
+  strm.next_in  = reinterpret_cast<uint8_t *>(in_data);
+  strm.avail_in = (uInt)in_data_size;
+  return gzip_end_buffer(strm,out_data,bound,out_size);
+}
+
+bool gzip_compress_parts(const std::vector<std::pair<void*,size_t>>& in_parts,uint8_t*& out_data,size_t& out_size)
+{
+  size_t total = 0;
+  for(const auto& part : in_parts)
+  {
+    total += part.second;
+  }
+  z_stream strm;
+  size_t   bound = 0;
+  if(!gzip_start_buffer(strm,total,out_data,bound))
+  {
+    return false;
+  }
+  // The buffer is big enough for all parts: each one is consumed at once
+  for(const auto& part : in_parts)
+  {
+    if(part.second == 0)
+    {
+      continue;
+    }
+    strm.next_in  = reinterpret_cast<uint8_t*>(part.first);
+    strm.avail_in = (uInt)part.second;
+    if(deflate(&strm,Z_NO_FLUSH) != Z_OK || strm.avail_in)
+    {
+      deflateEnd(&strm);
+      delete [] out_data;
+      out_data = nullptr;
+      return false;
+    }
+  }
+  return gzip_end_buffer(strm,out_data,bound,out_size);
+}
+
+bool gzip_compress_file(HANDLE in_file,size_t in_file_size,HANDLE out_file,size_t& out_size)
+{
+  const size_t CHUNKSIZE = 64 * 1024;
+
+  z_stream strm;
+  if(!gzip_start_stream(strm))
+  {
+    return false;
+  }
+  uint8_t* chunk  = alloc_new uint8_t[CHUNKSIZE];
+  uint8_t* block  = alloc_new uint8_t[CHUNKSIZE];
+  size_t   total  = 0;
+  int      flush  = Z_NO_FLUSH;
+  bool     result = true;
+  out_size = 0;
+
+  while(result && flush != Z_FINISH)
+  {
+    DWORD read = 0;
+    if(!ReadFile(in_file,chunk,(DWORD)CHUNKSIZE,&read,NULL) ||
+       (read == 0 && total < in_file_size) || total + read > in_file_size)
+    {
+      // Read error, or the file changed while reading
+      result = false;
+      break;
+    }
+    total        += read;
+    flush         = (total == in_file_size) ? Z_FINISH : Z_NO_FLUSH;
+    strm.next_in  = chunk;
+    strm.avail_in = read;
+
+    // Write every output block as soon as it is full
+    do
+    {
+      strm.next_out  = block;
+      strm.avail_out = (uInt)CHUNKSIZE;
+      if(deflate(&strm,flush) == Z_STREAM_ERROR)
+      {
+        result = false;
+        break;
+      }
+      DWORD have    = (DWORD)(CHUNKSIZE - strm.avail_out);
+      DWORD written = 0;
+      if(have && (!WriteFile(out_file,block,have,&written,NULL) || written != have))
+      {
+        result = false;
+        break;
+      }
+      out_size += have;
+    }
+    while(strm.avail_out == 0);
+  }
+  deflateEnd(&strm);
+  delete [] chunk;
+  delete [] block;
+  return result;
+}
+
 bool gzip_decompress_memory(void *in_data,size_t in_data_size,std::vector<uint8_t>& buffer)
 {
   const size_t BUFSIZE = 128 * 1024;
@@ -155,3 +303,92 @@ bool gzip_decompress_memory(void *in_data,size_t in_data_size,std::vector<uint8_
   delete [] temp_buffer;
   return true;
 }
+
+//////////////////////////////////////////////////////////////////////////
+//
+// STREAMING compression of chunked responses
+//
+//////////////////////////////////////////////////////////////////////////
+
+GzipStream::GzipStream()
+{
+  z_stream* strm = alloc_new z_stream;
+  memset(strm,0,sizeof(z_stream));
+
+  int windowBits = 15;
+  int GZIP_ENCODING = 16;
+
+  if(deflateInit2(strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,
+                  windowBits | GZIP_ENCODING,8,
+                  Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    delete strm;
+    return;
+  }
+  m_stream = strm;
+}
+
+GzipStream::~GzipStream()
+{
+  if(m_stream)
+  {
+    z_stream* strm = reinterpret_cast<z_stream*>(m_stream);
+    deflateEnd(strm);
+    delete strm;
+    m_stream = nullptr;
+  }
+}
+
+bool
+GzipStream::Compress(void* in_data,size_t in_data_size,bool p_final,uint8_t*& out_data,size_t& out_size)
+{
+  out_data = nullptr;
+  out_size = 0;
+  if(m_stream == nullptr || m_finished)
+  {
+    return false;
+  }
+  z_stream* strm = reinterpret_cast<z_stream*>(m_stream);
+  int flush = p_final ? Z_FINISH : Z_SYNC_FLUSH;
+
+  // Mostly big enough in one go: the data of a sync-flushed chunk
+  // never expands much. Otherwise the buffer doubles until it fits.
+  size_t bound = deflateBound(strm,(uLong)in_data_size) + 16;
+  out_data       = alloc_new uint8_t[bound + 2];
+  strm->next_in  = reinterpret_cast<uint8_t*>(in_data);
+  strm->avail_in = (uInt)in_data_size;
+
+  while(true)
+  {
+    strm->next_out  = out_data + out_size;
+    strm->avail_out = (uInt)(bound - out_size);
+
+    int res = deflate(strm,flush);
+    out_size = bound - strm->avail_out;
+    if(res == Z_STREAM_ERROR)
+    {
+      delete [] out_data;
+      out_data = nullptr;
+      out_size = 0;
+      return false;
+    }
+    if(res == Z_STREAM_END)
+    {
+      m_finished = true;
+      break;
+    }
+    if(!p_final && strm->avail_out > 0)
+    {
+      // Sync flush is complete if there was room left
+      break;
+    }
+    uint8_t* bigger = alloc_new uint8_t[2 * bound + 2];
+    memcpy(bigger,out_data,out_size);
+    delete [] out_data;
+    out_data = bigger;
+    bound   *= 2;
+  }
+  out_data[out_size    ] = 0;
+  out_data[out_size + 1] = 0;
+  return true;
+}
@@ -27,6 +27,7 @@
 //
 #pragma once
 #include <vector>
+#include <utility>
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -36,3 +37,33 @@
 
 bool gzip_compress_memory  (void *in_data,size_t in_data_size,std::vector<uint8_t>& buffer);
 bool gzip_decompress_memory(void *in_data,size_t in_data_size,std::vector<uint8_t>& buffer);
+
+// Compress into a new buffer of exactly the right bound (two spare bytes at the end)
+// No intermediate vector, and no copying afterwards. Call 'delete []' on the result
+bool gzip_compress_buffer  (void *in_data,size_t in_data_size,uint8_t*& out_data,size_t& out_size);
+// Compress a chain of buffer parts as one gzip stream, in the same way.
+// The parts are never copied together into one buffer first
+bool gzip_compress_parts   (const std::vector<std::pair<void*,size_t>>& in_parts,uint8_t*& out_data,size_t& out_size);
+// Streaming compression of a file into another file, in fixed size blocks.
+// Neither the file nor the result is ever in memory as a whole
+bool gzip_compress_file    (HANDLE in_file,size_t in_file_size,HANDLE out_file,size_t& out_size);
+
+// Streaming compression of a response that is sent in chunks.
+// One gzip stream for all chunks: each chunk is flushed on a byte boundary
+// (Z_SYNC_FLUSH), so the client can decompress everything it got so far.
+// The last chunk finishes the stream with the gzip trailer.
+class GzipStream
+{
+public:
+  GzipStream();
+ ~GzipStream();
+
+  // Compress the next chunk into a new buffer (two spare bytes at the end)
+  // Call 'delete []' on the result
+  bool Compress(void* in_data,size_t in_data_size,bool p_final,uint8_t*& out_data,size_t& out_size);
+  bool GetFinished() { return m_finished; }
+
+private:
+  void* m_stream   { nullptr };   // The z_stream
+  bool  m_finished { false   };   // Trailer was written
+};
@@ -0,0 +1,635 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "http_private.h"
+#include "ConnectionEngine.h"
+#include "Listener.h"
+#include "Request.h"
+#include "RequestQueue.h"
+#include "PlainSocket.h"
+#include "SSLUtilities.h"
+#include "Logging.h"
+#include <LogAnalysis.h>
+#include <process.h>
+#include <WS2tcpip.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// TIMER WHEEL
+//
+//////////////////////////////////////////////////////////////////////////
+
+TimerWheel::TimerWheel(ULONGLONG p_now)
+           :m_tick(p_now / ENGINE_WHEEL_TICK)
+{
+}
+
+// Place the timer in the slot of its tick.
+// A deadline in the past fires at the next tick.
+void
+TimerWheel::Add(ULONGLONG p_sequence,ULONGLONG p_deadline)
+{
+  ULONGLONG tick = p_deadline / ENGINE_WHEEL_TICK;
+  if(tick <= m_tick)
+  {
+    tick = m_tick + 1;
+  }
+  size_t slot = (size_t)(tick % ENGINE_WHEEL_SLOTS);
+  m_places[p_sequence] = { slot,m_slots[slot].size() };
+  m_slots[slot].push_back({ p_sequence,p_deadline });
+}
+
+// The connection left the loop before its deadline
+void
+TimerWheel::Cancel(ULONGLONG p_sequence)
+{
+  WheelPlaces::iterator it = m_places.find(p_sequence);
+  if(it != m_places.end())
+  {
+    WheelPlace place = it->second;
+    m_places.erase(it);
+    RemoveTimer(place.p_slot,place.p_index);
+  }
+}
+
+// Take a timer out of its slot. The last one is swapped into its place
+void
+TimerWheel::RemoveTimer(size_t p_slot,size_t p_index)
+{
+  WheelSlot& slot = m_slots[p_slot];
+  if(p_index + 1 < slot.size())
+  {
+    slot[p_index] = slot.back();
+    m_places[slot[p_index].t_sequence].p_index = p_index;
+  }
+  slot.pop_back();
+}
+
+void
+TimerWheel::Clear()
+{
+  for(auto& slot : m_slots)
+  {
+    slot.clear();
+  }
+  m_places.clear();
+}
+
+// Visit the slots of all ticks up to now. Timers that are due are handed
+// back to the caller. Timers that are due in a later round stay in place.
+void
+TimerWheel::Advance(ULONGLONG p_now,std::vector<ULONGLONG>& p_expired)
+{
+  // Only visit ticks that have fully passed. A tick that is still running
+  // may hold deadlines just after now, that would wait a full round.
+  ULONGLONG now = p_now / ENGINE_WHEEL_TICK;
+  if(now <= m_tick + 1)
+  {
+    return;
+  }
+  --now;
+  ULONGLONG ticks = now - m_tick;
+  // Slept for more than one round: every slot once is enough
+  if(ticks > ENGINE_WHEEL_SLOTS)
+  {
+    m_tick = now - ENGINE_WHEEL_SLOTS;
+  }
+  while(m_tick < now)
+  {
+    size_t     number = (size_t)(++m_tick % ENGINE_WHEEL_SLOTS);
+    WheelSlot& slot   = m_slots[number];
+    size_t index = 0;
+    while(index < slot.size())
+    {
+      if(slot[index].t_deadline <= p_now)
+      {
+        p_expired.push_back(slot[index].t_sequence);
+        m_places.erase(slot[index].t_sequence);
+        RemoveTimer(number,index);
+        continue;
+      }
+      ++index;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// EVENT LOOP
+//
+//////////////////////////////////////////////////////////////////////////
+
+EventLoop::EventLoop(ConnectionEngine* p_engine,int p_number)
+          :m_engine(p_engine)
+          ,m_number(p_number)
+          ,m_wheel(GetTickCount64())
+{
+  ZeroMemory(&m_wakeAddress,sizeof(sockaddr_in));
+  InitializeCriticalSection(&m_lock);
+}
+
+EventLoop::~EventLoop()
+{
+  Stop();
+  if(m_wakeSocket != INVALID_SOCKET)
+  {
+    closesocket(m_wakeSocket);
+    m_wakeSocket = INVALID_SOCKET;
+  }
+  DeleteCriticalSection(&m_lock);
+}
+
+// Start the thread of the event loop
+bool
+EventLoop::Start()
+{
+  if(!CreateWakeSocket())
+  {
+    return false;
+  }
+  // First poll descriptor is always our own wake-up socket
+  WSAPOLLFD wake;
+  wake.fd      = m_wakeSocket;
+  wake.events  = POLLRDNORM;
+  wake.revents = 0;
+  m_polls.push_back(wake);
+
+  m_stopping = false;
+  m_thread   = (HANDLE)_beginthreadex(nullptr,0,LoopWorker,this,0,nullptr);
+  return m_thread != NULL;
+}
+
+// Stop the loop and give back all connections
+void
+EventLoop::Stop()
+{
+  if(m_thread)
+  {
+    m_stopping = true;
+    WakeUp();
+    WaitForSingleObject(m_thread,INFINITE);
+    CloseHandle(m_thread);
+    m_thread = NULL;
+  }
+  RemoveAllConnections();
+}
+
+// Hand over a connection from another thread
+// False if the loop has stopped: the caller keeps the connection
+bool
+EventLoop::AddConnection(Request* p_request,ULONGLONG p_deadline,ConnectionStage p_stage)
+{
+  {
+    AutoCritSec lock(&m_lock);
+    if(m_closed)
+    {
+      return false;
+    }
+    m_pending.push_back({ p_request,p_deadline,0,p_stage });
+  }
+  InterlockedIncrement(&m_connections);
+  WakeUp();
+  return true;
+}
+
+unsigned __stdcall
+EventLoop::LoopWorker(void* p_param)
+{
+  EventLoop* loop = reinterpret_cast<EventLoop*>(p_param);
+
+  SetThreadName("HTTP event loop");
+
+  loop->RunLoop();
+  return 0;
+}
+
+// The loop itself. Waits on all parked connections at once
+// and hands readable (or broken) connections to the engine
+void
+EventLoop::RunLoop()
+{
+  DebugMsg(_T("Start of event loop: %d"),m_number);
+
+  while(!m_stopping)
+  {
+    MergePendingConnections();
+
+    int result = WSAPoll(m_polls.data(),(ULONG)m_polls.size(),ENGINE_WHEEL_TICK);
+    if(result == SOCKET_ERROR)
+    {
+      LogError(_T("Event loop [%d] cannot poll connections. Error: %d"),m_number,WSAGetLastError());
+      Sleep(THREAD_RETRY_WAITING);
+      continue;
+    }
+    if(m_stopping)
+    {
+      break;
+    }
+    if(m_polls[0].revents)
+    {
+      DrainWakeSocket();
+    }
+
+    // Walk the readable connections. Removal swaps the last one into place
+    size_t index = 1;
+    while(result > 0 && index < m_polls.size())
+    {
+      if(m_polls[index].revents & (POLLRDNORM | POLLHUP | POLLERR | POLLNVAL))
+      {
+        ParkedConnection parked = RemoveConnection(index - 1);
+        m_engine->DispatchConnection(parked.c_request);
+        continue;
+      }
+      ++index;
+    }
+
+    // Only the connections in the slots of the passed ticks are due
+    ExpireConnections(GetTickCount64());
+  }
+  DebugMsg(_T("End of event loop: %d"),m_number);
+}
+
+// Take a connection out of the poll set and cancel its timer.
+// The last one is swapped into its place
+ParkedConnection
+EventLoop::RemoveConnection(size_t p_index)
+{
+  ParkedConnection parked = m_parked[p_index];
+  m_index.erase(parked.c_sequence);
+  m_wheel.Cancel(parked.c_sequence);
+
+  if(p_index + 1 < m_parked.size())
+  {
+    m_polls [p_index + 1] = m_polls.back();
+    m_parked[p_index]     = m_parked.back();
+    m_index[m_parked[p_index].c_sequence] = p_index;
+  }
+  m_polls.pop_back();
+  m_parked.pop_back();
+  InterlockedDecrement(&m_connections);
+  return parked;
+}
+
+// Shed the connections whose timers are due
+void
+EventLoop::ExpireConnections(ULONGLONG p_now)
+{
+  std::vector<ULONGLONG> expired;
+  m_wheel.Advance(p_now,expired);
+
+  for(auto& sequence : expired)
+  {
+    ParkedIndex::iterator it = m_index.find(sequence);
+    if(it != m_index.end())
+    {
+      ParkedConnection parked = RemoveConnection(it->second);
+      m_engine->ExpireConnection(parked.c_request,parked.c_stage);
+    }
+  }
+}
+
+// Move the connections handed over by other threads into the poll set
+void
+EventLoop::MergePendingConnections()
+{
+  AutoCritSec lock(&m_lock);
+
+  for(auto& parked : m_pending)
+  {
+    PlainSocket* socket = reinterpret_cast<PlainSocket*>(parked.c_request->GetSocket());
+
+    WSAPOLLFD poll;
+    poll.fd      = socket->GetActualSocket();
+    poll.events  = POLLRDNORM;
+    poll.revents = 0;
+    m_polls.push_back(poll);
+
+    parked.c_sequence = ++m_sequence;
+    m_index[parked.c_sequence] = m_parked.size();
+    m_parked.push_back(parked);
+    m_wheel.Add(parked.c_sequence,parked.c_deadline);
+  }
+  m_pending.clear();
+}
+
+// Give all connections back to the request queue to be removed
+void
+EventLoop::RemoveAllConnections()
+{
+  {
+    AutoCritSec lock(&m_lock);
+    m_closed = true;
+  }
+  MergePendingConnections();
+
+  for(auto& parked : m_parked)
+  {
+    m_engine->ExpireConnection(parked.c_request,parked.c_stage);
+  }
+  m_parked.clear();
+  m_index.clear();
+  m_wheel.Clear();
+  m_polls.resize(m_polls.empty() ? 0 : 1);
+  m_connections = 0;
+}
+
+// A datagram socket on the loop-back adapter.
+// Sending a byte to ourselves interrupts the WSAPoll of the loop
+bool
+EventLoop::CreateWakeSocket()
+{
+  m_wakeSocket = WSASocketW(AF_INET,SOCK_DGRAM,IPPROTO_UDP,NULL,0,WSA_FLAG_NO_HANDLE_INHERIT);
+  if(m_wakeSocket == INVALID_SOCKET)
+  {
+    LogError(_T("Event loop cannot create a wake-up socket. Error: %d"),WSAGetLastError());
+    return false;
+  }
+  m_wakeAddress.sin_family      = AF_INET;
+  m_wakeAddress.sin_port        = 0;
+  m_wakeAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int length = sizeof(sockaddr_in);
+  u_long nonblocking = 1;
+  if(bind(m_wakeSocket,(PSOCKADDR)&m_wakeAddress,length)              ||
+     getsockname(m_wakeSocket,(PSOCKADDR)&m_wakeAddress,&length)       ||
+     ioctlsocket(m_wakeSocket,FIONBIO,&nonblocking))
+  {
+    LogError(_T("Event loop cannot bind the wake-up socket. Error: %d"),WSAGetLastError());
+    closesocket(m_wakeSocket);
+    m_wakeSocket = INVALID_SOCKET;
+    return false;
+  }
+  return true;
+}
+
+void
+EventLoop::WakeUp()
+{
+  if(m_wakeSocket != INVALID_SOCKET)
+  {
+    char signal = 0;
+    sendto(m_wakeSocket,&signal,1,0,(PSOCKADDR)&m_wakeAddress,sizeof(sockaddr_in));
+  }
+}
+
+void
+EventLoop::DrainWakeSocket()
+{
+  char buffer[64];
+  while(recv(m_wakeSocket,buffer,sizeof(buffer),0) > 0);
+  m_polls[0].revents = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// CONNECTION ENGINE
+//
+//////////////////////////////////////////////////////////////////////////
+
+ConnectionEngine::ConnectionEngine(Listener* p_listener,RequestQueue* p_queue)
+                 :m_listener(p_listener)
+                 ,m_queue(p_queue)
+{
+  InitializeCriticalSection(&m_sourceLock);
+  InitializeCriticalSection(&m_loopLock);
+}
+
+ConnectionEngine::~ConnectionEngine()
+{
+  Stop();
+  DeleteCriticalSection(&m_loopLock);
+  DeleteCriticalSection(&m_sourceLock);
+}
+
+// Create one event loop per processor core
+bool
+ConnectionEngine::Start()
+{
+  AutoCritSec lock(&m_loopLock);
+  if(m_running)
+  {
+    return true;
+  }
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int loops = (int)info.dwNumberOfProcessors;
+  if(loops < 1)
+  {
+    loops = 1;
+  }
+  if(loops > ENGINE_MAX_LOOPS)
+  {
+    loops = ENGINE_MAX_LOOPS;
+  }
+
+  for(int number = 0; number < loops; ++number)
+  {
+    EventLoop* loop = alloc_new EventLoop(this,number);
+    if(!loop->Start())
+    {
+      delete loop;
+      break;
+    }
+    m_loops.push_back(loop);
+  }
+  m_running = !m_loops.empty();
+  return m_running;
+}
+
+// Stop all loops. Parked connections will be closed.
+// Callers that are handing over a connection are waited for by the lock.
+// After that, nobody can reach the loops anymore.
+void
+ConnectionEngine::Stop()
+{
+  EventLoops loops;
+  {
+    AutoCritSec lock(&m_loopLock);
+    m_running = false;
+    loops.swap(m_loops);
+  }
+  for(auto& loop : loops)
+  {
+    loop->Stop();
+    delete loop;
+  }
+}
+
+// Park a connection in the least recently chosen event loop
+bool
+ConnectionEngine::ParkConnection(Request* p_request)
+{
+  if(!m_running)
+  {
+    return false;
+  }
+  p_request->SetStatus(RQ_PARKED);
+
+  // TLS may have already decrypted (part of) the next request
+  // or the client has pipelined its next request after the previous one
+  PlainSocket* socket = reinterpret_cast<PlainSocket*>(p_request->GetSocket());
+  if(p_request->HasPipelinedRequest() || (socket && socket->HasBufferedInput()))
+  {
+    DispatchConnection(p_request);
+    return true;
+  }
+
+  // Header lines are still due: keep the deadline of the first byte (or the accept)
+  // Otherwise wait for the next request on a keep-alive connection
+  ConnectionStage stage    = ConnectionStage::Header;
+  ULONGLONG       deadline = p_request->GetHeaderDeadline();
+  if(deadline == 0)
+  {
+    stage    = ConnectionStage::Idle;
+    deadline = CalculateIdleDeadline();
+  }
+
+  AutoCritSec lock(&m_loopLock);
+  if(!m_running || m_loops.empty())
+  {
+    return false;
+  }
+  ULONG number = (ULONG)InterlockedIncrement(&m_nextLoop) % (ULONG)m_loops.size();
+  return m_loops[number]->AddConnection(p_request,deadline,stage);
+}
+
+// See if the source address may have one more connection
+// Zero 'MaxConnectionsPerAddress' means: no limit
+bool
+ConnectionEngine::AddSource(Request* p_request)
+{
+  unsigned maximum = g_session ? g_session->GetMaxConnectionsPerAddress() : 0;
+  if(maximum == 0)
+  {
+    return true;
+  }
+  std::string key = SourceKey(p_request);
+
+  AutoCritSec lock(&m_sourceLock);
+  ULONG& count = m_sources[key];
+  if(count >= maximum)
+  {
+    ShedConnection(ShedStage::Address);
+    return false;
+  }
+  ++count;
+  p_request->SetSourceCounted(true);
+  return true;
+}
+
+void
+ConnectionEngine::RemoveSource(Request* p_request)
+{
+  std::string key = SourceKey(p_request);
+
+  AutoCritSec lock(&m_sourceLock);
+  SourceAddresses::iterator it = m_sources.find(key);
+  if(it != m_sources.end())
+  {
+    if(--it->second == 0)
+    {
+      m_sources.erase(it);
+    }
+  }
+  p_request->SetSourceCounted(false);
+}
+
+// The client has sent data: read the request on a worker from the system thread pool
+// The worker is counted before it is queued, so the listener waits for it
+// even if it has not started yet.
+void
+ConnectionEngine::DispatchConnection(Request* p_request)
+{
+  InterlockedIncrement(&m_dispatched);
+  p_request->SetStatus(RQ_CREATED);
+
+  m_listener->AddWorker();
+  if(!QueueUserWorkItem(DispatchWorker,p_request,WT_EXECUTELONGFUNCTION))
+  {
+    LogError(_T("Cannot dispatch a connection to the system thread pool. Error: %d"),GetLastError());
+    m_listener->RemoveWorker();
+    m_queue->RemoveRequest(p_request);
+  }
+}
+
+// The client did not send (all of) its request in time
+void
+ConnectionEngine::ExpireConnection(Request* p_request,ConnectionStage p_stage)
+{
+  ShedConnection(p_stage == ConnectionStage::Header ? ShedStage::Header : ShedStage::Idle);
+  m_queue->RemoveRequest(p_request);
+}
+
+void
+ConnectionEngine::ShedConnection(ShedStage p_stage)
+{
+  InterlockedIncrement64(&m_shed[(int)p_stage]);
+}
+
+ULONGLONG
+ConnectionEngine::GetShed(ShedStage p_stage)
+{
+  return (ULONGLONG)m_shed[(int)p_stage];
+}
+
+int
+ConnectionEngine::GetNumberOfLoops()
+{
+  AutoCritSec lock(&m_loopLock);
+  return (int)m_loops.size();
+}
+
+long
+ConnectionEngine::GetParkedConnections()
+{
+  AutoCritSec lock(&m_loopLock);
+  long total = 0;
+  for(auto& loop : m_loops)
+  {
+    total += loop->GetConnections();
+  }
+  return total;
+}
+
+DWORD WINAPI
+ConnectionEngine::DispatchWorker(void* p_param)
+{
+  return Listener::Worker(p_param);
+}
+
+// Keep-alive connections wait for the idle connection timeout of the session
+ULONGLONG
+ConnectionEngine::CalculateIdleDeadline()
+{
+  int timeout = g_session ? g_session->GetTimeoutIdleConnection() : 0;
+  if(timeout <= 0)
+  {
+    timeout = URL_TIMEOUT_IDLE_CONNECTION;
+  }
+  else if(timeout < HTTP_MINIMUM_TIMEOUT)
+  {
+    timeout = HTTP_MINIMUM_TIMEOUT;
+  }
+  return GetTickCount64() + (ULONGLONG)timeout * CLOCKS_PER_SEC;
+}
+
+// IPv4 or IPv6 address of the client, without the port
+std::string
+ConnectionEngine::SourceKey(Request* p_request)
+{
+  PSOCKADDR address = p_request->GetRemoteAddress();
+  if(address->sa_family == AF_INET6)
+  {
+    sockaddr_in6* ipv6 = (sockaddr_in6*)address;
+    return std::string((const char*)&ipv6->sin6_addr,sizeof(IN6_ADDR));
+  }
+  sockaddr_in* ipv4 = (sockaddr_in*)address;
+  return std::string((const char*)&ipv4->sin_addr,sizeof(IN_ADDR));
+}
@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <winsock2.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <atomic>
+
+// Never more event loops than this, regardless of the number of cores
+#define ENGINE_MAX_LOOPS        64
+// Milliseconds per slot of the timer wheel (and maximum poll sleep)
+#define ENGINE_WHEEL_TICK      250
+// Slots in the timer wheel. Later deadlines go round more than once
+#define ENGINE_WHEEL_SLOTS     512
+
+class Listener;
+class Request;
+class RequestQueue;
+
+// Why a connection is parked. Each stage has its own deadline
+enum class ConnectionStage
+{
+  Idle        // Keep-alive connection between two requests
+ ,Header      // New connection, or header lines not yet complete
+};
+
+// Stages at which connections are shed, for the statistics
+enum class ShedStage
+{
+  Overloaded  // Session has its maximum number of connections
+ ,Address     // Source address has its maximum number of connections
+ ,Header      // Header lines not complete within the header wait time
+ ,Idle        // Keep-alive connection idle for too long
+ ,BodyRate    // Request body arrived below the minimum rate
+ ,Maximum
+};
+
+// Connections that are parked in an event loop, waiting for the client
+typedef struct _parked_connection
+{
+  Request*        c_request;
+  ULONGLONG       c_deadline;
+  ULONGLONG       c_sequence;   // Identifies this parking in the timer wheel
+  ConnectionStage c_stage;
+}
+ParkedConnection;
+
+using ParkedConnections = std::vector<ParkedConnection>;
+using PollDescriptors   = std::vector<WSAPOLLFD>;
+using ParkedIndex       = std::unordered_map<ULONGLONG,size_t>;
+
+// One timer in a slot of the wheel
+typedef struct _wheel_timer
+{
+  ULONGLONG t_sequence;
+  ULONGLONG t_deadline;
+}
+WheelTimer;
+
+using WheelSlot = std::vector<WheelTimer>;
+
+// Where a timer lives in the wheel
+typedef struct _wheel_place
+{
+  size_t p_slot;
+  size_t p_index;
+}
+WheelPlace;
+
+using WheelPlaces = std::unordered_map<ULONGLONG,WheelPlace>;
+
+// Hashed timer wheel. Adding and cancelling a timer is O(1), and every tick
+// only looks at the timers in one slot. A connection that leaves the loop
+// cancels its timer, so the wheel only holds the parked connections.
+class TimerWheel
+{
+public:
+  explicit TimerWheel(ULONGLONG p_now);
+
+  void   Add(ULONGLONG p_sequence,ULONGLONG p_deadline);
+  void   Cancel(ULONGLONG p_sequence);
+  void   Advance(ULONGLONG p_now,std::vector<ULONGLONG>& p_expired);
+  void   Clear();
+  size_t GetTimers() const { return m_places.size(); }
+
+private:
+  void   RemoveTimer(size_t p_slot,size_t p_index);
+
+  WheelSlot   m_slots[ENGINE_WHEEL_SLOTS];
+  WheelPlaces m_places;         // Sequence -> slot and index of the timer
+  ULONGLONG   m_tick;           // Last tick that was processed
+};
+
+class ConnectionEngine;
+
+// One event loop of the engine.
+// Watches a set of idle connections for readability
+class EventLoop
+{
+public:
+  EventLoop(ConnectionEngine* p_engine,int p_number);
+ ~EventLoop();
+
+  bool  Start();
+  void  Stop();
+  bool  AddConnection(Request* p_request,ULONGLONG p_deadline,ConnectionStage p_stage);
+  long  GetConnections() { return m_connections; }
+
+private:
+  static unsigned __stdcall LoopWorker(void* p_param);
+  void  RunLoop();
+  bool  CreateWakeSocket();
+  void  WakeUp();
+  void  DrainWakeSocket();
+  void  MergePendingConnections();
+  void  RemoveAllConnections();
+  void  ExpireConnections(ULONGLONG p_now);
+  ParkedConnection RemoveConnection(size_t p_index);
+
+  ConnectionEngine* m_engine;
+  int               m_number;
+  HANDLE            m_thread      { NULL  };
+  bool              m_stopping    { false };
+  long              m_connections { 0     };
+  // Loop-back socket to interrupt the WSAPoll
+  SOCKET            m_wakeSocket  { INVALID_SOCKET };
+  sockaddr_in       m_wakeAddress;
+  // Only touched by the loop thread
+  PollDescriptors   m_polls;
+  ParkedConnections m_parked;
+  ParkedIndex       m_index;          // Sequence -> place in m_parked
+  TimerWheel        m_wheel;
+  ULONGLONG         m_sequence { 0 };
+  // Handed over by other threads
+  ParkedConnections m_pending;
+  bool              m_closed   { false };   // Stopped: no more connections are taken
+  CRITICAL_SECTION  m_lock;
+};
+
+using EventLoops = std::vector<EventLoop*>;
+
+// Open connections per source address
+using SourceAddresses = std::unordered_map<std::string,ULONG>;
+
+// The connection engine multiplexes all idle connections of one listener
+// over a small fixed set of event loops (one per core). Only a connection
+// with data waiting to be read gets a worker from the system thread pool.
+// A connection that does not send its header lines (or its next request)
+// in time is shed by the timer wheel of its loop, not by a blocked thread.
+class ConnectionEngine
+{
+public:
+  ConnectionEngine(Listener* p_listener,RequestQueue* p_queue);
+ ~ConnectionEngine();
+
+  bool  Start();
+  void  Stop();
+
+  // Park a new or keep-alive connection until the client sends data
+  bool  ParkConnection(Request* p_request);
+
+  // Connection budget per source address
+  bool  AddSource   (Request* p_request);
+  void  RemoveSource(Request* p_request);
+
+  // Called by the event loops
+  void  DispatchConnection(Request* p_request);
+  void  ExpireConnection  (Request* p_request,ConnectionStage p_stage);
+  // Count a connection that is shed
+  void  ShedConnection(ShedStage p_stage);
+
+  // GETTERS
+  int       GetNumberOfLoops();
+  long      GetParkedConnections();
+  ULONGLONG GetDispatched()         { return m_dispatched; }
+  ULONGLONG GetShed(ShedStage p_stage);
+
+private:
+  static DWORD WINAPI DispatchWorker(void* p_param);
+  ULONGLONG   CalculateIdleDeadline();
+  std::string SourceKey(Request* p_request);
+
+  Listener*       m_listener;
+  RequestQueue*   m_queue;
+  EventLoops      m_loops;
+  std::atomic<bool> m_running  { false };
+  // Stop() waits on this lock for the callers that are handing over a connection
+  CRITICAL_SECTION m_loopLock;
+  long            m_nextLoop   { 0 };
+  ULONGLONG       m_dispatched { 0 };
+  volatile LONG64 m_shed[(int)ShedStage::Maximum] { 0 };
+  // Connections per source address
+  SourceAddresses m_sources;
+  CRITICAL_SECTION m_sourceLock;
+};
@@ -0,0 +1,296 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "http_private.h"
+#include "FragmentCache.h"
+#include <AutoCritical.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// FRAGMENT
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Copy the data of the application into a new fragment
+Fragment*
+Fragment::Create(const XString& p_prefix,PVOID p_data,ULONG p_length,ULONGLONG p_expires)
+{
+  BYTE* data = (BYTE*) malloc((size_t)p_length + 1);
+  if(data == nullptr)
+  {
+    return nullptr;
+  }
+  memcpy(data,p_data,p_length);
+  data[p_length] = 0;
+
+  return alloc_new Fragment(p_prefix,data,p_length,p_expires);
+}
+
+Fragment::Fragment(const XString& p_prefix,BYTE* p_data,ULONG p_length,ULONGLONG p_expires)
+         :m_prefix(p_prefix)
+         ,m_data(p_data)
+         ,m_length(p_length)
+         ,m_expires(p_expires)
+{
+}
+
+Fragment::~Fragment()
+{
+  free(m_data);
+}
+
+void
+Fragment::Acquire()
+{
+  InterlockedIncrement(&m_references);
+}
+
+// The last one to release the fragment, cleans up
+void
+Fragment::Release()
+{
+  if(InterlockedDecrement(&m_references) == 0)
+  {
+    delete this;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// FRAGMENT CACHE
+//
+//////////////////////////////////////////////////////////////////////////
+
+FragmentCache::FragmentCache()
+{
+  for(auto& shard : m_shards)
+  {
+    InitializeCriticalSection(&shard.f_lock);
+  }
+}
+
+FragmentCache::~FragmentCache()
+{
+  Clear();
+  for(auto& shard : m_shards)
+  {
+    DeleteCriticalSection(&shard.f_lock);
+  }
+}
+
+ULONG
+FragmentCache::AddFragment(const XString& p_prefix,PVOID p_data,ULONG p_length,ULONG p_secondsToLive)
+{
+  if(p_length > m_budget)
+  {
+    return ERROR_NOT_ENOUGH_QUOTA;
+  }
+  ULONGLONG expires = 0L;
+  if(p_secondsToLive)
+  {
+    expires = GetTickCount64() + (ULONGLONG)p_secondsToLive * CLOCKS_PER_SEC;
+  }
+  Fragment* fragment = Fragment::Create(p_prefix,p_data,p_length,expires);
+  if(fragment == nullptr)
+  {
+    return ERROR_OUTOFMEMORY;
+  }
+
+  // Evict before taking our own shard, so we never hold two shard locks
+  MakeRoom(p_length);
+
+  FragmentShard* shard = GetShard(p_prefix);
+  AutoCritSec lock(&shard->f_lock);
+
+  FragmentMap::iterator it = shard->f_fragments.find(p_prefix);
+  if(it != shard->f_fragments.end())
+  {
+    if(!it->second->IsExpired(GetTickCount64()))
+    {
+      // Duplicate fragment
+      fragment->Release();
+      return ERROR_DUPLICATE_TAG;
+    }
+    RemoveFragment(shard,it);
+    InterlockedIncrement64(&m_expired);
+  }
+  fragment->m_slot = shard->f_clock.size();
+  shard->f_clock.push_back(fragment);
+  shard->f_fragments.insert(std::make_pair(p_prefix,fragment));
+
+  InterlockedExchangeAdd64(&m_bytes,p_length);
+  InterlockedIncrement(&m_count);
+  return NO_ERROR;
+}
+
+Fragment*
+FragmentCache::FindFragment(const XString& p_prefix)
+{
+  FragmentShard* shard = GetShard(p_prefix);
+  AutoCritSec lock(&shard->f_lock);
+
+  FragmentMap::iterator it = shard->f_fragments.find(p_prefix);
+  if(it == shard->f_fragments.end())
+  {
+    InterlockedIncrement64(&m_misses);
+    return nullptr;
+  }
+  Fragment* fragment = it->second;
+  if(fragment->IsExpired(GetTickCount64()))
+  {
+    RemoveFragment(shard,it);
+    InterlockedIncrement64(&m_expired);
+    InterlockedIncrement64(&m_misses);
+    return nullptr;
+  }
+  fragment->m_referenced = 1;
+  fragment->Acquire();
+  InterlockedIncrement64(&m_hits);
+  return fragment;
+}
+
+// Flush exactly this prefix, or all fragments below it as well
+ULONG
+FragmentCache::FlushFragment(const XString& p_prefix,bool p_recursive)
+{
+  if(!p_recursive)
+  {
+    FragmentShard* shard = GetShard(p_prefix);
+    AutoCritSec lock(&shard->f_lock);
+
+    FragmentMap::iterator it = shard->f_fragments.find(p_prefix);
+    if(it != shard->f_fragments.end())
+    {
+      RemoveFragment(shard,it);
+    }
+    return NO_ERROR;
+  }
+
+  int length = p_prefix.GetLength();
+  for(auto& shard : m_shards)
+  {
+    AutoCritSec lock(&shard.f_lock);
+
+    FragmentMap::iterator it = shard.f_fragments.begin();
+    while(it != shard.f_fragments.end())
+    {
+      if(it->first.GetLength() >= length && it->first.compare(0,length,p_prefix) == 0)
+      {
+        it = RemoveFragment(&shard,it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+  return NO_ERROR;
+}
+
+void
+FragmentCache::Clear()
+{
+  for(auto& shard : m_shards)
+  {
+    AutoCritSec lock(&shard.f_lock);
+
+    FragmentMap::iterator it = shard.f_fragments.begin();
+    while(it != shard.f_fragments.end())
+    {
+      it = RemoveFragment(&shard,it);
+    }
+    shard.f_hand = 0;
+  }
+}
+
+// Changing the budget evicts right away if the cache got smaller
+bool
+FragmentCache::SetBudget(ULONGLONG p_bytes)
+{
+  if(p_bytes < FRAGMENT_CACHE_MINIMUM)
+  {
+    return false;
+  }
+  m_budget = p_bytes;
+  MakeRoom(0);
+  return true;
+}
+
+FragmentShard*
+FragmentCache::GetShard(const XString& p_prefix)
+{
+  return &m_shards[FragmentHash()(p_prefix) % FRAGMENT_CACHE_SHARDS];
+}
+
+// Evict fragments, one shard at a time, until the new one fits the budget
+void
+FragmentCache::MakeRoom(ULONG p_length)
+{
+  int empty = 0;
+  while((ULONGLONG)m_bytes + p_length > m_budget && m_count > 0 && empty < FRAGMENT_CACHE_SHARDS)
+  {
+    FragmentShard* shard = &m_shards[(ULONG)InterlockedIncrement(&m_nextShard) % FRAGMENT_CACHE_SHARDS];
+    AutoCritSec lock(&shard->f_lock);
+
+    if(EvictOne(shard))
+    {
+      empty = 0;
+    }
+    else
+    {
+      ++empty;
+    }
+  }
+}
+
+// CLOCK: a fragment that was used since the last sweep gets a second chance
+bool
+FragmentCache::EvictOne(FragmentShard* p_shard)
+{
+  size_t size = p_shard->f_clock.size();
+  ULONGLONG now = GetTickCount64();
+
+  for(size_t step = 0;step < 2 * size;++step)
+  {
+    if(p_shard->f_hand >= p_shard->f_clock.size())
+    {
+      p_shard->f_hand = 0;
+    }
+    Fragment* fragment = p_shard->f_clock[p_shard->f_hand];
+    bool expired = fragment->IsExpired(now);
+    if(InterlockedExchange(&fragment->m_referenced,0) == 0 || expired)
+    {
+      RemoveFragment(p_shard,p_shard->f_fragments.find(fragment->GetPrefix()));
+      InterlockedIncrement64(expired ? &m_expired : &m_evictions);
+      return true;
+    }
+    ++p_shard->f_hand;
+  }
+  return false;
+}
+
+// Take the fragment out of the shard. The last place of
+// the CLOCK moves into the empty place.
+FragmentMap::iterator
+FragmentCache::RemoveFragment(FragmentShard* p_shard,FragmentMap::iterator p_iterator)
+{
+  Fragment* fragment = p_iterator->second;
+
+  Fragment* last = p_shard->f_clock.back();
+  p_shard->f_clock[fragment->m_slot] = last;
+  last->m_slot = fragment->m_slot;
+  p_shard->f_clock.pop_back();
+
+  InterlockedExchangeAdd64(&m_bytes,-(LONG64)fragment->GetLength());
+  InterlockedDecrement(&m_count);
+  fragment->Release();
+
+  return p_shard->f_fragments.erase(p_iterator);
+}
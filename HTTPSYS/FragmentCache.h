@@ -0,0 +1,112 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <unordered_map>
+#include <vector>
+
+// Number of independently locked parts of the cache
+#define FRAGMENT_CACHE_SHARDS        16
+// Default and minimum byte budget of the cache
+#define FRAGMENT_CACHE_DEFAULT      (64 * 1024 * 1024)
+#define FRAGMENT_CACHE_MINIMUM      (64 * 1024)
+
+// One fragment in the cache. The data never changes after creation.
+// Senders hold a reference, so a flush or an eviction never
+// pulls the buffer from under a response that is being sent.
+class Fragment
+{
+public:
+  static Fragment* Create(const XString& p_prefix,PVOID p_data,ULONG p_length,ULONGLONG p_expires);
+
+  void        Acquire();
+  void        Release();
+
+  XString     GetPrefix()   { return m_prefix; }
+  PVOID       GetData()     { return m_data;   }
+  ULONG       GetLength()   { return m_length; }
+  bool        IsExpired(ULONGLONG p_now) { return m_expires && p_now >= m_expires; }
+
+  // Used by the cache only
+  volatile LONG m_referenced { 1 };   // CLOCK bit: used since the last sweep
+  size_t        m_slot       { 0 };   // Place in the CLOCK of the shard
+
+private:
+  Fragment(const XString& p_prefix,BYTE* p_data,ULONG p_length,ULONGLONG p_expires);
+ ~Fragment();
+
+  XString       m_prefix;
+  BYTE*         m_data;
+  ULONG         m_length;
+  ULONGLONG     m_expires;            // Tick count, or zero for 'user invalidates'
+  volatile LONG m_references { 1 };
+};
+
+struct FragmentHash
+{
+  size_t operator()(const XString& p_prefix) const
+  {
+    return std::hash<stdstring>()(p_prefix);
+  }
+};
+
+using FragmentMap   = std::unordered_map<XString,Fragment*,FragmentHash>;
+using FragmentClock = std::vector<Fragment*>;
+
+typedef struct _fragment_shard
+{
+  FragmentMap       f_fragments;
+  FragmentClock     f_clock;        // All fragments, in the order of the CLOCK
+  size_t            f_hand { 0 };   // Next fragment to consider for eviction
+  CRITICAL_SECTION  f_lock;
+}
+FragmentShard;
+
+// Response fragment cache of a request queue.
+// Hashed over shards, bounded in bytes, with CLOCK eviction
+class FragmentCache
+{
+public:
+  FragmentCache();
+ ~FragmentCache();
+
+  // Prefix must already be in lower case
+  ULONG     AddFragment  (const XString& p_prefix,PVOID p_data,ULONG p_length,ULONG p_secondsToLive);
+  // Returned fragment is acquired. Caller must release it.
+  Fragment* FindFragment (const XString& p_prefix);
+  ULONG     FlushFragment(const XString& p_prefix,bool p_recursive);
+  void      Clear();
+
+  // Size of the cache
+  bool      SetBudget(ULONGLONG p_bytes);
+  ULONGLONG GetBudget()     { return m_budget;    }
+  ULONGLONG GetBytes()      { return (ULONGLONG)m_bytes; }
+  ULONG     GetFragments()  { return (ULONG)m_count;     }
+  // Counters
+  ULONGLONG GetHits()       { return (ULONGLONG)m_hits;      }
+  ULONGLONG GetMisses()     { return (ULONGLONG)m_misses;    }
+  ULONGLONG GetEvictions()  { return (ULONGLONG)m_evictions; }
+  ULONGLONG GetExpired()    { return (ULONGLONG)m_expired;   }
+
+private:
+  FragmentShard* GetShard(const XString& p_prefix);
+  void      MakeRoom(ULONG p_length);
+  bool      EvictOne(FragmentShard* p_shard);
+  FragmentMap::iterator RemoveFragment(FragmentShard* p_shard,FragmentMap::iterator p_iterator);
+
+  FragmentShard   m_shards[FRAGMENT_CACHE_SHARDS];
+  ULONGLONG       m_budget    { FRAGMENT_CACHE_DEFAULT };
+  volatile LONG64 m_bytes     { 0 };
+  volatile LONG   m_count     { 0 };
+  volatile LONG   m_nextShard { 0 };    // Next shard to evict from
+  volatile LONG64 m_hits      { 0 };
+  volatile LONG64 m_misses    { 0 };
+  volatile LONG64 m_evictions { 0 };
+  volatile LONG64 m_expired   { 0 };
+};
@@ -0,0 +1,247 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "http_private.h"
+#include "HeaderParser.h"
+#include <wininet.h>
+
+// Known headers for a HTTP call from client to server
+//
+LPCTSTR all_headers[] =
+{
+  _T("Cache-Control")         //  HttpHeaderCacheControl          = 0,    // general-header [section 4.5]
+ ,_T("Connection")            //  HttpHeaderConnection            = 1,    // general-header [section 4.5]
+ ,_T("Date")                  //  HttpHeaderDate                  = 2,    // general-header [section 4.5]
+ ,_T("Keep-Alive")            //  HttpHeaderKeepAlive             = 3,    // general-header [not in rfc]
+ ,_T("Pragma")                //  HttpHeaderPragma                = 4,    // general-header [section 4.5]
+ ,_T("Trailer")               //  HttpHeaderTrailer               = 5,    // general-header [section 4.5]
+ ,_T("Transfer-Encoding")     //  HttpHeaderTransferEncoding      = 6,    // general-header [section 4.5]
+ ,_T("Upgrade")               //  HttpHeaderUpgrade               = 7,    // general-header [section 4.5]
+ ,_T("Via")                   //  HttpHeaderVia                   = 8,    // general-header [section 4.5]
+ ,_T("Warning")               //  HttpHeaderWarning               = 9,    // general-header [section 4.5]
+ ,_T("Allow")                 //  HttpHeaderAllow                 = 10,   // entity-header  [section 7.1]
+ ,_T("Content-Length")        //  HttpHeaderContentLength         = 11,   // entity-header  [section 7.1]
+ ,_T("Content-Type")          //  HttpHeaderContentType           = 12,   // entity-header  [section 7.1]
+ ,_T("Content-Encoding")      //  HttpHeaderContentEncoding       = 13,   // entity-header  [section 7.1]
+ ,_T("Content-Language")      //  HttpHeaderContentLanguage       = 14,   // entity-header  [section 7.1]
+ ,_T("Content-Location")      //  HttpHeaderContentLocation       = 15,   // entity-header  [section 7.1]
+ ,_T("Content-Md5")           //  HttpHeaderContentMd5            = 16,   // entity-header  [section 7.1]
+ ,_T("Content-Range")         //  HttpHeaderContentRange          = 17,   // entity-header  [section 7.1]
+ ,_T("Expires")               //  HttpHeaderExpires               = 18,   // entity-header  [section 7.1]
+ ,_T("Last-Modified")         //  HttpHeaderLastModified          = 19,   // entity-header  [section 7.1]
+ ,_T("Accept")                //  HttpHeaderAccept                = 20,   // request-header [section 5.3]
+ ,_T("Accept-Charset")        //  HttpHeaderAcceptCharset         = 21,   // request-header [section 5.3]
+ ,_T("Accept-Encoding")       //  HttpHeaderAcceptEncoding        = 22,   // request-header [section 5.3]
+ ,_T("Accept-Language")       //  HttpHeaderAcceptLanguage        = 23,   // request-header [section 5.3]
+ ,_T("Authorization")         //  HttpHeaderAuthorization         = 24,   // request-header [section 5.3]
+ ,_T("Cookie")                //  HttpHeaderCookie                = 25,   // request-header [not in rfc]
+ ,_T("Expect")                //  HttpHeaderExpect                = 26,   // request-header [section 5.3]
+ ,_T("From")                  //  HttpHeaderFrom                  = 27,   // request-header [section 5.3]
+ ,_T("Host")                  //  HttpHeaderHost                  = 28,   // request-header [section 5.3]
+ ,_T("If-Match")              //  HttpHeaderIfMatch               = 29,   // request-header [section 5.3]
+ ,_T("If-Modified-Since")     //  HttpHeaderIfModifiedSince       = 30,   // request-header [section 5.3]
+ ,_T("If-None-Match")         //  HttpHeaderIfNoneMatch           = 31,   // request-header [section 5.3]
+ ,_T("If-Range")              //  HttpHeaderIfRange               = 32,   // request-header [section 5.3]
+ ,_T("If-Unmodified-Since")   //  HttpHeaderIfUnmodifiedSince     = 33,   // request-header [section 5.3]
+ ,_T("Max-Forwards")          //  HttpHeaderMaxForwards           = 34,   // request-header [section 5.3]
+ ,_T("Proxy-Authorization")   //  HttpHeaderProxyAuthorization    = 35,   // request-header [section 5.3]
+ ,_T("Referer")               //  HttpHeaderReferer               = 36,   // request-header [section 5.3]
+ ,_T("Header-Range")          //  HttpHeaderRange                 = 37,   // request-header [section 5.3]
+ ,_T("Te")                    //  HttpHeaderTe                    = 38,   // request-header [section 5.3]
+ ,_T("Translate")             //  HttpHeaderTranslate             = 39,   // request-header [webDAV, not in RFC 2518]
+ ,_T("UserAgent")             //  HttpHeaderUserAgent             = 40,   // request-header [section 5.3]
+};
+
+// Hashed lookup table of the known request headers.
+// Built once from 'all_headers' and never changed afterwards
+#define KNOWN_HEADER_SLOTS  128   // Power of two, more than 3 times the number of headers
+#define KNOWN_HEADER_NAME    32   // Longest known header name + terminator
+
+class KnownHeaderTable
+{
+public:
+  KnownHeaderTable()
+  {
+    ZeroMemory(m_slots,sizeof(m_slots));
+    for(int ind = 0; ind < HttpHeaderRequestMaximum; ++ind)
+    {
+      KnownSlot slot;
+      slot.k_index  = (short)ind;
+      slot.k_length = 0;
+      for(LPCTSTR name = all_headers[ind]; *name && slot.k_length < KNOWN_HEADER_NAME - 1; ++name)
+      {
+        slot.k_name[slot.k_length++] = (char)*name;
+      }
+      slot.k_name[slot.k_length] = 0;
+
+      unsigned pos = Hash(slot.k_name,slot.k_length) & (KNOWN_HEADER_SLOTS - 1);
+      while(m_slots[pos].k_length)
+      {
+        pos = (pos + 1) & (KNOWN_HEADER_SLOTS - 1);
+      }
+      m_slots[pos] = slot;
+    }
+  }
+
+  int Find(LPCSTR p_name,USHORT p_length) const
+  {
+    unsigned pos = Hash(p_name,p_length) & (KNOWN_HEADER_SLOTS - 1);
+    while(m_slots[pos].k_length)
+    {
+      if(m_slots[pos].k_length == p_length && _strnicmp(m_slots[pos].k_name,p_name,p_length) == 0)
+      {
+        return m_slots[pos].k_index;
+      }
+      pos = (pos + 1) & (KNOWN_HEADER_SLOTS - 1);
+    }
+    return -1;
+  }
+
+private:
+  // Case-insensitive FNV-1a hash. Header names are ASCII tokens
+  static unsigned Hash(LPCSTR p_name,USHORT p_length)
+  {
+    unsigned hash = 2166136261U;
+    for(USHORT ind = 0; ind < p_length; ++ind)
+    {
+      hash ^= (unsigned)(p_name[ind] | 0x20);
+      hash *= 16777619U;
+    }
+    return hash;
+  }
+
+  typedef struct _known_slot
+  {
+    char   k_name[KNOWN_HEADER_NAME];
+    USHORT k_length;
+    short  k_index;
+  }
+  KnownSlot;
+
+  KnownSlot m_slots[KNOWN_HEADER_SLOTS];
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+// HEADER PARSER
+//
+//////////////////////////////////////////////////////////////////////////
+
+// The line ends at the first <LF>, that must follow a <CR>.
+// A <CR> anywhere else in the line is refused as well: two parties that
+// split lines differently would see different headers (request smuggling)
+LPSTR
+HeaderParser::ReadLine(LPSTR p_buffer,ULONG p_left,ULONG& p_length)
+{
+  LPSTR end = (LPSTR)memchr(p_buffer,'\n',p_left);
+  if(end == nullptr || end == p_buffer || end[-1] != '\r')
+  {
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+  ULONG length = (ULONG)(end - p_buffer) - 1;
+  if(memchr(p_buffer,'\r',length))
+  {
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+  p_buffer[length] = 0;
+  p_length = length;
+  return p_buffer;
+}
+
+// Name and value are trimmed and terminated in place.
+// Refused are:
+// - A line starting with whitespace: obsolete line folding (RFC 9112 5.2)
+// - Whitespace between the name and the colon (RFC 9112 5.1)
+// - Names and values that do not fit in the USHORT lengths of HTTP_REQUEST
+void
+HeaderParser::SplitLine(LPSTR p_line,ULONG p_length,HeaderLine& p_header)
+{
+  if(p_length == 0 || *p_line == ' ' || *p_line == '\t')
+  {
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+  // Find separating colon
+  LPSTR colon = (LPSTR)memchr(p_line,':',p_length);
+  if(colon == nullptr || colon == p_line || isspace((unsigned char)colon[-1]))
+  {
+    // No valid HTTP header line
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+
+  // Header value without surrounding whitespace
+  LPSTR value = colon + 1;
+  LPSTR vend  = p_line + p_length;
+  while(value < vend && isspace((unsigned char)*value))  ++value;
+  while(vend > value && isspace((unsigned char)vend[-1])) --vend;
+
+  // Check before the lengths are cast
+  size_t nlen = (size_t)(colon - p_line);
+  size_t vlen = (size_t)(vend  - value);
+  if(nlen > HEADER_MAXIMUM_LENGTH || vlen > HEADER_MAXIMUM_LENGTH)
+  {
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+
+  // Make delimiters. Line end is the former <CR> position
+  *colon = 0;
+  *vend  = 0;
+  p_header.h_name        = p_line;
+  p_header.h_nameLength  = (USHORT)nlen;
+  p_header.h_value       = value;
+  p_header.h_valueLength = (USHORT)vlen;
+  p_header.h_known       = FindKnownHeader(p_line,(USHORT)nlen);
+}
+
+int
+HeaderParser::FindKnownHeader(LPCSTR p_name,USHORT p_length)
+{
+  static const KnownHeaderTable table;
+  return table.Find(p_name,p_length);
+}
+
+// The table doubles in the arena, but never beyond the USHORT count
+void
+HeaderParser::AddUnknownHeader(HTTP_REQUEST_HEADERS& p_headers
+                              ,PHTTP_UNKNOWN_HEADER  p_inline
+                              ,USHORT&               p_capacity
+                              ,RequestArena&         p_arena
+                              ,const HeaderLine&     p_header)
+{
+  USHORT count = p_headers.UnknownHeaderCount;
+
+  if(p_headers.pUnknownHeaders == nullptr)
+  {
+    p_headers.pUnknownHeaders = p_inline;
+  }
+  else if(count >= p_capacity)
+  {
+    if(p_capacity == HEADER_MAXIMUM_LENGTH)
+    {
+      throw ERROR_HTTP_INVALID_HEADER;
+    }
+    ULONG capacity = (ULONG)p_capacity * 2;
+    if(capacity > HEADER_MAXIMUM_LENGTH)
+    {
+      capacity = HEADER_MAXIMUM_LENGTH;
+    }
+    PHTTP_UNKNOWN_HEADER headers = (PHTTP_UNKNOWN_HEADER) p_arena.Allocate(capacity * sizeof(HTTP_UNKNOWN_HEADER));
+    memcpy(headers,p_headers.pUnknownHeaders,count * sizeof(HTTP_UNKNOWN_HEADER));
+    p_headers.pUnknownHeaders = headers;
+    p_capacity = (USHORT)capacity;
+  }
+
+  PHTTP_UNKNOWN_HEADER unknown = &p_headers.pUnknownHeaders[count];
+  unknown->pName          = p_header.h_name;
+  unknown->NameLength     = p_header.h_nameLength;
+  unknown->pRawValue      = p_header.h_value;
+  unknown->RawValueLength = p_header.h_valueLength;
+
+  p_headers.UnknownHeaderCount++;
+}
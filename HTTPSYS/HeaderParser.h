@@ -0,0 +1,49 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "RequestArena.h"
+
+// Longest header name or value: the lengths in HTTP_REQUEST are USHORT's
+#define HEADER_MAXIMUM_LENGTH   USHRT_MAX
+
+// One header line of a request, split in place in the message buffer
+typedef struct _header_line
+{
+  LPSTR   h_name;
+  USHORT  h_nameLength;
+  LPSTR   h_value;
+  USHORT  h_valueLength;
+  int     h_known;          // HTTP_HEADER_ID of a known header, or -1
+}
+HeaderLine;
+
+// Parsing of the header lines of a request. Nothing is copied:
+// names and values are terminated in place in the message buffer.
+// A malformed line throws ERROR_HTTP_INVALID_HEADER (a 400 for the client)
+class HeaderParser
+{
+public:
+  // Next line ending in <CR><LF>. Bare <CR> or <LF> are refused
+  static LPSTR  ReadLine(LPSTR p_buffer,ULONG p_left,ULONG& p_length);
+  // Split a header line in name and value
+  static void   SplitLine(LPSTR p_line,ULONG p_length,HeaderLine& p_header);
+  // Index of a known request header, or -1
+  static int    FindKnownHeader(LPCSTR p_name,USHORT p_length);
+  // Store an unknown header. The first ones go in the table of the
+  // request itself, a request with more of them grows into the arena
+  static void   AddUnknownHeader(HTTP_REQUEST_HEADERS& p_headers
+                                ,PHTTP_UNKNOWN_HEADER  p_inline
+                                ,USHORT&               p_capacity
+                                ,RequestArena&         p_arena
+                                ,const HeaderLine&     p_header);
+};
+
+// Known headers for a HTTP call from client to server
+extern LPCTSTR all_headers[];
@@ -32,11 +32,18 @@ HttpAddFragmentToCache(IN HANDLE              RequestQueueHandle
     return ERROR_INVALID_PARAMETER;
   }
 
-  // Only user invalidated fragments are accepted in the fragment cache
-  // Time-to-live parameter not yet implemented
-  if(CachePolicy && CachePolicy->Policy != HttpCachePolicyUserInvalidates)
+  // User invalidated or time-to-live fragments are accepted in the fragment cache
+  ULONG secondsToLive = 0;
+  if(CachePolicy)
   {
-    return ERROR_INVALID_PARAMETER;
+    if(CachePolicy->Policy == HttpCachePolicyTimeToLive && CachePolicy->SecondsToLive)
+    {
+      secondsToLive = CachePolicy->SecondsToLive;
+    }
+    else if(CachePolicy->Policy != HttpCachePolicyUserInvalidates)
+    {
+      return ERROR_INVALID_PARAMETER;
+    }
   }
 
   // Only memory fragments are accepted into the fragment cache
@@ -56,5 +63,5 @@ HttpAddFragmentToCache(IN HANDLE              RequestQueueHandle
   XString prefix(W2A(UrlPrefix));
 
   // Add fragment to the fragment cache of the request queue
-  return queue->AddFragment(prefix,DataChunk);
+  return queue->AddFragment(prefix,DataChunk,secondsToLive);
 }
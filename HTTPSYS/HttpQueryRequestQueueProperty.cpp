@@ -67,5 +67,49 @@ HttpQueryRequestQueueProperty(_In_ HANDLE                 RequestQueueHandle
       return NO_ERROR;
     }
   }
+  else if(Property == HttpServerQueueStatisticsProperty)
+  {
+    if(PropertyInformationLength >= sizeof(HTTP_QUEUE_STATISTICS))
+    {
+      PHTTP_QUEUE_STATISTICS statistics = (PHTTP_QUEUE_STATISTICS)PropertyInformation;
+      statistics->NumberOfShards   = queue->GetNumberOfShards();
+      statistics->IncomingRequests = queue->GetIncomingCount();
+      statistics->Contention       = queue->GetContention();
+      statistics->Stolen           = queue->GetStolen();
+      return NO_ERROR;
+    }
+  }
+  else if(Property == HttpServerFragmentCacheSizeProperty)
+  {
+    if(PropertyInformationLength == sizeof(ULONGLONG))
+    {
+      *((PULONGLONG)PropertyInformation) = queue->GetFragmentCache()->GetBudget();
+      return NO_ERROR;
+    }
+  }
+  else if(Property == HttpServerFragmentCacheStatisticsProperty)
+  {
+    if(PropertyInformationLength >= sizeof(HTTP_FRAGMENT_CACHE_STATISTICS))
+    {
+      FragmentCache* cache = queue->GetFragmentCache();
+      PHTTP_FRAGMENT_CACHE_STATISTICS statistics = (PHTTP_FRAGMENT_CACHE_STATISTICS)PropertyInformation;
+      statistics->Budget    = cache->GetBudget();
+      statistics->Bytes     = cache->GetBytes();
+      statistics->Fragments = cache->GetFragments();
+      statistics->Hits      = cache->GetHits();
+      statistics->Misses    = cache->GetMisses();
+      statistics->Evictions = cache->GetEvictions();
+      statistics->Expired   = cache->GetExpired();
+      return NO_ERROR;
+    }
+  }
+  else if(Property == HttpServerConnectionStatisticsProperty)
+  {
+    if(PropertyInformationLength >= sizeof(HTTP_CONNECTION_STATISTICS))
+    {
+      queue->GetConnectionStatistics((PHTTP_CONNECTION_STATISTICS)PropertyInformation);
+      return NO_ERROR;
+    }
+  }
   return ERROR_INVALID_PARAMETER;
 }
@@ -43,18 +43,23 @@ HttpReadFragmentFromCache(IN HANDLE           RequestQueueHandle
   USES_CONVERSION;
   XString prefix(W2A(UrlPrefix));
 
-  PHTTP_DATA_CHUNK chunk = queue->FindFragment(prefix);
-  if(chunk)
+  Fragment* fragment = queue->FindFragment(prefix);
+  if(fragment)
   {
-    ULONG size = chunk->FromMemory.BufferLength;
+    ULONG result = NO_ERROR;
+    ULONG size   = fragment->GetLength();
     *BytesRead = size;
     if(BufferLength < size)
     {
       // Reporting the number of bytes needed in 'BytesRead'
-      return ERROR_MORE_DATA;
+      result = ERROR_MORE_DATA;
     }
-    memcpy(Buffer,chunk->FromMemory.pBuffer,size);
-    return NO_ERROR;
+    else
+    {
+      memcpy(Buffer,fragment->GetData(),size);
+    }
+    fragment->Release();
+    return result;
   }
   return ERROR_NOT_FOUND;
 }
@@ -136,7 +136,7 @@ HttpSendResponseEntityBody(IN HANDLE          RequestQueueHandle
   }
   else
   {
-    ULONG bytes;
+    ULONG bytes = 0;
     result = request->SendEntityChunks(EntityChunks,EntityChunkCount,&bytes);
 
     // Sometimes propagate the number of bytes sent
@@ -96,6 +96,13 @@ HttpSetRequestQueueProperty(_In_ HANDLE               RequestQueueHandle
       return ERROR_INVALID_PARAMETER;
     }
   }
+  else if (Property == HttpServerFragmentCacheSizeProperty)
+  {
+    if(!queue->GetFragmentCache()->SetBudget((ULONGLONG)value))
+    {
+      return ERROR_INVALID_PARAMETER;
+    }
+  }
   else
   {
     // Wrong property
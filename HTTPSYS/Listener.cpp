@@ -11,6 +11,7 @@
 #include "http_private.h"
 #include "URL.h"
 #include "Listener.h"
+#include "ConnectionEngine.h"
 #include "Request.h"
 #include "RequestQueue.h"
 #include "UrlGroup.h"
@@ -22,8 +23,9 @@
 #include <strsafe.h>
 #include <WS2tcpip.h>
 
-// Listener object, listens for connections on one thread, and initiates a worker
-// thread each time a client connects. Listens on both IPv4 and IPv6 addresses
+// Listener object, listens for connections on one thread, and parks each connection
+// in the connection engine. Only when a client sends a request, a worker picks it up.
+// Listens on both IPv4 and IPv6 addresses
 Listener::Listener(RequestQueue* p_queue,USHORT p_port,URL* p_url,USHORT p_timeout)
          :m_queue(p_queue)
          ,m_port(p_port)
@@ -42,6 +44,7 @@ Listener::Listener(RequestQueue* p_queue,USHORT p_port,URL* p_url,USHORT p_timeo
   m_thumbprint[0] = 0;
   m_selectServerCert     = SelectServerCert;
   m_clientCertAcceptable = ClientCertAcceptable;
+  m_engine = alloc_new ConnectionEngine(this,p_queue);
 
   // Copy the secure channel settings from the URL provided
   m_secure = p_url->m_secure;
@@ -56,6 +59,11 @@ Listener::Listener(RequestQueue* p_queue,USHORT p_port,URL* p_url,USHORT p_timeo
 Listener::~Listener(void)
 {
   StopListener();
+  if(m_engine)
+  {
+    delete m_engine;
+    m_engine = nullptr;
+  }
   for(int i = 0;i < FD_SETSIZE;++i)
   {
     if(m_listenSockets[i] != INVALID_SOCKET)
@@ -71,8 +79,9 @@ Listener::~Listener(void)
   }
 }
 
-// This is the individual worker process, all it does is start, change its name to something useful,
-// then call the Lambda function passed in via the BeginListening method
+// This is the individual worker, all it does is start, change its name to something useful,
+// then receive the request. Runs on the system thread pool, dispatched by the connection engine
+// The engine has counted the worker when it was queued
 unsigned __stdcall Listener::Worker(void* p_argument)
 {
   Request*  request = reinterpret_cast<Request*>(p_argument);
@@ -81,9 +90,8 @@ unsigned __stdcall Listener::Worker(void* p_argument)
   SetThreadName("Request worker");
 
   // Doing our work
-  InterlockedIncrement(&listener->m_workerThreadCount);
   request->ReceiveRequest();
-  InterlockedDecrement(&listener->m_workerThreadCount);
+  listener->RemoveWorker();
 
   return 0;
 }
@@ -189,6 +197,11 @@ Listener::Initialize(int p_tcpListenPort)
 // Start listening for connections, if a timeout is specified keep listening until then
 void Listener::StartListener()
 {
+  if(!m_engine->Start())
+  {
+    LogError(_T("Cannot start the connection engine for port: %d"),m_port);
+    return;
+  }
   m_listenerThread = (HANDLE)_beginthreadex(nullptr,0,ListenerWorker,this,0,nullptr);
 }
 
@@ -203,6 +216,18 @@ void Listener::StopListener(void)
   m_listenerThread = NULL;
 }
 
+// Park a new or keep-alive connection in the connection engine
+// Returns false if we are stopping, the caller must remove the request
+bool
+Listener::ParkConnection(Request* p_request)
+{
+  if(m_engine == nullptr || WaitForSingleObject(m_stopEvent,0) == WAIT_OBJECT_0)
+  {
+    return false;
+  }
+  return m_engine->ParkConnection(p_request);
+}
+
 // Listen for connections until the "stop" event is caused, this is invoked on
 // its own thread
 void Listener::Listen(void)
@@ -211,8 +236,6 @@ void Listener::Listen(void)
   SOCKET readSocket = NULL;
   DWORD  wait       = 0;
 
-  m_workerThreadCount = 0;
-
   DebugMsg(_T("Start Listener::Listen method"));
 
   events[0] = m_stopEvent;
@@ -254,18 +277,32 @@ void Listener::Listen(void)
     else
     {
       LogError(_T("Server overloaded: rejected a new connection!"));
+      m_engine->ShedConnection(ShedStage::Overloaded);
       closesocket(readSocket);
       continue;
     }
 
-    // A request to open a socket has been received, begin a thread to handle that connection.
-    // Secure connections can take long to establish because of the handshaking, 
-    // so we offload it to an extra thread to do the job.
-    DebugMsg(_T("Starting request worker"));
+    // A request to open a socket has been received. Park it in the connection engine
+    // No thread is held until the client sends data. Secure connections can take long 
+    // to establish because of the handshaking, so that is done on the worker as well.
+    DebugMsg(_T("Parking new connection"));
     Request* request = alloc_new Request(m_queue,this,readSocket,events[0]);
-    _beginthreadex(nullptr,0,Worker,request,0,nullptr);
+    readSocket = NULL;
+
+    // One client address may not take all of our connections
+    if(!m_engine->AddSource(request))
+    {
+      LogError(_T("Too many connections from one address: rejected a new connection!"));
+      delete request;
+      continue;
+    }
+    if(!m_engine->ParkConnection(request))
+    {
+      delete request;
+    }
   }
-  // There has been a problem, wait for all the worker threads to terminate
+  // Close all idle connections, then wait for all the workers to terminate
+  m_engine->Stop();
   Sleep(100);
   m_workerThreadLock.Lock();
   while (m_workerThreadCount)
@@ -26,6 +26,7 @@ class UrlGroup;
 class Request;
 class RequestQueue;
 class SocketStream;
+class ConnectionEngine;
 
 class Listener
 {
@@ -39,6 +40,8 @@ public:
 
   void      StartListener();
   void      StopListener();
+  // Park an idle connection until the client sends a request
+  bool      ParkConnection(Request* p_request);
 
   USHORT    GetPort()       { return m_port;   };
   bool      GetSecureMode() { return m_secure; };
@@ -50,6 +53,10 @@ public:
   void      SetRecvTimeoutSeconds(int p_timeout) { m_recvTimeoutSeconds = p_timeout; };
   int       GetSendTimeoutSeconds() { return m_sendTimeoutSeconds; };
   int       GetRecvTimeoutSeconds() { return m_recvTimeoutSeconds; };
+  ConnectionEngine* GetConnectionEngine() { return m_engine; };
+  // Workers are counted from the moment they are queued until they are done
+  void      AddWorker()    { InterlockedIncrement(&m_workerThreadCount); };
+  void      RemoveWorker() { InterlockedDecrement(&m_workerThreadCount); };
 
   std::function<SECURITY_STATUS(PCCERT_CONTEXT & pCertContext, LPCTSTR p_certSTore,BYTE* p_thumbprint)> m_selectServerCert;
   std::function<bool(PCCERT_CONTEXT pCertContext, const bool trusted)> m_clientCertAcceptable;
@@ -72,6 +79,7 @@ private:
   int               m_numListenSockets;
   XCriticalSection  m_workerThreadLock;
   HANDLE            m_listenerThread { NULL };
+  ConnectionEngine* m_engine { nullptr };       // Multiplexes all idle connections
   // Timeouts
   int               m_sendTimeoutSeconds { 30 };  // Send timeout in seconds
   int               m_recvTimeoutSeconds { 30 };  // Receive timeout in seconds
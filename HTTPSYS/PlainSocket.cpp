@@ -699,19 +699,31 @@ int PlainSocket::RecvMsg(LPVOID p_buffer, const ULONG p_length)
 // sends a message, or part of one
 int PlainSocket::SendPartial(LPCVOID p_buffer, const ULONG p_length)
 {
-	WSAOVERLAPPED os;
-	WSABUF    buffer;
-	DWORD     bytes_sent = 0;
+	WSABUF buffer;
 
 	// Setup the buffer array
 	buffer.buf = (char *)p_buffer;
 	buffer.len = p_length;
 
-  if(!InSecureMode())
+  return SendPartialGather(&buffer,1);
+}
+
+// sends a message from a number of buffers, or part of it
+int PlainSocket::SendPartialGather(LPWSABUF p_buffers,const ULONG p_count)
+{
+	WSAOVERLAPPED os;
+	DWORD     bytes_sent = 0;
+  ULONG     length     = 0;
+
+  for(ULONG index = 0;index < p_count;++index)
   {
-    DebugMsg(_T(" "));
-    DebugMsg(_T("Send message has %d bytes"),p_length);
-    PrintHexDump(p_length,p_buffer);
+    length += p_buffers[index].len;
+    if(!InSecureMode())
+    {
+      DebugMsg(_T(" "));
+      DebugMsg(_T("Send message has %d bytes"),p_buffers[index].len);
+      PrintHexDump(p_buffers[index].len,p_buffers[index].buf);
+    }
   }
 
 	// Reset the timer if it has been invalidated 
@@ -725,7 +737,7 @@ int PlainSocket::SendPartial(LPCVOID p_buffer, const ULONG p_length)
 	memset(&os, 0, sizeof(OVERLAPPED));
 	os.hEvent = m_write_event;
 	WSAResetEvent(m_read_event);
-	int received = WSASend(m_actualSocket, &buffer, 1, &bytes_sent, 0, &os, NULL);
+	int received = WSASend(m_actualSocket, p_buffers, p_count, &bytes_sent, 0, &os, NULL);
 	m_lastError  = WSAGetLastError();
 
 	// Now wait for the I/O to complete if necessary, and see what happened
@@ -752,7 +764,7 @@ int PlainSocket::SendPartial(LPCVOID p_buffer, const ULONG p_length)
 		DWORD msg_flags = 0;
 		if (WSAGetOverlappedResult(m_actualSocket, &os, &bytes_sent, true, &msg_flags))
 		{
-      if(bytes_sent == p_length) // Everything that was requested was sent
+      if(bytes_sent == length) // Everything that was requested was sent
       {
         m_sendEndTime = 0;  // Invalidate the timer so it is set next time through
       }
@@ -825,6 +837,70 @@ PlainSocket::SendingOverlapped(DWORD dwError,DWORD cbTransferred,DWORD /*dwFlags
   }
 }
 
+// sends all the buffers in as few sends as possible, or returns a timeout
+//
+int
+PlainSocket::SendMsgGather(LPWSABUF p_buffers,const ULONG p_count)
+{
+  ULONG first = 0;
+  ULONG total_bytes_sent = 0;
+
+  // Skip leading empty buffers
+  while(first < p_count && p_buffers[first].len == 0)
+  {
+    ++first;
+  }
+  // Do we have something to do?
+  if(first == p_count)
+  {
+    return 0;
+  }
+
+  m_sendEndTime = 0; // Invalidate the timer so SendPartial can reset it.
+
+  // Resume point within the first unsent buffer
+  WSABUF resume = p_buffers[first];
+  while(first < p_count)
+  {
+    // The rest of the buffers, with the partially sent one adjusted
+    WSABUF original = p_buffers[first];
+    p_buffers[first] = resume;
+    int bytes_sent = SendPartialGather(&p_buffers[first],p_count - first);
+    p_buffers[first] = original;
+
+    if(bytes_sent == SOCKET_ERROR)
+    {
+      return SOCKET_ERROR;
+    }
+    else if(bytes_sent == 0)
+    {
+      if(total_bytes_sent == 0)
+      {
+        return SOCKET_ERROR;
+      }
+      break; // socket is closed, no chance of sending more
+    }
+    total_bytes_sent += bytes_sent;
+
+    // Advance over the buffers that went out completely
+    ULONG sent = (ULONG)bytes_sent;
+    while(first < p_count && sent >= resume.len)
+    {
+      sent -= resume.len;
+      if(++first < p_count)
+      {
+        resume = p_buffers[first];
+      }
+    }
+    if(first < p_count)
+    {
+      resume.buf += sent;
+      resume.len -= sent;
+    }
+  }
+  return (int)total_bytes_sent;
+}
+
 // sends all the data or returns a timeout
 //
 int
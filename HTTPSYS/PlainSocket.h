@@ -44,6 +44,8 @@ public:
   int   RecvPartialOverlapped(LPVOID p_buffer,const ULONG p_length,LPOVERLAPPED p_overlapped) override;
   // Sends    up to   p_length bytes of data with an OVERLAPPED callback
   int   SendPartialOverlapped(LPVOID p_buffer,const ULONG p_length,LPOVERLAPPED p_overlapped) override;
+  // Sends all buffers in one vectored send and returns the amount sent     - or SOCKET_ERROR if it times out
+  int   SendMsgGather(LPWSABUF p_buffers,const ULONG p_count) override;
 
   // Set up SSL/TLS state for this connection: NEVER USED ON PLAIN SOCKETS! Only on derived classes!!
   HRESULT InitializeSSL(const void* p_buffer = nullptr,const int p_length = 0) override;
@@ -59,6 +61,8 @@ public:
 
   // Check if the socket is (still) readable
   bool  IsReadible(bool& p_readible);
+  // Data already received from the socket, but not yet read by the caller
+  virtual bool HasBufferedInput() { return false; }
 
   // SETTERS
   void    SetConnTimeoutSeconds(int  p_newTimeoutSeconds);
@@ -101,6 +105,8 @@ private:
   bool  ActivateKeepalive();
   // Find connection type (AF_INET (IPv4) or AF_INET6 (IPv6))
   int   FindConnectType(LPCTSTR p_host,LPCTSTR p_portname);
+  // Sends up to the length of all buffers
+  int   SendPartialGather(LPWSABUF p_buffers,const ULONG p_count);
 
   bool            m_initDone            { false   };  // Initialize called (or not)
   bool            m_active              { true    };  // Active = true means clientside socket, passive is serverside
@@ -12,8 +12,10 @@
 #include "URL.h"
 #include "Request.h"
 #include "RequestQueue.h"
+#include "HeaderParser.h"
 #include "UrlGroup.h"
 #include "Listener.h"
+#include "ConnectionEngine.h"
 #include "Logging.h"
 #include "PlainSocket.h"
 #include "SecureServerSocket.h"
@@ -57,6 +59,9 @@ Request::Request(RequestQueue* p_queue
   // Create a socket, conforming to the security mode
   SetSocket(p_listener,p_socket,p_stopEvent);
 
+  // A new connection must send its header lines in time
+  StartHeaderDeadline();
+
   // Setting OUR identity!!
   // This is WHY we implemented HTTP.SYS in user space!
   m_request.ConnectionId = (HTTP_CONNECTION_ID)m_socket;
@@ -68,6 +73,20 @@ Request::~Request()
   CloseRequest();
   Reset();
 
+  // Give back our place in the connections of the client address
+  if(m_sourceCounted && m_listener->GetConnectionEngine())
+  {
+    m_listener->GetConnectionEngine()->RemoveSource(this);
+  }
+
+  // No longer reachable by the application.
+  // The memory goes back to the pool and may become a request again!
+  if(m_request.RequestId)
+  {
+    g_handles.RemoveOpaqueHandle((HANDLE)m_request.RequestId);
+  }
+  m_ident = 0;
+
   // Decrement the connection counter
   if(g_session)
   {
@@ -75,13 +94,43 @@ Request::~Request()
   }
 }
 
-// Starting of a request.
+void*
+Request::operator new(size_t p_size)
+{
+  return g_requestPool.AllocateRequest(p_size);
+}
+
+void*
+Request::operator new(size_t p_size,int /*p_block*/,const char* /*p_file*/,int /*p_line*/)
+{
+  return g_requestPool.AllocateRequest(p_size);
+}
+
+void
+Request::operator delete(void* p_memory)
+{
+  g_requestPool.ReleaseRequest(p_memory);
+}
+
+void
+Request::operator delete(void* p_memory,int /*p_block*/,const char* /*p_file*/,int /*p_line*/)
+{
+  g_requestPool.ReleaseRequest(p_memory);
+}
+
+// Starting of a request. Called by the worker after the connection
+// engine has seen data arriving on a parked connection.
 // Receive the general HTTP line and all headers lines
 // And put the request in the RequestQueue for our program 
 void
 Request::ReceiveRequest()
 {
   // Place request in the global handles
+  // A keep-alive connection gets a new handle for every request
+  if(m_request.RequestId)
+  {
+    g_handles.RemoveOpaqueHandle((HANDLE)m_request.RequestId);
+  }
   HANDLE handle = g_handles.CreateOpaqueHandle(HTTPHandleType::HTTP_Request,this);
   m_request.RequestId = (HTTP_REQUEST_ID)handle;
 
@@ -116,13 +165,22 @@ Request::ReceiveRequest()
   {
     try
     {
-      ReceiveHeaders();
+      if(!ReceiveHeaders())
+      {
+        // Header lines not complete: wait for the rest without holding this thread
+        if(!m_listener->ParkConnection(this))
+        {
+          m_queue->RemoveRequest(this);
+        }
+        return;
+      }
 
       if(CheckAuthentication())
       {
         looping = true;
         DrainRequest();
         ReplyClientError(HTTP_STATUS_DENIED,_T("Not authenticated"));
+        KeepPipelinedRequest();
         ResetRequestV1();
       }
       else
@@ -191,17 +249,9 @@ Request::CloseRequest()
     m_socket = nullptr;
   }
 
-  // Free the addresses here
-  if(m_request.Address.pLocalAddress)
-  {
-    free((void*)m_request.Address.pLocalAddress);
-    m_request.Address.pLocalAddress = nullptr;
-  }
-  if(m_request.Address.pRemoteAddress)
-  {
-    free((void*)m_request.Address.pRemoteAddress);
-    m_request.Address.pRemoteAddress = nullptr;
-  }
+  // Addresses are stored in the request object itself
+  m_request.Address.pLocalAddress  = nullptr;
+  m_request.Address.pRemoteAddress = nullptr;
 }
 
 // Drain our request, so we can get busy with a new one 
@@ -239,7 +289,8 @@ Request::DrainRequest()
     while(readin > 0)
     {
       ULONG read = 0L;
-      if(ReceiveBuffer(drain_buffer,size,&read,false) > 0)
+      int result = ReceiveBuffer(drain_buffer,size,&read,false);
+      if((result == NO_ERROR || result == ERROR_MORE_DATA) && read > 0)
       {
         if(read <= readin)
         {
@@ -270,18 +321,21 @@ Request::RestartConnection()
     DrainRequest();
   }
 
+  // The client may already have sent its next request (pipelining)
+  KeepPipelinedRequest();
+
   // Prepare for the next request
   ResetRequestV1();
 
   // Do **NOT** reset the HTTP_REQUEST_V2, we want the retain the authentication!!
 
-  // Remove from servicing queue and restart a worker
+  // Remove from servicing queue and park the connection
   m_queue->ResetToServicing(this);
   m_status = RQ_CREATED;
 
-  // Start new thread, like the listener would do
-  _beginthreadex(nullptr,0,m_listener->Worker,this,0,nullptr);
-  return true;
+  // Wait for the next request without holding a thread, like the listener would do
+  // A pipelined request is dispatched right away by the connection engine
+  return m_listener->ParkConnection(this);
 }
 
 // Reading the body of the HTTP call
@@ -308,11 +362,18 @@ Request::ReceiveBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes,bool p_all)
   }
 
   // Initial buffer left?, so use it!
-  if(m_bufferPosition < m_initialLength)
+  if(m_bufferPosition < m_bodyLimit)
   {
     return CopyInitialBuffer(p_buffer,p_size,p_bytes);
   }
 
+  // A keep-alive request without a content length or a transfer-encoding
+  // has no body. Whatever the client sends now is its next request.
+  if(m_keepAlive && m_contentLength == 0 && !m_chunked && m_status != RQ_OPAQUE)
+  {
+    return ERROR_HANDLE_EOF;
+  }
+
   // Restrict the number of bytes to read if a keep-alive situation
   // and we know the designated content-length of the request
   // So we do not read past this request into the following request
@@ -320,7 +381,7 @@ Request::ReceiveBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes,bool p_all)
     (m_bytesRead < m_contentLength) &&
     (m_contentLength - m_bytesRead) < p_size)
   {
-    p_size = (ULONG) m_contentLength;
+    p_size = (ULONG)(m_contentLength - m_bytesRead);
   }
 
   // Reading loop
@@ -379,15 +440,18 @@ Request::ReceiveChunk(PVOID p_buffer,ULONG p_size)
 {
   USHORT count = m_request.EntityChunkCount;
 
-  m_request.pEntityChunks = (PHTTP_DATA_CHUNK) realloc(m_request.pEntityChunks,(count + 1) * sizeof(PHTTP_DATA_CHUNK));
-  if(m_request.pEntityChunks)
+  PHTTP_DATA_CHUNK chunks = (PHTTP_DATA_CHUNK) m_arena.Allocate((count + 1) * sizeof(HTTP_DATA_CHUNK));
+  if(count)
   {
-    m_request.pEntityChunks[count].DataChunkType           = HttpDataChunkFromMemory;
-    m_request.pEntityChunks[count].FromMemory.pBuffer      = (PHTTP_DATA_CHUNK) p_buffer;
-    m_request.pEntityChunks[count].FromMemory.BufferLength = p_size;
-
-    ++m_request.EntityChunkCount;
+    memcpy(chunks,m_request.pEntityChunks,count * sizeof(HTTP_DATA_CHUNK));
   }
+  m_request.pEntityChunks = chunks;
+
+  m_request.pEntityChunks[count].DataChunkType           = HttpDataChunkFromMemory;
+  m_request.pEntityChunks[count].FromMemory.pBuffer      = (PHTTP_DATA_CHUNK) p_buffer;
+  m_request.pEntityChunks[count].FromMemory.BufferLength = p_size;
+
+  ++m_request.EntityChunkCount;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -402,6 +466,9 @@ Request::ReceiveChunk(PVOID p_buffer,ULONG p_size)
 // - Empty separator line between headers and body
 // - Any entity chunks given in the first response as first body part
 //
+// The header and the leading memory chunks of the body go out in one
+// gathered write, so a small response is just one send on the socket.
+//
 int
 Request::SendResponse(PHTTP_RESPONSE p_response,ULONG p_flags,PULONG p_bytes)
 {
@@ -428,12 +495,17 @@ Request::SendResponse(PHTTP_RESPONSE p_response,ULONG p_flags,PULONG p_bytes)
   // Line between headers and body
   buffer += "\r\n";
 
-  // Perform one write of all header lines in one go!
-  int result = WriteBuffer((PVOID)buffer.GetString(),(ULONG)buffer.GetLength(),p_bytes);
+  // Perform one write of all header lines and the first body chunks in one go!
+  int used   = 0;
+  int result = WriteGathered((PVOID)buffer.GetString()
+                            ,(ULONG)buffer.GetLength()
+                            ,p_response->pEntityChunks
+                            ,p_response->pEntityChunks ? p_response->EntityChunkCount : 0
+                            ,used
+                            ,p_bytes);
   if(result == NO_ERROR)
   {
-    // Reset byte pointers
-    m_bytesWritten  = 0;
+    // Reset byte pointers (m_bytesWritten already holds the body part sent)
     m_contentLength = 0;
     // Set status to writing the body
     m_status = RQ_WRITING;
@@ -449,14 +521,19 @@ Request::SendResponse(PHTTP_RESPONSE p_response,ULONG p_flags,PULONG p_bytes)
     // Grab the content length of the body
     if(p_response->Headers.KnownHeaders[HttpHeaderContentLength].pRawValue)
     {
-      m_contentLength = atoi(p_response->Headers.KnownHeaders[HttpHeaderContentLength].pRawValue);
+      m_contentLength = _atoi64(p_response->Headers.KnownHeaders[HttpHeaderContentLength].pRawValue);
+    }
+    // Body could already be complete with the header
+    if((m_status == RQ_WRITING) && m_contentLength && m_bytesWritten >= m_contentLength)
+    {
+      m_status = RQ_SERVICED;
     }
 
-    // Also send our body right away, if any chunks given
-    if(p_response->EntityChunkCount)
+    // Also send the rest of our body right away, if any chunks given
+    if(used < (int)p_response->EntityChunkCount)
     {
       ULONG bytes = 0;
-      int  send_result = SendEntityChunks(p_response->pEntityChunks,p_response->EntityChunkCount,&bytes);
+      int  send_result = SendEntityChunks(&p_response->pEntityChunks[used],p_response->EntityChunkCount - used,&bytes);
       if (send_result == NO_ERROR)
       {
         *p_bytes += bytes;
@@ -481,9 +558,24 @@ Request::SendEntityChunks(PHTTP_DATA_CHUNK p_chunks,int p_count,PULONG p_bytes)
     return ERROR_CONNECTION_INVALID;
   }
 
-  for(int index = 0; index < p_count; ++index)
+  int index = 0;
+  while(index < p_count)
   {
-    int result = SendEntityChunk(&p_chunks[index],p_bytes);
+    int result = NO_ERROR;
+
+    // A run of memory chunks is written in one gathered send
+    if(index + 1 < p_count &&
+       p_chunks[index    ].DataChunkType == HttpDataChunkFromMemory &&
+       p_chunks[index + 1].DataChunkType == HttpDataChunkFromMemory)
+    {
+      int used = 0;
+      result = WriteGathered(nullptr,0,&p_chunks[index],p_count - index,used,p_bytes);
+      index += used;
+    }
+    else
+    {
+      result = SendEntityChunk(&p_chunks[index++],p_bytes);
+    }
     if (result != NO_ERROR)
     {
       return result;
@@ -560,46 +652,25 @@ Request::ResetRequestV1()
   m_request.BytesReceived         = 0;
   m_request.RawConnectionId       = 0;
 
-  // VERB & URL
-  if(m_request.pUnknownVerb)
-  {
-    free((void*)m_request.pUnknownVerb);
-    m_request.pUnknownVerb = nullptr;
-    m_request.UnknownVerbLength = 0;
-  }
-  if(m_request.pRawUrl)
-  {
-    free((void*)m_request.pRawUrl);
-    m_request.pRawUrl = nullptr;
-    m_request.RawUrlLength = 0;
-  }
-  if(m_request.CookedUrl.pFullUrl)
-  {
-    free((void*)m_request.CookedUrl.pFullUrl);
-    m_request.CookedUrl.pFullUrl          = nullptr;
-    m_request.CookedUrl.pHost             = nullptr;
-    m_request.CookedUrl.pAbsPath          = nullptr;
-    m_request.CookedUrl.pQueryString      = nullptr;
-    m_request.CookedUrl.FullUrlLength     = 0;
-    m_request.CookedUrl.HostLength        = 0;
-    m_request.CookedUrl.AbsPathLength     = 0;
-    m_request.CookedUrl.QueryStringLength = 0;
-  }
+  // VERB & URL (strings are in the arena)
+  m_request.pUnknownVerb      = nullptr;
+  m_request.UnknownVerbLength = 0;
+  m_request.pRawUrl           = nullptr;
+  m_request.RawUrlLength      = 0;
+  m_request.CookedUrl.pFullUrl          = nullptr;
+  m_request.CookedUrl.pHost             = nullptr;
+  m_request.CookedUrl.pAbsPath          = nullptr;
+  m_request.CookedUrl.pQueryString      = nullptr;
+  m_request.CookedUrl.FullUrlLength     = 0;
+  m_request.CookedUrl.HostLength        = 0;
+  m_request.CookedUrl.AbsPathLength     = 0;
+  m_request.CookedUrl.QueryStringLength = 0;
 
   // Unknown headers/trailers
-  if(m_request.Headers.pUnknownHeaders)
-  {
-    for(int ind = 0;ind < m_request.Headers.UnknownHeaderCount; ++ind)
-    {
-      free((void*)m_request.Headers.pUnknownHeaders[ind].pName);
-      free((void*)m_request.Headers.pUnknownHeaders[ind].pRawValue);
-      m_request.Headers.pUnknownHeaders[ind].NameLength = 0;
-      m_request.Headers.pUnknownHeaders[ind].RawValueLength = 0;
-    }
-    free(m_request.Headers.pUnknownHeaders);
-    m_request.Headers.pUnknownHeaders = nullptr;
-    m_request.Headers.UnknownHeaderCount = 0;
-  }
+  // Names and values point into the initial buffer: never free-ed here!
+  m_request.Headers.pUnknownHeaders    = nullptr;
+  m_request.Headers.UnknownHeaderCount = 0;
+  m_unknownCapacity = REQUEST_UNKNOWN_HEADERS;
   if(m_request.Headers.pTrailers)
   {
     for(int ind = 0;ind < m_request.Headers.TrailerCount;++ind)
@@ -614,26 +685,18 @@ Request::ResetRequestV1()
     m_request.Headers.TrailerCount = 0;
   }
 
-  // Known headers
+  // Known headers (values are in the initial buffer)
   for(int ind = 0;ind < HttpHeaderRequestMaximum; ++ind)
   {
-    if(m_request.Headers.KnownHeaders[ind].pRawValue)
-    {
-      free((void*)m_request.Headers.KnownHeaders[ind].pRawValue);
-      m_request.Headers.KnownHeaders[ind].pRawValue = nullptr;
-      m_request.Headers.KnownHeaders[ind].RawValueLength = 0;
-    }
+    m_request.Headers.KnownHeaders[ind].pRawValue = nullptr;
+    m_request.Headers.KnownHeaders[ind].RawValueLength = 0;
   }
 
-  // Entity chunks
-  if(m_request.pEntityChunks)
-  {
-    free(m_request.pEntityChunks);
-    m_request.pEntityChunks = nullptr;
-    m_request.EntityChunkCount = 0;
-    // Data buffers are allocated by the calling program!!
-    // They are never free-ed here!
-  }
+  // Entity chunks (the array is in the arena)
+  // Data buffers are allocated by the calling program!!
+  // They are never free-ed here!
+  m_request.pEntityChunks    = nullptr;
+  m_request.EntityChunkCount = 0;
 
   // SSL Info and Certificate
   if(m_request.pSslInfo)
@@ -661,8 +724,13 @@ Request::ResetRequestV1()
   m_bytesRead     = 0L;
   m_bytesWritten  = 0L;
   m_contentLength = 0L;
+  m_chunked       = false;
   m_keepAlive     = false;
   m_url           = nullptr;
+  m_bodyStart     = 0;
+
+  // All strings and tables of the request at once
+  m_arena.Reset();
 }
 
 // Reset HTTP_REQUEST_V2
@@ -726,30 +794,29 @@ Request::SetSocket(Listener* p_listener,SOCKET p_socket,HANDLE p_stop)
 void
 Request::SetAddresses(SOCKET p_socket)
 {
-  // Address structure at least big enough for IPv6
-  // WinSock documentation on MSDN says: at least 1 paragraph of memory extra!!
-  sockaddr_in6 sockaddr;
-  int namelen = sizeof(sockaddr_in6) + 16;
+  // Address structures are big enough for IPv6 (and then some)
+  ZeroMemory(&m_localAddress, sizeof(SOCKADDR_STORAGE));
+  ZeroMemory(&m_remoteAddress,sizeof(SOCKADDR_STORAGE));
+  int namelen = sizeof(SOCKADDR_STORAGE);
 
   // Get local socket information
-  if(getsockname(p_socket,(PSOCKADDR)&sockaddr,&namelen))
+  if(getsockname(p_socket,(PSOCKADDR)&m_localAddress,&namelen))
   {
     LogError(_T("Cannot get local address name for connection: %s"),m_request.pRawUrl);
   }
   // Keep the address info
-  m_request.Address.pLocalAddress = (PSOCKADDR) calloc(1,namelen);
-  memcpy(m_request.Address.pLocalAddress,&sockaddr,namelen);
-  // And keep the port number
-  m_port = ntohs(sockaddr.sin6_port);
+  m_request.Address.pLocalAddress = (PSOCKADDR)&m_localAddress;
+  // And keep the port number (same place for IPv4 and IPv6)
+  m_port = ntohs(((sockaddr_in6*)&m_localAddress)->sin6_port);
 
   // Get remote address information
-  if(getpeername(p_socket,(PSOCKADDR)&sockaddr,&namelen))
+  namelen = sizeof(SOCKADDR_STORAGE);
+  if(getpeername(p_socket,(PSOCKADDR)&m_remoteAddress,&namelen))
   {
     LogError(_T("Cannot get remote address name for connection: %s"),m_request.pRawUrl);
   }
   // Keep as the remote side of the channel
-  m_request.Address.pRemoteAddress = (PSOCKADDR)calloc(1,namelen);
-  memcpy(m_request.Address.pRemoteAddress,&sockaddr,namelen);
+  m_request.Address.pRemoteAddress = (PSOCKADDR)&m_remoteAddress;
 }
 
 // Set timeout settings for reading and writing
@@ -800,32 +867,31 @@ Request::InitiateSSL()
 // - All headers
 // - Stop at the empty line under the headers
 // - Leave the first part of the body in the initial buffers
+// Returns false if the client has not yet sent all header lines
 //
-void
+bool
 Request::ReceiveHeaders()
 {
-  // Setup initial buffers
-  ReadInitialMessage();
+  // Setup initial buffers. A slow client can take more than one read
+  if(!ReadInitialMessage())
+  {
+    return false;
+  }
 
   // Getting the HTTP protocol line
-  LPSTR line = ReadTextLine();
+  ULONG length = 0;
+  LPSTR line = ReadTextLine(length);
   ReceiveHTTPLine(line);
-  delete[] line;
 
-  // Reading all request headers
-  while (true)
+  // Reading all request headers, up to the empty line
+  while(true)
   {
-    line = ReadTextLine();
-    if(line[0])
-    {
-      ProcessHeader(line);
-      delete[] line;
-    }
-    else 
+    line = ReadTextLine(length);
+    if(length == 0)
     {
-      delete[] line;
       break;
     }
+    ProcessHeader(line,length);
   }
 
   // Finding our site context
@@ -840,59 +906,175 @@ Request::ReceiveHeaders()
   // Checking for keep-alive round trips
   FindKeepAlive();
 
+  // Only the body of this request may be read from the initial buffer.
+  // On a keep-alive connection the client may have sent its next request already.
+  // The end of a body with a transfer-encoding is not known here: no pipelining.
+  m_bodyLimit = m_initialLength;
+  if(m_keepAlive && !m_chunked && (ULONGLONG)(m_initialLength - m_bufferPosition) > m_contentLength)
+  {
+    m_bodyLimit = m_bufferPosition + (ULONG)m_contentLength;
+  }
+
   // Reset number of bytes read. We will now go read the body
   m_bytesRead = 0;
+  return true;
 }
 
 // Grab the first available message part just under the optimal buffer length
-// so we can parse off the initial headers of the message
-void
+// so we can parse off the initial headers of the message.
+// Returns false if the empty line after the headers has not arrived yet.
+// The part we already have stays in the buffer for the next read.
+bool
 Request::ReadInitialMessage()
 {
-  FreeInitialBuffer();
+  if(!m_headerPending)
+  {
+    unsigned size = g_session->GetMaxRequestBytes();
+    if(size < MESSAGE_BUFFER_LENGTH)
+    {
+      size = MESSAGE_BUFFER_LENGTH;
+    }
+    // Keep-alive connections reuse their buffer
+    // (and never lose the bytes of a pipelined request)
+    if(m_initialBuffer && m_initialSize < size && m_pipelineLength == 0)
+    {
+      FreeInitialBuffer();
+    }
+    if(!m_initialBuffer)
+    {
+      m_initialBuffer = g_requestPool.AllocateBuffer(size);
+      m_initialSize   = size;
+    }
+    m_initialLength  = 0;
+    m_bufferPosition = 0;
+    if(!m_initialBuffer)
+    {
+      m_initialSize = 0;
+      throw (INT)ERROR_OUTOFMEMORY;
+    }
+  }
+  // Start with the pipelined request that came with the previous one
+  if(m_pipelineLength)
+  {
+    m_initialLength  = m_pipelineLength;
+    m_bytesRead     += m_pipelineLength;
+    m_pipelineLength = 0;
+    if(m_headerDeadline == 0)
+    {
+      StartHeaderDeadline();
+    }
+    if(FindHeaderEnd(0))
+    {
+      m_headerPending  = false;
+      m_headerDeadline = 0;
+      return true;
+    }
+    // Rest of the header lines is still underway: wait in the connection engine
+    m_headerPending = true;
+    return false;
+  }
+  ULONG space = m_initialSize - 1 - m_initialLength;
+  int length = m_socket->RecvPartial(&m_initialBuffer[m_initialLength],space);
+  if(length <= 0)
+  {
+    throw (int)ERROR_HANDLE_EOF;
+  }
+  // First byte of a request on a keep-alive connection
+  if(m_headerDeadline == 0)
+  {
+    StartHeaderDeadline();
+  }
+  ULONG from = m_initialLength > 3 ? m_initialLength - 3 : 0;
+  m_initialLength += length;
+  m_bytesRead     += length;
+  m_initialBuffer[m_initialLength] = 0;
 
-  unsigned size = g_session->GetMaxRequestBytes();
-  if(size < MESSAGE_BUFFER_LENGTH)
+  if(FindHeaderEnd(from))
   {
-    size = MESSAGE_BUFFER_LENGTH;
+    m_headerPending  = false;
+    m_headerDeadline = 0;
+    return true;
   }
-  m_initialBuffer = (BYTE*) malloc(size);
-  if(!m_initialBuffer)
+  // Header lines do not fit in the maximum request bytes
+  if(m_initialLength >= m_initialSize - 1)
   {
-    throw (INT)ERROR_OUTOFMEMORY;
+    m_headerPending = false;
+    throw ERROR_HTTP_INVALID_HEADER;
   }
-  int length = m_socket->RecvPartial(m_initialBuffer,size - 1);
-  if (length > 0)
+  m_headerPending = true;
+  return false;
+}
+
+// Look for the empty line that ends the header lines
+bool
+Request::FindHeaderEnd(ULONG p_from)
+{
+  for(ULONG index = p_from; index + 3 < m_initialLength; ++index)
   {
-    m_initialBuffer[length] = 0;
-    m_initialLength = length;
-    m_bytesRead    += length;
-    return;
+    if(m_initialBuffer[index    ] == '\r' && m_initialBuffer[index + 1] == '\n' &&
+       m_initialBuffer[index + 2] == '\r' && m_initialBuffer[index + 3] == '\n')
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// All header lines must arrive within the header wait time of the session
+void
+Request::StartHeaderDeadline()
+{
+  int timeout = g_session ? g_session->GetTimeoutHeaderWait() : 0;
+  if(timeout <= 0)
+  {
+    timeout = URL_TIMEOUT_HEADER_WAIT;
+  }
+  else if(timeout < HTTP_MINIMUM_TIMEOUT)
+  {
+    timeout = HTTP_MINIMUM_TIMEOUT;
   }
-  throw (int)ERROR_HANDLE_EOF;
+  m_headerDeadline = GetTickCount64() + (ULONGLONG)timeout * CLOCKS_PER_SEC;
+}
+
+// A client sending its body slower than the minimum receive rate of the session
+// would keep the reading thread busy. Checked after a short grace period.
+bool
+Request::CheckBodyRate()
+{
+  ULONG rate = g_session ? g_session->GetMinReceiveRate() : 0;
+  if(rate == 0 || m_status == RQ_OPAQUE || m_bodyStart == 0)
+  {
+    return true;
+  }
+  ULONGLONG elapsed = GetTickCount64() - m_bodyStart;
+  if(elapsed < (ULONGLONG)HTTP_MINIMUM_TIMEOUT * CLOCKS_PER_SEC)
+  {
+    return true;
+  }
+  if(((ULONGLONG)m_bytesRead * CLOCKS_PER_SEC) / elapsed >= rate)
+  {
+    return true;
+  }
+  LogError(_T("Request body below the minimum rate of %d bytes/sec: %s"),rate,m_request.pRawUrl);
+  if(m_listener->GetConnectionEngine())
+  {
+    m_listener->GetConnectionEngine()->ShedConnection(ShedStage::BodyRate);
+  }
+  m_keepAlive = false;
+  return false;
 }
 
 // Find the next line in the initial buffers up to the "\r\n"
 // Mark that the HTTP IETF RFC clearly states that all header
 // lines must end in a <CR><LF> sequence!!
+// The line is terminated in place and stays in the initial buffer.
 LPSTR
-Request::ReadTextLine()
+Request::ReadTextLine(ULONG& p_length)
 {
-  BYTE* begin = &m_initialBuffer[m_bufferPosition];
-  BYTE* end   = (BYTE*) strchr((char*)begin,'\r');
-
-  if(end && end[1] == '\n')
-  {
-    int len = (int)((ULONGLONG)end - (ULONGLONG)begin);
-
-
-    LPSTR buffer = (LPSTR) alloc_new char[len + 1];
-    memcpy_s(buffer,len + 1,begin,len);
-    buffer[len] = 0;
-    m_bufferPosition += len + 2;
-    return buffer;
-  }
-  throw ERROR_HTTP_INVALID_HEADER;
+  LPSTR begin = (LPSTR)&m_initialBuffer[m_bufferPosition];
+  LPSTR line  = HeaderParser::ReadLine(begin,m_initialLength - m_bufferPosition,p_length);
+  m_bufferPosition += p_length + 2;
+  return line;
 }
 
 // Process the essential first line beginning with the HTTP verb
@@ -927,66 +1109,30 @@ Request::ReceiveHTTPLine(LPSTR p_line)
 // either do one of two things:
 // - Store it as a 'known-header'
 // - Store it as a 'unknown-header'
-// All storing actions require string memory allocations!!
+// Name and value are trimmed and terminated in place in the initial buffer,
+// so storing a header never allocates string memory.
 void
-Request::ProcessHeader(LPSTR p_line)
+Request::ProcessHeader(LPSTR p_line,ULONG p_length)
 {
-  // Remove end-of-line markers.
-  int len = (int)strlen(p_line);
-  if (len > 2)
+  HeaderLine header;
+  HeaderParser::SplitLine(p_line,p_length,header);
+
+  if(header.h_known >= 0)
   {
-    if(p_line[len - 1] == '\n') --len;
-    if(p_line[len - 1] == '\r') --len;
+    m_request.Headers.KnownHeaders[header.h_known].pRawValue      = header.h_value;
+    m_request.Headers.KnownHeaders[header.h_known].RawValueLength = header.h_valueLength;
   }
-  p_line[len] = 0;
-
-  // Find separating colon
-  LPSTR colon = strchr(p_line,':');
-  if(colon)
+  else
   {
-    LPSTR header = p_line;
-    LPSTR value  = (colon + 1);
-    // Make delimiter
-    *colon = 0;
-    // Remove whitespace 
-    len = (int)strlen(header);
-    while(len >= 0 && isspace(header[len - 1])) --len;
-    if(len >= 0) header[len] = 0;
-
-    int vlen = (int)strlen(value);
-    while(vlen-- >= 0)
-    {
-      if(isspace(value[0])) ++value;
-    }
+    HeaderParser::AddUnknownHeader(m_request.Headers,m_unknownHeaders,m_unknownCapacity,m_arena,header);
 
-    int knwonHeader = FindKnownHeader(header);
-    if (knwonHeader >= 0)
+    // Check for incoming WebSocket
+    if(_stricmp(header.h_name,"Sec-WebSocket-Key") == 0)
     {
-      m_request.Headers.KnownHeaders[knwonHeader].pRawValue      = _strdup(value);
-      m_request.Headers.KnownHeaders[knwonHeader].RawValueLength = (USHORT)vlen;
-    }
-    else
-    {
-      m_request.Headers.pUnknownHeaders = (PHTTP_UNKNOWN_HEADER) realloc(m_request.Headers.pUnknownHeaders, (1 + m_request.Headers.UnknownHeaderCount) * sizeof(HTTP_UNKNOWN_HEADER));
-
-      m_request.Headers.pUnknownHeaders[m_request.Headers.UnknownHeaderCount].pName          = _strdup(header);
-      m_request.Headers.pUnknownHeaders[m_request.Headers.UnknownHeaderCount].NameLength     = (USHORT)len;
-      m_request.Headers.pUnknownHeaders[m_request.Headers.UnknownHeaderCount].pRawValue      = _strdup(value);
-      m_request.Headers.pUnknownHeaders[m_request.Headers.UnknownHeaderCount].RawValueLength = (USHORT)vlen;
-
-      m_request.Headers.UnknownHeaderCount++;
-
-      // Check for incoming WebSocket
-      if(_stricmp(header,"Sec-WebSocket-Key") == 0)
-      {
-        m_websocketPrepare = true;
-        m_websocketKey     = value;
-      }
+      m_websocketPrepare = true;
+      m_websocketKey     = header.h_value;
     }
-    return;
   }
-  // No colon found: no valid HTTP header line
-  throw ERROR_HTTP_INVALID_HEADER;
 }
 
 // Find our absolute URL path without the query part
@@ -1034,6 +1180,7 @@ Request::FindUrlContext()
 
 // Finding the content length header
 // Also works for empty headers (converts to zero)
+// A body with a transfer-encoding (chunked) has no content length
 void
 Request::FindContentLength()
 {
@@ -1045,6 +1192,12 @@ Request::FindContentLength()
       m_request.Flags = HTTP_REQUEST_FLAG_MORE_ENTITY_BODY_EXISTS;
     }
   }
+  LPCSTR encoding = m_request.Headers.KnownHeaders[HttpHeaderTransferEncoding].pRawValue;
+  if(encoding && *encoding)
+  {
+    m_chunked = true;
+    m_request.Flags = HTTP_REQUEST_FLAG_MORE_ENTITY_BODY_EXISTS;
+  }
 }
 
 // In case we just have an URL without a host: add the host
@@ -1079,34 +1232,49 @@ Request::CorrectFullURL()
     CStringT<char,StrTraitATL< char > > absolute = W2A(abspath);
     newpath.Format("http://%s%s",host,absolute.GetString());
 
-    if(m_request.CookedUrl.pFullUrl)
-    {
-      free((PVOID)m_request.CookedUrl.pFullUrl);
-      m_request.CookedUrl.pFullUrl = nullptr;
-    }
-    if (m_request.pRawUrl)
-    {
-      free((PVOID)m_request.pRawUrl);
-      m_request.pRawUrl = nullptr;
-    }
+    // Old strings stay in the arena until the request is reset
+    m_request.CookedUrl.pFullUrl = nullptr;
+    m_request.pRawUrl            = nullptr;
 
     FindURL((LPSTR)newpath.GetString());
   }
 }
 
-// At various stages: we may now forget the initial buffer
-// In case we just read all of the body
-// or in case we reset and destroy the request.
+// We may now forget the initial buffer: in case we start reading the next
+// request, or in case we reset and destroy the request.
+// Never before that: all request headers point into this buffer!
 void
 Request::FreeInitialBuffer()
 {
   if(m_initialBuffer)
   {
-    free(m_initialBuffer);
+    g_requestPool.ReleaseBuffer(m_initialBuffer,m_initialSize);
   }
   m_initialBuffer  = nullptr;
+  m_initialSize    = 0;
   m_initialLength  = 0;
   m_bufferPosition = 0;
+  m_bodyLimit      = 0;
+  m_pipelineLength = 0;
+}
+
+// Bytes after the body of this request are the start of the next request
+// that the client pipelined on the same connection. Move them to the front
+// of the buffer, so the next request is read from there.
+// Responses keep their order: the next request is read after this one is done.
+void
+Request::KeepPipelinedRequest()
+{
+  m_pipelineLength = 0;
+  if(m_initialBuffer && m_bodyLimit < m_initialLength)
+  {
+    m_pipelineLength = m_initialLength - m_bodyLimit;
+    memmove(m_initialBuffer,&m_initialBuffer[m_bodyLimit],m_pipelineLength);
+    m_initialBuffer[m_pipelineLength] = 0;
+  }
+  m_initialLength  = m_pipelineLength;
+  m_bufferPosition = 0;
+  m_bodyLimit      = 0;
 }
 
 // These are all of the 'known' verbs that the HTTPSYS
@@ -1138,7 +1306,7 @@ static LPCSTR all_verbs[] =
 };
 
 // Finding the VERB in the all_verbs array.
-// In case we do not find the verb, we store a string duplicate
+// In case we do not find the verb, we store a string duplicate in the arena
 void
 Request::FindVerb(LPSTR p_verb)
 {
@@ -1153,21 +1321,31 @@ Request::FindVerb(LPSTR p_verb)
   }
 
   // Store unknown VERB as word
-  m_request.pUnknownVerb      = _strdup(p_verb);
-  m_request.UnknownVerbLength = (USHORT) strlen(p_verb);
+  size_t length = strlen(p_verb);
+  if(length > HEADER_MAXIMUM_LENGTH)
+  {
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+  m_request.pUnknownVerb      = m_arena.Duplicate(p_verb,length);
+  m_request.UnknownVerbLength = (USHORT) length;
 }
 
 // Finding and storing an URL in the request structure
-// 1) As a string duplicate
-// 2) As a Unicode string duplicate
+// 1) As a string duplicate (in the arena)
+// 2) As a Unicode string duplicate (in the arena)
 // 3) As a 'cooked' pointer set to the Unicode duplicate
 //
 void
 Request::FindURL(LPSTR p_url)
 {
-  // Copy the raw URL
-  m_request.pRawUrl = _strdup(p_url);
-  m_request.RawUrlLength = (USHORT)strlen(p_url);
+  // Copy the raw URL. Lengths in the request are USHORT's
+  size_t length = strlen(p_url);
+  if(length > HEADER_MAXIMUM_LENGTH)
+  {
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+  m_request.pRawUrl = m_arena.Duplicate(p_url,length);
+  m_request.RawUrlLength = (USHORT)length;
 
   // Cook our URL
   XString cooked = CrackedURL::DecodeURLChars(p_url);
@@ -1178,9 +1356,13 @@ Request::FindURL(LPSTR p_url)
   int posPath  = cooked.Find('/',posHost > 0 ? posHost + 2 : 0);
   int posQuery = cooked.Find('?');
 
-  // FULL URL
+  // FULL URL. All parts are no longer than the full URL in bytes
   CStringW wurl(cooked);
-  wchar_t* copy  = _wcsdup(wurl.GetString());
+  if((size_t)wurl.GetLength() * sizeof(wchar_t) > HEADER_MAXIMUM_LENGTH)
+  {
+    throw ERROR_HTTP_INVALID_HEADER;
+  }
+  wchar_t* copy  = m_arena.Duplicate(wurl.GetString(),(size_t)wurl.GetLength());
   m_request.CookedUrl.pFullUrl = copy;
   m_request.CookedUrl.FullUrlLength = (USHORT) (wcslen(m_request.CookedUrl.pFullUrl) * sizeof(wchar_t));
 
@@ -1239,53 +1421,6 @@ Request::FindProtocol(LPCSTR p_protocol)
   throw ERROR_HTTP_INVALID_HEADER;
 }
 
-// Known headers for a HTTP call from client to server
-//
-static LPCTSTR all_headers[] =
-{
-  _T("Cache-Control")         //  HttpHeaderCacheControl          = 0,    // general-header [section 4.5]
- ,_T("Connection")            //  HttpHeaderConnection            = 1,    // general-header [section 4.5]
- ,_T("Date")                  //  HttpHeaderDate                  = 2,    // general-header [section 4.5]
- ,_T("Keep-Alive")            //  HttpHeaderKeepAlive             = 3,    // general-header [not in rfc]
- ,_T("Pragma")                //  HttpHeaderPragma                = 4,    // general-header [section 4.5]
- ,_T("Trailer")               //  HttpHeaderTrailer               = 5,    // general-header [section 4.5]
- ,_T("Transfer-Encoding")     //  HttpHeaderTransferEncoding      = 6,    // general-header [section 4.5]
- ,_T("Upgrade")               //  HttpHeaderUpgrade               = 7,    // general-header [section 4.5]
- ,_T("Via")                   //  HttpHeaderVia                   = 8,    // general-header [section 4.5]
- ,_T("Warning")               //  HttpHeaderWarning               = 9,    // general-header [section 4.5]
- ,_T("Allow")                 //  HttpHeaderAllow                 = 10,   // entity-header  [section 7.1]
- ,_T("Content-Length")        //  HttpHeaderContentLength         = 11,   // entity-header  [section 7.1]
- ,_T("Content-Type")          //  HttpHeaderContentType           = 12,   // entity-header  [section 7.1]
- ,_T("Content-Encoding")      //  HttpHeaderContentEncoding       = 13,   // entity-header  [section 7.1]
- ,_T("Content-Language")      //  HttpHeaderContentLanguage       = 14,   // entity-header  [section 7.1]
- ,_T("Content-Location")      //  HttpHeaderContentLocation       = 15,   // entity-header  [section 7.1]
- ,_T("Content-Md5")           //  HttpHeaderContentMd5            = 16,   // entity-header  [section 7.1]
- ,_T("Content-Range")         //  HttpHeaderContentRange          = 17,   // entity-header  [section 7.1]
- ,_T("Expires")               //  HttpHeaderExpires               = 18,   // entity-header  [section 7.1]
- ,_T("Last-Modified")         //  HttpHeaderLastModified          = 19,   // entity-header  [section 7.1]
- ,_T("Accept")                //  HttpHeaderAccept                = 20,   // request-header [section 5.3]
- ,_T("Accept-Charset")        //  HttpHeaderAcceptCharset         = 21,   // request-header [section 5.3]
- ,_T("Accept-Encoding")       //  HttpHeaderAcceptEncoding        = 22,   // request-header [section 5.3]
- ,_T("Accept-Language")       //  HttpHeaderAcceptLanguage        = 23,   // request-header [section 5.3]
- ,_T("Authorization")         //  HttpHeaderAuthorization         = 24,   // request-header [section 5.3]
- ,_T("Cookie")                //  HttpHeaderCookie                = 25,   // request-header [not in rfc]
- ,_T("Expect")                //  HttpHeaderExpect                = 26,   // request-header [section 5.3]
- ,_T("From")                  //  HttpHeaderFrom                  = 27,   // request-header [section 5.3]
- ,_T("Host")                  //  HttpHeaderHost                  = 28,   // request-header [section 5.3]
- ,_T("If-Match")              //  HttpHeaderIfMatch               = 29,   // request-header [section 5.3]
- ,_T("If-Modified-Since")     //  HttpHeaderIfModifiedSince       = 30,   // request-header [section 5.3]
- ,_T("If-None-Match")         //  HttpHeaderIfNoneMatch           = 31,   // request-header [section 5.3]
- ,_T("If-Range")              //  HttpHeaderIfRange               = 32,   // request-header [section 5.3]
- ,_T("If-Unmodified-Since")   //  HttpHeaderIfUnmodifiedSince     = 33,   // request-header [section 5.3]
- ,_T("Max-Forwards")          //  HttpHeaderMaxForwards           = 34,   // request-header [section 5.3]
- ,_T("Proxy-Authorization")   //  HttpHeaderProxyAuthorization    = 35,   // request-header [section 5.3]
- ,_T("Referer")               //  HttpHeaderReferer               = 36,   // request-header [section 5.3]
- ,_T("Header-Range")          //  HttpHeaderRange                 = 37,   // request-header [section 5.3]
- ,_T("Te")                    //  HttpHeaderTe                    = 38,   // request-header [section 5.3]
- ,_T("Translate")             //  HttpHeaderTranslate             = 39,   // request-header [webDAV, not in RFC 2518]
- ,_T("UserAgent")             //  HttpHeaderUserAgent             = 40,   // request-header [section 5.3]
-};
-
 // Known headers for a HTTP response from server back to the client 
 // Range  0-19 are identical to the request headers
 // Range 20-29 are only used in responses
@@ -1305,37 +1440,15 @@ static LPCTSTR all_responses[] =
  ,_T("WWW-Authenticate")      //  HttpHeaderWwwAuthenticate       = 29,   // response-header [section 6.2]
 };
 
-// Finding a 'known' header on the current header line.
-int
-Request::FindKnownHeader(LPSTR p_header)
-{
-  USES_CONVERSION;
-  XString header(A2CT(p_header));
-  // skip whitespace before and after the header name
-  header.Trim();
-
-  // Find known header
-  for(int ind = 0;ind < HttpHeaderRequestMaximum; ++ind)
-  {
-    if(header.CompareNoCase(all_headers[ind]) == 0)
-    {
-      return ind;
-    }
-  }
-  // Nothing found
-  return -1;
-}
-
 // Find our connection settings. can have two values:
 // keep-alive  -> Keep socket connection open
 // close       -> Close connection after servicing the request
 void
 Request::FindKeepAlive()
 {
-  USES_CONVERSION;
-  XString connection = A2T((LPSTR)m_request.Headers.KnownHeaders[HttpHeaderConnection].pRawValue);
-  connection.Trim();
-  m_keepAlive = connection.CompareNoCase(_T("keep-alive")) == 0;
+  // Value is already trimmed by the header parser
+  PCSTR connection = m_request.Headers.KnownHeaders[HttpHeaderConnection].pRawValue;
+  m_keepAlive = connection && _stricmp(connection,"keep-alive") == 0;
 }
 
 // Reply with a client error in the range 400 - 499
@@ -1426,8 +1539,8 @@ Request::ReplyServerError()
 int
 Request::CopyInitialBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes)
 {
-  // Calculate how much we have left in the buffer
-  ULONG length = m_initialLength - m_bufferPosition;
+  // Calculate how much we have left in the buffer (of this request's body)
+  ULONG length = m_bodyLimit - m_bufferPosition;
 
   // Test if we can copy the buffer in ONE go!
   if(length > p_size)
@@ -1445,8 +1558,9 @@ Request::CopyInitialBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes)
   }
 
   // OK, We have enough buffer. Do it in one go, and be done with the buffer
+  // The buffer itself stays until the next request: the headers live in it!
   memcpy_s(p_buffer,length,&m_initialBuffer[m_bufferPosition],length);
-  FreeInitialBuffer();
+  m_bufferPosition = m_bodyLimit;
   if (p_bytes)
   {
     *p_bytes = length;
@@ -1869,78 +1983,254 @@ Request::SendEntityChunkFromMemory(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes)
   return result;
 }
 
+// Send (part of) a file. Also used for range requests.
+// Plain HTTP lets the kernel send the file, HTTPS must encrypt it first.
 int
 Request::SendEntityChunkFromFile(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes)
 {
-  char buffer[FILE_BUFFER_LENGTH];
+  HANDLE file = p_chunk->FromFileHandle.FileHandle;
 
   // Getting the total file size
-  DWORD fhigh = 0;
-  DWORD fsize = GetFileSize(p_chunk->FromFileHandle.FileHandle,&fhigh);
-  ULONGLONG totalSize = ((ULONGLONG)fhigh << 32) | (ULONGLONG)fsize;
+  LARGE_INTEGER fileSize;
+  if(GetFileSizeEx(file,&fileSize) == FALSE)
+  {
+    return ERROR_FILE_CORRUPT;
+  }
+  ULONGLONG totalSize = (ULONGLONG)fileSize.QuadPart;
 
   // Begin and length of the part of the file to send
   ULONGLONG begin  = p_chunk->FromFileHandle.ByteRange.StartingOffset.QuadPart;
   ULONGLONG length = p_chunk->FromFileHandle.ByteRange.Length.QuadPart;
 
-  // If no file length given, use the whole file
-  if(length == 0L)
+  if(begin > totalSize)
   {
-    length = totalSize;
+    return ERROR_HANDLE_EOF;
   }
-  else if(begin + length > totalSize)
+  // If no file length given, use the rest of the file
+  if(length == 0L || length == HTTP_BYTE_RANGE_TO_EOF || length > totalSize - begin)
   {
     length = totalSize - begin;
   }
 
-  // Set file pointer to the beginning of the sending part
-  LONG beginHigh = (DWORD)(begin >> 32);
-  if(SetFilePointer(p_chunk->FromFileHandle.FileHandle,begin & 0xFFFFFFFF,&beginHigh,FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+  ULONGLONG size   = 0L;
+  int       result = ERROR_NOT_SUPPORTED;
+
+  if(!m_secure)
   {
-    return ERROR_HANDLE_EOF;
+    result = SendFileByTransmitFunction(file,begin,length,size);
+  }
+  if(result == ERROR_NOT_SUPPORTED)
+  {
+    result = SendFileByMemoryBlocks(file,begin,length,size);
+  }
+  if(result != NO_ERROR)
+  {
+    return result;
   }
 
-  ULONGLONG size = 0L;
+  // Add to the result of the other chunks
+  // The count of the API is a ULONG: it saturates for files over 4 GB
+  if(p_bytes)
+  {
+    ULONGLONG total = (ULONGLONG)*p_bytes + size;
+    *p_bytes = total > MAXULONG ? MAXULONG : (ULONG)total;
+  }
+  return NO_ERROR;
+}
 
-  // Sending loop: read buffer, send buffer
-  while(size < length)
+// Zero-copy: the kernel reads the file and sends it to the socket.
+// Sends in blocks, so a block never waits longer than the minimum
+// send rate allows. Returns ERROR_NOT_SUPPORTED if nothing was sent
+// and the caller should copy the file through memory instead.
+int
+Request::SendFileByTransmitFunction(HANDLE p_file,ULONGLONG p_begin,ULONGLONG p_length,ULONGLONG& p_size)
+{
+  PlainSocket* socket = reinterpret_cast<PlainSocket*>(m_socket);
+  if(socket == nullptr)
   {
-    // Calculate next block size
-    ULONG blocksize = FILE_BUFFER_LENGTH;
-    if((ULONG)(length - size) < FILE_BUFFER_LENGTH)
+    return SOCKET_ERROR;
+  }
+  SOCKET actual = socket->GetActualSocket();
+  PointTransmitFile transmit = m_queue->GetTransmitFile(actual);
+  if(transmit == nullptr)
+  {
+    return ERROR_NOT_SUPPORTED;
+  }
+
+  OVERLAPPED overlapped;
+  ZeroMemory(&overlapped,sizeof(OVERLAPPED));
+  overlapped.hEvent = ::CreateEvent(nullptr,TRUE,FALSE,nullptr);
+  if(overlapped.hEvent == NULL)
+  {
+    return ERROR_NOT_SUPPORTED;
+  }
+
+  int result = NO_ERROR;
+  while(p_size < p_length)
+  {
+    DWORD block = FILE_TRANSMIT_LENGTH;
+    if(p_length - p_size < FILE_TRANSMIT_LENGTH)
     {
-      blocksize = (ULONG)(length - size);
+      block = (DWORD)(p_length - p_size);
     }
+    DWORD timeout = (m_listener->GetSendTimeoutSeconds() + block / URL_DEFAULT_MIN_SEND_RATE) * CLOCKS_PER_SEC;
+
+    ULONGLONG offset = p_begin + p_size;
+    overlapped.Offset     = (DWORD)(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    ResetEvent(overlapped.hEvent);
 
-    // Read next block size
-    ULONG didread = 0L;
-    if(ReadFile(p_chunk->FromFileHandle.FileHandle,buffer,blocksize,&didread, nullptr) == FALSE)
+    DWORD sent  = 0;
+    DWORD flags = 0;
+    if(transmit(actual,p_file,block,0,&overlapped,nullptr,0) == FALSE)
     {
-      return ERROR_FILE_CORRUPT;
+      int error = WSAGetLastError();
+      if(error != WSA_IO_PENDING && error != ERROR_IO_PENDING)
+      {
+        result = (p_size == 0) ? ERROR_NOT_SUPPORTED : error;
+        break;
+      }
+      if(WaitForSingleObject(overlapped.hEvent,timeout) != WAIT_OBJECT_0)
+      {
+        CancelIoEx((HANDLE)actual,&overlapped);
+        WSAGetOverlappedResult(actual,&overlapped,&sent,TRUE,&flags);
+        result = WSAETIMEDOUT;
+        break;
+      }
+    }
+    if(WSAGetOverlappedResult(actual,&overlapped,&sent,FALSE,&flags) == FALSE)
+    {
+      result = WSAGetLastError();
+      break;
+    }
+    if(sent == 0)
+    {
+      result = ERROR_HANDLE_EOF;
+      break;
     }
+    p_size         += sent;
+    m_bytesWritten += sent;
+  }
+  CloseHandle(overlapped.hEvent);
 
-    // Send next block size
-    ULONG written = 0;
-    int result = WriteBuffer(buffer,didread,&written);
-    if (result != NO_ERROR)
+  if(result != NO_ERROR && result != ERROR_NOT_SUPPORTED)
+  {
+    LogError(_T("Transmitting file to connection: %s Error: %d"),m_request.pRawUrl,result);
+  }
+  // Keep track of service status
+  if((m_status == RQ_WRITING) && m_contentLength && m_bytesWritten >= m_contentLength)
+  {
+    m_status = RQ_SERVICED;
+  }
+  return result;
+}
+
+// Copy the file through memory, so it can be encrypted on the way.
+// Two buffers: while one is being sent, the next block is read ahead.
+int
+Request::SendFileByMemoryBlocks(HANDLE p_file,ULONGLONG p_begin,ULONGLONG p_length,ULONGLONG& p_size)
+{
+  // Read on our own overlapped handle if possible, so the reads run in parallel.
+  // Otherwise the overlapped reads on the callers handle complete synchronously.
+  HANDLE reader = ReOpenFile(p_file,GENERIC_READ,FILE_SHARE_READ | FILE_SHARE_WRITE,FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN);
+  HANDLE file   = (reader == INVALID_HANDLE_VALUE) ? p_file : reader;
+
+  BYTE*      buffers[2] = { nullptr,nullptr };
+  OVERLAPPED overlapped[2];
+  ZeroMemory(overlapped,sizeof(overlapped));
+
+  int result = NO_ERROR;
+  buffers[0] = alloc_new BYTE[FILE_READAHEAD_LENGTH];
+  buffers[1] = alloc_new BYTE[FILE_READAHEAD_LENGTH];
+  overlapped[0].hEvent = ::CreateEvent(nullptr,TRUE,FALSE,nullptr);
+  overlapped[1].hEvent = ::CreateEvent(nullptr,TRUE,FALSE,nullptr);
+
+  // Start reading the block at the offset in this buffer
+  auto startRead = [&](int p_index,ULONGLONG p_offset) -> ULONG
+  {
+    ULONG blocksize = FILE_READAHEAD_LENGTH;
+    if(p_length - p_offset < FILE_READAHEAD_LENGTH)
     {
-      return result;
+      blocksize = (ULONG)(p_length - p_offset);
     }
+    ULONGLONG position = p_begin + p_offset;
+    overlapped[p_index].Offset     = (DWORD)(position & 0xFFFFFFFF);
+    overlapped[p_index].OffsetHigh = (DWORD)(position >> 32);
+    ResetEvent(overlapped[p_index].hEvent);
 
-    // Keep record of how much we already did
-    size += written;
+    if(ReadFile(file,buffers[p_index],blocksize,nullptr,&overlapped[p_index]) == FALSE &&
+       GetLastError() != ERROR_IO_PENDING)
+    {
+      return 0;
+    }
+    return blocksize;
+  };
+
+  if(overlapped[0].hEvent == NULL || overlapped[1].hEvent == NULL)
+  {
+    result = ERROR_OUTOFMEMORY;
   }
+  else if(p_length > 0)
+  {
+    int       current = 0;
+    ULONGLONG offset  = 0;
+    ULONG     pending = startRead(current,offset);
 
-  // Tell the result
-  if(p_bytes)
+    while(pending)
+    {
+      // Wait for the current block
+      DWORD didread = 0;
+      if(GetOverlappedResult(file,&overlapped[current],&didread,TRUE) == FALSE || didread == 0)
+      {
+        result  = ERROR_FILE_CORRUPT;
+        pending = 0;
+        break;
+      }
+      // Read ahead into the other buffer, while we are sending
+      offset += didread;
+      pending = (offset < p_length) ? startRead(1 - current,offset) : 0;
+
+      // Send this block
+      ULONG written = 0;
+      result = WriteBuffer(buffers[current],didread,&written);
+      if(result != NO_ERROR)
+      {
+        break;
+      }
+      // Keep record of how much we already did
+      p_size += written;
+      current = 1 - current;
+    }
+    if(pending)
+    {
+      // Stopped with a read in progress
+      CancelIoEx(file,&overlapped[1 - current]);
+      DWORD didread = 0;
+      GetOverlappedResult(file,&overlapped[1 - current],&didread,TRUE);
+    }
+    if(result == NO_ERROR && p_size < p_length)
+    {
+      result = ERROR_FILE_CORRUPT;
+    }
+  }
+
+  for(int index = 0;index < 2;++index)
   {
-    *p_bytes = (ULONG)size;
+    if(overlapped[index].hEvent)
+    {
+      CloseHandle(overlapped[index].hEvent);
+    }
+    delete [] buffers[index];
   }
-  return NO_ERROR;
+  if(reader != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(reader);
+  }
+  return result;
 }
 
 // Sending one (1) fragment from the general fragment cache
-// This is done by relaying the buffer to sending a chunk from memory.
+// Sends straight from the cached buffer, which we hold on to while sending.
 int
 Request::SendEntityChunkFromFragment(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes)
 {
@@ -1948,10 +2238,12 @@ Request::SendEntityChunkFromFragment(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes)
   XString prefix(W2A(p_chunk->FromFragmentCache.pFragmentName));
 
   // Find memory chunk
-  PHTTP_DATA_CHUNK chunk = m_queue->FindFragment(prefix);
-  if(chunk)
+  Fragment* fragment = m_queue->FindFragment(prefix);
+  if(fragment)
   {
-    return SendEntityChunkFromMemory(chunk,p_bytes);
+    int result = WriteBuffer(fragment->GetData(),fragment->GetLength(),p_bytes);
+    fragment->Release();
+    return result;
   }
   // Log error : Chunk not found
   LogError(_T("Data chunk [%s] not found"),prefix.GetString());
@@ -1960,7 +2252,7 @@ Request::SendEntityChunkFromFragment(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes)
 
 // Sending one (1) fragment from the general fragment cache
 // while defining a specific part of the fragment (begin / length)
-// This is done by relaying the buffer to sending a chunk from memory.
+// Sends straight from the cached buffer, which we hold on to while sending.
 int
 Request::SendEntityChunkFromFragmentEx(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes)
 {
@@ -1968,26 +2260,28 @@ Request::SendEntityChunkFromFragmentEx(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes)
   XString prefix(W2A(p_chunk->FromFragmentCacheEx.pFragmentName));
 
   // Find memory chunk
-  PHTTP_DATA_CHUNK chunk = m_queue->FindFragment(prefix);
-  if (chunk)
+  Fragment* fragment = m_queue->FindFragment(prefix);
+  if(fragment)
   {
-    DWORD start = p_chunk->FromFragmentCacheEx.ByteRange.StartingOffset.LowPart;
-    DWORD end   = p_chunk->FromFragmentCacheEx.ByteRange.Length.LowPart;
+    ULONGLONG size   = fragment->GetLength();
+    ULONGLONG start  = p_chunk->FromFragmentCacheEx.ByteRange.StartingOffset.QuadPart;
+    ULONGLONG length = p_chunk->FromFragmentCacheEx.ByteRange.Length.QuadPart;
+    if(length == HTTP_BYTE_RANGE_TO_EOF && start < size)
+    {
+      length = size - start;
+    }
 
-    if(start < chunk->FromMemory.BufferLength && 
-       end   < chunk->FromMemory.BufferLength &&
-       start < end)
+    int result = ERROR_RANGE_NOT_FOUND;
+    if(start < size && length > 0 && length <= size - start)
     {
-      ULONG written = 0;
-      int result = WriteBuffer((PVOID)&(((char*)chunk->FromMemory.pBuffer)[start]),end - start,&written);
-      if (result == NO_ERROR)
-      {
-        *p_bytes += written;
-      }
-      return result;
+      result = WriteBuffer((BYTE*)fragment->GetData() + start,(ULONG)length,p_bytes);
+    }
+    else
+    {
+      LogError(_T("Data chunk [%s] out of range"),prefix.GetString());
     }
-    LogError(_T("Data chunk [%s] out of range"),prefix.GetString());
-    return ERROR_RANGE_NOT_FOUND;
+    fragment->Release();
+    return result;
   }
   // Log error : Chunk not found
   LogError(_T("Data chunk [%s] not found"),prefix.GetString());
@@ -2056,6 +2350,11 @@ Request::ReadBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes)
   {
     return SOCKET_ERROR;
   }
+  // Body rate is measured from the first read on
+  if(m_bodyStart == 0)
+  {
+    m_bodyStart = GetTickCount64();
+  }
   int result = m_socket->RecvPartial(p_buffer,p_size);
   if (result == SOCKET_ERROR)
   {
@@ -2069,6 +2368,11 @@ Request::ReadBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes)
   m_bytesRead += result;
   *p_bytes     = result;
 
+  // Shed clients that send too slow
+  if(!CheckBodyRate())
+  {
+    return WSAETIMEDOUT;
+  }
   return NO_ERROR;
 }
 
@@ -2121,6 +2425,72 @@ Request::WriteBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes)
   return NO_ERROR;;
 }
 
+// Gathered write to the socket of an optional header buffer and
+// the leading memory chunks (at most REQUEST_GATHER_BUFFERS buffers).
+// Returns the number of chunks consumed in "p_used"
+int
+Request::WriteGathered(PVOID            p_header
+                      ,ULONG            p_headerLength
+                      ,PHTTP_DATA_CHUNK p_chunks
+                      ,int              p_count
+                      ,int&             p_used
+                      ,PULONG           p_bytes)
+{
+  p_used = 0;
+  if(m_socket == nullptr)
+  {
+    return SOCKET_ERROR;
+  }
+  WSABUF buffers[REQUEST_GATHER_BUFFERS];
+  ULONG  count = 0;
+
+  if(p_header && p_headerLength)
+  {
+    buffers[count].buf = (char*)p_header;
+    buffers[count].len = p_headerLength;
+    ++count;
+  }
+  while(p_used < p_count && count < REQUEST_GATHER_BUFFERS &&
+        p_chunks[p_used].DataChunkType == HttpDataChunkFromMemory)
+  {
+    buffers[count].buf = (char*)p_chunks[p_used].FromMemory.pBuffer;
+    buffers[count].len = p_chunks[p_used].FromMemory.BufferLength;
+    ++count;
+    ++p_used;
+  }
+  if(count == 0)
+  {
+    return NO_ERROR;
+  }
+
+  int result = m_socket->SendMsgGather(buffers,count);
+  if (result == SOCKET_ERROR)
+  {
+    // Log the error
+    int error = WSAGetLastError();
+    LogError(_T("Writing to connection: %s Error: %d"), m_request.pRawUrl,error);
+    return error;
+  }
+
+  // Keep track of bytes written. Only the body counts for the content length
+  if (result > 0)
+  {
+    *p_bytes += result;
+    if((ULONG)result > p_headerLength)
+    {
+      m_bytesWritten += (ULONG)result - p_headerLength;
+    }
+  }
+
+  // Keep track of service status
+  // Does **not** happen for RQ_OPAQUE mode!!
+  if((m_status == RQ_WRITING) && m_contentLength && m_bytesWritten >= m_contentLength)
+  {
+    m_status = RQ_SERVICED;
+  }
+  return NO_ERROR;
+}
+
 // Register the fact that the request starts a WebSocket
 void
 Request::CreateWebSocket()
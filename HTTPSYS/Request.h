@@ -11,15 +11,25 @@
 #define SECURITY_WIN32
 #include <sspi.h>
 #include <time.h>
+#include "RequestArena.h"
 
 // Test to see if it is still a request object
 #define HTTP_REQUEST_IDENT 0x00EDED0000EDED00
 
 // For header lines (minimum to impose)
 #define MESSAGE_BUFFER_LENGTH (16*1024)
+// Unknown headers stored in the request object itself, before using the heap
+#define REQUEST_UNKNOWN_HEADERS 32
 // For files, the buffer should be arbitrarily shorter than the maximum TCP/IP frame
 // To accommodate the header blocks of the TCP/IP stack ( a few hundred bytes)
 #define FILE_BUFFER_LENGTH    (16*1000)
+// Read-ahead buffers for encrypted file sending (two of them)
+#define FILE_READAHEAD_LENGTH (128*1024)
+// Bytes handed to the kernel per call of TransmitFile
+#define FILE_TRANSMIT_LENGTH  (1024*1024)
+
+// Maximum number of memory buffers in one gathered write to the socket
+#define REQUEST_GATHER_BUFFERS 16
 
 // Minimum timeout for HTTP body receiving in seconds
 #define HTTP_MINIMUM_TIMEOUT 10 
@@ -29,6 +39,7 @@
 typedef enum _rq_status
 {
   RQ_CREATED    // Object created and initialized
+ ,RQ_PARKED     // Idle connection parked in the connection engine
  ,RQ_RECEIVED   // Fully received + headers. Waiting to be serviced
  ,RQ_READING    // Server is busy reading the request body
  ,RQ_ANSWERING  // Server is busy answering with a response header
@@ -52,10 +63,17 @@ public:
          ,HANDLE        p_stopEvent);
  ~Request();
 
+  // Request objects come from (and go back to) the request pool
+  static void*      operator new   (size_t p_size);
+  static void*      operator new   (size_t p_size,int p_block,const char* p_file,int p_line);
+  static void       operator delete(void* p_memory);
+  static void       operator delete(void* p_memory,int p_block,const char* p_file,int p_line);
+
   // SETTERS
   void              SetStatus(RQ_Status p_status)             { m_status                = p_status;  }
   void              SetURLContext(HTTP_URL_CONTEXT p_context) { m_request.UrlContext    = p_context; }
   void              SetBytesRead(ULONG p_bytes)               { m_request.BytesReceived = p_bytes;   }
+  void              SetSourceCounted(bool p_counted)          { m_sourceCounted         = p_counted; }
 
   // GETTERS
   ULONGLONG         GetIdent()          { return m_ident;               }
@@ -68,6 +86,9 @@ public:
   ULONGLONG         GetContentLength()  { return m_contentLength;       }
   Listener*         GetListener()       { return m_listener;            }
   HANDLE            GetAccessToken()    { return m_token;               }
+  ULONGLONG         GetHeaderDeadline() { return m_headerDeadline;      }
+  bool              HasPipelinedRequest() { return m_pipelineLength > 0; }
+  PSOCKADDR         GetRemoteAddress()  { return (PSOCKADDR)&m_remoteAddress; }
   SYSWebSocket*     GetWebSocket()      { return m_websocket;           }
   bool              GetResponseComplete();
   XString           GetHostName();
@@ -102,22 +123,24 @@ private:
   void              SetTimings();
   void              InitiateSSL();
   // Header lines
-  void              ReceiveHeaders();
-  void              ReadInitialMessage();
-  LPSTR             ReadTextLine();
+  bool              ReceiveHeaders();
+  bool              ReadInitialMessage();
+  bool              FindHeaderEnd(ULONG p_from);
+  void              StartHeaderDeadline();
+  bool              CheckBodyRate();
+  LPSTR             ReadTextLine(ULONG& p_length);
   void              ReceiveHTTPLine(LPSTR p_line);
-  void              ProcessHeader(LPSTR p_line);
+  void              ProcessHeader(LPSTR p_line,ULONG p_length);
   void              FindContentLength();
   void              CorrectFullURL();
   int               CopyInitialBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes);
   void              FreeInitialBuffer();
+  void              KeepPipelinedRequest();
 
   // Cooking the URL
   void              FindVerb(LPSTR p_verb);
   void              FindURL (LPSTR p_url);
   void              FindProtocol(LPCSTR p_protocol);
-  // Finding the known header names
-  int               FindKnownHeader(LPSTR p_header);
   void              FindKeepAlive();
   // Authentication of the request
   bool              CheckAuthentication();
@@ -139,14 +162,15 @@ private:
   int               SendEntityChunkFromFragment  (PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes);
   int               SendEntityChunkFromFragmentEx(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes);
   // File sending sub functions
-//int               SendFileByTransmitFunction(PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes);
-//int               SendFileByMemoryBlocks    (PHTTP_DATA_CHUNK p_chunk,PULONG p_bytes);
+  int               SendFileByTransmitFunction(HANDLE p_file,ULONGLONG p_begin,ULONGLONG p_length,ULONGLONG& p_size);
+  int               SendFileByMemoryBlocks    (HANDLE p_file,ULONGLONG p_begin,ULONGLONG p_length,ULONGLONG& p_size);
 
   // Reading and writing
   int               WriteBuffer(const XString& p_string,PULONG p_bytes);
   // Low level reading and writing
   int               ReadBuffer (PVOID p_buffer,ULONG p_size,PULONG p_bytes);
   int               WriteBuffer(PVOID p_buffer,ULONG p_size,PULONG p_bytes);
+  int               WriteGathered(PVOID p_header,ULONG p_headerLength,PHTTP_DATA_CHUNK p_chunks,int p_count,int& p_used,PULONG p_bytes);
 
   // WebSockets
   void              CreateWebSocket();
@@ -162,10 +186,11 @@ private:
   bool              m_secure;         // HTTPS (secure) or not (HTTP)
   bool              m_handshakeDone;  // HTTPS initial handshake done for socket
   ULONG             m_bytesRead;      // Total number of bytes read so far
-  ULONG             m_bytesWritten;   // Total number of bytes written so far
+  ULONGLONG         m_bytesWritten;   // Total number of bytes written so far
   SocketStream*     m_socket;         // Socket used to communicate with the client
   USHORT            m_port;           // Port the request came from
   ULONGLONG         m_contentLength;  // Content length to be read or write
+  bool              m_chunked { false }; // Request body has a transfer-encoding
   bool              m_keepAlive;      // Keep connection alive
   URL*              m_url;            // URL with longest matching absolute path
   // SSPI authentication handlers
@@ -174,9 +199,25 @@ private:
   clock_t           m_timestamp;      // Time of the authentication
   HANDLE            m_token;          // Primary authentication token
   // Initial buffer (Header and optional first body part) are cached here
+  // All header names and values of the request point into this buffer
   BYTE*             m_initialBuffer { 0 };
+  ULONG             m_initialSize   { 0 };
   ULONG             m_initialLength { 0 };
   ULONG             m_bufferPosition{ 0 };
+  ULONG             m_bodyLimit     { 0 };      // End of this request's body in the buffer
+  ULONG             m_pipelineLength{ 0 };      // Bytes of the next (pipelined) request
+  bool              m_headerPending { false };  // Header lines not yet complete
+  ULONGLONG         m_headerDeadline{ 0 };      // Tick count for all header lines to arrive
+  ULONGLONG         m_bodyStart     { 0 };      // Tick count of the first body read
+  bool              m_sourceCounted { false };  // Counted in the connections per address
+  // Unknown headers: in place, or in the arena if the request has more of them
+  HTTP_UNKNOWN_HEADER m_unknownHeaders[REQUEST_UNKNOWN_HEADERS];
+  USHORT            m_unknownCapacity { REQUEST_UNKNOWN_HEADERS };
+  // All other strings and tables of one request. Rewound between requests
+  RequestArena      m_arena;
+  // Addresses of the connection
+  SOCKADDR_STORAGE  m_localAddress;
+  SOCKADDR_STORAGE  m_remoteAddress;
   // WebSocket
   bool              m_websocketPrepare;
   XString           m_websocketKey;
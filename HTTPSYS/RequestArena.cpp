@@ -0,0 +1,219 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "RequestArena.h"
+#include <malloc.h>
+
+// All request objects come from here
+RequestPool g_requestPool;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// REQUEST ARENA
+//
+//////////////////////////////////////////////////////////////////////////
+
+RequestArena::RequestArena()
+{
+  m_current = m_inline;
+  m_end     = m_inline + REQUEST_ARENA_BLOCK;
+}
+
+RequestArena::~RequestArena()
+{
+  Reset();
+}
+
+// Bump allocation from the current block.
+// Throws ERROR_OUTOFMEMORY, just like the header parsing does
+void*
+RequestArena::Allocate(size_t p_size)
+{
+  p_size = (p_size + REQUEST_ARENA_ALIGN - 1) & ~((size_t)REQUEST_ARENA_ALIGN - 1);
+  if(p_size == 0)
+  {
+    p_size = REQUEST_ARENA_ALIGN;
+  }
+  if((size_t)(m_end - m_current) < p_size)
+  {
+    AddBlock(p_size);
+  }
+  void* memory = m_current;
+  m_current += p_size;
+  ++m_allocations;
+  return memory;
+}
+
+LPSTR
+RequestArena::Duplicate(LPCSTR p_string,size_t p_length)
+{
+  LPSTR copy = (LPSTR) Allocate(p_length + 1);
+  memcpy(copy,p_string,p_length);
+  copy[p_length] = 0;
+  return copy;
+}
+
+PWSTR
+RequestArena::Duplicate(PCWSTR p_string,size_t p_length)
+{
+  PWSTR copy = (PWSTR) Allocate((p_length + 1) * sizeof(wchar_t));
+  memcpy(copy,p_string,p_length * sizeof(wchar_t));
+  copy[p_length] = 0;
+  return copy;
+}
+
+// Rewind to the inline block.
+// Only requests that needed extra blocks have something to free
+void
+RequestArena::Reset()
+{
+  while(m_blocks)
+  {
+    ArenaBlock* next = m_blocks->b_next;
+    _aligned_free(m_blocks);
+    m_blocks = next;
+  }
+  m_current     = m_inline;
+  m_end         = m_inline + REQUEST_ARENA_BLOCK;
+  m_allocations = 0;
+}
+
+// Chain a new block from the heap. The rest of the current block is lost
+void
+RequestArena::AddBlock(size_t p_size)
+{
+  size_t header = (sizeof(ArenaBlock) + REQUEST_ARENA_ALIGN - 1) & ~((size_t)REQUEST_ARENA_ALIGN - 1);
+  size_t size   = header + (p_size > REQUEST_ARENA_GROWTH ? p_size : REQUEST_ARENA_GROWTH);
+
+  ArenaBlock* block = (ArenaBlock*) _aligned_malloc(size,REQUEST_ARENA_ALIGN);
+  if(block == nullptr)
+  {
+    throw (int)ERROR_OUTOFMEMORY;
+  }
+  block->b_next = m_blocks;
+  m_blocks      = block;
+  ++m_heapBlocks;
+  m_current     = (BYTE*)block + header;
+  m_end         = (BYTE*)block + size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// REQUEST POOL
+//
+//////////////////////////////////////////////////////////////////////////
+
+// A free message buffer remembers its own size behind the list entry
+typedef struct _pooled_buffer
+{
+  SLIST_ENTRY l_entry;
+  ULONG       l_size;
+}
+PooledBuffer;
+
+RequestPool::RequestPool()
+{
+  InitializeSListHead(&m_requests);
+  InitializeSListHead(&m_buffers);
+}
+
+RequestPool::~RequestPool()
+{
+  FreeList(&m_requests);
+  FreeList(&m_buffers);
+}
+
+void*
+RequestPool::AllocateRequest(size_t p_size)
+{
+  if(p_size == m_requestSize)
+  {
+    void* memory = InterlockedPopEntrySList(&m_requests);
+    if(memory)
+    {
+      InterlockedIncrement64((LONG64*)&m_reused);
+      return memory;
+    }
+  }
+  void* memory = _aligned_malloc(p_size,MEMORY_ALLOCATION_ALIGNMENT);
+  if(memory == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  m_requestSize = p_size;
+  InterlockedIncrement64((LONG64*)&m_created);
+  return memory;
+}
+
+void
+RequestPool::ReleaseRequest(void* p_memory)
+{
+  if(p_memory == nullptr)
+  {
+    return;
+  }
+  if(QueryDepthSList(&m_requests) < REQUEST_POOL_MAXIMUM)
+  {
+    InterlockedPushEntrySList(&m_requests,(PSLIST_ENTRY)p_memory);
+    return;
+  }
+  _aligned_free(p_memory);
+}
+
+// Buffers too small for the current maximum request bytes are dropped
+BYTE*
+RequestPool::AllocateBuffer(ULONG p_size)
+{
+  PooledBuffer* pooled = (PooledBuffer*) InterlockedPopEntrySList(&m_buffers);
+  if(pooled)
+  {
+    if(pooled->l_size >= p_size)
+    {
+      InterlockedIncrement64((LONG64*)&m_buffersReused);
+      return (BYTE*)pooled;
+    }
+    _aligned_free(pooled);
+  }
+  if(p_size < sizeof(PooledBuffer))
+  {
+    p_size = sizeof(PooledBuffer);
+  }
+  InterlockedIncrement64((LONG64*)&m_buffersCreated);
+  return (BYTE*) _aligned_malloc(p_size,MEMORY_ALLOCATION_ALIGNMENT);
+}
+
+void
+RequestPool::ReleaseBuffer(BYTE* p_buffer,ULONG p_size)
+{
+  if(p_buffer == nullptr)
+  {
+    return;
+  }
+  if(QueryDepthSList(&m_buffers) < REQUEST_POOL_MAXIMUM)
+  {
+    PooledBuffer* pooled = (PooledBuffer*)p_buffer;
+    pooled->l_size = p_size;
+    InterlockedPushEntrySList(&m_buffers,&pooled->l_entry);
+    return;
+  }
+  _aligned_free(p_buffer);
+}
+
+void
+RequestPool::FreeList(PSLIST_HEADER p_list)
+{
+  PSLIST_ENTRY entry = InterlockedFlushSList(p_list);
+  while(entry)
+  {
+    PSLIST_ENTRY next = entry->Next;
+    _aligned_free(entry);
+    entry = next;
+  }
+}
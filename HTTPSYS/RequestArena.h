@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// First block of the arena lives inside the request object itself
+#define REQUEST_ARENA_BLOCK    (4 * 1024)
+// Extra blocks for requests with very long URL's or many headers
+#define REQUEST_ARENA_GROWTH   (16 * 1024)
+// Alignment of every arena allocation
+#define REQUEST_ARENA_ALIGN    MEMORY_ALLOCATION_ALIGNMENT
+// Maximum number of free request objects kept for reuse
+#define REQUEST_POOL_MAXIMUM   1024
+
+// Bump allocator for all strings and tables of one request.
+// Nothing is free-ed separately: Reset() rewinds the arena between
+// two requests on a keep-alive connection. Only a request that did
+// not fit in the inline block has extra blocks to give back.
+class RequestArena
+{
+public:
+  RequestArena();
+ ~RequestArena();
+
+  void*       Allocate(size_t p_size);
+  LPSTR       Duplicate(LPCSTR p_string,size_t p_length);
+  PWSTR       Duplicate(PCWSTR p_string,size_t p_length);
+  void        Reset();
+
+  // Number of allocations since the last reset
+  ULONG       GetAllocations() { return m_allocations; }
+  // Number of extra blocks taken from the heap, ever
+  ULONGLONG   GetHeapBlocks()  { return m_heapBlocks;  }
+
+private:
+  void        AddBlock(size_t p_size);
+
+  // Header of an extra block from the heap
+  typedef struct _arena_block
+  {
+    struct _arena_block* b_next;
+  }
+  ArenaBlock;
+
+  BYTE*       m_current     { nullptr };
+  BYTE*       m_end         { nullptr };
+  ArenaBlock* m_blocks      { nullptr };
+  ULONG       m_allocations { 0 };
+  ULONGLONG   m_heapBlocks  { 0 };
+  DECLSPEC_ALIGN(REQUEST_ARENA_ALIGN) BYTE m_inline[REQUEST_ARENA_BLOCK];
+};
+
+// Free list of request objects and their message buffers.
+// Connection churn takes them from here instead of the process heap.
+class RequestPool
+{
+public:
+  RequestPool();
+ ~RequestPool();
+
+  // Memory for a request object
+  void*       AllocateRequest(size_t p_size);
+  void        ReleaseRequest(void* p_memory);
+  // Message buffer for the header lines of a request
+  BYTE*       AllocateBuffer(ULONG p_size);
+  void        ReleaseBuffer(BYTE* p_buffer,ULONG p_size);
+
+  // Statistics
+  ULONGLONG   GetCreated()        { return m_created;        }
+  ULONGLONG   GetReused()         { return m_reused;         }
+  ULONGLONG   GetBuffersCreated() { return m_buffersCreated; }
+  ULONGLONG   GetBuffersReused()  { return m_buffersReused;  }
+
+private:
+  void        FreeList(PSLIST_HEADER p_list);
+
+  SLIST_HEADER  m_requests;
+  SLIST_HEADER  m_buffers;
+  size_t        m_requestSize { 0 };
+  ULONG         m_bufferSize  { 0 };
+  ULONGLONG     m_created     { 0 };
+  ULONGLONG     m_reused      { 0 };
+  ULONGLONG     m_buffersCreated { 0 };
+  ULONGLONG     m_buffersReused  { 0 };
+};
+
+// All request objects come from here
+extern RequestPool g_requestPool;
@@ -11,12 +11,14 @@
 #include "http_private.h"
 #include "URL.h"
 #include "RequestQueue.h"
+#include "ConnectionEngine.h"
 #include "UrlGroup.h"
 #include "SYSWebSocket.h"
 #include "OpaqueHandles.h"
 #include <malloc.h>
 #include <algorithm>
 #include <winhttp.h>
+#include <VersionHelpers.h>
 #include <algorithm>
 
 // CTOR
@@ -24,17 +26,19 @@ RequestQueue::RequestQueue(const XString& p_name)
 {
   m_name = p_name;
   InitializeCriticalSection(&m_lock);
+  CreateShards();
   CreateEvent();
 }
 
 RequestQueue::~RequestQueue()
 {
   StopAllListeners();
-  DeleteAllFragments();
+  m_fragments.Clear();
   ClearIncomingWaiters();
   DeleteAllWaiters();
   DeleteAllServicing();
   DeleteAllWebSockets();
+  DeleteShards();
   DeleteCriticalSection(&m_lock);
   CloseEvent();
   CloseQueueHandle();
@@ -230,12 +234,66 @@ RequestQueue::FindListener(USHORT p_port)
   return nullptr;
 }
 
-// Add a new request to the incoming queue
+// Sum of the connection engines of all our listeners
 void
-RequestQueue::AddIncomingRequest(Request* p_request)
+RequestQueue::GetConnectionStatistics(PHTTP_CONNECTION_STATISTICS p_statistics)
+{
+  ZeroMemory(p_statistics,sizeof(HTTP_CONNECTION_STATISTICS));
+
+  for(auto& listener : m_listeners)
+  {
+    ConnectionEngine* engine = listener.second->GetConnectionEngine();
+    if(engine)
+    {
+      p_statistics->ParkedConnections += engine->GetParkedConnections();
+      p_statistics->Dispatched        += engine->GetDispatched();
+      p_statistics->ShedOverloaded    += engine->GetShed(ShedStage::Overloaded);
+      p_statistics->ShedAddress       += engine->GetShed(ShedStage::Address);
+      p_statistics->ShedHeaderWait    += engine->GetShed(ShedStage::Header);
+      p_statistics->ShedIdle          += engine->GetShed(ShedStage::Idle);
+      p_statistics->ShedBodyRate      += engine->GetShed(ShedStage::BodyRate);
+    }
+  }
+}
+
+// Resolve the TransmitFile extension of WinSock, just once.
+// Client editions of MS-Windows allow only two concurrent
+// TransmitFile operations on the whole system. So there we do not use it.
+PointTransmitFile
+RequestQueue::GetTransmitFile(SOCKET p_socket)
 {
+  if(m_transmitDone)
+  {
+    return m_transmitFile;
+  }
   AutoCritSec lock(&m_lock);
 
+  if(!m_transmitDone && IsWindowsServer())
+  {
+    GUID  guid  = WSAID_TRANSMITFILE;
+    DWORD bytes = 0;
+    PointTransmitFile function = nullptr;
+    if(WSAIoctl(p_socket
+               ,SIO_GET_EXTENSION_FUNCTION_POINTER
+               ,&guid
+               ,sizeof(GUID)
+               ,&function
+               ,sizeof(PointTransmitFile)
+               ,&bytes
+               ,nullptr
+               ,nullptr) == 0)
+    {
+      m_transmitFile = function;
+    }
+  }
+  m_transmitDone = true;
+  return m_transmitFile;
+}
+
+// Add a new request to the incoming queue
+void
+RequestQueue::AddIncomingRequest(Request* p_request)
+{
   if(m_state == HttpEnabledStateInactive)
   {
     // TODO: Report inactive server receiving calls
@@ -245,44 +303,47 @@ RequestQueue::AddIncomingRequest(Request* p_request)
   // Headers now fully received
   p_request->SetStatus(RQ_RECEIVED);
 
-  // See if there is space in the queue
-  if(m_incoming.size() < m_queueLength)
+  // See if there is space in the queue.
+  // Removed requests still hold their ring cell until a consumer passes it
+  if((ULONG)(InterlockedIncrement(&m_incomingCount) + m_removedCount) > m_queueLength)
   {
-    m_incoming.push_back(p_request);
-
-    // In the case of a Overlapped I/O request, do that first
-    // Otherwise we will hang in synchronous mode
-    if(!m_waiting.empty())
-    {
-      PREGISTER_HTTP_RECEIVE_REQUEST reg = FirstWaitingRequest();
-      if(reg)
-      {
-        StartAsyncReceiveHttpRequest(reg);
-      }
-    }
-    // Wake up waiters for the request queue
-    SetEvent(m_event);
+    // Report queue overflow = Server overflow
+    InterlockedDecrement(&m_incomingCount);
+    throw HTTP_STATUS_SERVICE_UNAVAIL;
   }
-  else
+
+  // Index first, so a consumer popping the request will find it
+  RequestShard* shard = IndexShard(p_request);
+  LONG64 ticket = shard->IndexIncoming(p_request);
+
+  if(!PushIncoming(p_request,ticket))
   {
-    // Report queue overflow = Server overflow
+    bool incoming = false;
+    shard->RemoveIndex(p_request,incoming);
+    InterlockedDecrement(&m_incomingCount);
     throw HTTP_STATUS_SERVICE_UNAVAIL;
   }
+
+  // In the case of a Overlapped I/O request, do that first
+  // Otherwise we will hang in synchronous mode
+  if(m_waitingCount > 0)
+  {
+    PREGISTER_HTTP_RECEIVE_REQUEST reg = FirstWaitingRequest();
+    if(reg)
+    {
+      StartAsyncReceiveHttpRequest(reg);
+    }
+  }
+  // Wake up waiters for the request queue
+  SetEvent(m_event);
 }
 
-// Put the request back in the servicing queue
+// Remove the request from the servicing queue
+// The connection will be parked for the next request
 bool
 RequestQueue::ResetToServicing(Request* p_request)
 {
-  AutoCritSec lock(&m_lock);
-
-  Requests::iterator it = std::find(m_servicing.begin(),m_servicing.end(),p_request);
-  if(it != m_servicing.end())
-  {
-    m_servicing.erase(it);
-    return true;
-  }
-  return false;
+  return IndexShard(p_request)->ResetServicing(p_request);
 }
 
 // Our workhorse. Implementations call this to get the next HTTP request
@@ -299,29 +360,26 @@ RequestQueue::GetNextRequest(HTTP_REQUEST_ID  RequestId
   if(RequestId == 0)
   {
     // Get a new request from the incoming queue
-    AutoCritSec lock(&m_lock);
-
-    if(m_incoming.empty())
+    // Popping it moves the request to the servicing state
+    request = PopIncoming();
+    if(request == nullptr)
     {
-      lock.Unlock();
       // Wait for event of incoming request
       result = WaitForSingleObject(m_event,INFINITE);
-      lock.Relock();
 
       // Check if server is stopping
+      if(!m_listening || result == WAIT_ABANDONED || result == WAIT_FAILED)
+      {
+        return ERROR_OPERATION_ABORTED;
+      }
       // Still no request in the queue, or event interrupted
-      if(!m_listening || m_incoming.empty() || result == WAIT_ABANDONED || result == WAIT_FAILED)
+      request = PopIncoming();
+      if(request == nullptr)
       {
         return ERROR_OPERATION_ABORTED;
       }
     }
 
-    // Move request to servicing queue
-    request = m_incoming.front();
-    m_incoming.pop_front();
-    m_servicing.push_back(request);
-    request->SetStatus(RQ_READING);
-
     // BitBlitting our request!
     memcpy_s(RequestBuffer,RequestBufferLength,request->GetV2Request(),sizeof(HTTP_REQUEST_V2));
 
@@ -423,27 +481,19 @@ RequestQueue::FindLongestURL(USHORT p_port,XString p_abspath)
 void
 RequestQueue::RemoveRequest(Request* p_request)
 {
-  AutoCritSec lock(&m_lock);
-
   // Close socket of the request
   p_request->CloseRequest();
 
-  // After servicing find the request in the servicing queue
-  Requests::iterator it = std::find(m_servicing.begin(),m_servicing.end(),p_request);
-  if(it != m_servicing.end())
-  {
-    delete p_request;
-    m_servicing.erase(it);
-    return;
-  }
-
-  // Just to be sure, also look in the incoming queue
-  it = std::find(m_incoming.begin(),m_incoming.end(),p_request);
-  if(it != m_incoming.end())
+  // After servicing find the request in the index of its shard.
+  // An incoming request stays behind in the ring, but the consumer
+  // will skip it: the ticket of that cell is no longer in the index,
+  // even if the pool hands out the same address again.
+  bool incoming = false;
+  IndexShard(p_request)->RemoveIndex(p_request,incoming);
+  if(incoming)
   {
-    delete p_request;
-    m_incoming.erase(it);
-    return;
+    InterlockedIncrement(&m_removedCount);
+    InterlockedDecrement(&m_incomingCount);
   }
 
   // Request was not found in any queue
@@ -453,107 +503,35 @@ RequestQueue::RemoveRequest(Request* p_request)
 
 // Add a fragment to the fragment cache
 ULONG
-RequestQueue::AddFragment(const XString& p_prefix, PHTTP_DATA_CHUNK p_chunk)
+RequestQueue::AddFragment(const XString& p_prefix,PHTTP_DATA_CHUNK p_chunk,ULONG p_secondsToLive)
 {
-  AutoCritSec lock(&m_lock);
-
   if(p_chunk == nullptr || p_prefix.IsEmpty())
   {
     return ERROR_INVALID_PARAMETER;
   }
-
   XString prefix(p_prefix);
   prefix.MakeLower();
-  Fragments::iterator it = m_fragments.find(prefix);
-  if(it != m_fragments.end())
-  {
-    // Make a copy of the memory data chunk
-    PHTTP_DATA_CHUNK chunk = (PHTTP_DATA_CHUNK) calloc(1,sizeof(HTTP_DATA_CHUNK));
-    if(chunk == nullptr)
-    {
-      return ERROR_OUTOFMEMORY;
-    }
-    chunk->DataChunkType = HttpDataChunkFromMemory;
-    ULONG length = p_chunk->FromMemory.BufferLength;
-    chunk->FromMemory.BufferLength =   length;
-    chunk->FromMemory.pBuffer = malloc(length + 1);
-    if(chunk->FromMemory.pBuffer == nullptr)
-    {
-      return ERROR_OUTOFMEMORY;
-    }
-    memcpy (chunk->FromMemory.pBuffer,p_chunk->FromMemory.pBuffer,length);
-    ((char*)chunk->FromMemory.pBuffer)[length] = 0;
 
-    // Add the copied chunk into the cache
-    m_fragments.insert(std::make_pair(prefix,chunk));
-    return NO_ERROR;
-  }
-  // Duplicate fragment
-  return ERROR_DUPLICATE_TAG;
+  // Add a copy of the memory data chunk into the cache
+  return m_fragments.AddFragment(prefix,p_chunk->FromMemory.pBuffer,p_chunk->FromMemory.BufferLength,p_secondsToLive);
 }
 
-// Finding a fragment in the fragment cache
-PHTTP_DATA_CHUNK
+// Find a fragment in the cache. Release it after use!
+Fragment*
 RequestQueue::FindFragment(const XString& p_prefix)
 {
-  AutoCritSec lock(&m_lock);
-
   XString prefix(p_prefix);
   prefix.MakeLower();
-  Fragments::iterator it = m_fragments.find(prefix);
-  if(it != m_fragments.end())
-  {
-    return it->second;
-  }
-  // Fragment not found
-  return nullptr;
+  return m_fragments.FindFragment(prefix);
 }
 
-// Flush (remove) a fragment from the cache
-// Removes one fragment or all descendants of it.
+// Flush a fragment, and optionally all its descendants
 ULONG
 RequestQueue::FlushFragment(const XString& p_prefix,ULONG Flags)
 {
-  AutoCritSec lock(&m_lock);
-
-  int erased = 0;
   XString prefix(p_prefix);
   prefix.MakeLower();
-
-  // Try to erase exactly this prefix from the cache
-  Fragments::iterator it = m_fragments.find(prefix);
-  if(it != m_fragments.end())
-  {
-    PHTTP_DATA_CHUNK chunk = it->second;
-    free(chunk->FromMemory.pBuffer);
-    free(chunk);
-    m_fragments.erase(it);
-    ++erased;
-  }
-
-  // Also find fragments that are descendants of the prefix given
-  if(Flags == HTTP_FLUSH_RESPONSE_FLAG_RECURSIVE)
-  {
-    Fragments::iterator fr = m_fragments.begin();
-    while(fr != m_fragments.end())
-    {
-      if(p_prefix.Compare(fr->first.Left(prefix.GetLength())) == 0)
-      {
-        PHTTP_DATA_CHUNK chunk = fr->second;
-        free(chunk->FromMemory.pBuffer);
-        free(chunk);
-        fr = m_fragments.erase(fr);
-        ++erased;
-      }
-      else
-      {
-        ++fr;
-      }
-    }
-  }
-
-  // Return flushed or no fragments found
-  return NO_ERROR;
+  return m_fragments.FlushFragment(prefix,Flags == HTTP_FLUSH_RESPONSE_FLAG_RECURSIVE);
 }
 
 // Signal all listeners to stop listening
@@ -569,10 +547,7 @@ RequestQueue::ClearIncomingWaiters()
 bool
 RequestQueue::RequestStillInService(Request* p_request)
 {
-  AutoCritSec lock(&m_lock);
-
-  Requests::iterator it = std::find(m_servicing.begin(),m_servicing.end(),p_request);
-  return it != m_servicing.end();
+  return IndexShard(p_request)->IsServicing(p_request);
 }
 
 // Demand start
@@ -675,21 +650,6 @@ RequestQueue::CloseQueueHandle()
   }
 }
 
-// Directly remove all fragments from the fragment cache
-void
-RequestQueue::DeleteAllFragments()
-{
-  AutoCritSec lock(&m_lock);
-
-  for(auto& frag : m_fragments)
-  {
-    PHTTP_DATA_CHUNK chunk = frag.second;
-    free(chunk->FromMemory.pBuffer);
-    free(chunk);
-  }
-  m_fragments.clear();
-}
-
 //////////////////////////////////////////////////////////////////////////
 //
 // OVERLAPPED I/O
@@ -703,6 +663,7 @@ RequestQueue::AddWaitingRequest(PREGISTER_HTTP_RECEIVE_REQUEST p_register)
   AutoCritSec lock(&m_lock);
 
   m_waiting.push_back(p_register);
+  InterlockedIncrement(&m_waitingCount);
 }
 
 // Return the first request to signal from the queue
@@ -717,6 +678,7 @@ RequestQueue::FirstWaitingRequest()
   {
     req = m_waiting.front();
     m_waiting.pop_front();
+    InterlockedDecrement(&m_waitingCount);
   }
   return req;
 }
@@ -731,18 +693,146 @@ RequestQueue::DeleteAllWaiters()
     delete req;
     m_waiting.pop_front();
   }
+  m_waitingCount = 0;
 }
 
 // Part of the reset procedure: Clean out the servicing requests queue
+// Requests still in the incoming rings are owned by the queue as well
 void
 RequestQueue::DeleteAllServicing()
 {
-  while(!m_servicing.empty())
+  for(auto& shard : m_shards)
+  {
+    AutoCritSec lock(&shard->m_lock);
+
+    for(auto& request : shard->m_index)
+    {
+      delete request.first;
+    }
+    shard->m_index.clear();
+    LONG64 ticket = 0;
+    while(shard->m_incoming.Pop(ticket));
+  }
+  m_incomingCount = 0;
+  m_removedCount  = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// SHARDS
+//
+//////////////////////////////////////////////////////////////////////////
+
+// One shard per processor core. Together the rings can always
+// hold the maximum queue length, even if all of the requests
+// arrive on one and the same core.
+void
+RequestQueue::CreateShards()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  ULONG shards = info.dwNumberOfProcessors;
+  if(shards < 1)
+  {
+    shards = 1;
+  }
+  if(shards > QUEUE_MAX_SHARDS)
+  {
+    shards = QUEUE_MAX_SHARDS;
+  }
+  ULONG capacity = QUEUE_MIN_RING_SIZE;
+  while(capacity * shards < HTTP_REQUEST_QUEUE_MAXIMUM)
+  {
+    capacity <<= 1;
+  }
+  for(ULONG index = 0;index < shards;++index)
+  {
+    m_shards.push_back(alloc_new RequestShard(capacity));
+  }
+}
+
+void
+RequestQueue::DeleteShards()
+{
+  for(auto& shard : m_shards)
+  {
+    delete shard;
+  }
+  m_shards.clear();
+}
+
+// The index of a request does not depend on the core,
+// but on the request itself. So we never have to dereference it.
+RequestShard*
+RequestQueue::IndexShard(Request* p_request)
+{
+  ULONG_PTR hash = reinterpret_cast<ULONG_PTR>(p_request);
+  hash ^= (hash >> 17);
+  hash ^= (hash >> 7);
+  return m_shards[hash % m_shards.size()];
+}
+
+// Push on the ring of the current core, or the next one that has room
+bool
+RequestQueue::PushIncoming(Request* p_request,LONG64 p_ticket)
+{
+  ULONG shards = (ULONG)m_shards.size();
+  ULONG start  = GetCurrentProcessorNumber() % shards;
+
+  for(ULONG index = 0;index < shards;++index)
   {
-    Request* request = m_servicing.front();
-    delete request;
-    m_servicing.pop_front();
+    if(m_shards[(start + index) % shards]->m_incoming.Push(p_request,p_ticket))
+    {
+      return true;
+    }
   }
+  return false;
+}
+
+// Pop from the ring of the current core first. If that one is empty
+// steal from the other cores. Requests that were removed while waiting
+// in a ring no longer have the ticket of their cell and are skipped.
+// The request object is never touched for those: it may be deleted,
+// or be in use by a new connection.
+Request*
+RequestQueue::PopIncoming()
+{
+  ULONG shards = (ULONG)m_shards.size();
+  ULONG start  = GetCurrentProcessorNumber() % shards;
+
+  for(ULONG index = 0;index < shards;++index)
+  {
+    Request* request = nullptr;
+    LONG64   ticket  = 0;
+    while((request = m_shards[(start + index) % shards]->m_incoming.Pop(ticket)) != nullptr)
+    {
+      if(IndexShard(request)->ClaimIncoming(request,ticket))
+      {
+        request->SetStatus(RQ_READING);
+        InterlockedDecrement(&m_incomingCount);
+        if(index > 0)
+        {
+          InterlockedIncrement64(&m_stolen);
+        }
+        return request;
+      }
+      // Ring cell of a removed request is free again
+      InterlockedDecrement(&m_removedCount);
+    }
+  }
+  return nullptr;
+}
+
+// Total contention on the rings and the shard locks
+ULONGLONG
+RequestQueue::GetContention()
+{
+  ULONGLONG total = 0;
+  for(auto& shard : m_shards)
+  {
+    total += shard->GetContention();
+  }
+  return total;
 }
 
 // Close and remove all WebSockets
@@ -11,6 +11,8 @@
 #include "URL.h"
 #include "Listener.h"
 #include "Request.h"
+#include "RequestShard.h"
+#include "FragmentCache.h"
 #include <mswsock.h>
 #include <vector>
 #include <deque>
@@ -40,18 +42,16 @@ REGISTER_HTTP_RECEIVE_REQUEST,*PREGISTER_HTTP_RECEIVE_REQUEST;
 
 using UrlGroups       = std::vector<UrlGroup*>;
 using Listeners       = std::map<USHORT,Listener*>;
-using Requests        = std::deque<Request*>;
-using Fragments       = std::map<XString,PHTTP_DATA_CHUNK>;
 using WaitingRequests = std::deque<PREGISTER_HTTP_RECEIVE_REQUEST>;
 using WebSockets      = std::map<XString,SYSWebSocket*>;
 
-typedef BOOL (* PointTransmitFile)(SOCKET hSocket,
-                                   HANDLE hFile,
-                                   DWORD nNumberOfBytesToWrite,
-                                   DWORD nNumberOfBytesPerSend,
-                                   LPOVERLAPPED lpOverlapped,
-                                   LPTRANSMIT_FILE_BUFFERS lpFileBuffers,
-                                   DWORD dwReserved);
+typedef BOOL (PASCAL* PointTransmitFile)(SOCKET hSocket,
+                                         HANDLE hFile,
+                                         DWORD nNumberOfBytesToWrite,
+                                         DWORD nNumberOfBytesPerSend,
+                                         LPOVERLAPPED lpOverlapped,
+                                         LPTRANSMIT_FILE_BUFFERS lpFileBuffers,
+                                         DWORD dwReserved);
 
 // Forward declaration to handle a request
 void StartAsyncReceiveHttpRequest(PREGISTER_HTTP_RECEIVE_REQUEST reg);
@@ -77,6 +77,10 @@ public:
   HTTP_ENABLED_STATE          GetEnabledState()     { return m_state;       }
   HANDLE                      GetIOCompletionPort() { return m_iocPort;     }
   ULONG_PTR                   GetIOCompletionKey()  { return m_iocKey;      }
+  ULONG                       GetNumberOfShards()   { return (ULONG)m_shards.size(); }
+  ULONG                       GetIncomingCount()    { return (ULONG)m_incomingCount; }
+  ULONGLONG                   GetStolen()           { return (ULONGLONG)m_stolen;    }
+  ULONGLONG                   GetContention();
 
   // SETTERS
   bool      SetEnabledState(HTTP_ENABLED_STATE p_state);
@@ -93,8 +97,11 @@ public:
   ULONG     StartListener(USHORT p_port,URL* p_url,USHORT p_timeout);
   ULONG     StopListener (USHORT p_port);
   Listener* FindListener (USHORT p_port);
+  void      GetConnectionStatistics(PHTTP_CONNECTION_STATISTICS p_statistics);
 
   HANDLE    CreateHandle();
+  // Kernel file sending (server editions of MS-Windows only)
+  PointTransmitFile GetTransmitFile(SOCKET p_socket);
   void      AddIncomingRequest(Request* p_request);
   bool      ResetToServicing  (Request* p_request);
   URL*      FindLongestURL(USHORT p_port,XString p_abspath);
@@ -113,9 +120,10 @@ public:
   ULONG     GetNextRequest(HTTP_REQUEST_ID RequestId,ULONG Flags,PHTTP_REQUEST RequestBuffer,ULONG RequestBufferLength,PULONG Bytes);
 
   // The fragment cache
-  ULONG             AddFragment  (const XString& p_prefix,PHTTP_DATA_CHUNK p_chunk);
+  ULONG             AddFragment  (const XString& p_prefix,PHTTP_DATA_CHUNK p_chunk,ULONG p_secondsToLive);
   ULONG             FlushFragment(const XString& p_prefix,ULONG Flags);
-  PHTTP_DATA_CHUNK  FindFragment (const XString& p_prefix);
+  Fragment*         FindFragment (const XString& p_prefix);
+  FragmentCache*    GetFragmentCache() { return &m_fragments; }
 
   // WebSocket functionality
   SYSWebSocket* FindWebSocket     (const XString& p_websocketKey);
@@ -126,9 +134,14 @@ public:
 private:
   void        StopAllListeners();
   ULONG       NumberOfPorts(USHORT p_port);
-  void        DeleteAllFragments();
   void        DeleteAllWaiters();
   void        DeleteAllServicing();
+  // Sharding of the queue
+  void          CreateShards();
+  void          DeleteShards();
+  RequestShard* IndexShard(Request* p_request);
+  bool          PushIncoming(Request* p_request,LONG64 p_ticket);
+  Request*      PopIncoming();
   void        DeleteAllWebSockets();
   void        CreateEvent();
   void        CloseEvent();
@@ -147,19 +160,23 @@ private:
   // All listeners
   Listeners                   m_listeners;
   bool                        m_listening { false };
-  // All requests from HTTP. Our 'real' queues
-  Requests                    m_incoming;       // Incoming (unserviced) requests
-  Requests                    m_servicing;      // Currently serviced by server
+  // All requests from HTTP. Our 'real' queues, one shard per core
+  RequestShards               m_shards;
+  volatile LONG               m_incomingCount { 0 };  // Incoming (unserviced) requests in all shards
+  volatile LONG               m_removedCount  { 0 };  // Removed while incoming, cell still in a ring
+  volatile LONG64             m_stolen        { 0 };  // Requests taken from the shard of another core
   // All WebSockets
   WebSockets                  m_websockets;
   // I/O Completion of the session registration
   HANDLE                      m_iocPort { NULL };
   ULONG_PTR                   m_iocKey  { NULL };
   // The fragment cache
-  Fragments                   m_fragments;
+  FragmentCache               m_fragments;
   PointTransmitFile           m_transmitFile { nullptr };
+  bool                        m_transmitDone { false   };
   // Waiting Overlapped I/O
   WaitingRequests             m_waiting;
+  volatile LONG               m_waitingCount { 0 };
   // Synchronization
   HANDLE                      m_start { NULL }; // Demand start event
   CRITICAL_SECTION            m_lock;           // Queue synchronization
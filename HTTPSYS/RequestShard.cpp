@@ -0,0 +1,216 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pch.h"
+#include "RequestShard.h"
+
+//////////////////////////////////////////////////////////////////////////
+//
+// RING OF INCOMING REQUESTS
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Capacity must be a power of two
+RequestRing::RequestRing(ULONG p_capacity)
+{
+  m_cells = alloc_new RingCell[p_capacity];
+  m_mask  = (LONG64)p_capacity - 1;
+
+  for(ULONG index = 0;index < p_capacity;++index)
+  {
+    m_cells[index].c_sequence = index;
+    m_cells[index].c_request  = nullptr;
+    m_cells[index].c_ticket   = 0;
+  }
+}
+
+RequestRing::~RequestRing()
+{
+  delete [] m_cells;
+}
+
+// Returns false if the ring is full
+bool
+RequestRing::Push(Request* p_request,LONG64 p_ticket)
+{
+  RingCell* cell = nullptr;
+  LONG64 position = ReadAcquire64(&m_enqueue);
+
+  while(true)
+  {
+    cell = &m_cells[position & m_mask];
+    LONG64 sequence = ReadAcquire64(&cell->c_sequence);
+    LONG64 diff = sequence - position;
+
+    if(diff == 0)
+    {
+      // Slot is free: try to claim it
+      if(InterlockedCompareExchange64(&m_enqueue,position + 1,position) == position)
+      {
+        break;
+      }
+      InterlockedIncrement64(&m_contention);
+    }
+    else if(diff < 0)
+    {
+      // Slot not yet consumed: we are full
+      return false;
+    }
+    position = ReadAcquire64(&m_enqueue);
+  }
+  cell->c_request = p_request;
+  cell->c_ticket  = p_ticket;
+  WriteRelease64(&cell->c_sequence,position + 1);
+  return true;
+}
+
+// Returns nullptr if the ring is empty
+Request*
+RequestRing::Pop(LONG64& p_ticket)
+{
+  RingCell* cell = nullptr;
+  LONG64 position = ReadAcquire64(&m_dequeue);
+
+  while(true)
+  {
+    cell = &m_cells[position & m_mask];
+    LONG64 sequence = ReadAcquire64(&cell->c_sequence);
+    LONG64 diff = sequence - (position + 1);
+
+    if(diff == 0)
+    {
+      // Slot is filled: try to claim it
+      if(InterlockedCompareExchange64(&m_dequeue,position + 1,position) == position)
+      {
+        break;
+      }
+      InterlockedIncrement64(&m_contention);
+    }
+    else if(diff < 0)
+    {
+      // Slot not yet filled: we are empty
+      return nullptr;
+    }
+    position = ReadAcquire64(&m_dequeue);
+  }
+  Request* request = cell->c_request;
+  p_ticket = cell->c_ticket;
+  WriteRelease64(&cell->c_sequence,position + m_mask + 1);
+  return request;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// SHARD OF THE REQUEST QUEUE
+//
+//////////////////////////////////////////////////////////////////////////
+
+RequestShard::RequestShard(ULONG p_capacity)
+             :m_incoming(p_capacity)
+{
+  InitializeCriticalSection(&m_lock);
+}
+
+RequestShard::~RequestShard()
+{
+  DeleteCriticalSection(&m_lock);
+}
+
+// Count the times another thread already had the shard
+void
+RequestShard::Lock()
+{
+  if(!TryEnterCriticalSection(&m_lock))
+  {
+    InterlockedIncrement64(&m_contention);
+    EnterCriticalSection(&m_lock);
+  }
+}
+
+// Index first, so a consumer popping the request will find it.
+// Returns the ticket to push on the ring together with the request.
+LONG64
+RequestShard::IndexIncoming(Request* p_request)
+{
+  Lock();
+  LONG64 ticket = ++m_tickets;
+  m_index[p_request] = { QueueState::QS_Incoming,ticket };
+  LeaveCriticalSection(&m_lock);
+  return ticket;
+}
+
+// A consumer popped the request from a ring. It is only ours if it is
+// still incoming and the ticket is that of the current queueing.
+bool
+RequestShard::ClaimIncoming(Request* p_request,LONG64 p_ticket)
+{
+  Lock();
+  bool claimed = false;
+  RequestIndex::iterator it = m_index.find(p_request);
+  if(it != m_index.end() && it->second.e_state  == QueueState::QS_Incoming
+                         && it->second.e_ticket == p_ticket)
+  {
+    it->second.e_state = QueueState::QS_Servicing;
+    claimed = true;
+  }
+  LeaveCriticalSection(&m_lock);
+  return claimed;
+}
+
+// Servicing is done, the connection will be parked for the next request
+bool
+RequestShard::ResetServicing(Request* p_request)
+{
+  Lock();
+  bool found = false;
+  RequestIndex::iterator it = m_index.find(p_request);
+  if(it != m_index.end() && it->second.e_state == QueueState::QS_Servicing)
+  {
+    m_index.erase(it);
+    found = true;
+  }
+  LeaveCriticalSection(&m_lock);
+  return found;
+}
+
+bool
+RequestShard::IsServicing(Request* p_request)
+{
+  Lock();
+  RequestIndex::iterator it = m_index.find(p_request);
+  bool found = (it != m_index.end() && it->second.e_state == QueueState::QS_Servicing);
+  LeaveCriticalSection(&m_lock);
+  return found;
+}
+
+// Take the request out of the index. An incoming request stays behind
+// in its ring, but no consumer can claim that cell anymore.
+bool
+RequestShard::RemoveIndex(Request* p_request,bool& p_incoming)
+{
+  Lock();
+  bool found = false;
+  p_incoming = false;
+  RequestIndex::iterator it = m_index.find(p_request);
+  if(it != m_index.end())
+  {
+    p_incoming = (it->second.e_state == QueueState::QS_Incoming);
+    m_index.erase(it);
+    found = true;
+  }
+  LeaveCriticalSection(&m_lock);
+  return found;
+}
+
+// Contention on the ring and on the lock of the index
+ULONGLONG
+RequestShard::GetContention()
+{
+  return m_incoming.GetContention() + (ULONGLONG)m_contention;
+}
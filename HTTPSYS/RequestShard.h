@@ -0,0 +1,103 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// USER-SPACE IMPLEMENTTION OF HTTP.SYS
+//
+// 2018 - 2025 (c) ir. W.E. Huisman
+// License: MIT
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include <unordered_map>
+#include <vector>
+
+// Never more shards than this, regardless of the number of cores
+#define QUEUE_MAX_SHARDS        64
+// Smallest ring of incoming requests for one shard
+#define QUEUE_MIN_RING_SIZE    256
+
+class Request;
+
+// One slot in the ring. The sequence tells producers and consumers
+// whose turn it is to use the slot (bounded MPMC queue of D. Vyukov)
+// The ticket tells which queueing of the request this is.
+typedef struct _ring_cell
+{
+  volatile LONG64 c_sequence;
+  Request*        c_request;
+  LONG64          c_ticket;
+}
+RingCell;
+
+// Bounded multi-producer multi-consumer ring of incoming requests.
+// Pushing and popping only ever does one compare-exchange.
+class RequestRing
+{
+public:
+  explicit RequestRing(ULONG p_capacity);
+ ~RequestRing();
+
+  bool      Push(Request* p_request,LONG64 p_ticket);
+  Request*  Pop(LONG64& p_ticket);
+
+  ULONG     GetCapacity()   { return (ULONG)(m_mask + 1); }
+  ULONGLONG GetContention() { return (ULONGLONG)m_contention; }
+
+private:
+  RingCell*                 m_cells;
+  LONG64                    m_mask;
+  alignas(64) volatile LONG64 m_enqueue   { 0 };
+  alignas(64) volatile LONG64 m_dequeue   { 0 };
+  alignas(64) volatile LONG64 m_contention{ 0 };
+};
+
+// Where a request is in the request queue
+enum class QueueState
+{
+  QS_Incoming     // Received, waiting for the application
+ ,QS_Servicing    // Handed to the application
+};
+
+// A request in the index of a shard.
+// Request objects are pooled, so the same address can be queued again
+// while an earlier, removed queueing still sits in a ring. Only the ring
+// cell with the ticket of the index is the live one.
+typedef struct _queue_entry
+{
+  QueueState e_state;
+  LONG64     e_ticket;
+}
+QueueEntry;
+
+using RequestIndex = std::unordered_map<Request*,QueueEntry>;
+
+// One shard of the request queue.
+// The ring gets the requests from the listeners of one core.
+// The index holds all requests that hash to this shard, so that
+// finding and removing a request is always O(1).
+class RequestShard
+{
+public:
+  RequestShard(ULONG p_capacity);
+ ~RequestShard();
+
+  // Index of the requests that hash to this shard
+  LONG64    IndexIncoming (Request* p_request);
+  bool      ClaimIncoming (Request* p_request,LONG64 p_ticket);
+  bool      ResetServicing(Request* p_request);
+  bool      IsServicing   (Request* p_request);
+  bool      RemoveIndex   (Request* p_request,bool& p_incoming);
+  ULONGLONG GetContention();
+
+  RequestRing       m_incoming;
+  RequestIndex      m_index;
+  CRITICAL_SECTION  m_lock;
+
+private:
+  void      Lock();
+
+  LONG64            m_tickets    { 0 };   // Last ticket handed out, under the lock
+  volatile LONG64   m_contention { 0 };   // Times the lock was already taken
+};
+
+using RequestShards = std::vector<RequestShard*>;
@@ -371,6 +371,16 @@ int SecureServerSocket::SendPartial(LPCVOID p_buffer, const ULONG p_length)
     return PlainSocket::SendPartial(p_buffer,p_length);
   }
 
+  // Put the message in the right place in the buffer
+  memcpy_s(m_writeBuffer + m_sizes.cbHeader, (m_maxMsgSize + m_maxExtraSize) - m_sizes.cbHeader - m_sizes.cbTrailer, p_buffer, p_length);
+
+  return EncryptAndSend(p_length);
+}
+
+// Encrypt the plaintext that is already in place behind the stream header
+// in the write buffer, and send the whole TLS record to the client
+int SecureServerSocket::EncryptAndSend(const ULONG p_length)
+{
   INT err;
 
   SecBufferDesc   Message;
@@ -384,14 +394,6 @@ int SecureServerSocket::SendPartial(LPCVOID p_buffer, const ULONG p_length)
   Message.cBuffers = 4;
   Message.pBuffers = Buffers;
 
-  Buffers[0].BufferType = SECBUFFER_EMPTY;
-  Buffers[1].BufferType = SECBUFFER_EMPTY;
-  Buffers[2].BufferType = SECBUFFER_EMPTY;
-  Buffers[3].BufferType = SECBUFFER_EMPTY;
-
-  // Put the message in the right place in the buffer
-  memcpy_s(m_writeBuffer + m_sizes.cbHeader, (m_maxMsgSize + m_maxExtraSize) - m_sizes.cbHeader - m_sizes.cbTrailer, p_buffer, p_length);
-
   //
   // Line up the buffers so that the header, trailer and content will be
   // all positioned in the right place to be sent across the TCP connection as one message.
@@ -411,12 +413,12 @@ int SecureServerSocket::SendPartial(LPCVOID p_buffer, const ULONG p_length)
 
   Buffers[3].BufferType = SECBUFFER_EMPTY;
 
-  // ENCRYPT THE MESSAGE
-  scRet = g_pSSPI->EncryptMessage(&m_context, 0, &Message, 0);
-
   DebugMsg(_T(" "));
   DebugMsg(_T("Plaintext message has %d bytes"), p_length);
-  PrintHexDump(p_length, p_buffer);
+  PrintHexDump(p_length, m_writeBuffer + m_sizes.cbHeader);
+
+  // ENCRYPT THE MESSAGE
+  scRet = g_pSSPI->EncryptMessage(&m_context, 0, &Message, 0);
 
   if (FAILED(scRet))
   {
@@ -425,12 +427,14 @@ int SecureServerSocket::SendPartial(LPCVOID p_buffer, const ULONG p_length)
     return SOCKET_ERROR;
   }
 
-  err = PlainSocket::SendPartial(m_writeBuffer, Buffers[0].cbBuffer + Buffers[1].cbBuffer + Buffers[2].cbBuffer);
+  // A record must go out as a whole, or the client cannot decrypt the stream
+  ULONG total = Buffers[0].cbBuffer + Buffers[1].cbBuffer + Buffers[2].cbBuffer;
+  err = PlainSocket::SendMsg(m_writeBuffer,total);
   m_lastError = 0;
 
-  DebugMsg(_T("Send %d encrypted bytes to client"), Buffers[0].cbBuffer + Buffers[1].cbBuffer + Buffers[2].cbBuffer);
-  PrintHexDump(Buffers[0].cbBuffer + Buffers[1].cbBuffer + Buffers[2].cbBuffer, m_writeBuffer);
-  if (err == SOCKET_ERROR)
+  DebugMsg(_T("Send %d encrypted bytes to client"), total);
+  PrintHexDump(total, m_writeBuffer);
+  if (err == SOCKET_ERROR || (ULONG)err < total)
   {
     LogError(_T("Send failed: %ld"),GetLastError());
     return SOCKET_ERROR;
@@ -955,6 +959,63 @@ SecureServerSocket::SendMsg(LPCVOID p_buffer,const ULONG p_length)
   return (total_bytes_sent);
 }
 
+// Sends all buffers as one stream. Small buffers (e.g. a response header
+// and a short body) are coalesced into full TLS records, so we do not
+// send one record (and one TCP packet) per buffer.
+int
+SecureServerSocket::SendMsgGather(LPWSABUF p_buffers,const ULONG p_count)
+{
+  // If not in SSL/TLS mode: pass on the the insecure plain socket
+  if(!InSecureMode())
+  {
+    return PlainSocket::SendMsgGather(p_buffers,p_count);
+  }
+
+  ULONG total_bytes_sent = 0;
+  ULONG filled = 0;
+  char* record = m_writeBuffer + m_sizes.cbHeader;
+
+  for(ULONG index = 0;index < p_count;++index)
+  {
+    char* buffer = p_buffers[index].buf;
+    ULONG length = p_buffers[index].len;
+
+    while(length > 0)
+    {
+      ULONG part = m_maxMsgSize - filled;
+      if(part > length)
+      {
+        part = length;
+      }
+      memcpy_s(record + filled,m_maxMsgSize - filled,buffer,part);
+      filled += part;
+      buffer += part;
+      length -= part;
+
+      // Record is full: encrypt and send it
+      if(filled == m_maxMsgSize)
+      {
+        if(EncryptAndSend(filled) == SOCKET_ERROR)
+        {
+          return SOCKET_ERROR;
+        }
+        total_bytes_sent += filled;
+        filled = 0;
+      }
+    }
+  }
+  // Last partial record
+  if(filled > 0)
+  {
+    if(EncryptAndSend(filled) == SOCKET_ERROR)
+    {
+      return SOCKET_ERROR;
+    }
+    total_bytes_sent += filled;
+  }
+  return total_bytes_sent;
+}
+
 // Receives exactly Len bytes of data and returns the amount received - or SOCKET_ERROR if it times out
 int
 SecureServerSocket::RecvMsg(LPVOID p_buffer,const ULONG p_length)
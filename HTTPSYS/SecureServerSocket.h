@@ -37,8 +37,10 @@ public:
 	int     SendPartial(LPCVOID p_buffer,const ULONG p_length) override;
   int     RecvPartialOverlapped(LPVOID p_buffer,const ULONG p_length,LPOVERLAPPED p_overlapped) override;
   int     SendPartialOverlapped(LPVOID p_buffer,const ULONG p_length,LPOVERLAPPED p_overlapped) override;
+  int     SendMsgGather(LPWSABUF p_buffers,const ULONG p_count) override;
 	int     Disconnect(int p_how = SD_BOTH) override;
   bool    Close(void) override;
+  bool    HasBufferedInput() override { return m_readBufferBytes > 0; }
 
 	static PSecurityFunctionTable SSPI(void);
 
@@ -58,6 +60,7 @@ private:
   static HRESULT    InitializeClass(void);
          HRESULT    LogSSLInitError(HRESULT hr);
          bool       SSPINegotiateLoop(void);
+         int        EncryptAndSend(const ULONG p_length);
   SECURITY_STATUS   CreateCredentialsFromCertificate(PCredHandle phCreds, PCCERT_CONTEXT pCertContext);
 
   static PSecurityFunctionTable g_pSSPI;
@@ -510,6 +510,25 @@ ServerSession::ReadRegistrySettings()
     }
   }
 
+  // Maximum number of live connections from one client address
+  // Guards against one client holding all connections (slowloris)
+  // Default = 0 (no restrictions)
+  if(HTTPReadRegister(sectie,_T("MaxConnectionsPerAddress"),REG_DWORD,value1,&value2,value3,&size3))
+  {
+    if(value2 <= SESSION_MAX_CONNECTIONS)
+    {
+      m_maxConnectionsPerAddress = value2;
+    }
+  }
+
+  // Minimum rate (bytes/sec) at which a client must send a request body
+  // Independent of the MinSendRate timeout, which is for our responses
+  // Default = 150, 0 = no restrictions
+  if(HTTPReadRegister(sectie,_T("MinReceiveRate"),REG_DWORD,value1,&value2,value3,&size3))
+  {
+    m_minReceiveRate = value2;
+  }
+
   // Maximum number of URL endpoints to service
   // Normally between 1 and 1024
   // Default = 0 (no restrictions)
@@ -75,9 +75,11 @@ public:
  ULONG      GetTimeoutMinSendRate()     { return m_timeoutMinSendRate;      }
  int        GetDisableServerHeader()    { return m_disableServerHeader;     }
  unsigned   GetMaxConnections()         { return m_maxConnections;          }
+ unsigned   GetMaxConnectionsPerAddress(){ return m_maxConnectionsPerAddress;}
  unsigned   GetMaxEndpoints()           { return m_maxEndpoints;            }
  unsigned   GetMaxFieldLength()         { return m_maxFieldLength;          }
  unsigned   GetMaxRequestBytes()        { return m_maxRequestBytes;         }
+ ULONG      GetMinReceiveRate()         { return m_minReceiveRate;          }
  unsigned   GetCurrentConnections()     { return m_connections;             }
  unsigned   GetCurrentEndpoints()       { return m_endpoints;               }
 
@@ -101,9 +103,11 @@ private:
   // Registry settings
   int                 m_disableServerHeader      { 0 };
   unsigned            m_maxConnections           { 0 };
+  unsigned            m_maxConnectionsPerAddress { 0 };
   unsigned            m_maxEndpoints             { 0 };
   unsigned            m_maxFieldLength           { SESSION_DEF_FIELDLENGTH  };
   unsigned            m_maxRequestBytes          { SESSION_DEF_REQUESTBYTES };
+  ULONG               m_minReceiveRate           { URL_DEFAULT_MIN_RECV_RATE };
   // Current endpoints and connections
   unsigned            m_endpoints                { 0 };
   unsigned            m_connections              { 0 };
@@ -40,6 +40,8 @@ public:
   virtual int     RecvPartialOverlapped(LPVOID p_buffer,const ULONG p_length,LPOVERLAPPED p_overlapped) = 0;
   // Sends    up to   p_length bytes of data with an OVERLAPPED callback
   virtual int     SendPartialOverlapped(LPVOID p_buffer,const ULONG p_length,LPOVERLAPPED p_overlapped) = 0;
+  // Sends all buffers as one stream and returns the amount sent           - or SOCKET_ERROR if it times out
+  virtual int     SendMsgGather(LPWSABUF p_buffers,const ULONG p_count) = 0;
 
   // Connect to the threadpool of the server
   virtual void    AssociateThreadPool(HANDLE p_threadPoolIOCP) = 0;
@@ -33,6 +33,7 @@
 #define URL_TIMEOUT_IDLE_CONNECTION 120
 #define URL_TIMEOUT_HEADER_WAIT     120
 #define URL_DEFAULT_MIN_SEND_RATE   150   // Bytes per second
+#define URL_DEFAULT_MIN_RECV_RATE   150   // Bytes per second, for request bodies
 
 // Standard ports for HTTP connections
 #define INTERNET_DEFAULT_HTTP_PORT   80
@@ -54,6 +55,52 @@
 // Thread waiting time when too many threads in the system
 #define THREAD_RETRY_WAITING 100    // Milliseconds
 
+// Extra request queue property of this implementation (not in HTTP.SYS)
+// HttpQueryRequestQueueProperty returns the statistics of the queue shards
+#define HttpServerQueueStatisticsProperty ((HTTP_SERVER_PROPERTY)0x1000)
+
+typedef struct _HTTP_QUEUE_STATISTICS
+{
+  ULONG     NumberOfShards;     // One shard of incoming requests per core
+  ULONG     IncomingRequests;   // Requests waiting for the application
+  ULONGLONG Contention;         // Collisions on the rings and shard locks
+  ULONGLONG Stolen;             // Requests taken from the shard of another core
+}
+HTTP_QUEUE_STATISTICS,*PHTTP_QUEUE_STATISTICS;
+
+// Extra request queue properties for the fragment cache
+// Set: byte budget of the cache (8 bytes). Query: HTTP_FRAGMENT_CACHE_STATISTICS
+#define HttpServerFragmentCacheSizeProperty       ((HTTP_SERVER_PROPERTY)0x1001)
+#define HttpServerFragmentCacheStatisticsProperty ((HTTP_SERVER_PROPERTY)0x1002)
+
+typedef struct _HTTP_FRAGMENT_CACHE_STATISTICS
+{
+  ULONGLONG Budget;             // Maximum number of bytes in the cache
+  ULONGLONG Bytes;              // Current number of bytes in the cache
+  ULONG     Fragments;          // Current number of fragments
+  ULONGLONG Hits;               // Fragments found
+  ULONGLONG Misses;             // Fragments not found (or expired)
+  ULONGLONG Evictions;          // Fragments removed to stay within the budget
+  ULONGLONG Expired;            // Fragments removed after their time-to-live
+}
+HTTP_FRAGMENT_CACHE_STATISTICS,*PHTTP_FRAGMENT_CACHE_STATISTICS;
+
+// Extra request queue property for the connections of all listeners of the queue
+// Query: HTTP_CONNECTION_STATISTICS
+#define HttpServerConnectionStatisticsProperty    ((HTTP_SERVER_PROPERTY)0x1003)
+
+typedef struct _HTTP_CONNECTION_STATISTICS
+{
+  ULONG     ParkedConnections;  // Idle connections waiting in the event loops
+  ULONGLONG Dispatched;         // Connections handed to a worker to be read
+  ULONGLONG ShedOverloaded;     // Rejected: session has its maximum connections
+  ULONGLONG ShedAddress;        // Rejected: too many connections from one address
+  ULONGLONG ShedHeaderWait;     // Closed: header lines not complete in time
+  ULONGLONG ShedIdle;           // Closed: keep-alive connection idle for too long
+  ULONGLONG ShedBodyRate;       // Closed: request body below the minimum rate
+}
+HTTP_CONNECTION_STATISTICS,*PHTTP_CONNECTION_STATISTICS;
+
 // The system is/was initialized by calling HttpInitialize
 extern bool g_httpsys_initialized;   // Default = false;
 
@@ -0,0 +1,237 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: DDOSDetector.cpp
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "DDOSDetector.h"
+#include <AutoCritical.h>
+
+DDOSDetector::DDOSDetector()
+{
+  memset(m_sketch,0,sizeof(m_sketch));
+  InitializeCriticalSection(&m_registerLock);
+  InitializeCriticalSection(&m_alarmLock);
+}
+
+DDOSDetector::~DDOSDetector()
+{
+  DeleteCriticalSection(&m_registerLock);
+  DeleteCriticalSection(&m_alarmLock);
+}
+
+void
+DDOSDetector::SetThreshold(ULONG p_threshold)
+{
+  m_threshold = p_threshold ? p_threshold : 1;
+}
+
+void
+DDOSDetector::SetTimeout(ULONG p_milliseconds)
+{
+  if(p_milliseconds)
+  {
+    m_timeout = p_milliseconds;
+  }
+}
+
+// Applications register an offense (e.g. a failed login)
+// Only the registration is locked, the checks are not.
+bool
+DDOSDetector::Register(PSOCKADDR_IN6 p_sender,const XString& p_path)
+{
+  ULONGLONG key = MakeKey(p_sender,p_path);
+  ULONGLONG now = GetTickCount64();
+  AutoCritSec lock(&m_registerLock);
+
+  if(CountOffense(key,now) < m_threshold)
+  {
+    return false;
+  }
+
+  // Find the attack, or else the slot that was not used the longest
+  DDOSSlot* victim = nullptr;
+  for(int probe = 0;probe < DDOS_TABLE_PROBE; ++probe)
+  {
+    DDOSSlot& slot = m_slots[(key + probe) & (DDOS_TABLE_SIZE - 1)];
+    ULONGLONG seen = slot.m_seen.load();
+    if(slot.m_key.load() == key)
+    {
+      // Already known: prolong it. New if it had decayed already
+      bool active = now <= seen + m_timeout;
+      slot.m_seen.store(now);
+      m_lastAttack.store(now);
+      return !active;
+    }
+    if(victim == nullptr || seen < victim->m_seen.load())
+    {
+      victim = &slot;
+    }
+  }
+  // A check can never see the new key with the time of the old one
+  victim->m_key.store(0);
+  victim->m_seen.store(now);
+  victim->m_key.store(key);
+  m_lastAttack.store(now);
+  return true;
+}
+
+// Called for incoming requests: no locking
+bool
+DDOSDetector::Check(PSOCKADDR_IN6 p_sender,const XString& p_path)
+{
+  // If no attacks are going on: we are *NOT* under attack
+  ULONGLONG now  = GetTickCount64();
+  ULONGLONG last = m_lastAttack.load(std::memory_order_relaxed);
+  if(last == 0 || now > last + m_timeout)
+  {
+    return false;
+  }
+
+  ULONGLONG key = MakeKey(p_sender,p_path);
+  for(int probe = 0;probe < DDOS_TABLE_PROBE; ++probe)
+  {
+    DDOSSlot& slot = m_slots[(key + probe) & (DDOS_TABLE_SIZE - 1)];
+    if(slot.m_key.load(std::memory_order_acquire) == key)
+    {
+      if(now > slot.m_seen.load(std::memory_order_relaxed) + m_timeout)
+      {
+        // DDOS Attack is now officially over from this sender
+        return false;
+      }
+      // Extra attack: Bump the clock and wait an extra interval
+      slot.m_seen.store(now,std::memory_order_relaxed);
+      m_lastAttack.store(now,std::memory_order_relaxed);
+      return true;
+    }
+  }
+  // Nothing found: we are *NOT* part of any attack
+  return false;
+}
+
+// Queue an alarm. Only the first alarm of a batch needs a reporter
+bool
+DDOSDetector::PostAlarm(const XString& p_alarm)
+{
+  AutoCritSec lock(&m_alarmLock);
+
+  if(m_alarms.size() < DDOS_ALARMS_MAX)
+  {
+    m_alarms.push_back(p_alarm);
+  }
+  if(m_reporting)
+  {
+    return false;
+  }
+  m_reporting = true;
+  return true;
+}
+
+void
+DDOSDetector::TakeAlarms(std::vector<XString>& p_alarms)
+{
+  AutoCritSec lock(&m_alarmLock);
+
+  p_alarms.swap(m_alarms);
+  m_alarms.clear();
+  m_reporting = false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// PRIVATE
+//
+//////////////////////////////////////////////////////////////////////////
+
+// FNV-1a hash of the sender address (not the port!) and the path.
+// The path is case insensitive
+ULONGLONG
+DDOSDetector::MakeKey(PSOCKADDR_IN6 p_sender,const XString& p_path)
+{
+  ULONGLONG hash = 14695981039346656037ULL;
+  auto addBytes = [&hash](const void* p_data,size_t p_size)
+  {
+    const BYTE* data = reinterpret_cast<const BYTE*>(p_data);
+    for(size_t index = 0;index < p_size; ++index)
+    {
+      hash ^= data[index];
+      hash *= 1099511628211ULL;
+    }
+  };
+  addBytes(&p_sender->sin6_family,  sizeof(p_sender->sin6_family));
+  addBytes(&p_sender->sin6_flowinfo,sizeof(p_sender->sin6_flowinfo));
+  addBytes(&p_sender->sin6_addr,    sizeof(p_sender->sin6_addr));
+  addBytes(&p_sender->sin6_scope_id,sizeof(p_sender->sin6_scope_id));
+
+  LPCTSTR path = p_path.GetString();
+  for(int index = 0;index < p_path.GetLength(); ++index)
+  {
+    TCHAR ch = (TCHAR)_totlower(path[index]);
+    addBytes(&ch,sizeof(TCHAR));
+  }
+  // Zero is a free slot
+  return hash ? hash : 1;
+}
+
+// Count in the sketch of the current window, and estimate the number
+// of offenses in the last 'timeout' milliseconds. The previous window
+// counts for the part that still overlaps the sliding window.
+// Called with the register lock held.
+ULONG
+DDOSDetector::CountOffense(ULONGLONG p_key,ULONGLONG p_now)
+{
+  ULONGLONG window = p_now / m_timeout;
+  if(window != m_window)
+  {
+    if(window == m_window + 1)
+    {
+      // The window before the previous one can go
+      memset(m_sketch[window & 1],0,sizeof(m_sketch[0]));
+    }
+    else
+    {
+      // Quiet for more than a window
+      memset(m_sketch,0,sizeof(m_sketch));
+    }
+    m_window = window;
+  }
+  ULONG (&current) [DDOS_SKETCH_ROWS][DDOS_SKETCH_SIZE] = m_sketch[window & 1];
+  ULONG (&previous)[DDOS_SKETCH_ROWS][DDOS_SKETCH_SIZE] = m_sketch[(window + 1) & 1];
+  double overlap = 1.0 - (double)(p_now % m_timeout) / (double)m_timeout;
+
+  ULONG estimate = ULONG_MAX;
+  ULONG low  = (ULONG) p_key;
+  ULONG high = (ULONG)(p_key >> 32);
+  for(int row = 0;row < DDOS_SKETCH_ROWS; ++row)
+  {
+    ULONG index = (low + row * high) & (DDOS_SKETCH_SIZE - 1);
+    ULONG count = ++current[row][index] + (ULONG)(previous[row][index] * overlap);
+    if(count < estimate)
+    {
+      estimate = count;
+    }
+  }
+  return estimate;
+}
@@ -0,0 +1,102 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: DDOSDetector.h
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include <atomic>
+#include <vector>
+
+// Number of slots for registered attacks. Must be a power of two
+constexpr int  DDOS_TABLE_SIZE  = 4096;
+// Slots looked at for one sender+path. Collisions go to the next slots
+constexpr int  DDOS_TABLE_PROBE = 8;
+// Count-min sketch of the registrations: rows and counters per row
+// The number of counters must be a power of two
+constexpr int  DDOS_SKETCH_ROWS = 4;
+constexpr int  DDOS_SKETCH_SIZE = 1024;
+// Default number of registrations within the window before it is an attack
+constexpr ULONG DDOS_THRESHOLD  = 1;
+// Default milliseconds of the window, and of the decay of an attack
+constexpr ULONG DDOS_TIMEOUT    = 10000;
+// Maximum number of alarms waiting to be reported
+constexpr int  DDOS_ALARMS_MAX  = 100;
+
+// Detection of DDOS attacks by sender+path.
+// Applications register offenses (failed logins, failed event streams).
+// These are counted in a count-min sketch over a sliding window of the
+// brute-force timeout. When a sender+path reaches the threshold, it is put
+// in a hashed table of attacks. Checking the table is O(1) and lock free:
+// the request path is never serialised. An attack decays by itself when
+// it has not been seen for the timeout. Newly found attacks are queued as
+// alarms, for the server to report them outside of the request path.
+class DDOSDetector
+{
+public:
+  DDOSDetector();
+ ~DDOSDetector();
+
+  // Count an offense. Returns true if this starts a new attack
+  bool  Register(PSOCKADDR_IN6 p_sender,const XString& p_path);
+  // Is sender+path under attack? If so, the attack is prolonged
+  bool  Check(PSOCKADDR_IN6 p_sender,const XString& p_path);
+
+  // Alarms for the reporting. Returns true if the caller must report them
+  bool  PostAlarm(const XString& p_alarm);
+  void  TakeAlarms(std::vector<XString>& p_alarms);
+
+  // SETTERS
+  void  SetThreshold(ULONG p_threshold);
+  void  SetTimeout(ULONG p_milliseconds);
+
+  // GETTERS
+  ULONG GetThreshold() { return m_threshold; }
+  ULONG GetTimeout()   { return m_timeout;   }
+
+private:
+  typedef struct _ddosSlot
+  {
+    std::atomic<ULONGLONG> m_key  { 0 };    // Hash of sender+path. 0 = free
+    std::atomic<ULONGLONG> m_seen { 0 };    // Tick count of the last hit
+  }
+  DDOSSlot;
+
+  ULONGLONG MakeKey(PSOCKADDR_IN6 p_sender,const XString& p_path);
+  ULONG     CountOffense(ULONGLONG p_key,ULONGLONG p_now);
+
+  ULONG     m_threshold { DDOS_THRESHOLD };
+  ULONG     m_timeout   { DDOS_TIMEOUT   };
+  // Tick of the last attack seen. Checks are free if nothing is going on
+  std::atomic<ULONGLONG> m_lastAttack { 0 };
+  DDOSSlot  m_slots[DDOS_TABLE_SIZE];
+  // Sliding window: counters of the current and the previous window
+  ULONG     m_sketch[2][DDOS_SKETCH_ROWS][DDOS_SKETCH_SIZE];
+  ULONGLONG m_window { 0 };
+  CRITICAL_SECTION m_registerLock;
+  // Alarms to be reported
+  std::vector<XString> m_alarms;
+  bool      m_reporting { false };
+  CRITICAL_SECTION m_alarmLock;
+};
@@ -26,6 +26,8 @@
 // THE SOFTWARE.
 //
 #pragma once
+#include <deque>
+#include <vector>
 
 // Initial event keep alive milliseconds
 constexpr auto DEFAULT_EVENT_KEEPALIVE = 60000;
@@ -41,6 +43,63 @@ constexpr auto EVENT_RETRYTIME_MAX =  5000;   //  5 seconds
 // Theoretical max = 65535, but we stop before this is reached
 constexpr auto MAX_DATACHUNKS = 65530;
 
+// Maximum number of events waiting to be sent to one stream
+constexpr auto EVENT_OUTBOX_MAXIMUM = 256;
+// Default ceiling of the threads sending the outboxes to the clients
+constexpr auto EVENT_DRAIN_THREADS  = 10;
+
+// What to do with a subscriber that cannot keep up with the events
+enum class EventOverflow
+{
+  DropStream    // Abort the stream. The client reconnects with its Last-Event-ID
+ ,DropOldest    // Forget the oldest waiting event of the stream
+};
+
+// One event, encoded once in UTF-8 for all subscribers of an URL.
+// Every outbox holding the event holds a reference.
+class EventBuffer
+{
+public:
+  EventBuffer(BYTE* p_buffer,int p_length)
+    :m_buffer(p_buffer)
+    ,m_length(p_length)
+  {
+  }
+
+  void AddReference()
+  {
+    InterlockedIncrement(&m_references);
+  }
+
+  void DropReference()
+  {
+    if(InterlockedDecrement(&m_references) == 0)
+    {
+      delete this;
+    }
+  }
+
+  BYTE*  m_buffer;              // Event and data lines in UTF-8
+  int    m_length;              // Length of the buffer
+private:
+  ~EventBuffer()
+  {
+    delete [] m_buffer;
+  }
+  long   m_references { 1 };
+};
+
+// An event waiting in the outbox of a stream
+// The id is per stream, so it is not part of the shared buffer
+class OutboxEvent
+{
+public:
+  EventBuffer* m_buffer;
+  UINT         m_id;
+};
+
+using EventOutbox = std::deque<OutboxEvent>;
+
 class EventStream
 {
 public:
@@ -54,10 +113,17 @@ public:
   HTTP_OPAQUE_ID  m_requestID;  // Outstanding HTTP request ID
   UINT            m_lastID;     // Last ID of this connection
   bool            m_alive;      // Connection still alive after sending
-  __time64_t      m_lastPulse;  // Time of last sent event
+  ULONGLONG       m_lastPulse;  // Tick count of last sent event or keep-alive
   XString         m_user;       // For authenticated user
   long            m_chunks;     // Send chunk counter
+  XString         m_registration; // Key in the event streams map of the server
+  bool            m_registered; // Still in the event streams map of the server
   CRITICAL_SECTION m_lock;       // Just one message from one thread please!
+  // Outbox of the broadcast events
+  EventOutbox     m_outbox;     // Events waiting to be sent
+  bool            m_draining;   // A thread is draining the outbox
+  ULONG           m_dropped;    // Events dropped because the client was too slow
+  CRITICAL_SECTION m_outboxLock; // Lock for the outbox
 
   // Construct and init
   EventStream()
@@ -67,17 +133,46 @@ public:
     ,m_requestID(NULL)
     ,m_lastID   (0)
     ,m_alive    (false)
-    ,m_lastPulse(NULL)
+    ,m_lastPulse(0)
     ,m_chunks   (0)
+    ,m_registered(false)
+    ,m_draining (false)
+    ,m_dropped  (0)
   {
     memset(&m_sender,  0,sizeof(SOCKADDR_IN6));
     memset(&m_response,0,sizeof(HTTP_RESPONSE));
     InitializeCriticalSection(&m_lock);
+    InitializeCriticalSection(&m_outboxLock);
+  }
+
+  // The map of the server holds the first reference.
+  // The keep-alive wheel and a thread draining the outbox hold others.
+  void AddReference()
+  {
+    InterlockedIncrement(&m_references);
+  }
+
+  void DropReference()
+  {
+    if(InterlockedDecrement(&m_references) == 0)
+    {
+      delete this;
+    }
   }
 
   ~EventStream()
   {
+    for(auto& event : m_outbox)
+    {
+      event.m_buffer->DropReference();
+    }
+    DeleteCriticalSection(&m_outboxLock);
     DeleteCriticalSection(&m_lock);
   }
+
+private:
+  long            m_references { 1 };
 };
 
+using EventStreams = std::vector<EventStream*>;
+
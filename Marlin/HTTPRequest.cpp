@@ -341,10 +341,11 @@ HTTPRequest::ReceivedRequest()
   }
 
   // See if we must substitute for a sub-site
+  int matched = -1;
   if(m_server->GetHasSubsites())
   {
     XString absPath = WStringToString(m_request->CookedUrl.pAbsPath);
-    m_site = m_server->FindHTTPSite(m_site,absPath);
+    m_site = m_server->FindHTTPSite(m_site,absPath,&matched);
   }
 
   // Check our authentication
@@ -464,7 +465,7 @@ HTTPRequest::ReceivedRequest()
   }
 
   // Find routing information within the site
-  m_server->CalculateRouting(m_site,m_message);
+  m_server->CalculateRouting(m_site,m_message,matched);
 
   // Find X-HTTP-Method VERB Tunneling
   if(type == HTTPCommand::http_post && m_site->GetVerbTunneling())
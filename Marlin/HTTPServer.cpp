@@ -39,19 +39,23 @@
 #include "WebServiceServer.h"
 #include "WebSocketMain.h"
 #include "ThreadPool.h"
+#include "SiteRouter.h"
 // BaseLibrary
 #include <AutoCritical.h>
 #include <ConvertWideString.h>
 #include <Cookie.h>
 #include <Crypto.h>
 #include <GetLastErrorAsString.h>
+#include <GzipCache.h>
 #include <LogAnalysis.h>
 #include <HTTPError.h>
 #include <HTTPMessage.h>
 #include <PrintToken.h>
 #include <SOAPMessage.h>
+#include <ServiceQuality.h>
 #include <ServiceReporting.h>
 #include <WinFile.h>
+#include <ZIP\gzip.h>
 // Windows
 #include <algorithm>
 #include <io.h>
@@ -125,6 +129,7 @@ HTTPServer::HTTPServer(XString p_name)
   InitializeCriticalSection(&m_eventLock);
   InitializeCriticalSection(&m_sitesLock);
   InitializeCriticalSection(&m_socketLock);
+  InitializeCriticalSection(&m_socketPingLock);
 
   // Initially the counter is stopped
   m_counter.Stop();
@@ -153,10 +158,19 @@ HTTPServer::~HTTPServer()
     g_media = nullptr;
   }
 
+  // Clean out the site router and the routers it replaced
+  ReclaimSiteRouters(true);
+  if(m_siteRouter)
+  {
+    delete m_siteRouter;
+    m_siteRouter = nullptr;
+  }
+
   // Free CS to the OS
   DeleteCriticalSection(&m_eventLock);
   DeleteCriticalSection(&m_sitesLock);
   DeleteCriticalSection(&m_socketLock);
+  DeleteCriticalSection(&m_socketPingLock);
 
   // Resetting the signal handlers
   ResetProcessAfterSEH();
@@ -212,10 +226,18 @@ HTTPServer::InitThreadPool()
   int minThreads = m_marlinConfig->GetParameterInteger(_T("Server"),_T("MinThreads"),NUM_THREADS_MINIMUM);
   int maxThreads = m_marlinConfig->GetParameterInteger(_T("Server"),_T("MaxThreads"),NUM_THREADS_MAXIMUM);
   int stackSize  = m_marlinConfig->GetParameterInteger(_T("Server"),_T("StackSize"), THREAD_STACKSIZE);
+  bool stealing  = m_marlinConfig->GetParameterBoolean(_T("Server"),_T("WorkStealing"),false);
+  int drainers   = m_marlinConfig->GetParameterInteger(_T("Server"),_T("EventDrainThreads"),EVENT_DRAIN_THREADS);
 
   m_pool.TrySetMinimum(minThreads);
   m_pool.TrySetMaximum(maxThreads);
   m_pool.SetStackSize(stackSize);
+  m_pool.SetWorkStealing(stealing);
+
+  // Slow SSE clients block the drain threads, never the request threads
+  m_drainPool.TrySetMinimum(NUM_THREADS_MINIMUM);
+  m_drainPool.TrySetMaximum(drainers);
+  m_drainPool.SetStackSize(stackSize);
 }
 
 // Initialise the hard server limits in bytes
@@ -247,6 +269,17 @@ HTTPServer::InitHardLimits()
 
   DETAILLOGV(_T("Server hard-limit file-size streaming limit: %d"),g_streaming_limit);
   DETAILLOGV(_T("Server hard-limit compression threshold: %d"),    g_compress_limit);
+
+  // Percentage of the processors that may be compressing responses
+  g_compress_share = m_marlinConfig->GetParameterInteger(_T("Server"),_T("CompressShare"),g_compress_share);
+  if(g_compress_share < 1)   g_compress_share = 1;
+  if(g_compress_share > 100) g_compress_share = 100;
+  DETAILLOGV(_T("Server compression share of processors: %d%%"),  g_compress_share);
+
+  // Offenses within the brute-force time before it is a DDOS attack
+  m_ddos.SetTimeout(TIMEOUT_BRUTEFORCE * 1000 / CLOCKS_PER_SEC);
+  m_ddos.SetThreshold(m_marlinConfig->GetParameterInteger(_T("Server"),_T("DDOSThreshold"),DDOS_THRESHOLD));
+  DETAILLOGV(_T("Server DDOS attack after offenses: %d"),m_ddos.GetThreshold());
 }
 
 // Initialise the even stream parameters
@@ -261,6 +294,9 @@ HTTPServer::InitEventstreamKeepalive()
   if(m_eventRetryTime < EVENT_RETRYTIME_MIN) m_eventRetryTime = EVENT_RETRYTIME_MIN;
   if(m_eventRetryTime > EVENT_RETRYTIME_MAX) m_eventRetryTime = EVENT_RETRYTIME_MAX;
 
+  XString overflow = m_marlinConfig->GetParameterString(_T("Server"),_T("EventOverflow"),_T("DropStream"));
+  m_eventOverflow  = overflow.CompareNoCase(_T("DropOldest")) == 0 ? EventOverflow::DropOldest : EventOverflow::DropStream;
+
   DETAILLOGV(_T("Server SSE/WS keepalive interval: %d ms"), m_eventKeepAlive);
   DETAILLOGV(_T("Server SSE/WS client retry time : %d ms"), m_eventRetryTime);
 }
@@ -510,6 +546,7 @@ HTTPServer::RegisterSite(const HTTPSite* p_site,const XString& p_urlPrefix)
 
   // Remember the site 
   m_allsites[site] = const_cast<HTTPSite*>(p_site);
+  PublishSiteRouter();
 
   // Use counter
   m_counter.Stop();
@@ -560,10 +597,12 @@ HTTPServer::FindHTTPSite(int p_port,PCWSTR p_url)
 }
 
 // Find a site or a sub-site of the site
+// The matched part is only returned for a sub-site
 HTTPSite*
-HTTPServer::FindHTTPSite(HTTPSite* p_site,const XString& p_url)
+HTTPServer::FindHTTPSite(HTTPSite* p_site,const XString& p_url,int* p_matched /*= nullptr*/)
 {
-  HTTPSite* site = FindHTTPSite(p_site->GetPort(),p_url);
+  int matched = -1;
+  HTTPSite* site = FindHTTPSite(p_site->GetPort(),p_url,&matched);
   if(site)
   {
     // Check if the found site is indeed it's main site
@@ -573,6 +612,10 @@ HTTPServer::FindHTTPSite(HTTPSite* p_site,const XString& p_url)
     {
       if(main == p_site)
       {
+        if(p_matched)
+        {
+          *p_matched = matched;
+        }
         return site;
       }
       main = main->GetMainSite();
@@ -582,67 +625,121 @@ HTTPServer::FindHTTPSite(HTTPSite* p_site,const XString& p_url)
 }
 
 // Finding the HTTP site from the mappings of all sites
-// by the 'longest match' method, optimized for pathnames
+// by the 'longest match' method, optimized for pathnames.
+// Does not take the sites lock: the router is never changed once published.
+// The lookup is counted in the epoch it started in, so that a replaced
+// router is only freed after all lookups in it have ended.
+// The registration name is the URL behind "port:", lowercased and cut
+// off at the parameters. So the match is at the same position in the URL.
 HTTPSite*
-HTTPServer::FindHTTPSite(int p_port,const XString& p_url)
+HTTPServer::FindHTTPSite(int p_port,const XString& p_url,int* p_matched /*= nullptr*/)
 {
-  AutoCritSec lock(&m_sitesLock);
-
   // Prepare the URL
   XString search(MakeSiteRegistrationName(p_port,p_url));
 
-  // Search for longest match between incoming URL 
-  // and registered sites from "RegisterSite"
-  int pos = search.GetLength();
-  while(pos > 0)
+  long epoch = 0;
+  for(;;)
   {
-    XString finding = search.Left(pos);
-    SiteMap::iterator it = m_allsites.find(finding);
-    if(it != m_allsites.end())
+    epoch = InterlockedCompareExchange(&m_routerEpoch,0,0) & 1;
+    InterlockedIncrement(&m_routerReaders[epoch]);
+    if((InterlockedCompareExchange(&m_routerEpoch,0,0) & 1) == epoch)
     {
-      // Longest match is found
-      return it->second;
+      break;
     }
-    // Find next length to match
-    while(--pos > 0)
+    // Router was published in between: count us in the new epoch
+    InterlockedDecrement(&m_routerReaders[epoch]);
+  }
+  HTTPSite* site = nullptr;
+  int matched = 0;
+  SiteRouter* router = (SiteRouter*) InterlockedCompareExchangePointer((PVOID*)&m_siteRouter,nullptr,nullptr);
+  if(router)
+  {
+    site = router->FindSite(search,&matched);
+  }
+  InterlockedDecrement(&m_routerReaders[epoch]);
+
+  if(site && p_matched)
+  {
+    *p_matched = matched - (search.Find(_T(':')) + 1);
+  }
+  return site;
+}
+
+// Build a new router from the site map and swap it in.
+// Lookups that are still walking the old router keep on doing so. These
+// are all counted in the previous epoch. Lookups that start after the flip
+// of the epoch can only see the new router. So once the previous epoch has
+// drained, the old router (and the site just removed from the site map)
+// is no longer in use and can be freed. We do not wait for that here,
+// as we are holding the sites lock: the old router is retired instead.
+void
+HTTPServer::PublishSiteRouter(HTTPSite* p_removed /*= nullptr*/)
+{
+  SiteRouter* router = new SiteRouter();
+  for(auto& site : m_allsites)
+  {
+    router->AddSite(site.first,site.second);
+  }
+  SiteRouter* previous = (SiteRouter*) InterlockedExchangePointer((PVOID*)&m_siteRouter,router);
+  long epoch = InterlockedIncrement(&m_routerEpoch);
+  m_retiredRouters.push_back({ previous,p_removed,epoch });
+
+  // Free what earlier publications left behind
+  ReclaimSiteRouters(false);
+}
+
+// A retired router is free as soon as the epoch before its replacement
+// is seen empty. Later lookups in an epoch of the same parity can delay
+// this, but never make it unsafe: they cannot see the retired router.
+void
+HTTPServer::ReclaimSiteRouters(bool p_wait)
+{
+  AutoCritSec lock(&m_sitesLock);
+
+  RetiredRouters::iterator it = m_retiredRouters.begin();
+  while(it != m_retiredRouters.end())
+  {
+    long drain = (it->m_epoch - 1) & 1;
+    while(p_wait && InterlockedCompareExchange(&m_routerReaders[drain],0,0) != 0)
     {
-      if(search.GetAt(pos) == _T('/') ||
-         search.GetAt(pos) == '\\')
-      {
-        break;
-      }
+      Sleep(0);
+    }
+    if(InterlockedCompareExchange(&m_routerReaders[drain],0,0) == 0)
+    {
+      delete it->m_router;
+      delete it->m_site;
+      it = m_retiredRouters.erase(it);
+    }
+    else
+    {
+      ++it;
     }
   }
-  return nullptr;
 }
 
 // Find routing information within the site
+// Starts at the part of the URL matched by the site router, if it was used.
 void
-HTTPServer::CalculateRouting(const HTTPSite* p_site,HTTPMessage* p_message)
+HTTPServer::CalculateRouting(const HTTPSite* p_site,HTTPMessage* p_message,int p_matched /*= -1*/)
 {
   XString url = p_message->GetCrackedURL().AbsoluteResource();
-  XString known(p_site->GetSite());
+  LPCTSTR route  = url.GetString();
+  int     length = url.GetLength();
+  int     pos    = p_matched >= 0 ? p_matched : p_site->GetSite().GetLength();
 
-  XString route = url.Mid(known.GetLength());
-  route = route.Trim('/');
-  route = route.Trim('\\');
-
-  while(route.GetLength())
+  // One pass over the rest of the URL. Empty route parts are skipped
+  while(pos < length)
   {
-    int pos = route.Find('/');
-    if (pos < 0) pos = route.Find('\\');
-
-    if(pos > 0)
+    int end = pos;
+    while(end < length && route[end] != _T('/') && route[end] != _T('\\'))
     {
-      p_message->AddRoute(route.Left(pos));
-      route = route.Mid(pos + 1);
+      ++end;
     }
-    else
+    if(end > pos)
     {
-      // Last route part to add
-      p_message->AddRoute(route);
-      route.Empty();
+      p_message->AddRoute(url.Mid(pos,end - pos));
     }
+    pos = end + 1;
   }
 }
 
@@ -901,6 +998,54 @@ HTTPServer::SendResponse(JSONMessage* p_message)
   p_message->SetHasBeenAnswered();
 }
 
+// GZIP the next chunk of a chunked response, before the chunk encoding.
+// On the first chunk we decide: the site must compress and the client must
+// accept 'gzip'. From then on all chunks go through the same deflate stream.
+// Returns false if the chunk cannot be compressed: the response is aborted
+// and the connection is closed, as the client has been promised gzip.
+bool
+HTTPServer::CompressChunk(HTTPMessage* p_message,bool p_final)
+{
+  GzipStream* stream = p_message->GetGzipStream();
+  if(p_message->GetChunkNumber() == 0 && stream == nullptr)
+  {
+    HTTPSite* site = p_message->GetHTTPSite();
+    if(site == nullptr || !site->GetHTTPCompression())
+    {
+      return true;
+    }
+    ServiceQuality quality(p_message->GetAcceptEncoding());
+    if(quality.GetPreferenceByName(_T("gzip")) <= 0)
+    {
+      return true;
+    }
+    stream = alloc_new GzipStream();
+    p_message->SetGzipStream(stream);
+    p_message->AddHeader(_T("Content-Encoding"),_T("gzip"));
+  }
+  if(stream == nullptr)
+  {
+    // Chunks are sent as-is
+    return true;
+  }
+  FileBuffer* buffer = p_message->GetFileBuffer();
+  size_t length = buffer->GetLength();
+  if(!buffer->ZipChunk(stream,p_final))
+  {
+    // Halfway the stream, there is no going back to plain text
+    ERRORLOG(ERROR_INVALID_DATA,_T("Cannot GZIP the chunk for transfer-encoding! Response aborted."));
+    if(p_message->GetRequestHandle())
+    {
+      CancelRequestStream(p_message->GetRequestHandle());
+    }
+    // Do **NOT** send another chunk
+    p_message->SetHasBeenAnswered();
+    return false;
+  }
+  DETAILLOGV(_T("GZIP chunk [%d] from %lu to %lu bytes"),p_message->GetChunkNumber() + 1,(unsigned long)length,(unsigned long)buffer->GetLength());
+  return true;
+}
+
 // Response in the server error range (500-505)
 void
 HTTPServer::RespondWithServerError(HTTPMessage*   p_message
@@ -1120,6 +1265,33 @@ HTTPServer::DoIsModifiedSince(HTTPMessage* p_msg)
     return false;
   }
 
+  // Answer from the static content cache of the site
+  StaticFile* file = site ? site->GetStaticCache()->GetFile(fileName) : nullptr;
+  if(file)
+  {
+    bool modified = true;
+    if(file->m_exists)
+    {
+      FILETIME fTime;
+      SystemTimeToFileTime(sinceTime,&fTime);
+      modified = CompareFileTime(&fTime,&file->m_lastWrite) < 0;
+    }
+    XString etag = file->m_etag;
+    file->DropReference();
+    if(modified)
+    {
+      return false;
+    }
+    // Not modified = 304
+    DETAILLOG1(_T("Sending response: Not modified"));
+    p_msg->Reset();
+    p_msg->GetFileBuffer()->Reset();
+    p_msg->SetStatus(HTTP_STATUS_NOT_MODIFIED);
+    p_msg->AddHeader(_T("ETag"),etag);
+    SendResponse(p_msg);
+    return true;
+  }
+
   // See if the file is there (existence)
   if(_taccess(fileName,00) == 0)
   {
@@ -1216,6 +1388,12 @@ HTTPServer::SubscribeEventStream(PSOCKADDR_IN6    p_sender
   if(stream->m_alive)
   {
     m_eventStreams.insert(std::make_pair(p_url,stream));
+    stream->m_registration = p_url;
+    stream->m_registered   = true;
+    stream->m_lastPulse    = GetTickCount64();
+    // Schedule the first keep-alive. The wheel holds a reference
+    stream->AddReference();
+    m_streamWheel.Add(stream,stream->m_lastPulse + m_eventKeepAlive);
     TryStartEventHeartbeat();
   }
   else
@@ -1227,54 +1405,70 @@ HTTPServer::SubscribeEventStream(PSOCKADDR_IN6    p_sender
   return stream;
 }
 
+// Drain the outbox of one event stream in the threadpool
+static void
+DrainEventStreamWork(void* p_stream)
+{
+  EventStream* stream = reinterpret_cast<EventStream*>(p_stream);
+  stream->m_site->GetHTTPServer()->DrainEventStream(stream);
+}
+
 // Send to a server push event stream / deleting p_event
+// The event is encoded only once, and placed in the outbox of every
+// subscriber. The event lock is NOT held during the network I/O: the
+// outboxes are drained by a separate bounded pool, so a slow client
+// cannot stall the publisher, the other subscribers or the request threads.
 bool
 HTTPServer::SendEvent(int p_port,const XString& p_site,ServerEvent* p_event,const XString& p_user /*=""*/)
 {
-  AutoCritSec lock(&m_eventLock);
   bool result = false;
+  EventStreams drain;
 
   XString site(p_site);
   site.MakeLower();
   site.TrimRight('/');
 
-//   // Get the stream-string of the event
-//   BYTE* buffer = nullptr;
-//   int   length = 0;
-//   EventToStringBuffer(p_event,&buffer,length);
-
   // Find the context of the URL (if any)
   HTTPSite* context = FindHTTPSite(p_port,site);
   if(context && context->GetIsEventStream())
   {
-    EventMap::iterator lower = m_eventStreams.lower_bound(site);
-    EventMap::iterator upper = m_eventStreams.upper_bound(site);
+    // Get the stream-string of the event, once for all streams
+    EventBuffer* buffer = EventBodyToBuffer(p_event);
 
-    while(lower != m_eventStreams.end())
-    {
-      // Find the stream
-      EventStream* stream = lower->second;
-
-      // Find next already before we remove this one on closing the stream
-      if(lower != upper)
-      {
-        ++lower;
-      }
+    // Snapshot of the subscribers: only queueing under the lock
+    { AutoCritSec lock(&m_eventLock);
 
-      // See if we must push the event to this stream
-      if(p_user.IsEmpty() || p_user.CompareNoCase(stream->m_user) == 0)
+      auto range = m_eventStreams.equal_range(site);
+      for(EventMap::iterator it = range.first; it != range.second; ++it)
       {
-        // Copy the event
-        ServerEvent* event = alloc_new ServerEvent(p_event);
+        EventStream* stream = it->second;
 
-        // Sending the event, while deleting it
-        // Accumulating the results, true if at least one is sent :-)
-        result |= SendEvent(stream,event);
+        // See if we must push the event to this stream
+        if(stream->m_alive && (p_user.IsEmpty() || p_user.CompareNoCase(stream->m_user) == 0))
+        {
+          bool mustDrain = false;
+          if(PostEvent(stream,buffer,NextEventID(stream,p_event->m_id),mustDrain))
+          {
+            // Accumulating the results, true if at least one is queued :-)
+            result = true;
+          }
+          if(mustDrain)
+          {
+            stream->AddReference();
+            drain.push_back(stream);
+          }
+        }
       }
-      // Next iterator
-      if(lower == upper)
+    }
+    // The outboxes hold their own references
+    buffer->DropReference();
+
+    // Wake a drain thread for every outbox that was idle
+    for(auto& stream : drain)
+    {
+      if(!m_drainPool.SubmitWork(DrainEventStreamWork,stream))
       {
-        break;
+        DrainEventStream(stream);
       }
     }
   }
@@ -1284,6 +1478,119 @@ HTTPServer::SendEvent(int p_port,const XString& p_site,ServerEvent* p_event,cons
   return result;
 }
 
+// Next event id of a stream
+// The given ID from the event is prevailing over the automatic stream id
+UINT
+HTTPServer::NextEventID(EventStream* p_stream,UINT p_id)
+{
+  ++p_stream->m_lastID;
+  if(p_id == 0)
+  {
+    return p_stream->m_lastID;
+  }
+  p_stream->m_lastID = p_id;
+  return p_id;
+}
+
+// Place an event in the outbox of a stream
+// Returns true if queued. p_drain tells if a thread must drain the outbox
+bool
+HTTPServer::PostEvent(EventStream* p_stream,EventBuffer* p_buffer,UINT p_id,bool& p_drain)
+{
+  AutoCritSec lock(&p_stream->m_outboxLock);
+
+  p_drain = false;
+  if(p_stream->m_outbox.size() >= EVENT_OUTBOX_MAXIMUM)
+  {
+    ++p_stream->m_dropped;
+    if(m_eventOverflow == EventOverflow::DropStream)
+    {
+      // Client cannot keep up. The drain or the monitor will abort it
+      // and the client will reconnect with its last event id
+      DETAILLOGS(_T("Event stream client too slow. Dropping stream: "),p_stream->m_baseURL);
+      p_stream->m_alive = false;
+      return false;
+    }
+    // Forget the oldest event
+    p_stream->m_outbox.front().m_buffer->DropReference();
+    p_stream->m_outbox.pop_front();
+  }
+  OutboxEvent event;
+  event.m_buffer = p_buffer;
+  event.m_id     = p_id;
+  p_buffer->AddReference();
+  p_stream->m_outbox.push_back(event);
+
+  if(!p_stream->m_draining)
+  {
+    p_stream->m_draining = true;
+    p_drain = true;
+  }
+  return true;
+}
+
+// Send the outbox of an event stream, until it is empty.
+// The caller holds a reference to the stream, so it cannot disappear
+// even if it is aborted while we are sending.
+void
+HTTPServer::DrainEventStream(EventStream* p_stream)
+{
+  while(true)
+  {
+    OutboxEvent event;
+    { AutoCritSec lock(&p_stream->m_outboxLock);
+      if(p_stream->m_outbox.empty())
+      {
+        p_stream->m_draining = false;
+        break;
+      }
+      event = p_stream->m_outbox.front();
+      p_stream->m_outbox.pop_front();
+    }
+
+    if(p_stream->m_alive)
+    {
+      // Stream id (and retry time for the first event) before the shared lines
+      char prefix[64];
+      int  prefixLength = 0;
+      if(event.m_id == 1)
+      {
+        prefixLength = sprintf_s(prefix,64,"retry: %u\n",m_eventRetryTime);
+      }
+      if(event.m_id > 0)
+      {
+        prefixLength += sprintf_s(&prefix[prefixLength],64 - prefixLength,"id:%u\n",event.m_id);
+      }
+      int   length = prefixLength + event.m_buffer->m_length;
+      BYTE* buffer = alloc_new BYTE[length + 1];
+      memcpy(buffer,prefix,prefixLength);
+      memcpy(&buffer[prefixLength],event.m_buffer->m_buffer,event.m_buffer->m_length);
+      buffer[length] = 0;
+
+      DETAILLOGV(_T("Sent event id: %d to client(s) on URL: %s"),event.m_id,p_stream->m_baseURL.GetString());
+
+      // Send the event to the client. This can take an I/O wait time
+      bool alive = SendResponseEventBuffer(p_stream->m_requestID,&p_stream->m_lock,&buffer,length);
+      delete [] buffer;
+
+      if(p_stream->m_alive)
+      {
+        p_stream->m_alive = alive;
+      }
+      p_stream->m_lastPulse = GetTickCount64();
+      ++p_stream->m_chunks;
+
+      // Not alive anymore, or out of data chunks: client will reopen a new stream
+      if(!p_stream->m_alive || p_stream->m_chunks > MAX_DATACHUNKS)
+      {
+        AbortEventStream(p_stream);
+      }
+    }
+    event.m_buffer->DropReference();
+  }
+  p_stream->DropReference();
+}
+
 // Send to a server push event stream on EventStream basis
 bool
 HTTPServer::SendEvent(EventStream* p_stream
@@ -1305,19 +1612,8 @@ HTTPServer::SendEvent(EventStream* p_stream
     return false;
   }
 
-  // Set next stream id
-  ++p_stream->m_lastID;
-
   // See to it that we have an id
-  // The given ID from the event is prevailing over the automatic stream id
-  if(p_event->m_id == 0)
-  {
-    p_event->m_id = p_stream->m_lastID;
-  }
-  else
-  {
-    p_stream->m_lastID = p_event->m_id;
-  }
+  p_event->m_id = NextEventID(p_stream,p_event->m_id);
 
   // Tell what we are about to do
   if (MUSTLOG(HLL_LOGGING) && m_log && p_stream->m_alive)
@@ -1344,7 +1640,7 @@ HTTPServer::SendEvent(EventStream* p_stream
   }
 
   // Remember the time we sent the event pulse
-  _time64(&(p_stream->m_lastPulse));
+  p_stream->m_lastPulse = GetTickCount64();
 
   // Remember the highest last ID
   if(p_event->m_id > p_stream->m_lastID)
@@ -1378,71 +1674,143 @@ HTTPServer::SendEvent(EventStream* p_stream
   return p_stream->m_alive;
 }
 
-// Form event to a stream string buffer 
-// Guaranteed to be in UTF-8 format
+// SSE Stream is always in UTF-8 format.
 // Caller must delete the buffer
-void
-HTTPServer::EventToStringBuffer(ServerEvent* p_event,BYTE** p_buffer,int& p_length)
+static void
+EventStringToBuffer(const XString& stream,BYTE** p_buffer,int& p_length)
+{
+#ifdef _UNICODE
+  TryCreateNarrowString(stream,_T("utf-8"),false,p_buffer,p_length);
+#else
+  XString utf8stream = EncodeStringForTheWire(stream,_T("utf-8"));
+  p_length  = utf8stream.GetLength();
+  *p_buffer = alloc_new BYTE[p_length + 1];
+  memcpy_s(*p_buffer,p_length + 1,utf8stream.GetString(),p_length);
+  (*p_buffer)[p_length] = 0;
+#endif
+}
+
+// Single pass SSE frame encoder.
+// Only the event name and the data are converted to UTF-8 (once). The frame
+// is then written straight into a buffer that is sized in advance:
+// every line of the data gets a "data:" prefix, with CR/LF and lone CR
+// normalized to LF on the fly, and the frame ends with an empty line.
+// Caller must delete the buffer
+static void
+EncodeEventFrame(LPCSTR p_prefix,ServerEvent* p_event,BYTE** p_buffer,int& p_length)
 {
-  XString stream;
+  static const char data[] = "data:";
+  static const char name[] = "event:";
+
+  BYTE* event       = nullptr;
+  int   eventLength = 0;
+  BYTE* lines       = nullptr;
+  int   linesLength = 0;
 
-  // Append client retry time to the first event
-  if(p_event->m_id == 1)
-  {
-    stream.Format(_T("retry: %u\n"),p_event->m_id);
-  }
   // Event name if not standard 'message'
   if(!p_event->m_event.IsEmpty() && p_event->m_event.CompareNoCase(_T("message")))
   {
-    stream.AppendFormat(_T("event:%s\n"),p_event->m_event.GetString());
+    EventStringToBuffer(p_event->m_event,&event,eventLength);
   }
-  // Event ID if not zero
-  if(p_event->m_id > 0)
+  if(!p_event->m_data.IsEmpty())
   {
-    stream.AppendFormat(_T("id:%u\n"),p_event->m_id);
+    EventStringToBuffer(p_event->m_data,&lines,linesLength);
   }
-  if(!p_event->m_data.IsEmpty())
+
+  // Every line break can start a new data line
+  int breaks = 0;
+  for(int ind = 0; ind < linesLength; ++ind)
   {
-    XString buffer = p_event->m_data;
-    // Optimize our carriage returns
-    if(buffer.Find('\r') >= 0)
+    if(lines[ind] == '\n' || lines[ind] == '\r')
     {
-      buffer.Replace(_T("\r\n"),_T("\n"));
-      buffer.Replace(_T("\r"),_T("\n"));
+      ++breaks;
     }
-    while(!buffer.IsEmpty())
+  }
+  int prefixLength = (int)strlen(p_prefix);
+  int size = prefixLength
+           + (event ? (int)sizeof(name) + eventLength : 0)
+           + linesLength + (breaks + 1) * (int)sizeof(data)
+           + 2;
+
+  BYTE* buffer = alloc_new BYTE[size + 1];
+  BYTE* out    = buffer;
+
+  memcpy(out,p_prefix,prefixLength);
+  out += prefixLength;
+
+  if(event)
+  {
+    memcpy(out,name,sizeof(name) - 1);
+    out += sizeof(name) - 1;
+    memcpy(out,event,eventLength);
+    out += eventLength;
+    *out++ = '\n';
+  }
+
+  int ind = 0;
+  while(ind < linesLength)
+  {
+    memcpy(out,data,sizeof(data) - 1);
+    out += sizeof(data) - 1;
+
+    // Copy up to the end of the line
+    while(ind < linesLength && lines[ind] != '\n' && lines[ind] != '\r')
     {
-      int pos = buffer.Find('\n');
-      if(pos < 0)
-      {
-        stream += _T("data:") + buffer + _T("\n");
-        buffer.Empty();
-      }
-      else
-      {
-        ++pos;
-        stream += _T("data:") + buffer.Left(pos);
-        buffer = buffer.Mid(pos);
-      }
+      *out++ = lines[ind++];
     }
-    // Catch the last line without a newline
-    if(stream.Right(1) != _T("\n"))
+    // Normalize CR/LF, CR and LF to one LF
+    if(ind < linesLength && lines[ind] == '\r')
     {
-      stream += _T("\n");
+      ++ind;
     }
+    if(ind < linesLength && lines[ind] == '\n')
+    {
+      ++ind;
+    }
+    *out++ = '\n';
   }
-  stream += _T("\n");
+  // End of the frame
+  *out++ = '\n';
+  *out   = 0;
 
-  // SSE Stream is always in UTF-8 format.
-#ifdef _UNICODE
-  TryCreateNarrowString(stream,_T("utf-8"),false,p_buffer,p_length);
-#else
-  XString utf8stream = EncodeStringForTheWire(stream,_T("utf-8"));
-  p_length  = utf8stream.GetLength();
-  *p_buffer = alloc_new BYTE[p_length + 1];
-  memcpy_s(*p_buffer,p_length + 1,utf8stream.GetString(),p_length);
-  (*p_buffer)[p_length] = 0;
-#endif
+  delete [] event;
+  delete [] lines;
+
+  *p_buffer = buffer;
+  p_length  = (int)(out - buffer);
+}
+
+// Form event to a stream string buffer 
+// Guaranteed to be in UTF-8 format
+// Caller must delete the buffer
+void
+HTTPServer::EventToStringBuffer(ServerEvent* p_event,BYTE** p_buffer,int& p_length)
+{
+  char prefix[64] = "";
+  int  length = 0;
+
+  // Append client retry time to the first event
+  if(p_event->m_id == 1)
+  {
+    length = sprintf_s(prefix,64,"retry: %u\n",m_eventRetryTime);
+  }
+  // Event ID if not zero
+  if(p_event->m_id > 0)
+  {
+    sprintf_s(&prefix[length],64 - length,"id:%u\n",p_event->m_id);
+  }
+  EncodeEventFrame(prefix,p_event,p_buffer,p_length);
+}
+
+// Form the event and data lines once, for all streams of an URL
+// The id is different for every stream, and is added when sending
+EventBuffer*
+HTTPServer::EventBodyToBuffer(ServerEvent* p_event)
+{
+  BYTE* buffer = nullptr;
+  int   length = 0;
+  EncodeEventFrame("",p_event,&buffer,length);
+  return alloc_new EventBuffer(buffer,length);
 }
 
 // Running our event monitor heartbeat thread
@@ -1476,7 +1844,7 @@ HTTPServer::EventMonitor()
   DETAILLOG1(_T("Event heartbeat monitor started"));
   do
   {
-    DWORD waited = WaitForSingleObjectEx(m_eventEvent,m_eventKeepAlive,true);
+    DWORD waited = WaitForSingleObjectEx(m_eventEvent,KEEPALIVE_WHEEL_TICK,true);
     switch(waited)
     {
       case WAIT_TIMEOUT:        streams  = CheckEventStreams();
@@ -1510,153 +1878,190 @@ HTTPServer::EventMonitor()
   }
 }
 
-// Check all event streams for the heartbeat monitor
-// No events are sent on this server, for the duration of this call
-// Dead streams will be cleaned
+// Keep-alive the event streams that are due on the timer wheel
+// Only the due streams are touched, and the event lock is not held
+// while sending. Dead streams are removed as soon as they are seen.
 UINT
 HTTPServer::CheckEventStreams()
 {
-  // Calculate the current moment in milliseconds
-  __timeb64 now;
-  _ftime64_s(&now);
-  __time64_t pulse = (now.time * CLOCKS_PER_SEC) + now.millitm;
-
-  AutoCritSec lock(&m_eventLock);
+  ULONGLONG now = GetTickCount64();
+  std::vector<EventStream*> due;
   UINT number = 0;
+
+  { AutoCritSec lock(&m_eventLock);
+    m_streamWheel.Advance(now,due);
+  }
+
   // Create keep alive buffer (always UTF-8 format compatible)
   char* keepAlive = ":keepalive\r\n\r\n";
   int size = (int) strlen(keepAlive);
 
-  DETAILLOG1(_T("Starting event heartbeat"));
-
-  // Pulse event stream with a comment
-  EventMap::iterator it = m_eventStreams.begin();
-  while(it != m_eventStreams.end())
+  for(auto& stream : due)
   {
     try
     {
-      EventStream* stream = it->second;
-      // If we did not send anything for the last eventKeepAlive seconds,
-      // Keep a margin of half a second for the wakeup of the server
-      // we send a ":keepalive" comment to the clients
-      if((pulse - stream->m_lastPulse) > (m_eventKeepAlive - 500))
+      // Stream already removed: drop the timer
+      if(!stream->m_registered)
       {
-        stream->m_alive = SendResponseEventBuffer(stream->m_requestID,&stream->m_lock,(BYTE**)&keepAlive,size);
-        stream->m_lastPulse = pulse;
-        ++stream->m_chunks;
-        ++number;
+        stream->DropReference();
+        continue;
       }
-      ++it;
-    }
-    catch(StdException& ex)
-    {
-      ERRORLOG(ERROR_NOT_FOUND,_T("Cannot handle event stream: ") + ex.GetErrorMessage());
-      try
+      if(stream->m_chunks > MAX_DATACHUNKS)
       {
-        delete it->second;
+        DETAILLOGS(_T("Push-event stream out of data chunks: "),stream->m_baseURL);
+        // Send a close-stream event, and close the connection
+        CloseEventStream(stream);
+        stream->DropReference();
+        continue;
       }
-      catch(StdException&)
+      if(stream->m_alive == false)
       {
-        ERRORLOG(ERROR_NOT_FOUND,_T("Event stream already gone!"));
+        DETAILLOGS(_T("Abandoned push-event client from: "),stream->m_baseURL);
+        AbortEventStream(stream);
+        stream->DropReference();
+        continue;
       }
-      it = m_eventStreams.erase(it);
-    }
-  }
 
-  // What we just did
-  DETAILLOGV(_T("Sent heartbeat to %d push-event clients."),number);
-
-  // Clean up dead event streams
-  it = m_eventStreams.begin();
-  while(it != m_eventStreams.end())
-  {
-    try
-    {
-      EventStream* stream = it->second;
-          if(stream->m_chunks > MAX_DATACHUNKS)
+      // If we did not send anything for the last eventKeepAlive seconds,
+      // Keep a margin of half a second for the wakeup of the server
+      // we send a ":keepalive" comment to the clients
+      ULONGLONG next = stream->m_lastPulse + m_eventKeepAlive;
+      if((now - stream->m_lastPulse) > (m_eventKeepAlive - 500))
       {
-        DETAILLOGS(_T("Push-event stream out of data chunks: "),stream->m_baseURL);
+        stream->m_alive = SendResponseEventBuffer(stream->m_requestID,&stream->m_lock,(BYTE**)&keepAlive,size);
+        stream->m_lastPulse = now;
+        next = now + m_eventKeepAlive;
+        ++stream->m_chunks;
+        ++number;
 
-        // Send a close-stream event
-        ServerEvent* event = alloc_new ServerEvent(_T("close"));
-        SendEvent(stream,event);
-        // Remove request from the request queue, closing the connection
-        CancelRequestStream(stream->m_requestID);
-        // Erase stream, it's out of chunks now
-        delete it->second;
-        it = m_eventStreams.erase(it);
+        if(!stream->m_alive)
+        {
+          DETAILLOGS(_T("Abandoned push-event client from: "),stream->m_baseURL);
+          AbortEventStream(stream);
+          stream->DropReference();
+          continue;
+        }
       }
-      else if(stream->m_alive == false)
+      // Schedule the next keep-alive (events sent in between postpone it)
+      AutoCritSec lock(&m_eventLock);
+      if(stream->m_registered)
       {
-        DETAILLOGS(_T("Abandoned push-event client from: "),stream->m_baseURL);
-
-        // Remove request from the request queue, closing the connection
-        CancelRequestStream(stream->m_requestID);
-        // Erase dead stream, and goto next
-        delete it->second;
-        it = m_eventStreams.erase(it);
+        m_streamWheel.Add(stream,next);
       }
       else
       {
-        ++it; // Next stream
+        stream->DropReference();
       }
     }
     catch(StdException& ex)
     {
-      ERRORLOG(ERROR_NOT_FOUND,_T("Cannot clean up event stream: ") + ex.GetErrorMessage());
-      try
-      {
-        delete it->second;
-      }
-      catch(StdException&)
-      {
-        ERRORLOG(ERROR_NOT_FOUND,_T("Event stream already gone!"));
-      }
-      it = m_eventStreams.erase(it);
+      ERRORLOG(ERROR_NOT_FOUND,_T("Cannot handle event stream: ") + ex.GetErrorMessage());
+      AbortEventStream(stream);
+      stream->DropReference();
     }
   }
 
+  // What we just did
+  if(number)
+  {
+    DETAILLOGV(_T("Sent heartbeat to %d push-event clients."),number);
+  }
+
   // Monitor still needed?
+  AutoCritSec lock(&m_eventLock);
   return (unsigned) m_eventStreams.size();
 }
 
+// Keep-alive the WebSockets that are due on the timer wheel
+// The due sockets are collected under the socket lock, but pinged after
+// releasing it, so a slow client does not block the (un)registering of
+// other sockets. UnRegisterWebSocket waits for the ping lock before a
+// socket that is being pinged can be destroyed.
 UINT
 HTTPServer::CheckWebsocketStreams()
 {
+  std::vector<SocketTimer> due;
   UINT number = 0;
-  bool retry(true);
 
-  while(retry)
+  { AutoCritSec lock(&m_socketLock);
+    m_socketWheel.Advance(GetTickCount64(),due);
+  }
+
+  for(auto& timer : due)
   {
-    number = 0;
-    retry  = false;
-    for(SocketMap::iterator it = m_sockets.begin();it != m_sockets.end();++it)
+    AutoCritSec ping(&m_socketPingLock);
+
+    { AutoCritSec lock(&m_socketLock);
+      // Socket gone or registered again: drop the timer
+      SocketTimers::iterator it = m_socketTimers.find(timer.m_socket);
+      if(it == m_socketTimers.end() || it->second.m_generation != timer.m_generation)
+      {
+        continue;
+      }
+      m_socketPinging = timer.m_socket;
+    }
+
+    bool alive = false;
+    try
     {
-      try
+      alive = timer.m_socket->SendKeepAlive();
+      if(!alive)
       {
-        if(!it->second->SendKeepAlive())
-        {
-          it->second->CloseSocket();
-          retry  = true;
-          break;
-        }
-        ++number;
+        // Removes the socket from the mapping
+        timer.m_socket->CloseSocket();
       }
-      catch(StdException&)
+    }
+    catch(StdException&)
+    {
+      ERRORLOG(ERROR_NOT_FOUND,_T("WebSocket stream already gone!"));
+    }
+
+    AutoCritSec lock(&m_socketLock);
+    m_socketPinging = nullptr;
+    if(alive)
+    {
+      SocketTimers::iterator it = m_socketTimers.find(timer.m_socket);
+      if(it != m_socketTimers.end() && it->second.m_generation == timer.m_generation)
       {
-        ERRORLOG(ERROR_NOT_FOUND,_T("WebSocket stream already gone!"));
-        retry = true;
-        break;
+        ScheduleSocketTimer(timer.m_socket,timer.m_generation,GetTickCount64() + m_eventKeepAlive);
+        ++number;
       }
     }
   }
   // What we just did
-  DETAILLOGV(_T("Sent pingpong heartbeat to %d websocket clients."),number);
+  if(number)
+  {
+    DETAILLOGV(_T("Sent pingpong heartbeat to %d websocket clients."),number);
+  }
 
   // Monitor still needed?
+  AutoCritSec lock(&m_socketLock);
   return (unsigned)m_sockets.size();
 }
 
+// Schedule the next keep-alive of a WebSocket (under the socket lock)
+void
+HTTPServer::ScheduleSocketTimer(WebSocket* p_socket,ULONG p_generation,ULONGLONG p_deadline)
+{
+  SocketTimer timer { p_socket,p_generation };
+  SocketSchedule& schedule = m_socketTimers[p_socket];
+  schedule.m_generation = p_generation;
+  schedule.m_slot       = m_socketWheel.Add(timer,p_deadline);
+}
+
+// Remove the keep-alive of a WebSocket from the wheel (under the socket lock)
+void
+HTTPServer::CancelSocketTimer(WebSocket* p_socket)
+{
+  SocketTimers::iterator it = m_socketTimers.find(p_socket);
+  if(it != m_socketTimers.end())
+  {
+    SocketTimer timer { p_socket,it->second.m_generation };
+    m_socketWheel.Cancel(timer,it->second.m_slot);
+    m_socketTimers.erase(it);
+  }
+}
+
 // Return the fact that we have an event stream
 bool
 HTTPServer::HasEventStream(const EventStream* p_stream)
@@ -1769,8 +2174,9 @@ HTTPServer::AbortEventStream(EventStream* p_stream)
   // No lock on the m_siteslock, as we are dealing with an event
   AutoCritSec lock(&m_eventLock);
 
-  EventMap::iterator it = m_eventStreams.begin();
-  while(it != m_eventStreams.end())
+  // Only look at the streams of the same registration
+  auto range = m_eventStreams.equal_range(p_stream->m_registration);
+  for(EventMap::iterator it = range.first; it != range.second; ++it)
   {
     if(it->second == p_stream)
     {
@@ -1778,14 +2184,15 @@ HTTPServer::AbortEventStream(EventStream* p_stream)
       {
         // Abandon the stream in the correct server
         CancelRequestStream(p_stream->m_requestID);
+        p_stream->m_alive = false;
       }
-      // Done with the stream
-      delete p_stream;
-      // Erase from the cache and return next position
+      // Erase from the cache
+      p_stream->m_registered = false;
       m_eventStreams.erase(it);
+      // Done with the stream. The keep-alive wheel or a draining thread may still hold it
+      p_stream->DropReference();
       return true;
     }
-    ++it;
   }
   return false;
 }
@@ -1798,6 +2205,7 @@ HTTPServer::RemoveEventStream(const XString& p_url)
   EventMap::iterator it = m_eventStreams.find(p_url);
   if (it != m_eventStreams.end())
   {
+    it->second->m_registered = false;
     m_eventStreams.erase(it);
   }
 }
@@ -1807,15 +2215,15 @@ HTTPServer::RemoveEventStream(const EventStream* p_stream)
 {
   AutoCritSec lock(&m_eventLock);
 
-  EventMap::iterator it = m_eventStreams.begin();
-  while(it != m_eventStreams.end())
+  auto range = m_eventStreams.equal_range(p_stream->m_registration);
+  for(EventMap::iterator it = range.first; it != range.second; ++it)
   {
     if(it->second == p_stream)
     {
+      it->second->m_registered = false;
       m_eventStreams.erase(it);
       return;
     }
-    ++it;
   }
 }
 
@@ -1890,15 +2298,25 @@ HTTPServer::RegisterSocket(WebSocket* p_socket)
   DETAILLOGV(_T("Register websocket [%s] at the server"),key.GetString());
   key.MakeLower();
 
+  // Drop the double socket. Removes socket from the mapping and its timer!
+  // Not under the socket lock: closing may wait for a keep-alive in progress
+  WebSocket* previous = FindWebSocket(key);
+  if(previous)
+  {
+    previous->CloseSocket();
+  }
+
   AutoCritSec lock(&m_socketLock);
   SocketMap::iterator it = m_sockets.find(key);
   if(it != m_sockets.end())
   {
-    // Drop the double socket. Removes socket from the mapping!
-    it->second->CloseSocket();
+    // Closing did not remove the double socket
+    CancelSocketTimer(it->second);
+    m_sockets.erase(it);
   }
-  // Register new socket
+  // Register new socket, with a keep-alive timer of its own
   m_sockets.insert(std::make_pair(key,p_socket));
+  ScheduleSocketTimer(p_socket,++m_socketGeneration,GetTickCount64() + m_eventKeepAlive);
 
   // Keep the sockets alive
   TryStartEventHeartbeat();
@@ -1909,30 +2327,45 @@ HTTPServer::RegisterSocket(WebSocket* p_socket)
 bool
 HTTPServer::UnRegisterWebSocket(WebSocket* p_socket,bool p_destroy /*= true*/)
 {
-  XString key;
-  AutoCritSec lock(&m_socketLock);
+  XString    key;
+  WebSocket* socket  = nullptr;
+  bool       found   = false;
+  bool       pinging = false;
   try
   {
     key = p_socket->GetIdentityKey();
     DETAILLOGV(_T("Unregistering websocket [%s] from the server"),key.GetString());
     key.MakeLower();
 
+    AutoCritSec lock(&m_socketLock);
     SocketMap::iterator it = m_sockets.find(key);
     if(it != m_sockets.end())
     {
-      WebSocket* socket = p_destroy ? it->second : nullptr;
+      socket  = p_destroy ? it->second : nullptr;
+      pinging = m_socketPinging == it->second;
+      CancelSocketTimer(it->second);
       m_sockets.erase(it);
-      if(socket)
-      {
-        delete socket;
-      }
-      return true;
+      found = true;
     }
+    pinging = pinging || m_socketPinging == p_socket;
   }
   catch(StdException& ex)
   {
     ERRORLOG(ERROR_INVALID_ACCESS,_T("WebSocket memory NOT FOUND! : " + ex.GetErrorMessage()));
   }
+  // Wait for the keep-alive in progress on this socket
+  if(pinging)
+  {
+    AutoCritSec ping(&m_socketPingLock);
+  }
+  if(found)
+  {
+    if(socket)
+    {
+      delete socket;
+    }
+    return true;
+  }
   if(p_destroy)
   {
     // We don't have it
@@ -2368,78 +2801,76 @@ HTTPServer::LogTraceResponse(PHTTP_RESPONSE p_response,unsigned char* p_buffer,u
 //
 //////////////////////////////////////////////////////////////////////////
 
+// Report the alarms in the threadpool
+static void
+ReportDDOSAttackWork(void* p_server)
+{
+  reinterpret_cast<HTTPServer*>(p_server)->ReportDDOSAttacks();
+}
+
 // Applications may call this registration after several failed 
 // login attempts of several failed SSE stream registration events
+// Once an attack is detected, it is reported outside of the call
 void
 HTTPServer::RegisterDDOSAttack(PSOCKADDR_IN6 p_sender,const XString& p_path)
 {
-  AutoCritSec lock(&m_sitesLock);
-
-  if(CheckUnderDDOSAttack(p_sender, p_path) == false)
+  if(m_ddos.Register(p_sender,p_path))
   {
-    DDOS attack;
-    memcpy(&attack.m_sender,p_sender,sizeof(SOCKADDR_IN6));
-    attack.m_abspath   = p_path;
-    attack.m_beginTime = clock();
-
-    m_attacks.push_back(attack);
-
-    // REGISTER THE ATTACK
-    XString sender = SocketToServer(p_sender);
-    ERRORLOG(ERROR_TOO_MANY_SESS,_T("DDOS ATTACK REGISTERED FOR: ") + sender + _T(" : ") + p_path);
-
-    // If we have a logfile where administrators may look
-    // register the attack there for all to see!
-    if(m_log)
+    XString alarm = SocketToServer(p_sender) + _T(" : ") + p_path;
+    if(m_ddos.PostAlarm(alarm))
     {
-      XString filename = m_log->GetLogFileName();
-      int pos = filename.ReverseFind('\\');
-      if(pos)
+      if(!m_pool.SubmitWork(ReportDDOSAttackWork,this))
       {
-        filename = filename.Left(pos) + _T("ALARM_DDOS_ATTACK.txt");
-        WinFile file(filename);
-
-        if(file.Open(winfile_write,FAttributes::attrib_none,Encoding::UTF8))
-        {
-          file.Format(_T("%s: %s\n"),sender.GetString(),p_path.GetString());
-          file.Close();
-        }
+        ReportDDOSAttacks();
       }
     }
   }
 }
 
+// Called for incoming requests. Lock free
 bool
 HTTPServer::CheckUnderDDOSAttack(PSOCKADDR_IN6 p_sender,const XString& p_path)
 {
-  AutoCritSec lock(&m_sitesLock);
+  return m_ddos.Check(p_sender,p_path);
+}
 
-  // If no attacks registered: we are *NOT* under attack
-  if(m_attacks.empty())
+// Write all queued alarms to the logfile and the alarm file
+void
+HTTPServer::ReportDDOSAttacks()
+{
+  std::vector<XString> alarms;
+  m_ddos.TakeAlarms(alarms);
+  if(alarms.empty())
   {
-    return false;
+    return;
+  }
+
+  // REGISTER THE ATTACK
+  for(auto& alarm : alarms)
+  {
+    ERRORLOG(ERROR_TOO_MANY_SESS,_T("DDOS ATTACK REGISTERED FOR: ") + alarm);
   }
-  // See if we find the attack vector.
-  for(DDOSMap::iterator it = m_attacks.begin();it != m_attacks.end();++it)
+
+  // If we have a logfile where administrators may look
+  // register the attack there for all to see!
+  if(m_log)
   {
-    if((memcmp(&it->m_sender,p_sender,sizeof(SOCKADDR_IN6)) == 0) &&
-       (it->m_abspath.CompareNoCase(p_path) == 0))
+    XString filename = m_log->GetLogFileName();
+    int pos = filename.ReverseFind('\\');
+    if(pos)
     {
-      if(it->m_beginTime < (clock() - TIMEOUT_BRUTEFORCE))
-      {
-        // DDOS Attack is now officially over from this sender
-        m_attacks.erase(it);
-        return false;
-      }
-      else
+      filename = filename.Left(pos) + _T("ALARM_DDOS_ATTACK.txt");
+      WinFile file(filename);
+
+      if(file.Open(winfile_write,FAttributes::attrib_none,Encoding::UTF8))
       {
-        // Extra attack: Bump the clock and wait an extra interval
-        it->m_beginTime = clock();
-        return true;
+        for(auto& alarm : alarms)
+        {
+          file.Format(_T("%s\n"),alarm.GetString());
+        }
+        file.Close();
       }
     }
   }
-  // Nothing found: we are *NOT* part of any attack
-  return false;
 }
 
@@ -43,6 +43,8 @@
 #include "MediaType.h"
 #include "ErrorReport.h"
 #include "EventStream.h"
+#include "KeepaliveWheel.h"
+#include "DDOSDetector.h"
 #include "Version.h"
 #include <wincred.h>
 #include <http.h>
@@ -116,20 +118,6 @@ enum class SendHeader
  ,HTTP_SH_HIDESERVER            // Hide the server type - do not send header
 };
 
-// Registration of DDOS attacks on the server
-class DDOS
-{
-public:
-  DDOS()
-  {
-    memset(&m_sender,0,sizeof(SOCKADDR_IN6));
-  }
-
-  SOCKADDR_IN6  m_sender;
-  XString       m_abspath;
-  clock_t       m_beginTime { 0 };
-};
-
 class UKHeader
 {
 public:
@@ -154,6 +142,7 @@ public:
 // Forward declarations
 class LogAnalysis;
 class HTTPSite;
+class SiteRouter;
 class HTTPURLGroup;
 class HTTPRequest;
 class JSONMessage;
@@ -161,6 +150,37 @@ class WebServiceServer;
 class WebSocket;
 class RawFrame;
 
+// Keep-alive timer of a WebSocket on the timer wheel.
+// The generation tells a later registration of the same socket apart.
+class SocketTimer
+{
+public:
+  WebSocket* m_socket;
+  ULONG      m_generation;
+
+  bool operator==(const SocketTimer& p_other) const
+  {
+    return m_socket == p_other.m_socket && m_generation == p_other.m_generation;
+  }
+};
+
+// Current keep-alive timer of a registered WebSocket
+class SocketSchedule
+{
+public:
+  ULONG      m_generation;  // Generation of the registration
+  size_t     m_slot;        // Slot of the timer in the wheel
+};
+
+// A replaced site router, freed once no lookup can be walking it any more
+class RetiredRouter
+{
+public:
+  SiteRouter* m_router;     // The replaced router
+  HTTPSite*   m_site;       // Site removed from the site map with it (if any)
+  long        m_epoch;      // Epoch that started with the replacement
+};
+
 // Type declarations for mappings
 using SiteMap     = std::map<XString,HTTPSite*>;
 using EventMap    = std::multimap<XString,EventStream*>;
@@ -168,8 +188,9 @@ using ServiceMap  = std::map<XString,WebServiceServer*>;
 using URLGroupMap = std::vector<HTTPURLGroup*>;
 using UKHeaders   = std::vector<UKHeader>;
 using SocketMap   = std::map<XString,WebSocket*>;;
+using SocketTimers= std::map<WebSocket*,SocketSchedule>;
 using RequestMap  = std::deque<HTTPRequest*>;
-using DDOSMap     = std::vector<DDOS>;
+using RetiredRouters = std::vector<RetiredRouter>;
 
 // All the media types
 extern MediaTypes* g_media;
@@ -248,6 +269,8 @@ public:
   void       SetQueueLength(ULONG p_length);
   // OPTIONAL: Sent a BOM in the event stream
   void       SetByteOrderMark(bool p_mark);
+  // OPTIONAL: What to do with event stream clients that cannot keep up
+  void       SetEventOverflow(EventOverflow p_overflow);
   // OPTIONAL: Set (detailed) logging of the server components
   // DEPRECATED: Do no longer use this interface!
   void       SetDetailedLogging(bool p_detail);
@@ -302,6 +325,8 @@ public:
   SendHeader  GetSendServerHeader();
   // Event stream starts with BOM
   bool        GetEventBOM();
+  // What to do with event stream clients that cannot keep up
+  EventOverflow GetEventOverflow();
   // Exposes the server-sent-event lock
   CRITICAL_SECTION* GetEventLock();
 
@@ -318,8 +343,9 @@ public:
 
   // Find HTTPSite for an URL
   HTTPSite*  FindHTTPSite(int p_port,PCWSTR p_url);
-  HTTPSite*  FindHTTPSite(int p_port,const XString& p_url);
-  HTTPSite*  FindHTTPSite(HTTPSite* p_default,const XString& p_url);
+  // Optionally returns the number of characters of the URL matched by the site
+  HTTPSite*  FindHTTPSite(int p_port,const XString& p_url,int* p_matched = nullptr);
+  HTTPSite*  FindHTTPSite(HTTPSite* p_default,const XString& p_url,int* p_matched = nullptr);
 
   // Logging and tracing: The response
   void      LogTraceResponse(PHTTP_RESPONSE p_response,HTTPMessage* p_message,Encoding p_encoding = Encoding::EN_ACP);
@@ -342,6 +368,8 @@ public:
   // Sending response for an incoming message
   void       SendResponse(SOAPMessage* p_message);
   void       SendResponse(JSONMessage* p_message);
+  // GZIP the next chunk of a chunked response (if the client accepts it). False = response aborted
+  bool       CompressChunk(HTTPMessage* p_message,bool p_final);
   // Return the number of push-event-streams for this URL, and probably for a user
   int        HasEventStreams(int p_port,const XString& p_url,const XString& p_user = _T(""));
   // Return the fact that we have an event stream
@@ -359,6 +387,10 @@ public:
   // Delete event stream
   void       RemoveEventStream(const XString& p_url);
   void       RemoveEventStream(const EventStream* p_stream);
+  // Send the outbox of an event stream (called from the threadpool)
+  void       DrainEventStream(EventStream* p_stream);
+  // Form the event and data lines of an event, for all streams at once
+  EventBuffer* EventBodyToBuffer(ServerEvent* p_event);
   // Monitor all server push event streams
   void       EventMonitor();
   // Register a WebServiceServer
@@ -371,8 +403,8 @@ public:
   int        FindRemoteDesktop(USHORT p_count,PHTTP_UNKNOWN_HEADER p_headers);
   // Authentication failed for this reason
   XString    AuthenticationStatus(SECURITY_STATUS p_secStatus);
-  // Find routing information within the site
-  void       CalculateRouting(const HTTPSite* p_site,HTTPMessage* p_message);
+  // Find routing information within the site, after the matched part of the URL
+  void       CalculateRouting(const HTTPSite* p_site,HTTPMessage* p_message,int p_matched = -1);
   // Finding a previous registered service endpoint
   WebServiceServer* FindService(const XString& p_serviceName);
   // Finding a previous registered WebSocket
@@ -415,6 +447,7 @@ public:
   // DDOS Attack mechanism
   void       RegisterDDOSAttack  (PSOCKADDR_IN6 p_sender,const XString& p_path);
   bool       CheckUnderDDOSAttack(PSOCKADDR_IN6 p_sender,const XString& p_path);
+  void       ReportDDOSAttacks();
 
 protected:
   // Cleanup the server
@@ -440,13 +473,25 @@ protected:
   void      CheckSitesStarted();
   // Make a "port:url" registration name
   XString   MakeSiteRegistrationName(int p_port,const XString& p_url);
+  // Publish a new site router after changing the site map (under the sites lock)
+  // A removed site is freed together with the router it was in.
+  void      PublishSiteRouter(HTTPSite* p_removed = nullptr);
+  // Free the replaced routers that no lookup is walking any more
+  void      ReclaimSiteRouters(bool p_wait);
     // Form event to a stream string
   void      EventToStringBuffer(ServerEvent* p_event,BYTE** p_buffer,int& p_length);
+  // Next event id of a stream
+  UINT      NextEventID(EventStream* p_stream,UINT p_id);
+  // Place an event in the outbox of a stream (under the event lock)
+  bool      PostEvent(EventStream* p_stream,EventBuffer* p_buffer,UINT p_id,bool& p_drain);
   // Try to start the even heartbeat monitor
   void      TryStartEventHeartbeat();
-  // Check all event streams for the heartbeat monitor
+  // Keep-alive the event streams and WebSockets that are due
   UINT      CheckEventStreams();
   UINT      CheckWebsocketStreams();
+  // Keep-alive timer of a WebSocket (under the socket lock)
+  void      ScheduleSocketTimer(WebSocket* p_socket,ULONG p_generation,ULONGLONG p_deadline);
+  void      CancelSocketTimer(WebSocket* p_socket);
   // For the handling of the event streams: implement this function
   virtual bool SendResponseEventBuffer(HTTP_OPAQUE_ID     p_response
                                       ,CRITICAL_SECTION*  p_lock
@@ -477,6 +522,7 @@ protected:
   HTTP_CACHE_POLICY_TYPE  m_policy   { HttpCachePolicyNocache };        // Cache policy
   ULONG                   m_secondsToLive  { 0 };   // Seconds to live in the cache
   ThreadPool              m_pool;                   // Our threadpool for the server
+  ThreadPool              m_drainPool;              // Bounded pool sending the event stream outboxes
   MarlinConfig*           m_marlinConfig;           // Web.config or Marlin.Config in our current directory
   LogAnalysis*            m_log      { nullptr };   // Logging object
   bool                    m_logOwner { false   };   // Server owns the log
@@ -489,6 +535,10 @@ protected:
   SiteMap                 m_allsites;               // All URL's and context pointers
   ServiceMap              m_allServices;            // All Services
   CRITICAL_SECTION        m_sitesLock;              // Creating/starting/stopping sites
+  SiteRouter* volatile    m_siteRouter { nullptr }; // Current lock-free router to all sites
+  long volatile           m_routerEpoch { 0 };      // Flips on every publication of a router
+  long                    m_routerReaders[2] { 0,0 }; // Lookups in progress per epoch parity
+  RetiredRouters          m_retiredRouters;         // Replaced routers, still in use by lookups
   bool                    m_hasSubsites{ false };   // Server serves at least 1 sub-site
   // All requests
   RequestMap              m_requests;               // All outstanding HTTP requests
@@ -499,12 +549,19 @@ protected:
   ULONG                   m_eventKeepAlive{ DEFAULT_EVENT_KEEPALIVE };  // MS between keep-alive pulses
   ULONG                   m_eventRetryTime{ DEFAULT_EVENT_RETRYTIME };  // Clients must retry after this time
   bool                    m_eventBOM   { false };   // Prepend all event with a Byte-order-mark
+  EventOverflow           m_eventOverflow { EventOverflow::DropStream }; // Slow event stream clients
   CRITICAL_SECTION        m_eventLock;              // Pulsing events or accessing streams
+  KeepaliveWheel<EventStream*> m_streamWheel;       // Next keep-alive of the event streams
   // WebSocket
   SocketMap               m_sockets;                // Registered WebSockets
   CRITICAL_SECTION        m_socketLock;             // Lock to register, find, remove WebSockets
+  KeepaliveWheel<SocketTimer> m_socketWheel;        // Next keep-alive of the WebSockets
+  SocketTimers            m_socketTimers;           // Keep-alive timer of each registered WebSocket
+  ULONG                   m_socketGeneration{ 0 };  // Last generation of a socket registration
+  WebSocket*              m_socketPinging{nullptr}; // WebSocket that is getting a keep-alive
+  CRITICAL_SECTION        m_socketPingLock;         // Held by the monitor while pinging a WebSocket
   // Registered DDOS Attacks
-  DDOSMap                 m_attacks;                // Registration of DDOS attacks
+  DDOSDetector            m_ddos;                   // Detection of DDOS attacks
 };
 
 inline XString
@@ -693,6 +750,18 @@ HTTPServer::GetEventBOM()
   return m_eventBOM;
 }
 
+inline void
+HTTPServer::SetEventOverflow(EventOverflow p_overflow)
+{
+  m_eventOverflow = p_overflow;
+}
+
+inline EventOverflow
+HTTPServer::GetEventOverflow()
+{
+  return m_eventOverflow;
+}
+
 inline CRITICAL_SECTION*
 HTTPServer::GetEventLock()
 {
@@ -118,6 +118,9 @@ HTTPServerIIS::Initialise()
 void
 HTTPServerIIS::Cleanup()
 {
+  // No more draining of the event stream outboxes
+  m_drainPool.Shutdown();
+
   AutoCritSec lock1(&m_sitesLock);
   AutoCritSec lock2(&m_eventLock);
 
@@ -127,6 +130,7 @@ HTTPServerIIS::Cleanup()
     delete it.second;
   }
   m_sockets.clear();
+  m_socketTimers.clear();
 
   // Remove all event streams within the scope of the eventLock
   for(const auto& it : m_eventStreams)
@@ -149,6 +153,7 @@ HTTPServerIIS::Cleanup()
     if (it->second->StopSite(true) == false)
     {
       m_allsites.erase(it);
+      PublishSiteRouter();
     };
   }
 
@@ -345,8 +350,10 @@ HTTPServerIIS::DeleteSite(int p_port,const XString& p_baseURL,bool /*p_force /*=
     }
     // And remove from the site map
     DETAILLOGS(_T("Removed site: "),site->GetPrefixURL());
-    delete site;
+    // The site is freed with the router it was in,
+    // once no lookup can find the site any more
     m_allsites.erase(it);
+    PublishSiteRouter(site);
     result = true;
   }
   return result;
@@ -430,7 +437,7 @@ HTTPServerIIS::GetHTTPStreamFromRequest(IHttpContext* p_context
       }
       RemoveEventStream(stream);
       delete message;
-      delete stream;
+      stream->DropReference();
     }
     return -1;
   }
@@ -476,10 +483,11 @@ HTTPServerIIS::GetHTTPMessageFromRequest(IHttpContext* p_context
   LogTraceRequest(p_request,nullptr,encoding);
 
   // See if we must substitute for a sub-site
+  int matched = -1;
   if(m_hasSubsites)
   {
     XString absPath = WStringToString(p_request->CookedUrl.pAbsPath);
-    p_site = FindHTTPSite(p_site,absPath);
+    p_site = FindHTTPSite(p_site,absPath,&matched);
   }
 
   // Check our authentication
@@ -560,7 +568,7 @@ HTTPServerIIS::GetHTTPMessageFromRequest(IHttpContext* p_context
   }
 
   // Find routing information within the site
-  CalculateRouting(p_site,message);
+  CalculateRouting(p_site,message,matched);
 
   // Find X-HTTP-Method VERB Tunneling
   if(type == HTTPCommand::http_post && p_site->GetVerbTunneling())
@@ -871,13 +879,19 @@ HTTPServerIIS::SendAsChunk(HTTPMessage* p_message,bool p_final /*= false*/)
     ERRORLOG(ERROR_INVALID_PARAMETER,_T("Send as chunk cannot send a file!"));
     return;
   }
+  // Streaming compression of the chunk
+  if(!CompressChunk(p_message,p_final))
+  {
+    return;
+  }
+
   // Chunk encode the file buffer
   if(!buffer->ChunkedEncoding(p_final))
   {
     ERRORLOG(ERROR_NOT_ENOUGH_MEMORY,_T("Cannot chunk-encode the message for transfer-encoding!"));
   }
 
-  // If we want to send a (g)zipped buffer, that should have been done already by now
+  // Already (g)zipped by the stream: the buffer of the chunk is never zipped as a whole
   p_message->SetAcceptEncoding(_T(""));
 
   // Get the chunk number (first->next)
@@ -210,6 +210,9 @@ void
 HTTPServerMarlin::Cleanup()
 {
   ULONG retCode;
+  // No more draining of the event stream outboxes
+  m_drainPool.Shutdown();
+
   AutoCritSec lock1(&m_sitesLock);
   AutoCritSec lock2(&m_eventLock);
 
@@ -219,6 +222,7 @@ HTTPServerMarlin::Cleanup()
     delete it.second;
   }
   m_sockets.clear();
+  m_socketTimers.clear();
 
   // Remove all event streams within the scope of the eventLock
   for(const auto& it : m_eventStreams)
@@ -506,8 +510,10 @@ HTTPServerMarlin::DeleteSite(int p_port,const XString& p_baseURL,bool p_force /*
     // And remove from the site map
     if(result || p_force)
     {
-      delete site;
+      // The site is freed with the router it was in,
+      // once no lookup can find the site any more
       m_allsites.erase(it);
+      PublishSiteRouter(site);
       result = true;
     }
   }
@@ -841,6 +847,12 @@ HTTPServerMarlin::SendAsChunk(HTTPMessage* p_message, bool p_final /*= false*/)
     ERRORLOG(ERROR_INVALID_PARAMETER, _T("Send as chunk cannot send a file!"));
     return;
   }
+  // Streaming compression of the chunk
+  if(!CompressChunk(p_message,p_final))
+  {
+    return;
+  }
+
   // Chunk encode the file buffer
   if(!buffer->ChunkedEncoding(p_final))
   {
@@ -848,7 +860,7 @@ HTTPServerMarlin::SendAsChunk(HTTPMessage* p_message, bool p_final /*= false*/)
     return;
   }
 
-  // If we want to send a (g)zipped buffer, that should have been done already by now
+  // Already (g)zipped by the stream: the buffer of the chunk is never zipped as a whole
   p_message->SetAcceptEncoding(_T(""));
   // Add chunked indicator
   p_message->AddHeader(HttpHeaderTransferEncoding,_T("chunked"));
@@ -173,6 +173,9 @@ void
 HTTPServerSync::Cleanup()
 {
   ULONG retCode;
+  // No more draining of the event stream outboxes
+  m_drainPool.Shutdown();
+
   AutoCritSec lock1(&m_sitesLock);
   AutoCritSec lock2(&m_eventLock);
 
@@ -298,7 +301,7 @@ void HTTPSiteCallbackEvent(void* p_argument)
       if(!site->HandleEventStream(message,stream))
       {
         site->GetHTTPServer()->RemoveEventStream(stream);
-        delete stream;
+        stream->DropReference();
       }
     }
   }
@@ -474,10 +477,11 @@ HTTPServerSync::RunHTTPServer()
         SvcReportErrorEvent(0,true,_T(__FUNCTION__),XString(_T("FATAL: Site not found: ")) + rawUrl);
       }
       // See if we must substitute for a sub-site
+      int matched = -1;
       if(site && m_hasSubsites)
       {
         XString absPath = WStringToString(request->CookedUrl.pAbsPath);
-        site = FindHTTPSite(site,absPath);
+        site = FindHTTPSite(site,absPath,&matched);
       }
 
       // Check our authentication
@@ -590,7 +594,7 @@ HTTPServerSync::RunHTTPServer()
       }
 
       // Find routing information within the site
-      CalculateRouting(site,message);
+      CalculateRouting(site,message,matched);
 
       // Find X-HTTP-Method VERB Tunneling
       if(type == HTTPCommand::http_post && site->GetVerbTunneling())
@@ -962,6 +966,12 @@ HTTPServerSync::SendAsChunk(HTTPMessage* p_message,bool p_final /*= false*/)
     ERRORLOG(ERROR_INVALID_PARAMETER,_T("Send as chunk cannot send a file!"));
     return;
   }
+  // Streaming compression of the chunk
+  if(!CompressChunk(p_message,p_final))
+  {
+    return;
+  }
+
   // Chunk encode the file buffer
   if(!buffer->ChunkedEncoding(p_final))
   {
@@ -969,7 +979,7 @@ HTTPServerSync::SendAsChunk(HTTPMessage* p_message,bool p_final /*= false*/)
     return;
   }
 
-  // If we want to send a (g)zipped buffer, that should have been done already by now
+  // Already (g)zipped by the stream: the buffer of the chunk is never zipped as a whole
   p_message->SetAcceptEncoding(_T(""));
 
   // Get the chunk number (first->next)
@@ -56,7 +56,6 @@
 
 // Cleanup handler after a crash-report
 __declspec(thread) SiteHandler*      g_cleanup  = nullptr;
-__declspec(thread) CRITICAL_SECTION* g_throttle = nullptr;
 
 // THE XTOR
 HTTPSite::HTTPSite(HTTPServer*    p_server
@@ -84,7 +83,6 @@ HTTPSite::~HTTPSite()
 {
   CleanupFilters();
   CleanupHandlers();
-  CleanupThrotteling();
   CleanupRewriter();
   DeleteCriticalSection(&m_filterLock);
   DeleteCriticalSection(&m_sessionLock);
@@ -123,18 +121,6 @@ HTTPSite::CleanupFilters()
   m_filters.clear();
 }
 
-// Remove all critical sections from the throttling map
-void
-HTTPSite::CleanupThrotteling()
-{
-  for(ThrottlingMap::iterator it = m_throttels.begin();it != m_throttels.end(); ++it)
-  {
-    DeleteCriticalSection(it->second);
-    delete it->second;
-  }
-  m_throttels.clear();
-}
-
 // Remove the URL rewriter
 void
 HTTPSite::CleanupRewriter()
@@ -169,6 +155,8 @@ HTTPSite::AddContentType(bool p_logging,const XString& p_extension,const XString
     it->second.SetExtension(extension);
     it->second.SetContentType(p_contentType);
   }
+  // Cached files have their content type
+  m_staticCache.Reset();
 }
 
 // Getting a registered content type for a file extension
@@ -411,6 +399,16 @@ HTTPSite::InitSite(MarlinConfig& p_config)
   m_compression   = p_config.GetParameterBoolean(_T("Server"),_T("HTTPCompression"),m_compression);
   m_throttling    = p_config.GetParameterBoolean(_T("Server"),_T("HTTPThrotteling"),m_throttling);
 
+  // Getting throttling settings: token bucket per address
+  m_limiter.SetRate          (p_config.GetParameterDouble (_T("Server"),_T("ThrottlingRate"),   m_limiter.GetRate()));
+  m_limiter.SetBurst         (p_config.GetParameterDouble (_T("Server"),_T("ThrottlingBurst"),  m_limiter.GetBurst()));
+  m_limiter.SetMaximumClients(p_config.GetParameterInteger(_T("Server"),_T("ThrottlingClients"),m_limiter.GetMaximumClients()));
+
+  // Getting the static content cache settings
+  m_staticCache.SetActive        (p_config.GetParameterBoolean(_T("Server"),_T("StaticCache"),        m_staticCache.GetActive()));
+  m_staticCache.SetTimeToLive    (p_config.GetParameterInteger(_T("Server"),_T("StaticCacheTTL"),     m_staticCache.GetTimeToLive()));
+  m_staticCache.SetMemoryFileSize(p_config.GetParameterInteger(_T("Server"),_T("StaticCacheFileSize"),(int)m_staticCache.GetMemoryFileSize()));
+
   // Getting cookie settings
   m_cookieHasSecure = p_config.HasParameter(_T("Cookies"),_T("Secure"));
   m_cookieHasHttp   = p_config.HasParameter(_T("Cookies"),_T("HttpOnly"));
@@ -546,6 +544,9 @@ HTTPSite::LogSettings()
   DETAILLOGS(_T("Site accepting Server-Sent-Events  : "),       m_isEventStream ? _T("ON") : _T("OFF"));
   DETAILLOGS(_T("Site allows for HTTP-VERB Tunneling: "),       m_verbTunneling ? _T("ON") : _T("OFF"));
   DETAILLOGS(_T("Site uses HTTP Throtteling         : "),       m_throttling    ? _T("ON") : _T("OFF"));
+  DETAILLOGV(_T("Site HTTP Throttling rate/burst    : %g/%g"),  m_limiter.GetRate(),m_limiter.GetBurst());
+  DETAILLOGV(_T("Site HTTP Throttling clients       : %u"),     m_limiter.GetMaximumClients());
+  DETAILLOGS(_T("Site caches static content         : "),       m_staticCache.GetActive() ? _T("ON") : _T("OFF"));
   DETAILLOGS(_T("Site forces response to UTF-16     : "),       m_sendUnicode   ? _T("ON") : _T("OFF"));
   DETAILLOGS(_T("Site forces SOAP response UTF BOM  : "),       m_sendSoapBOM   ? _T("ON") : _T("OFF"));
   DETAILLOGS(_T("Site forces JSON response UTF BOM  : "),       m_sendJsonBOM   ? _T("ON") : _T("OFF"));
@@ -669,10 +670,12 @@ HTTPSite::HandleHTTPMessage(HTTPMessage* p_message)
 
   try
   {
-    // HTTP Throttling is one call per calling address at the time
-    if(m_throttling)
+    // HTTP Throttling is a maximum call rate per calling address
+    if(m_throttling && !StartThrottling(p_message))
     {
-      g_throttle = StartThrottling(p_message);
+      // Already answered with 'too many requests'
+      p_message->DropReference();
+      return;
     }
 
     // Try to read the body / rest of the message
@@ -747,12 +750,6 @@ HTTPSite::HandleHTTPMessage(HTTPMessage* p_message)
     // TEST CRASH HANDLER
     // HANDLE* event = nullptr;
     // *event = 0L;
-
-    // Remove the throttling lock!
-    if(m_throttling)
-    {
-      EndThrottling(g_throttle);
-    }
   }
   catch(StdException& ex)
   {
@@ -805,12 +802,6 @@ HTTPSite::PostHandle(HTTPMessage* p_message,bool p_reset /*=true*/)
 {
   try
   {
-    // If we did throttling, remove the lock
-    if(m_throttling)
-    {
-      EndThrottling(g_throttle);
-    }
-
     // Respond to the client with a server error in all cases. 
     // Do NOT send the error report to the client. No need to show the error-stack!!
     if(p_reset)
@@ -1023,75 +1014,36 @@ HTTPSite::RemoveFilter(unsigned p_priority)
 //
 //////////////////////////////////////////////////////////////////////////
 
-CRITICAL_SECTION* 
+// Take a token from the bucket of the calling address (USER/IP/Desktop combination)
+// If the bucket is empty, reject the call with 'Retry-After' and return false
+// Never waits for a token: that would hold a threadpool thread
+bool
 HTTPSite::StartThrottling(HTTPMessage* p_message)
 {
-  CRITICAL_SECTION* section = nullptr;
+  XString       userSID = GetStringSID(p_message->GetAccessToken());
+  UINT          desktop = p_message->GetRemoteDesktop();
+  PSOCKADDR_IN6 sender  = p_message->GetSender();
 
-  // Get the address of the sender (USER/IP/Desktop combination)
-  // Do not fill in the URL absPath member !!
-  SessionAddress address;
-  address.m_userSID = GetStringSID(p_message->GetAccessToken());
-  address.m_desktop = p_message->GetRemoteDesktop();
-  address.m_address = p_message->GetSender()->sin6_flowinfo;
+  ULONGLONG client = RateLimiter::HashClient(userSID.GetString(),userSID.GetLength() * sizeof(TCHAR));
+  client = RateLimiter::HashClient(&desktop,sizeof(UINT),client);
+  client = RateLimiter::HashClient(&sender->sin6_flowinfo,sizeof(ULONG),client);
+  client = RateLimiter::HashClient(&sender->sin6_addr,sizeof(IN6_ADDR),client);
 
-  // Finding/creating the throttle
-  ThrottlingMap::iterator it = m_throttels.find(address);
-  if(it == m_throttels.end())
+  ULONG retry = 0;
+  if(m_limiter.Acquire(client,retry))
   {
-    // Create a throttle for this address
-    section = alloc_new CRITICAL_SECTION();
-    InitializeCriticalSection(section);
-    m_throttels.insert(std::make_pair(address,section));
-    it = m_throttels.find(address);
-  }
-  else
-  {
-    // Already created
-    section = it->second;
-  }
-  // Throttle is now found, consume it
-  EnterCriticalSection(section);
-
-  return section;
-}
-
-void
-HTTPSite::EndThrottling(CRITICAL_SECTION*& p_throttle)
-{
-  // That easy!
-  LeaveCriticalSection(p_throttle);
-
-  // See if we must start the cleanup process
-  // Thread has already serviced the HTTP call
-  if(m_throttels.size() > MAX_HTTP_THROTTLES)
-  {
-    TryFlushThrottling();
+    return true;
   }
-}
-
-// Erase all throttles that are not in use
-// But leave the once that are currently used by a session call
-// And so reducing the amount of memory used by the site
-void
-HTTPSite::TryFlushThrottling()
-{
-  AutoCritSec lock(&m_sessionLock);
 
-  ThrottlingMap::iterator it = m_throttels.begin();
-  while(it != m_throttels.end())
-  {
-    if(TryEnterCriticalSection(it->second))
-    {
-      DeleteCriticalSection(it->second);
-      delete it->second;
-      it = m_throttels.erase(it);
-    }
-    else
-    {
-      ++it;
-    }
-  }
+  // Too many calls: the client must come back later
+  DETAILLOGV(_T("HTTP throttling rejects call. Retry after %u seconds"),retry);
+  XString after;
+  after.Format(_T("%u"),retry);
+  p_message->Reset();
+  p_message->SetStatus(HTTP_STATUS_TOO_MANY_REQUESTS);
+  p_message->AddHeader(_T("Retry-After"),after);
+  SendResponse(p_message);
+  return false;
 }
 
 // Set the URL rewriter BEFORE starting the site
@@ -31,6 +31,8 @@
 #include "ThreadPool.h"
 #include "SiteFilter.h"
 #include "SiteHandler.h"
+#include "RateLimiter.h"
+#include "StaticFileCache.h"
 #include <HTTPMessage.h>
 #include <SOAPMessage.h>
 #include <JSONMessage.h>
@@ -95,9 +97,6 @@ enum class XFrameOption
 void HTTPSiteCallbackMessage(void* p_argument);
 void HTTPSiteCallbackEvent  (void* p_argument);
 
-// Default maximum number of HTTP Throttling addresses
-constexpr long MAX_HTTP_THROTTLES = 1000;
-
 class HTTPURLGroup;
 class MarlinConfig;
 class SiteFilter;
@@ -117,7 +116,6 @@ RegHandler;
 using FilterMap       = std::map<unsigned,SiteFilter*>;
 using ReliableMap     = std::map<SessionAddress,SessionSequence,AddressCompare>;
 using HandlerMap      = std::map<HTTPCommand,RegHandler>;
-using ThrottlingMap   = std::map<SessionAddress,CRITICAL_SECTION*,AddressCompare>;
 
 // Cleanup handler after a crash-report
 extern __declspec(thread) SiteHandler* g_cleanup;
@@ -194,6 +192,10 @@ public:
   void            SetHTTPCompression(bool p_compression);
   // OPTIONAL: Set HTTP throttling per address
   void            SetHTTPThrotteling(bool p_throttel);
+  // OPTIONAL: Set HTTP throttling rate (calls per second) and burst size per address
+  void            SetHTTPThrottlingRate(double p_rate,double p_burst);
+  // OPTIONAL: Set HTTP throttling maximum number of addresses to remember
+  void            SetHTTPThrottlingClients(ULONG p_clients);
   // OPTIONAL: Set use CORS (Cross Origin Resource Sharing)
   void            SetUseCORS(bool p_use);
   // OPTIONAL: Set use this origin for CORS (otherwise all = '*')
@@ -230,6 +232,7 @@ public:
   bool            GetIsEventStream()                { return m_isEventStream; }
   LPFN_CALLBACK   GetCallback()                     { return m_callback;      }
   MediaTypeMap&   GetContentTypeMap()               { return m_contentTypes;  }
+  StaticFileCache* GetStaticCache()                 { return &m_staticCache;  }
   XMLEncryption   GetEncryptionLevel()              { return m_securityLevel; }
   XString         GetEncryptionPassword()           { return m_enc_password;  }
   bool            GetReliable()                     { return m_reliable;      }
@@ -243,6 +246,7 @@ public:
   bool            GetVerbTunneling()                { return m_verbTunneling; }
   bool            GetHTTPCompression()              { return m_compression;   }
   bool            GetHTTPThrotteling()              { return m_throttling;    }
+  RateLimiter*    GetHTTPThrottling()               { return &m_limiter;      }
   bool            GetUseCORS()                      { return m_useCORS;       }
   XString         GetCORSOrigin()                   { return m_allowOrigin;   }
   XString         GetCORSHeaders()                  { return m_allowHeaders;  }
@@ -317,7 +321,6 @@ protected:
   // Cleanup the site when stopping
   void              CleanupHandlers();
   void              CleanupFilters();
-  void              CleanupThrotteling();
   void              CleanupRewriter();
   // Finding the SiteHandler registration
   RegHandler*       FindSiteHandler(HTTPCommand p_command);
@@ -350,9 +353,7 @@ protected:
   void              DebugPrintSessionAddress(const XString& p_prefix,SessionAddress& p_address);
 
   // Handle HTTP throttling
-  CRITICAL_SECTION* StartThrottling(HTTPMessage* p_message);
-  void              EndThrottling(CRITICAL_SECTION*& p_throttle);
-  void              TryFlushThrottling();
+  bool              StartThrottling(HTTPMessage* p_message);
 
   // Unique site
   XString           m_site;                               // Absolute path of the URL
@@ -372,6 +373,7 @@ protected:
   LPFN_CALLBACK     m_callback        { nullptr };        // Context for the threadpool
   bool              m_async           { false   };        // Site in async-accept mode
   MediaTypeMap      m_contentTypes;                       // Text based content type
+  StaticFileCache   m_staticCache     { this    };        // Static content for the GET handler
   XMLEncryption     m_securityLevel   { XMLEncryption::XENC_Plain };  // Security level
   XString           m_enc_password;                       // Security encryption password
   bool              m_sendUnicode     { false   };        // Send UTF-16 Unicode answers
@@ -403,7 +405,7 @@ protected:
   // Multi-threading
   CRITICAL_SECTION  m_filterLock;                         // Adding/deleting/calling filters
   CRITICAL_SECTION  m_sessionLock;                        // Adding/deleting sessions sequences
-  ThrottlingMap     m_throttels;                          // Addresses to be throttled
+  RateLimiter       m_limiter;                            // Token buckets of the throttled addresses
   // Cookie settings enforcement
   bool              m_cookieHasSecure { false };          // Site override for 'secure'   cookies
   bool              m_cookieHasHttp   { false };          // Site override for 'httpOnly' cookies
@@ -535,6 +537,19 @@ HTTPSite::SetHTTPThrotteling(bool p_throttel)
   m_throttling = p_throttel;
 }
 
+inline void
+HTTPSite::SetHTTPThrottlingRate(double p_rate,double p_burst)
+{
+  m_limiter.SetRate(p_rate);
+  m_limiter.SetBurst(p_burst);
+}
+
+inline void
+HTTPSite::SetHTTPThrottlingClients(ULONG p_clients)
+{
+  m_limiter.SetMaximumClients(p_clients);
+}
+
 inline void
 HTTPSite::SetUseCORS(bool p_use)
 {
@@ -0,0 +1,131 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: KeepaliveWheel.h
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include <vector>
+
+// Milliseconds per slot of the wheel. Also the tick of the event monitor
+constexpr auto KEEPALIVE_WHEEL_TICK  = 500;
+// Number of slots: one turn of the wheel is longer than EVENT_KEEPALIVE_MAX
+// Later deadlines simply go round the wheel once more
+constexpr auto KEEPALIVE_WHEEL_SLOTS = 256;
+
+// Timer wheel for the keep-alive pulses of event streams and WebSockets.
+// Every stream is scheduled for its next keep-alive deadline. A tick only
+// looks at the timers in the slots that passed, so the heartbeat does not
+// walk all streams. Event stream timers are never cancelled: a stream that
+// is gone is simply skipped when its timer fires. An owner that does want
+// to cancel a timer keeps the slot that Add returns.
+// Not locked: the server protects each wheel with the lock of its map.
+template<typename ITEM>
+class KeepaliveWheel
+{
+public:
+  explicit KeepaliveWheel(ULONGLONG p_now = GetTickCount64())
+  {
+    m_tick = p_now / KEEPALIVE_WHEEL_TICK;
+  }
+
+  // Schedule an item for a deadline (tick count in milliseconds)
+  // Returns the slot of the timer, for a later Cancel
+  size_t Add(const ITEM& p_item,ULONGLONG p_deadline)
+  {
+    ULONGLONG tick = p_deadline / KEEPALIVE_WHEEL_TICK;
+    if(tick <= m_tick)
+    {
+      tick = m_tick + 1;
+    }
+    Timer timer;
+    timer.m_item     = p_item;
+    timer.m_deadline = p_deadline;
+    size_t slot = (size_t)(tick % KEEPALIVE_WHEEL_SLOTS);
+    m_slots[slot].push_back(timer);
+    ++m_timers;
+    return slot;
+  }
+
+  // Remove the timer of an item from its slot
+  bool Cancel(const ITEM& p_item,size_t p_slot)
+  {
+    std::vector<Timer>& slot = m_slots[p_slot % KEEPALIVE_WHEEL_SLOTS];
+    for(size_t ind = 0; ind < slot.size(); ++ind)
+    {
+      if(slot[ind].m_item == p_item)
+      {
+        slot[ind] = slot.back();
+        slot.pop_back();
+        --m_timers;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Move the wheel up to now, collecting all items that are due
+  void Advance(ULONGLONG p_now,std::vector<ITEM>& p_due)
+  {
+    ULONGLONG now = p_now / KEEPALIVE_WHEEL_TICK;
+    // Never more than one full turn: after that all slots are seen
+    if(now - m_tick > KEEPALIVE_WHEEL_SLOTS)
+    {
+      m_tick = now - KEEPALIVE_WHEEL_SLOTS;
+    }
+    while(m_tick < now)
+    {
+      ++m_tick;
+      std::vector<Timer>& slot = m_slots[m_tick % KEEPALIVE_WHEEL_SLOTS];
+      size_t ind = 0;
+      while(ind < slot.size())
+      {
+        if(slot[ind].m_deadline <= p_now)
+        {
+          p_due.push_back(slot[ind].m_item);
+          slot[ind] = slot.back();
+          slot.pop_back();
+          --m_timers;
+        }
+        else
+        {
+          // Next round of the wheel
+          ++ind;
+        }
+      }
+    }
+  }
+
+  size_t GetTimers() { return m_timers; }
+
+private:
+  struct Timer
+  {
+    ITEM      m_item;
+    ULONGLONG m_deadline;
+  };
+  std::vector<Timer> m_slots[KEEPALIVE_WHEEL_SLOTS];
+  ULONGLONG          m_tick   { 0 };    // Last tick that was processed
+  size_t             m_timers { 0 };
+};
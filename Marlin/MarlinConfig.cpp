@@ -465,6 +465,17 @@ MarlinConfig::GetParameterInteger(const XString& p_section,const XString& p_para
   return _ttoi(param);
 }
 
+double
+MarlinConfig::GetParameterDouble(const XString& p_section,const XString& p_parameter,double p_default) const
+{
+  XString param = GetParameterString(p_section,p_parameter,_T(""));
+  if(param.IsEmpty())
+  {
+    return p_default;
+  }
+  return _ttof(param);
+}
+
 bool
 MarlinConfig::GetParameterBoolean(const XString& p_section,const XString& p_parameter,bool p_default) const
 {
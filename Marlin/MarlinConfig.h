@@ -82,6 +82,7 @@ public:
   XString GetParameterString (const XString& p_section,const XString& p_parameter,const XString& p_default) const;
   bool    GetParameterBoolean(const XString& p_section,const XString& p_parameter,bool  p_default) const;
   int     GetParameterInteger(const XString& p_section,const XString& p_parameter,int   p_default) const;
+  double  GetParameterDouble (const XString& p_section,const XString& p_parameter,double p_default) const;
   XString GetEncryptedString (const XString& p_section,const XString& p_parameter,const XString& p_default) const;
   int     GetAttribute(const XString& p_section,const XString& p_parameter,const XString& p_attrib,int    p_default) const;
   double  GetAttribute(const XString& p_section,const XString& p_parameter,const XString& p_attrib,double p_default) const;
@@ -0,0 +1,225 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: RateLimiter.cpp
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "RateLimiter.h"
+#include <AutoCritical.h>
+#include <math.h>
+
+RateLimiter::RateLimiter()
+{
+  for(int index = 0;index < RATELIMIT_SHARDS; ++index)
+  {
+    InitializeCriticalSection(&m_shards[index].m_lock);
+    m_shards[index].m_nextExpire = 0;
+  }
+}
+
+RateLimiter::~RateLimiter()
+{
+  Reset();
+  for(int index = 0;index < RATELIMIT_SHARDS; ++index)
+  {
+    DeleteCriticalSection(&m_shards[index].m_lock);
+  }
+}
+
+void
+RateLimiter::SetRate(double p_rate)
+{
+  // Fractions are allowed: 0.5 is one call per two seconds
+  if(p_rate > 0.0)
+  {
+    m_rate = p_rate;
+  }
+}
+
+void
+RateLimiter::SetBurst(double p_burst)
+{
+  // Must at least hold the token of one call
+  m_burst = p_burst < 1.0 ? 1.0 : p_burst;
+}
+
+void
+RateLimiter::SetMaximumClients(ULONG p_clients)
+{
+  if(p_clients < RATELIMIT_SHARDS)
+  {
+    p_clients = RATELIMIT_SHARDS;
+  }
+  m_clients  = p_clients;
+  m_perShard = p_clients / RATELIMIT_SHARDS;
+}
+
+// FNV-1a over the bytes of (a part of) the client identity
+ULONGLONG
+RateLimiter::HashClient(const void* p_data,size_t p_size,ULONGLONG p_hash /*= FNV offset*/)
+{
+  const BYTE* data = reinterpret_cast<const BYTE*>(p_data);
+  for(size_t index = 0;index < p_size; ++index)
+  {
+    p_hash ^= data[index];
+    p_hash *= 1099511628211ULL;
+  }
+  return p_hash;
+}
+
+bool
+RateLimiter::Acquire(ULONGLONG p_client,ULONG& p_retryAfter)
+{
+  p_retryAfter = 0;
+
+  ULONGLONG now = GetTickCount64();
+  BucketShard& shard = m_shards[(p_client ^ (p_client >> 32)) & (RATELIMIT_SHARDS - 1)];
+  AutoCritSec lock(&shard.m_lock);
+
+  BucketMap::iterator it = shard.m_buckets.find(p_client);
+  if(it == shard.m_buckets.end())
+  {
+    // New client: make room first
+    if(shard.m_buckets.size() >= m_perShard)
+    {
+      ExpireBuckets(shard,now);
+    }
+    if(shard.m_buckets.size() >= m_perShard)
+    {
+      // Full of active clients: come back when the first bucket is full
+      return Reject((double)(shard.m_nextExpire - now),p_retryAfter);
+    }
+    TokenBucket bucket { m_burst, now };
+    it = shard.m_buckets.insert(std::make_pair(p_client,bucket)).first;
+    // A new bucket can be full again before the ones seen in the last scan
+    shard.m_nextExpire = 0;
+  }
+  TokenBucket& bucket = it->second;
+  Refill(bucket,now);
+
+  if(bucket.m_tokens >= 1.0)
+  {
+    bucket.m_tokens -= 1.0;
+    return true;
+  }
+
+  // Time until our token is there
+  return Reject((1.0 - bucket.m_tokens) * 1000.0 / m_rate,p_retryAfter);
+}
+
+void
+RateLimiter::Reset()
+{
+  for(int index = 0;index < RATELIMIT_SHARDS; ++index)
+  {
+    AutoCritSec lock(&m_shards[index].m_lock);
+    m_shards[index].m_buckets.clear();
+    m_shards[index].m_nextExpire = 0;
+  }
+}
+
+ULONG
+RateLimiter::GetNumberOfClients()
+{
+  ULONG clients = 0;
+  for(int index = 0;index < RATELIMIT_SHARDS; ++index)
+  {
+    AutoCritSec lock(&m_shards[index].m_lock);
+    clients += (ULONG) m_shards[index].m_buckets.size();
+  }
+  return clients;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// PRIVATE
+//
+//////////////////////////////////////////////////////////////////////////
+
+void
+RateLimiter::Refill(TokenBucket& p_bucket,ULONGLONG p_now)
+{
+  if(p_now > p_bucket.m_refill)
+  {
+    p_bucket.m_tokens += (double)(p_now - p_bucket.m_refill) * m_rate / 1000.0;
+    if(p_bucket.m_tokens > m_burst)
+    {
+      p_bucket.m_tokens = m_burst;
+    }
+    p_bucket.m_refill = p_now;
+  }
+}
+
+// Rejected: but at least one second, as 'Retry-After' has no fractions
+bool
+RateLimiter::Reject(double p_wait,ULONG& p_retryAfter)
+{
+  p_retryAfter = (ULONG) ceil(p_wait / 1000.0);
+  if(p_retryAfter == 0)
+  {
+    p_retryAfter = 1;
+  }
+  InterlockedIncrement64((LONG64*)&m_rejected);
+  return false;
+}
+
+// Called with the lock of the shard held.
+// Only idle buckets (refilled to the burst size) are removed: they go
+// without any effect. Active clients keep their bucket, otherwise they
+// could reset their limit by crowding the shard. The scan also finds the
+// first moment a bucket will be full, so a shard that is full of active
+// clients is not scanned again for every new client before that time.
+void
+RateLimiter::ExpireBuckets(BucketShard& p_shard,ULONGLONG p_now)
+{
+  if(p_now < p_shard.m_nextExpire)
+  {
+    return;
+  }
+  ULONGLONG next = MAXULONGLONG;
+  BucketMap::iterator it = p_shard.m_buckets.begin();
+  while(it != p_shard.m_buckets.end())
+  {
+    double tokens = it->second.m_tokens;
+    if(p_now > it->second.m_refill)
+    {
+      tokens += (double)(p_now - it->second.m_refill) * m_rate / 1000.0;
+    }
+    if(tokens >= m_burst)
+    {
+      it = p_shard.m_buckets.erase(it);
+    }
+    else
+    {
+      ULONGLONG full = p_now + (ULONGLONG) ceil((m_burst - tokens) * 1000.0 / m_rate);
+      if(full < next)
+      {
+        next = full;
+      }
+      ++it;
+    }
+  }
+  p_shard.m_nextExpire = next;
+}
@@ -0,0 +1,107 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: RateLimiter.h
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include <unordered_map>
+
+// Default token bucket of a client: requests per second and burst size
+constexpr double RATELIMIT_DEFAULT_RATE    = 10.0;
+constexpr double RATELIMIT_DEFAULT_BURST   = 20.0;
+// Default maximum number of clients that have a bucket
+constexpr ULONG  RATELIMIT_DEFAULT_CLIENTS = 100000;
+// Number of independently locked parts of the table. Must be a power of two
+constexpr int    RATELIMIT_SHARDS          = 64;
+
+// Token bucket of one client
+typedef struct _tokenBucket
+{
+  double    m_tokens;   // Tokens left
+  ULONGLONG m_refill;   // Tick count of the last refill
+}
+TokenBucket;
+
+// Client hash -> bucket
+using BucketMap = std::unordered_map<ULONGLONG,TokenBucket>;
+
+// Rate limiting of the HTTP calls to a site.
+// Every client (user/address/desktop) has a token bucket that refills at
+// 'rate' tokens per second, up to 'burst' tokens. A call takes a token.
+// Without a token, the call is rejected with the number of seconds after
+// which to retry. A call never waits for a token: that would hold a thread.
+// The buckets live in a hashed table that is split in shards, each with its
+// own lock, so clients seldom contend. A bucket that has refilled to the
+// burst size is just the same as a new one, so it can be removed at will.
+// This is done lazily when a shard reaches its maximum number of clients.
+// Buckets of active clients are never dropped: if a shard is full of them,
+// new clients are rejected until the first bucket has refilled.
+class RateLimiter
+{
+public:
+  RateLimiter();
+ ~RateLimiter();
+
+  // Take a token for a client. Returns false if the call must be rejected
+  // p_retryAfter : if rejected, the seconds after which to retry
+  bool      Acquire(ULONGLONG p_client,ULONG& p_retryAfter);
+  // Remove all buckets
+  void      Reset();
+
+  // Hashing of the client identity (FNV-1a). Chain the parts with p_hash
+  static ULONGLONG HashClient(const void* p_data,size_t p_size,ULONGLONG p_hash = 14695981039346656037ULL);
+
+  // SETTERS: Before the first call is made!
+  void      SetRate(double p_rate);
+  void      SetBurst(double p_burst);
+  void      SetMaximumClients(ULONG p_clients);
+
+  // GETTERS
+  double    GetRate()           { return m_rate;     }
+  double    GetBurst()          { return m_burst;    }
+  ULONG     GetMaximumClients() { return m_clients;  }
+  ULONGLONG GetRejected()       { return m_rejected; }
+  ULONG     GetNumberOfClients();
+
+private:
+  typedef struct _bucketShard
+  {
+    CRITICAL_SECTION m_lock;
+    BucketMap        m_buckets;
+    ULONGLONG        m_nextExpire;  // No bucket can expire before this tick
+  }
+  BucketShard;
+
+  void      Refill(TokenBucket& p_bucket,ULONGLONG p_now);
+  void      ExpireBuckets(BucketShard& p_shard,ULONGLONG p_now);
+  bool      Reject(double p_wait,ULONG& p_retryAfter);
+
+  double    m_rate     { RATELIMIT_DEFAULT_RATE    };
+  double    m_burst    { RATELIMIT_DEFAULT_BURST   };
+  ULONG     m_clients  { RATELIMIT_DEFAULT_CLIENTS };
+  size_t    m_perShard { RATELIMIT_DEFAULT_CLIENTS / RATELIMIT_SHARDS };
+  ULONGLONG m_rejected { 0 };
+  BucketShard m_shards[RATELIMIT_SHARDS];
+};
@@ -65,6 +65,15 @@ SiteHandlerGet::Handle(HTTPMessage* p_message)
   // Convert into a filename
   XString pathname = m_site->GetWebroot() + ensure.FileNameFromResourceName(resource);
 
+  // Static content that the site already knows
+  StaticFile* file = m_site->GetStaticCache()->GetFile(pathname);
+  if(file)
+  {
+    HandleStaticFile(p_message,file);
+    file->DropReference();
+    return true;
+  }
+
   // Finding and setting the content type
   XString content  = m_site->GetContentTypeByResourceName(pathname);
   p_message->SetContentType(content);
@@ -96,6 +105,53 @@ SiteHandlerGet::Handle(HTTPMessage* p_message)
   return true;
 }
 
+// Same as the handling above, but without going to the file system
+// Small files are served from memory. A matching ETag gives a 304.
+void
+SiteHandlerGet::HandleStaticFile(HTTPMessage* p_message,StaticFile* p_file)
+{
+  XString pathname(p_file->m_pathname);
+  p_message->SetContentType(p_file->m_contentType);
+
+  if(!p_file->m_exists)
+  {
+    // File does not exist, or no read access
+    p_message->SetStatus(HTTP_STATUS_NOT_FOUND);
+    XString text;
+    text.Format(_T("HTTP GET: File not found: %s"),pathname.GetString());
+    SITE_ERRORLOG(ERROR_FILE_NOT_FOUND,text);
+    return;
+  }
+  if(!p_file->m_readable && !FileNameRestrictions(pathname))
+  {
+    p_message->SetStatus(HTTP_STATUS_DENIED);
+    return;
+  }
+
+  // Conditional GET: client already has this version
+  XString match = p_message->GetHeader(_T("If-None-Match"));
+  if(!match.IsEmpty() && StaticFileCache::MatchETag(match,p_file->m_etag))
+  {
+    p_message->Reset();
+    p_message->SetStatus(HTTP_STATUS_NOT_MODIFIED);
+    p_message->AddHeader(_T("ETag"),p_file->m_etag);
+    SITE_DETAILLOGS(_T("HTTP GET not modified: "),pathname);
+    return;
+  }
+
+  if(p_file->m_bytes)
+  {
+    p_message->GetFileBuffer()->SetBuffer(p_file->m_bytes,(size_t)p_file->m_size);
+  }
+  else
+  {
+    p_message->GetFileBuffer()->SetFileName(pathname);
+  }
+  p_message->AddHeader(_T("ETag"),p_file->m_etag);
+  p_message->SetStatus(HTTP_STATUS_OK);
+  SITE_DETAILLOGS(_T("HTTP GET: "),pathname);
+}
+
 void
 SiteHandlerGet::PostHandle(HTTPMessage* p_message)
 {
@@ -30,6 +30,8 @@
 
 #define BASE_INDEX_PAGE "index.html";
 
+class StaticFile;
+
 class SiteHandlerGet: public SiteHandler
 {
 protected:
@@ -42,4 +44,8 @@ protected:
   // Filename handlers
   virtual bool FileNameTransformations(XString& p_filename);
   virtual bool FileNameRestrictions   (XString& p_filename);
+
+private:
+  // Answer from the static content cache of the site
+  void HandleStaticFile(HTTPMessage* p_message,StaticFile* p_file);
 };
\ No newline at end of file
@@ -0,0 +1,81 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: SiteHandlerJsonReader.cpp
+//
+// Marlin Server: Internet server/client
+// 
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "SiteHandlerJsonReader.h"
+#include "HTTPMessage.h"
+#include "HTTPSite.h"
+#include "HTTPServer.h"
+#include "ConvertWideString.h"
+#include <winhttp.h>
+
+bool
+SiteHandlerJsonReader::Handle(HTTPMessage* p_message)
+{
+  // The reader can only read UTF-8
+  XString charset = FindCharsetInContentType(p_message->GetContentType());
+  if(!charset.IsEmpty() && charset.CompareNoCase(_T("utf-8")) != 0)
+  {
+    SITE_ERRORLOG(ERROR_INVALID_PARAMETER,_T("JSON reader can only read UTF-8, not: ") + charset);
+    p_message->Reset();
+    p_message->SetStatus(HTTP_STATUS_UNSUPPORTED_MEDIA);
+    return false;
+  }
+
+  // Read straight from the parts of the body
+  JSONReader reader;
+  reader.Feed(*p_message->GetFileBuffer());
+  reader.Finish();
+
+  int errors = HandleReader(p_message,reader);
+
+  if(!reader.GetErrorText().IsEmpty())
+  {
+    // Setting HTTP status "400 Bad request"
+    SITE_ERRORLOG(ERROR_INVALID_DATA,_T("JSON body not read: ") + reader.GetErrorText());
+    p_message->Reset();
+    p_message->SetStatus(HTTP_STATUS_BAD_REQUEST);
+    return false;
+  }
+  if(errors)
+  {
+    // Setting HTTP status "409 Resource Conflict"
+    p_message->Reset();
+    p_message->SetStatus(HTTP_STATUS_CONFLICT);
+    return false;
+  }
+  return true;
+}
+
+// DOES NOTHING: OVVERRIDE ME!
+// IMPLEMENT YOURSELF: YOUR IMPLEMENTATION HERE
+int
+SiteHandlerJsonReader::HandleReader(HTTPMessage* /*p_message*/,JSONReader& /*p_reader*/)
+{
+  SITE_ERRORLOG(ERROR_BAD_COMMAND,_T("Default JSON reader handler. Override me!"));
+  return 1;
+}
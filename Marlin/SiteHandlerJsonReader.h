@@ -0,0 +1,51 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: SiteHandlerJsonReader.h
+//
+// Marlin Server: Internet server/client
+// 
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include "SiteHandlerPost.h"
+#include "JSONReader.h"
+
+// A JSON handler for request bodies that are too big for a JSONMessage.
+// The body is read by a JSONReader: no text of the whole body and no tree
+// of JSONvalue's is ever built. Only what the handler collects is in memory.
+// The body itself is still received in the HTTPMessage as it always was,
+// so the streaming limit of the server still holds for it.
+// The reader reads UTF-8 only: other charsets get a HTTP 415 status.
+// The response is the HTTPMessage itself, not a JSONMessage.
+
+class SiteHandlerJsonReader: public SiteHandlerPost
+{
+protected:
+  // Handlers: Override and return 'true' if handling is ready
+  virtual bool Handle(HTTPMessage* p_message) override;
+
+  // This is the work of the posted action
+  // Pull the events of the body from the reader, up to JR_End.
+  // Do not reset the message before the reader is done: it reads the body.
+  // RETURN: NUMBER OF ERRORS!
+  virtual int  HandleReader(HTTPMessage* p_message,JSONReader& p_reader);
+};
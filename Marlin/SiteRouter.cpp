@@ -0,0 +1,206 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: SiteRouter.cpp
+//
+// Marlin Server: Internet server/client
+// 
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "SiteRouter.h"
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// ROUTE NODE
+//
+//////////////////////////////////////////////////////////////////////////
+
+SiteRouteNode::SiteRouteNode(const XString& p_segment)
+              :m_segment(p_segment)
+{
+}
+
+SiteRouteNode::~SiteRouteNode()
+{
+  for(auto& child : m_children)
+  {
+    delete child;
+  }
+  m_children.clear();
+}
+
+// Compare a segment within a longer string to the segment of a node
+static int
+CompareSegment(const SiteRouteNode* p_node,LPCTSTR p_segment,int p_length)
+{
+  int length = p_node->m_segment.GetLength();
+  int result = _tcsncmp(p_node->m_segment.GetString(),p_segment,(std::min)(length,p_length));
+  if(result == 0)
+  {
+    result = length - p_length;
+  }
+  return result;
+}
+
+SiteRouteNode*
+SiteRouteNode::FindChild(LPCTSTR p_segment,int p_length) const
+{
+  auto it = std::lower_bound(m_children.begin(),m_children.end(),p_segment,[p_length](const SiteRouteNode* p_node,LPCTSTR p_find)
+  {
+    return CompareSegment(p_node,p_find,p_length) < 0;
+  });
+  if(it != m_children.end() && CompareSegment(*it,p_segment,p_length) == 0)
+  {
+    return *it;
+  }
+  return nullptr;
+}
+
+SiteRouteNode*
+SiteRouteNode::AddChild(LPCTSTR p_segment,int p_length)
+{
+  auto it = std::lower_bound(m_children.begin(),m_children.end(),p_segment,[p_length](const SiteRouteNode* p_node,LPCTSTR p_find)
+  {
+    return CompareSegment(p_node,p_find,p_length) < 0;
+  });
+  if(it != m_children.end() && CompareSegment(*it,p_segment,p_length) == 0)
+  {
+    return *it;
+  }
+  SiteRouteNode* node = new SiteRouteNode(stdstring(p_segment,p_length));
+  m_children.insert(it,node);
+  return node;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// THE ROUTER
+//
+//////////////////////////////////////////////////////////////////////////
+
+SiteRouter::~SiteRouter()
+{
+  for(auto& port : m_ports)
+  {
+    delete port.second;
+  }
+  m_ports.clear();
+}
+
+// Registration names are "port:url"
+LPCTSTR
+SiteRouter::SplitPort(LPCTSTR p_registration,int& p_port)
+{
+  LPTSTR end = nullptr;
+  p_port = (int)_tcstol(p_registration,&end,10);
+  if(end == nullptr || *end != _T(':'))
+  {
+    return nullptr;
+  }
+  return end + 1;
+}
+
+// End of the current path segment. Both separators count
+LPCTSTR
+SiteRouter::NextSegment(LPCTSTR p_segment)
+{
+  while(*p_segment && *p_segment != _T('/') && *p_segment != _T('\\'))
+  {
+    ++p_segment;
+  }
+  return p_segment;
+}
+
+void
+SiteRouter::AddSite(const XString& p_registration,HTTPSite* p_site)
+{
+  int port = 0;
+  LPCTSTR path = SplitPort(p_registration.GetString(),port);
+  if(path == nullptr)
+  {
+    return;
+  }
+  SiteRouteNode*& root = m_ports[port];
+  if(root == nullptr)
+  {
+    root = new SiteRouteNode(_T(""));
+  }
+
+  // Every segment is a level in the trie. An empty path is one empty segment
+  SiteRouteNode* node = root;
+  while(true)
+  {
+    LPCTSTR end = NextSegment(path);
+    node = node->AddChild(path,(int)(end - path));
+    if(*end == 0)
+    {
+      break;
+    }
+    path = end + 1;
+  }
+  node->m_site = p_site;
+}
+
+// Walks the segments just once. The deepest node with a site is the longest match
+HTTPSite*
+SiteRouter::FindSite(const XString& p_registration,int* p_matched /*= nullptr*/) const
+{
+  int port = 0;
+  LPCTSTR name = p_registration.GetString();
+  LPCTSTR path = SplitPort(name,port);
+  if(path == nullptr)
+  {
+    return nullptr;
+  }
+  RoutePorts::const_iterator it = m_ports.find(port);
+  if(it == m_ports.end())
+  {
+    return nullptr;
+  }
+
+  HTTPSite* found = nullptr;
+  const SiteRouteNode* node = it->second;
+  while(true)
+  {
+    LPCTSTR end = NextSegment(path);
+    node = node->FindChild(path,(int)(end - path));
+    if(node == nullptr)
+    {
+      break;
+    }
+    if(node->m_site)
+    {
+      found = node->m_site;
+      if(p_matched)
+      {
+        *p_matched = (int)(end - name);
+      }
+    }
+    if(*end == 0)
+    {
+      break;
+    }
+    path = end + 1;
+  }
+  return found;
+}
@@ -0,0 +1,76 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: SiteRouter.h
+//
+// Marlin Server: Internet server/client
+// 
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include <vector>
+#include <map>
+
+class HTTPSite;
+class SiteRouteNode;
+
+using RouteNodes = std::vector<SiteRouteNode*>;
+
+// One path segment of a registered site
+class SiteRouteNode
+{
+public:
+  explicit SiteRouteNode(const XString& p_segment);
+ ~SiteRouteNode();
+
+  // Binary search in the (sorted) children
+  SiteRouteNode* FindChild(LPCTSTR p_segment,int p_length) const;
+  SiteRouteNode* AddChild (LPCTSTR p_segment,int p_length);
+
+  XString    m_segment;
+  HTTPSite*  m_site { nullptr };  // Registered site ending in this segment (if any)
+  RouteNodes m_children;          // Sorted on segment
+};
+
+using RoutePorts = std::map<int,SiteRouteNode*>;
+
+// Trie of all registered sites, per port and keyed on the path segments
+// of the "port:url" registration names. Once built, a router is never
+// changed again. The server publishes a complete new router on every
+// registration or removal of a site, so lookups need no locking at all.
+class SiteRouter
+{
+public:
+  SiteRouter() = default;
+ ~SiteRouter();
+
+  // Only while building the router
+  void      AddSite(const XString& p_registration,HTTPSite* p_site);
+  // Longest match of a "port:url" name to a site on a segment boundary
+  // Optionally returns the number of characters of the matching site name
+  HTTPSite* FindSite(const XString& p_registration,int* p_matched = nullptr) const;
+
+private:
+  static LPCTSTR SplitPort(LPCTSTR p_registration,int& p_port);
+  static LPCTSTR NextSegment(LPCTSTR p_segment);
+
+  RoutePorts m_ports;
+};
@@ -0,0 +1,347 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: StaticFileCache.cpp
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "StaticFileCache.h"
+#include "HTTPSite.h"
+#include <AutoCritical.h>
+#include <io.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// STATIC FILE
+//
+//////////////////////////////////////////////////////////////////////////
+
+StaticFile::StaticFile(const XString& p_pathname)
+           :m_pathname(p_pathname)
+{
+}
+
+StaticFile::~StaticFile()
+{
+  if(m_bytes)
+  {
+    delete [] m_bytes;
+  }
+}
+
+void
+StaticFile::AddReference()
+{
+  InterlockedIncrement(&m_references);
+}
+
+void
+StaticFile::DropReference()
+{
+  if(InterlockedDecrement(&m_references) == 0)
+  {
+    delete this;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// STATIC FILE CACHE
+//
+//////////////////////////////////////////////////////////////////////////
+
+StaticFileCache::StaticFileCache(HTTPSite* p_site)
+                :m_site(p_site)
+{
+  InitializeCriticalSection(&m_lock);
+}
+
+StaticFileCache::~StaticFileCache()
+{
+  Reset();
+  DeleteCriticalSection(&m_lock);
+}
+
+// Returns nullptr if the cache cannot be used.
+// The caller must then look at the file system itself
+StaticFile*
+StaticFileCache::GetFile(const XString& p_pathname)
+{
+  if(!m_active || IsImpersonating())
+  {
+    return nullptr;
+  }
+  XString key(p_pathname);
+  key.MakeLower();
+
+  StaticFile* file = nullptr;
+  { AutoCritSec lock(&m_lock);
+
+    StaticFiles::iterator it = m_files.find(key);
+    if(it != m_files.end())
+    {
+      file = it->second.m_file;
+      file->AddReference();
+      // Most recently used
+      m_used.splice(m_used.begin(),m_used,it->second.m_used);
+    }
+  }
+
+  if(file)
+  {
+    ULONGLONG now = GetTickCount64();
+    if(now <= file->m_checked + m_ttl)
+    {
+      InterlockedIncrement64((LONG64*)&m_hits);
+      return file;
+    }
+    // Time-to-live has passed: is it still the same file?
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    bool exists = GetFileAttributesEx(p_pathname,GetFileExInfoStandard,&data) != 0;
+    if(exists == file->m_exists)
+    {
+      bool same = true;
+      if(exists)
+      {
+        ULONGLONG size = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        same = size == file->m_size &&
+               CompareFileTime(&data.ftLastWriteTime,&file->m_lastWrite) == 0 &&
+               (_taccess(p_pathname,4) == 0) == file->m_readable;
+      }
+      if(same)
+      {
+        file->m_checked = now;
+        InterlockedIncrement64((LONG64*)&m_hits);
+        return file;
+      }
+    }
+    file->DropReference();
+  }
+
+  // New or changed file
+  InterlockedIncrement64((LONG64*)&m_misses);
+  file = LoadFile(p_pathname);
+  Store(key,file);
+  return file;
+}
+
+void
+StaticFileCache::Reset()
+{
+  AutoCritSec lock(&m_lock);
+
+  while(!m_files.empty())
+  {
+    Remove(m_files.begin());
+  }
+}
+
+// If-None-Match: "*" or a list of (weak) ETags
+bool
+StaticFileCache::MatchETag(const XString& p_header,const XString& p_etag)
+{
+  XString header(p_header);
+  header.Trim();
+  if(header == _T("*"))
+  {
+    return true;
+  }
+  int pos = 0;
+  while(pos < header.GetLength())
+  {
+    int comma = header.Find(',',pos);
+    if(comma < 0)
+    {
+      comma = header.GetLength();
+    }
+    XString tag = header.Mid(pos,comma - pos);
+    tag.Trim();
+    if(tag.Left(2) == _T("W/"))
+    {
+      tag = tag.Mid(2);
+    }
+    if(tag == p_etag)
+    {
+      return true;
+    }
+    pos = comma + 1;
+  }
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// PRIVATE
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Gather everything the GET handler wants to know of the file
+StaticFile*
+StaticFileCache::LoadFile(const XString& p_pathname)
+{
+  StaticFile* file = alloc_new StaticFile(p_pathname);
+  file->m_contentType = m_site->GetContentTypeByResourceName(p_pathname);
+
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if(GetFileAttributesEx(p_pathname,GetFileExInfoStandard,&data))
+  {
+    file->m_exists    = true;
+    file->m_readable  = _taccess(p_pathname,4) == 0;
+    file->m_size      = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    file->m_lastWrite = data.ftLastWriteTime;
+
+    ULONGLONG time = ((ULONGLONG)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    file->m_etag.Format(_T("\"%llx-%llx\""),time,file->m_size);
+
+    // Small files are served from memory
+    if(file->m_readable && file->m_size > 0 && file->m_size <= m_memoryFile &&
+       (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+    {
+      ReadContents(file);
+    }
+  }
+  file->m_checked = GetTickCount64();
+  return file;
+}
+
+// Read a small file into memory, within the budget of the cache.
+// The budget is reserved before reading and stays reserved with the contents
+bool
+StaticFileCache::ReadContents(StaticFile* p_file)
+{
+  size_t size = (size_t)p_file->m_size;
+  if(!ReserveMemory(size))
+  {
+    return false;
+  }
+  HANDLE handle = CreateFile(p_file->m_pathname
+                            ,GENERIC_READ
+                            ,FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE
+                            ,NULL
+                            ,OPEN_EXISTING
+                            ,FILE_FLAG_SEQUENTIAL_SCAN
+                            ,NULL);
+  if(handle == INVALID_HANDLE_VALUE)
+  {
+    ReleaseMemory(size);
+    return false;
+  }
+  BYTE* bytes = alloc_new BYTE[size];
+  DWORD read  = 0;
+  if(::ReadFile(handle,bytes,(DWORD)size,&read,NULL) && read == size)
+  {
+    p_file->m_bytes = bytes;
+  }
+  else
+  {
+    // File changed while reading: serve it from disk
+    delete [] bytes;
+  }
+  CloseHandle(handle);
+  if(p_file->m_bytes == nullptr)
+  {
+    ReleaseMemory(size);
+    return false;
+  }
+  return true;
+}
+
+// Thread uses the identity of the client. Access rights may differ
+bool
+StaticFileCache::IsImpersonating()
+{
+  HANDLE token = NULL;
+  if(OpenThreadToken(GetCurrentThread(),TOKEN_QUERY,TRUE,&token))
+  {
+    CloseHandle(token);
+    return true;
+  }
+  return false;
+}
+
+// Put a new entry in the cache. The caller keeps its own reference
+// The memory of the contents was already reserved by ReadContents
+void
+StaticFileCache::Store(const XString& p_key,StaticFile* p_file)
+{
+  AutoCritSec lock(&m_lock);
+
+  // Forget an older version of the file
+  StaticFiles::iterator it = m_files.find(p_key);
+  if(it != m_files.end())
+  {
+    Remove(it);
+  }
+  // Misses are not cached
+  if(!p_file->m_exists)
+  {
+    return;
+  }
+  // Never more than the maximum: the least recently used file goes
+  while(m_files.size() >= STATICCACHE_ENTRIES && !m_used.empty())
+  {
+    Remove(m_files.find(m_used.back()));
+  }
+  p_file->AddReference();
+  m_used.push_front(p_key);
+  StaticEntry entry { p_file,m_used.begin() };
+  m_files.insert(std::make_pair(p_key,entry));
+}
+
+// Take a file out of the cache (under the lock)
+// The file lives on until the last caller drops its reference
+void
+StaticFileCache::Remove(StaticFiles::iterator p_entry)
+{
+  StaticFile* file = p_entry->second.m_file;
+  if(file->m_bytes)
+  {
+    m_memory -= (size_t)file->m_size;
+  }
+  m_used.erase(p_entry->second.m_used);
+  m_files.erase(p_entry);
+  file->DropReference();
+}
+
+// Check and reserve memory for the contents of a file
+bool
+StaticFileCache::ReserveMemory(size_t p_size)
+{
+  AutoCritSec lock(&m_lock);
+
+  if(m_memory + p_size > m_memoryMax)
+  {
+    return false;
+  }
+  m_memory += p_size;
+  return true;
+}
+
+// Contents could not be read after all
+void
+StaticFileCache::ReleaseMemory(size_t p_size)
+{
+  AutoCritSec lock(&m_lock);
+  m_memory -= p_size;
+}
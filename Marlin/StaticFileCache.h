@@ -0,0 +1,147 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: StaticFileCache.h
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#pragma once
+#include <unordered_map>
+#include <list>
+
+// Default milliseconds before a cached file is checked again on disk
+constexpr ULONG  STATICCACHE_TTL         = 2000;
+// Default: files up to this size are kept in memory
+constexpr size_t STATICCACHE_MEMORY_FILE = 64 * 1024;
+// Default: total bytes of all files in memory
+constexpr size_t STATICCACHE_MEMORY_MAX  = 32 * 1024 * 1024;
+// Maximum number of files in the cache. Then the least recently used goes
+constexpr size_t STATICCACHE_ENTRIES     = 10000;
+
+class HTTPSite;
+
+// What we know of one file of the site. Never changed once in the cache,
+// except for the time of the last check. A changed file gets a new entry.
+class StaticFile
+{
+public:
+  explicit StaticFile(const XString& p_pathname);
+
+  void      AddReference();
+  void      DropReference();
+
+  XString   m_pathname;                 // Full filename on disk
+  bool      m_exists      { false   };  // File is there
+  bool      m_readable    { false   };  // Server has read access
+  ULONGLONG m_size        { 0       };  // File size in bytes
+  FILETIME  m_lastWrite   { 0, 0    };  // Last modification time
+  XString   m_etag;                     // Strong ETag from size and time
+  XString   m_contentType;              // Content type by extension
+  BYTE*     m_bytes       { nullptr };  // Contents of small files
+  volatile ULONGLONG m_checked { 0 };   // Tick count of the last check
+
+private:
+ ~StaticFile();
+  volatile LONG m_references { 1 };
+};
+
+struct StaticFileHash
+{
+  size_t operator()(const XString& p_pathname) const
+  {
+    return std::hash<std::stdstring>()(p_pathname);
+  }
+};
+
+// Keys of the cached files, the most recently used first
+using StaticLRU = std::list<XString>;
+
+// A file in the cache and its place in the LRU list
+class StaticEntry
+{
+public:
+  StaticFile*         m_file;
+  StaticLRU::iterator m_used;
+};
+
+using StaticFiles = std::unordered_map<XString,StaticEntry,StaticFileHash>;
+
+// Cache of the static content of a site, for the GET handler.
+// Remembers existence, access, size, modification time, ETag and content
+// type of the files. Small files are kept in memory and are not read from
+// disk for every call. An entry is checked against the disk (one file
+// attribute call) when its time-to-live has passed.
+// Files that do not exist are not cached: a flood of unknown names would
+// otherwise push out the real content. When the cache is full, the least
+// recently used file makes room for a new one.
+// Files are only checked for access under the server's own identity:
+// an impersonating thread must not use or fill the cache.
+class StaticFileCache
+{
+public:
+  explicit StaticFileCache(HTTPSite* p_site);
+ ~StaticFileCache();
+
+  // Get the entry of a file. Call 'DropReference' when done with it
+  StaticFile* GetFile(const XString& p_pathname);
+  // Forget all files
+  void        Reset();
+
+  // Conditional GET: Does the 'If-None-Match' header match the file
+  static bool MatchETag(const XString& p_header,const XString& p_etag);
+
+  // SETTERS
+  void    SetActive(bool p_active)              { m_active     = p_active;   }
+  void    SetTimeToLive(ULONG p_milliseconds)   { m_ttl        = p_milliseconds; }
+  void    SetMemoryFileSize(size_t p_size)      { m_memoryFile = p_size;     }
+  void    SetMemoryMaximum(size_t p_size)       { m_memoryMax  = p_size;     }
+
+  // GETTERS
+  bool      GetActive()         { return m_active;     }
+  ULONG     GetTimeToLive()     { return m_ttl;        }
+  size_t    GetMemoryFileSize() { return m_memoryFile; }
+  size_t    GetMemoryMaximum()  { return m_memoryMax;  }
+  ULONGLONG GetHits()           { return m_hits;       }
+  ULONGLONG GetMisses()         { return m_misses;     }
+
+private:
+  StaticFile* LoadFile(const XString& p_pathname);
+  bool        ReadContents(StaticFile* p_file);
+  bool        IsImpersonating();
+  void        Store(const XString& p_key,StaticFile* p_file);
+  void        Remove(StaticFiles::iterator p_entry);
+  bool        ReserveMemory(size_t p_size);
+  void        ReleaseMemory(size_t p_size);
+
+  HTTPSite*   m_site;
+  bool        m_active     { true };
+  ULONG       m_ttl        { STATICCACHE_TTL         };
+  size_t      m_memoryFile { STATICCACHE_MEMORY_FILE };
+  size_t      m_memoryMax  { STATICCACHE_MEMORY_MAX  };
+  size_t      m_memory     { 0 };     // Contents in the cache, or reserved for it
+  ULONGLONG   m_hits       { 0 };
+  ULONGLONG   m_misses     { 0 };
+  StaticFiles m_files;
+  StaticLRU   m_used;
+  CRITICAL_SECTION m_lock;
+};
@@ -48,6 +48,11 @@
 static unsigned __stdcall RunThread(void* p_myThread);
 static unsigned __stdcall RunHeartBeat(void* p_pool);
 
+// Work stealing: the deque of the current thread and its pool
+static thread_local ThreadPool* t_pool   = nullptr;
+static thread_local WorkDeque*  t_deque  = nullptr;
+static thread_local unsigned    t_random = 0;
+
 //////////////////////////////////////////////////////////////////////////
 //
 // The ThreadPool
@@ -71,6 +76,15 @@ ThreadPool::ThreadPool(int p_minThreads,int p_maxThreads)
 ThreadPool::~ThreadPool()
 {
   StopThreadPool();
+  if(m_deques)
+  {
+    for(long ind = 0; ind < m_numDeques; ++ind)
+    {
+      delete m_deques[ind];
+    }
+    delete [] m_deques;
+    m_deques = nullptr;
+  }
   DeleteCriticalSection(&m_critical);
   DeleteCriticalSection(&m_cpuclock);
 }
@@ -119,10 +133,6 @@ ThreadPool::InitThreadPool()
   {
     m_maxThreads = NUM_THREADS_DEFAULT;
   }
-  if(m_maxThreads > NUM_THREADS_MAXIMUM)
-  {
-    m_maxThreads = NUM_THREADS_MAXIMUM;
-  }
   // Check the logic of minThreads
   if(m_minThreads >= m_maxThreads)
   {
@@ -149,11 +159,34 @@ ThreadPool::InitThreadPool()
     }
 
     // Adjust maximum of threads for the number of processors
-    if (m_maxThreads > (4 * m_processors))
+    if(m_maxThreads > (NUM_THREADS_PERCORE * m_processors))
     {
-      m_maxThreads = (4 * m_processors);
+      m_maxThreads = (NUM_THREADS_PERCORE * m_processors);
     }
   }
+  // The controller starts at the minimum and measures from here
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&counter);
+  m_frequency = counter.QuadPart;
+  QueryPerformanceCounter(&counter);
+  m_startCounter  = counter.QuadPart;
+  m_lastSample    = GetTickCount64();
+  m_targetThreads = m_minThreads;
+
+  // Room for the deques of the work stealing mode, up to the ceiling of the pool.
+  // Must be there before the first thread claims one. The deques themselves
+  // are only made when a thread claims one, and live as long as the pool.
+  if(m_stealing && !m_deques)
+  {
+    m_numDeques = NUM_THREADS_PERCORE * (m_processors > 0 ? m_processors : 1) + NUM_WORKDEQUES_EXTRA;
+    if(m_numDeques < m_maxThreads + NUM_WORKDEQUES_EXTRA)
+    {
+      m_numDeques = m_maxThreads + NUM_WORKDEQUES_EXTRA;
+    }
+    m_deques = alloc_new WorkDeque*[m_numDeques];
+    ZeroMemory(m_deques,m_numDeques * sizeof(WorkDeque*));
+  }
+
   // Create IO Completion Port
   // Must be done before creating the threads!
   // But could already have been done by association of an I/O handle
@@ -283,9 +316,9 @@ ThreadPool::TrySetMaximum(int p_maxThreads)
   {
     p_maxThreads = NUM_THREADS_DEFAULT;
   }
-  if(p_maxThreads > (4 * NUM_THREADS_MAXIMUM))
+  if(m_initialized && p_maxThreads > (NUM_THREADS_PERCORE * m_processors))
   {
-    p_maxThreads = 4 * NUM_THREADS_MAXIMUM;
+    p_maxThreads = NUM_THREADS_PERCORE * m_processors;
   }
   // Raising the bar is simple
   if(m_maxThreads < p_maxThreads)
@@ -307,6 +340,21 @@ ThreadPool::TrySetMaximum(int p_maxThreads)
   return false;
 }
 
+// Work stealing keeps work submitted from a pool thread on the deque of
+// that thread. Can only be set before the pool is running
+bool
+ThreadPool::SetWorkStealing(bool p_stealing)
+{
+  if(!m_initialized)
+  {
+    m_stealing = p_stealing;
+    TP_TRACE1("Threadpool work stealing mode: %d\n",p_stealing);
+    return true;
+  }
+  TP_TRACE0("FAILED: Cannot set threadpool work stealing after init\n");
+  return false;
+}
+
 // Intended for long running threads to call, just before entering 
 // the WaitForSingleObject API 
 void
@@ -397,6 +445,7 @@ ThreadPool::RunAThread(ThreadRegister* p_register)
   InterlockedIncrement(&m_bsyThreads);
 
   SetThreadName("Marlin::ThreadPool",p_register->m_threadId);
+  ClaimWorkDeque();
 
   try
   {
@@ -414,7 +463,6 @@ ThreadPool::RunAThread(ThreadRegister* p_register)
       DWORD     bytes = 0;
       DWORD     error = 0;
       ULONG_PTR key   = 0;
-      float     load  = 0.0;
       LPOVERLAPPED overlapped = nullptr;
 
       // Stops executing and wait in I/O completion port
@@ -442,9 +490,11 @@ ThreadPool::RunAThread(ThreadRegister* p_register)
       }
 
       // Should we add another thread to the pool?
+      // Keep one spare thread, so work is not stuck behind blocking callbacks.
+      // The CPU load is the one of the last sample: no system call per item
       if((m_bsyThreads == m_curThreads) &&
          (m_bsyThreads  < m_maxThreads) &&
-         (GetCPULoad(&m_cpuclock)  < 0.75) &&
+         (m_cpuLoad < 0.75) &&
          m_openForWork)
       {
         CreateThreadPoolThread();
@@ -466,23 +516,30 @@ ThreadPool::RunAThread(ThreadRegister* p_register)
         if(key == COMPLETION_WORK && overlapped == INVALID_HANDLE_VALUE)
         {
           // 1: Thread woke to do some interesting work....
+          // The packet carries the time stamp of the submit
+          RecordDelay(bytes);
           LPFN_CALLBACK callback = nullptr;
           void*         payload  = nullptr;
           if(WorkToDo(callback,payload))
           {
             DoTheCallback(callback,payload);
+            InterlockedIncrement(&m_completed);
           }
+          // Nested work stays on this core
+          WorkOwnDeque();
         }
         else if (key == COMPLETION_CALL)
         {
           // 2: Implement your overload of this special call
           DoTheCallback(overlapped);
+          InterlockedIncrement(&m_completed);
         }
         else
         {
           // 3: The completion key **IS** the callback mechanism
           LPFN_CALLBACK callback = reinterpret_cast<LPFN_CALLBACK>(key);
           (*callback)(overlapped);
+          InterlockedIncrement(&m_completed);
         }
       }
 
@@ -490,10 +547,13 @@ ThreadPool::RunAThread(ThreadRegister* p_register)
       // HANDLE* event = nullptr;
       // *event = 0L;
 
-      // Find CPU load and see if we must remain in the threadpool
-      load = GetCPULoad(&m_cpuclock);
-      TP_TRACE1("CPU Load: %f\n",load);
-      if((load > 0.9) && (m_curThreads > m_minThreads))
+      // Without a heartbeat, the workers take the samples
+      if(m_heartbeat == 0)
+      {
+        SamplePoolSize();
+      }
+      // See if we must remain in the threadpool
+      if(RetireThread())
       {
         stayInThePool = false;
       }
@@ -540,6 +600,7 @@ ThreadPool::RunAThread(ThreadRegister* p_register)
   TP_TRACE0("Thread is leaving the pool\n");
   InterlockedDecrement(&m_bsyThreads);
   InterlockedDecrement(&m_curThreads);
+  ReleaseWorkDeque();
 
   // Try removing ourselves
   // We are now out-of-business
@@ -582,6 +643,10 @@ ThreadPool::RunCleanupJobs()
 bool 
 ThreadPool::WorkToDo(LPFN_CALLBACK& p_callback,void*& p_argument)
 {
+  if(m_stealing)
+  {
+    return WorkToSteal(p_callback,p_argument);
+  }
   AutoLockTP lock(&m_critical);
 
   // See if there are items in the work queue
@@ -600,6 +665,184 @@ ThreadPool::WorkToDo(LPFN_CALLBACK& p_callback,void*& p_argument)
   return true;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// WORK STEALING MODE
+//
+// Every pool thread owns a Chase-Lev deque. Work submitted from a pool
+// thread is pushed on its own deque, and popped by that same thread after
+// its current callback (LIFO: the data is still in the cache of the core).
+// Work from outside the pool goes to the global injection queue (m_work).
+// Every submit still posts one completion packet, so an idle thread wakes
+// up and steals from a random victim when its own deque is empty.
+// A thread can be woken for work that the owner already did itself.
+// It then finds nothing, and simply returns to the completion port.
+// No thread spins on work it cannot see: an owner always runs its own deque
+// empty before it returns to the completion port, and work in the injection
+// queue always has a completion packet of its own.
+//
+//////////////////////////////////////////////////////////////////////////
+
+bool
+ThreadPool::WorkToSteal(LPFN_CALLBACK& p_callback,void*& p_argument)
+{
+  if(InterlockedCompareExchange(&m_pending,0,0) <= 0)
+  {
+    return false;
+  }
+
+  // 1: Our own deque
+  if(t_pool == this && t_deque && t_deque->Pop(p_callback,p_argument))
+  {
+    InterlockedDecrement(&m_pending);
+    return true;
+  }
+
+  // 2: The injection queue
+  { AutoLockTP lock(&m_critical);
+    if(!m_work.empty())
+    {
+      p_callback = m_work.front().m_callback;
+      p_argument = m_work.front().m_argument;
+      m_work.pop_front();
+      InterlockedDecrement(&m_pending);
+      return true;
+    }
+  }
+
+  // 3: Steal from a random victim, one round along all deques
+  long used = m_usedDeques;
+  if(used > 0)
+  {
+    // Cheap xorshift. Does not need to be a good random
+    if(t_random == 0)
+    {
+      t_random = GetCurrentThreadId() | 1;
+    }
+    t_random ^= t_random << 13;
+    t_random ^= t_random >> 17;
+    t_random ^= t_random << 5;
+
+    long start = (long)(t_random % (unsigned)used);
+    for(long ind = 0; ind < used; ++ind)
+    {
+      WorkDeque* victim = m_deques[(start + ind) % used];
+      if(victim == nullptr || victim == t_deque)
+      {
+        continue;
+      }
+      // An abort only means that another thread was faster: try again
+      StealResult result = StealResult::Abort;
+      while(result == StealResult::Abort)
+      {
+        result = victim->Steal(p_callback,p_argument);
+      }
+      if(result == StealResult::Success)
+      {
+        TP_TRACE0("WORK STOLEN from another thread!\n");
+        InterlockedDecrement(&m_pending);
+        return true;
+      }
+    }
+  }
+  // Nothing to be seen: back to the completion port
+  return false;
+}
+
+// Run the work that the last callback pushed on our own deque
+// The completion packets posted for it wake thieves for the rest
+void
+ThreadPool::WorkOwnDeque()
+{
+  if(t_pool != this || t_deque == nullptr)
+  {
+    return;
+  }
+  LPFN_CALLBACK callback = nullptr;
+  void*         payload  = nullptr;
+  while(t_deque->Pop(callback,payload))
+  {
+    InterlockedDecrement(&m_pending);
+    DoTheCallback(callback,payload);
+    InterlockedIncrement(&m_completed);
+  }
+}
+
+// Claim a free deque for the current thread, making it on first use
+// If none is free, the thread submits to the injection queue
+void
+ThreadPool::ClaimWorkDeque()
+{
+  if(!m_stealing || m_deques == nullptr)
+  {
+    return;
+  }
+  for(long ind = 0; ind < m_numDeques; ++ind)
+  {
+    WorkDeque* deque = m_deques[ind];
+    if(deque == nullptr)
+    {
+      // Publish a new deque in the free slot, unless another thread was first
+      WorkDeque* made  = alloc_new WorkDeque();
+      WorkDeque* found = (WorkDeque*) InterlockedCompareExchangePointer((PVOID*)&m_deques[ind],made,nullptr);
+      if(found)
+      {
+        delete made;
+        deque = found;
+      }
+      else
+      {
+        deque = made;
+      }
+    }
+    if(deque->Claim())
+    {
+      t_pool  = this;
+      t_deque = deque;
+
+      // Thieves must look this far
+      long used = m_usedDeques;
+      while(used < ind + 1)
+      {
+        long found = InterlockedCompareExchange(&m_usedDeques,ind + 1,used);
+        if(found == used)
+        {
+          break;
+        }
+        used = found;
+      }
+      return;
+    }
+  }
+  TP_TRACE0("No free work stealing deque for this thread\n");
+}
+
+// Leaving thread: hand the rest of our deque to the injection queue
+// The pending count does not change, the work is only moved. Every moved
+// item gets a completion packet, as its owner will not run it any more.
+void
+ThreadPool::ReleaseWorkDeque()
+{
+  if(t_pool != this || t_deque == nullptr)
+  {
+    return;
+  }
+  LPFN_CALLBACK callback = nullptr;
+  void*         payload  = nullptr;
+  while(t_deque->Pop(callback,payload))
+  {
+    AutoLockTP lock(&m_critical);
+    ThreadWork work;
+    work.m_callback = callback;
+    work.m_argument = payload;
+    m_work.push_back(work);
+    PostQueuedCompletionStatus(m_completion,GetDelayStamp(),COMPLETION_WORK,(LPOVERLAPPED)INVALID_HANDLE_VALUE);
+  }
+  t_deque->Release();
+  t_deque = nullptr;
+  t_pool  = nullptr;
+}
+
 // Stop a thread for good
 // Stop the last thread in the pool. Does **NOT** stop the exact thread (anymore)
 // Now only relevant for stopping ALL jobs at the end of the lifetime
@@ -680,6 +923,7 @@ ThreadPool::RunHeartbeat()
 
       case WAIT_TIMEOUT:    // Heartbeat! Do the call!
                             TP_TRACE0("Heartbeat waking up\n");
+                            SamplePoolSize();
                             SafeCallHeartbeat(m_heartbeatCallback,m_heartbeatPayload);
                             break;
     }
@@ -764,6 +1008,24 @@ ThreadPool::StopHeartbeat()
 bool
 ThreadPool::SubmitWork(LPFN_CALLBACK p_callback,void* p_argument)
 {
+  // Work stealing: from a pool thread no lock is needed
+  if(m_stealing && t_pool == this && t_deque && m_openForWork)
+  {
+    InterlockedIncrement(&m_pending);
+    if(t_deque->Push(p_callback,p_argument))
+    {
+      TP_TRACE0("Queueing 1 job on the deque of this thread\n");
+      if(!PostQueuedCompletionStatus(m_completion,GetDelayStamp(),COMPLETION_WORK,(LPOVERLAPPED)INVALID_HANDLE_VALUE))
+      {
+        // Still done by ourselves, after the current callback
+        TP_TRACE0("Posting of I/O Completion failed\n");
+      }
+      return true;
+    }
+    // Deque is full: use the injection queue
+    InterlockedDecrement(&m_pending);
+  }
+
   // Lock the pool
   AutoLockTP lock(&m_critical);
 
@@ -784,10 +1046,14 @@ ThreadPool::SubmitWork(LPFN_CALLBACK p_callback,void* p_argument)
   work.m_callback = p_callback;
   work.m_argument = p_argument;
   m_work.push_back(work);
+  if(m_stealing)
+  {
+    InterlockedIncrement(&m_pending);
+  }
   TP_TRACE1("Queueing 1 job. Work queue now [%d] items\n",m_work.size());
 
   // Post to free 1 thread from the pool
-  if(!PostQueuedCompletionStatus(m_completion,0,COMPLETION_WORK,(LPOVERLAPPED)INVALID_HANDLE_VALUE))
+  if(!PostQueuedCompletionStatus(m_completion,GetDelayStamp(),COMPLETION_WORK,(LPOVERLAPPED)INVALID_HANDLE_VALUE))
   {
     TP_TRACE0("Posting of I/O Completion failed\n");
     return false;
@@ -806,6 +1072,195 @@ ThreadPool::SubmitCleanup(LPFN_CALLBACK p_cleanup,void* p_argument)
   TP_TRACE1("Cleanup jobs queue [%d] items\n",m_cleanup.size());
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// ADAPTIVE POOL SIZING
+//
+// Every work packet carries the time of its submit. The delay until a
+// thread picks it up goes into a log2 histogram. Once per sample interval
+// (on the heartbeat, or by a worker if there is no heartbeat) the controller
+// looks at the median and 99th percentile delay and at the throughput:
+// - Work waits for a thread         -> grow the target by one
+// - Growing did not raise throughput -> step back
+// - Threads are idle and no waiting -> shrink the target by one
+// Threads above the target leave the pool after their current work.
+// The CPU load is only read at the sample, not for every work item.
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Microseconds since the pool started, wrapping after 71 minutes.
+// The wrapping is harmless: only the difference of two stamps counts.
+// Whole seconds and the rest are converted apart, as the counter ticks
+// times a million would overflow after some days of uptime.
+// The origin is moved on by the sampler: read it as one consistent pair.
+DWORD
+ThreadPool::GetDelayStamp()
+{
+  LARGE_INTEGER counter;
+  LONGLONG start    = 0;
+  DWORD    base     = 0;
+  long     sequence = 0;
+  do
+  {
+    sequence = InterlockedCompareExchange(&m_stampSequence,0,0);
+    start    = m_startCounter;
+    base     = m_stampBase;
+    QueryPerformanceCounter(&counter);
+  }
+  while((sequence & 1) || sequence != InterlockedCompareExchange(&m_stampSequence,0,0));
+
+  LONGLONG ticks = counter.QuadPart - start;
+  return base + (DWORD)((ticks / m_frequency) * 1000000 + ((ticks % m_frequency) * 1000000) / m_frequency);
+}
+
+// Move the origin of the stamps on by whole seconds, and the base of the
+// stamps by exactly as many microseconds. So stamps taken before and after
+// the move still give the right difference.
+void
+ThreadPool::RebaseDelayStamp()
+{
+  long sequence = InterlockedCompareExchange(&m_stampSequence,0,0);
+  if((sequence & 1) || InterlockedCompareExchange(&m_stampSequence,sequence + 1,sequence) != sequence)
+  {
+    return;
+  }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  LONGLONG seconds = (counter.QuadPart - m_startCounter) / m_frequency;
+  if(seconds >= POOL_STAMP_REBASE)
+  {
+    m_startCounter += seconds * m_frequency;
+    m_stampBase    += (DWORD)(seconds * 1000000);
+  }
+  InterlockedIncrement(&m_stampSequence);
+}
+
+void
+ThreadPool::RecordDelay(DWORD p_stamp)
+{
+  DWORD delay  = GetDelayStamp() - p_stamp;
+  int   bucket = 0;
+  while(delay > 1 && bucket < POOL_DELAY_BUCKETS - 1)
+  {
+    delay >>= 1;
+    ++bucket;
+  }
+  InterlockedIncrement(&m_delays[bucket]);
+}
+
+// Only the thread that moves the sample time does the sampling
+void
+ThreadPool::SamplePoolSize()
+{
+  ULONGLONG now  = GetTickCount64();
+  ULONGLONG last = m_lastSample;
+  if(now - last < POOL_SAMPLE_INTERVAL || !m_openForWork)
+  {
+    return;
+  }
+  if(InterlockedCompareExchange64((LONG64*)&m_lastSample,(LONG64)now,(LONG64)last) == (LONG64)last)
+  {
+    AdjustPoolSize(now - last);
+    RebaseDelayStamp();
+  }
+}
+
+void
+ThreadPool::AdjustPoolSize(ULONGLONG p_elapsed)
+{
+  // Take the histogram of this sample
+  long delays[POOL_DELAY_BUCKETS];
+  long total = 0;
+  for(int ind = 0; ind < POOL_DELAY_BUCKETS; ++ind)
+  {
+    delays[ind] = InterlockedExchange(&m_delays[ind],0);
+    total += delays[ind];
+  }
+  long completed = InterlockedExchange(&m_completed,0);
+
+  // Percentiles: upper bound of the bucket in microseconds
+  ULONG p50 = 0;
+  ULONG p99 = 0;
+  long  seen = 0;
+  for(int ind = 0; ind < POOL_DELAY_BUCKETS && total > 0; ++ind)
+  {
+    seen += delays[ind];
+    if(p50 == 0 && seen * 2 >= total)
+    {
+      p50 = 1UL << ind;
+    }
+    if(seen * 100 >= total * 99)
+    {
+      p99 = 1UL << ind;
+      break;
+    }
+  }
+  ULONG lastThroughput = m_throughput;
+  m_throughput = (ULONG)((completed * 1000) / (p_elapsed ? p_elapsed : 1));
+  m_delayP50   = p50;
+  m_delayP99   = p99;
+  m_cpuLoad    = GetCPULoad(&m_cpuclock);
+
+  // Hill climbing on the target size
+  long target = m_targetThreads;
+  long idle   = m_curThreads - m_bsyThreads;
+  if(p50 > POOL_DELAY_GROW && m_cpuLoad < POOL_LOAD_MAXIMUM)
+  {
+    ++target;
+    m_direction = 1;
+  }
+  else if(m_direction > 0 && m_throughput < (lastThroughput * 95) / 100)
+  {
+    // More threads made it worse: step back
+    --target;
+    m_direction = -1;
+  }
+  else if(p99 < POOL_DELAY_SHRINK && idle > 1)
+  {
+    --target;
+    m_direction = -1;
+  }
+  else
+  {
+    m_direction = 0;
+  }
+  if(target > m_maxThreads)
+  {
+    target = m_maxThreads;
+  }
+  if(target < m_minThreads)
+  {
+    target = m_minThreads;
+  }
+  InterlockedExchange(&m_targetThreads,target);
+
+  // Grow now, shrink as threads finish their work
+  long surplus = m_curThreads - target;
+  InterlockedExchange(&m_retire,surplus > 0 ? surplus : 0);
+  for(long ind = m_curThreads; ind < target; ++ind)
+  {
+    CreateThreadPoolThread();
+  }
+  TP_TRACE2("Threadpool target: %d threads. Queue delay p50: %d us\n",target,p50);
+}
+
+// Claim one of the retirements the controller decided on
+bool
+ThreadPool::RetireThread()
+{
+  long retire = m_retire;
+  while(retire > 0 && m_curThreads > m_minThreads)
+  {
+    long found = InterlockedCompareExchange(&m_retire,retire - 1,retire);
+    if(found == retire)
+    {
+      return true;
+    }
+    retire = found;
+  }
+  return false;
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // SLEEPING THREADS
@@ -898,6 +1353,7 @@ ThreadPool::SleepThread(DWORD_PTR p_unique,void* p_payload)
     {
       InterlockedDecrement(&m_curThreads);
       InterlockedDecrement(&m_bsyThreads);
+      ReleaseWorkDeque();
       RemoveThreadPoolThread(id);
     }
     // Now do the opposite of _beginthread
@@ -1027,7 +1483,7 @@ ThreadPool::WaitingForIdle(int p_part)
                               break;
         case WF_IDLE_CLEAN:   if(m_cleanup.empty()) idle = true;
                               break;
-        case WF_IDLE_WORK:    if(m_work.empty())    idle = true;
+        case WF_IDLE_WORK:    if(m_stealing ? m_pending <= 0 : m_work.empty()) idle = true;
                               break;
         case WF_IDLE_THREADS: if(m_threads.empty()) idle = true;
                               break;
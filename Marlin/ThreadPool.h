@@ -26,6 +26,7 @@
 // THE SOFTWARE.
 //
 #pragma once
+#include "WorkDeque.h"
 #include <vector>
 #include <deque>
 
@@ -35,8 +36,23 @@
 // Threads minimum and maximum
 constexpr auto NUM_THREADS_MINIMUM =  4;   // No use for a ThreadPool below this number
 constexpr auto NUM_THREADS_DEFAULT = 10;   // Default max threads
-constexpr auto NUM_THREADS_MAXIMUM = 20;   // More than this is not wise under Windows-OS
-                                           // Theoretically on a deca-core machine with hyper-threading
+constexpr auto NUM_THREADS_MAXIMUM = 20;   // Default ceiling if not configured
+constexpr auto NUM_THREADS_PERCORE = 16;   // Absolute ceiling per logical processor
+
+// Adaptive pool sizing. The controller samples the queue delay and the
+// throughput on the heartbeat and moves the target size between min and max
+constexpr auto POOL_SAMPLE_INTERVAL =   500;  // Milliseconds between two samples
+constexpr auto POOL_DELAY_BUCKETS   =    32;  // Log2 histogram of queue delay in microseconds
+constexpr auto POOL_DELAY_GROW      =  2000;  // Median delay (us) above which the pool grows
+constexpr auto POOL_DELAY_SHRINK    =   500;  // 99th percentile (us) below which the pool may shrink
+constexpr auto POOL_LOAD_MAXIMUM    =  0.90;  // Do not grow above this CPU load
+constexpr auto POOL_STAMP_REBASE    =  3600;  // Seconds after which the delay stamps get a new origin
+
+// Work stealing deques for the threads. There is room for a deque for every
+// thread up to the absolute ceiling of the pool, plus this number of threads
+// for the extended maximums (AutoIncrementPoolMax). A thread beyond that has
+// no deque of its own, and submits to the global injection queue.
+constexpr auto NUM_WORKDEQUES_EXTRA = NUM_THREADS_MAXIMUM;
 
 // Standard stack size of a thread in 64 bits architectures
 constexpr auto THREAD_STACKSIZE = (2 * 1024 * 1024);
@@ -124,6 +140,8 @@ public:
   void  RestoreMaximumThreads(AutoIncrementPoolMax& p_increment);
   // Number of current running threads
   long  GetCurrentThreads();
+  // Scheduling with per-thread deques and work stealing (before Run only)
+  bool  SetWorkStealing(bool p_stealing);
 
   // Sleeping and waking-up a thread
   // Sleeps ANY thread. Also threads not originating in this ThreadPool
@@ -153,11 +171,16 @@ public:
   int    GetMaxThreads()          { return m_maxThreads;          }
   int    GetStackSize()           { return m_stackSize;           }
   int    GetProcessors()          { return m_processors;          }
-  int    GetWorkOverflow()        { return (int)m_work.size();    }
+  long   GetTargetThreads()       { return m_targetThreads;       }   // Decided by the controller
+  ULONG  GetQueueDelayP50()       { return m_delayP50;            }   // Microseconds, last sample
+  ULONG  GetQueueDelayP99()       { return m_delayP99;            }   // Microseconds, last sample
+  ULONG  GetThroughput()          { return m_throughput;          }   // Work items per second, last sample
+  int    GetWorkOverflow()        { return m_stealing ? m_pending : (int)m_work.size(); }
   int    GetCleanupJobs()         { return (int)m_cleanup.size(); }
   int    GetHeartBeatTime()       { return m_heartbeat;           }
   HANDLE GetIOCompletionPort()    { return m_completion;          }
   bool   GetInheritSecurity()     { return m_inherit;             }
+  bool   GetWorkStealing()        { return m_stealing;            }
 
   // These running-a-thread methods are public, but really should only be called 
   // from within the static work functions of the ThreadPool itself, to get things working
@@ -184,6 +207,14 @@ private:
   bool IsThreadInThreadPool(unsigned p_threadID);
   // More work to do on a thread  (pool must be locked!!)
   bool WorkToDo(LPFN_CALLBACK& p_callback,void*& p_argument);
+  // WORK STEALING MODE
+  // Own deque first, then the injection queue, then steal from other threads
+  bool WorkToSteal(LPFN_CALLBACK& p_callback,void*& p_argument);
+  // Run the work that the callback pushed on our own deque
+  void WorkOwnDeque();
+  // Claim and release a deque for the current thread
+  void ClaimWorkDeque();
+  void ReleaseWorkDeque();
   // Running all cleanup jobs for the ThreadPool
   void RunCleanupJobs();
   // Wake up all sleeping threads as part of the shutdown
@@ -191,6 +222,19 @@ private:
   // Safe SEH calling of a heartbeat function
   void SafeCallHeartbeat(LPFN_CALLBACK p_function,void* p_payload);
 
+  // ADAPTIVE POOL SIZING
+
+  // Time stamp of a posted work item and its delay until a thread picks it up
+  DWORD GetDelayStamp();
+  void  RecordDelay(DWORD p_stamp);
+  void  RebaseDelayStamp();
+  // Sample if the interval has passed. Only one thread does the sampling
+  void  SamplePoolSize();
+  // Hill climbing on queue delay and throughput
+  void  AdjustPoolSize(ULONGLONG p_elapsed);
+  // A thread that may leave the pool, as the target size is lower
+  bool  RetireThread();
+
   // This is the real callback. 
   // Overload for your needs, in your own class derived from ThreadPool
   virtual void DoTheCallback(LPFN_CALLBACK p_callback,void* p_argument);
@@ -214,6 +258,26 @@ private:
   int               m_stackSize       { THREAD_STACKSIZE    };  // TP size of SP stack of each thread
   int               m_processors      { 1       };              // Number of logical processors on the system
   bool              m_inherit         { false   };              // Threads inherit the proces security handle
+  bool              m_stealing        { false   };              // Work stealing scheduler mode
+  WorkDeque**       m_deques          { nullptr };              // WS deques for the threads, made on first claim
+  long              m_numDeques       { 0       };              // WS room for this number of deques
+  long              m_usedDeques      { 0       };              // WS highest claimed deque + 1
+  long              m_pending         { 0       };              // WS work items not yet taken
+  // Adaptive pool sizing
+  long              m_targetThreads   { 0       };              // AS target number of threads
+  long              m_retire          { 0       };              // AS threads that may still leave the pool
+  long              m_completed       { 0       };              // AS work items done in this sample
+  long              m_delays[POOL_DELAY_BUCKETS] { 0 };         // AS histogram of the queue delay
+  ULONGLONG         m_lastSample      { 0       };              // AS tick count of the last sample
+  LONGLONG          m_frequency       { 1       };              // AS performance counter frequency
+  LONGLONG          m_startCounter    { 0       };              // AS performance counter at the stamp origin
+  DWORD             m_stampBase       { 0       };              // AS delay stamp at the origin
+  long              m_stampSequence   { 0       };              // AS odd while the origin is moved
+  float             m_cpuLoad         { 0.0     };              // AS CPU load at the last sample
+  ULONG             m_delayP50        { 0       };              // AS median queue delay
+  ULONG             m_delayP99        { 0       };              // AS 99th percentile queue delay
+  ULONG             m_throughput      { 0       };              // AS work items per second
+  int               m_direction       { 0       };              // AS last move: -1, 0 or +1
   HANDLE            m_completion      { nullptr };              // I/O Completion port for I/O and thread sync
   ThreadMap         m_threads;                                  // Map with all running and waiting threads
   SleepingMap       m_sleeping;                                 // Registration of sleeping threads
@@ -0,0 +1,148 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: WorkDeque.h
+//
+// Marlin Server: Internet server/client
+//
+// Copyright (c) 2014-2024 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// Chase-Lev work stealing deque for the ThreadPool.
+// The owning thread pushes and pops at the bottom (LIFO, so nested work stays
+// warm in the cache of that core). Any other thread steals from the top.
+// Uses nothing but the C++ standard library, so it compiles on any platform.
+//
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Number of work items per deque. Must be a power of two
+// When a deque is full, the work goes to the global injection queue
+constexpr auto WORKDEQUE_CAPACITY = 1024;
+
+// Result of a steal attempt
+enum class StealResult
+{
+  Empty       // Nothing to steal
+ ,Abort       // Lost the race with another thief or the owner: try again
+ ,Success     // Got a work item
+};
+
+class WorkDeque
+{
+public:
+  typedef void (*WorkCallback)(void*);
+
+  // OWNER THREAD ONLY
+
+  // Push at the bottom. Returns false if the deque is full
+  bool Push(WorkCallback p_callback,void* p_argument)
+  {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top    = m_top.load(std::memory_order_acquire);
+    if(bottom - top >= WORKDEQUE_CAPACITY)
+    {
+      return false;
+    }
+    Slot& slot = m_slots[bottom & (WORKDEQUE_CAPACITY - 1)];
+    slot.s_callback.store(p_callback,std::memory_order_relaxed);
+    slot.s_argument.store(p_argument,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(bottom + 1,std::memory_order_relaxed);
+    return true;
+  }
+
+  // Pop the last pushed item from the bottom
+  bool Pop(WorkCallback& p_callback,void*& p_argument)
+  {
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+
+    if(top > bottom)
+    {
+      // Was already empty
+      m_bottom.store(bottom + 1,std::memory_order_relaxed);
+      return false;
+    }
+    Slot& slot = m_slots[bottom & (WORKDEQUE_CAPACITY - 1)];
+    p_callback = slot.s_callback.load(std::memory_order_relaxed);
+    p_argument = slot.s_argument.load(std::memory_order_relaxed);
+    if(top == bottom)
+    {
+      // Last item: race against the thieves for it
+      bool won = m_top.compare_exchange_strong(top,top + 1,std::memory_order_seq_cst,std::memory_order_relaxed);
+      m_bottom.store(bottom + 1,std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // ANY THREAD
+
+  // Steal the oldest item from the top
+  StealResult Steal(WorkCallback& p_callback,void*& p_argument)
+  {
+    int64_t top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+    if(top >= bottom)
+    {
+      return StealResult::Empty;
+    }
+    // The slot can only be overwritten after 'top' has moved on,
+    // in which case the exchange below fails and we discard the read
+    Slot& slot = m_slots[top & (WORKDEQUE_CAPACITY - 1)];
+    p_callback = slot.s_callback.load(std::memory_order_relaxed);
+    p_argument = slot.s_argument.load(std::memory_order_relaxed);
+    if(!m_top.compare_exchange_strong(top,top + 1,std::memory_order_seq_cst,std::memory_order_relaxed))
+    {
+      return StealResult::Abort;
+    }
+    return StealResult::Success;
+  }
+
+  // Not exact while running, but good enough for statistics
+  int GetSize()
+  {
+    int64_t size = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+    return size > 0 ? (int)size : 0;
+  }
+
+  // Claiming the deque for a thread of the pool
+  bool Claim()   { bool free = false; return m_owned.compare_exchange_strong(free,true); }
+  void Release() { m_owned.store(false); }
+
+private:
+  struct Slot
+  {
+    std::atomic<WorkCallback> s_callback { nullptr };
+    std::atomic<void*>        s_argument { nullptr };
+  };
+
+  // Thieves and the owner on separate cache lines
+  alignas(64) std::atomic<int64_t> m_top    { 0 };
+  alignas(64) std::atomic<int64_t> m_bottom { 0 };
+  alignas(64) std::atomic<bool>    m_owned  { false };
+  Slot m_slots[WORKDEQUE_CAPACITY];
+};
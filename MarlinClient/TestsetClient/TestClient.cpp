@@ -147,12 +147,14 @@ int _tmain(int argc,const TCHAR* argv[],const TCHAR* /*envp[]*/)
       errors += TestCookies(*client);
       errors += TestFormData(client);
       errors += TestJsonData(client);
+      errors += TestJsonStream(client);
       errors += TestContract(client,true, false);  // JSON No authentication
       errors += TestContract(client,false,false);  // WS   No authentication
       errors += TestContract(client,false,true);   // WS   WS-Secure token-profile
       errors += TestPatching(client);
       errors += TestCompression(client);
       errors += TestEvents(client);
+      errors += TestEventScaling(client);
 #ifdef TEST_WEBSOCKETS
       errors += TestWebSocketAccept();
       errors += TestWebSocket(g_log);
@@ -56,9 +56,11 @@ extern int TestCloseWebSocket(void);
 extern int TestWebSocketSecure(LogAnalysis* p_log);
 extern int TestCloseWebSocketSecure(void);
 extern int TestEvents(HTTPClient* p_client);
+extern int TestEventScaling(HTTPClient* p_client);
 extern int TestCookies(HTTPClient& p_client);
 extern int TestContract(HTTPClient* p_client,bool p_json,bool p_tokenProfile);
 extern int TestJsonData(HTTPClient* p_client);
+extern int TestJsonStream(HTTPClient* p_client);
 extern int TestPatching(HTTPClient* p_client);
 extern int TestFormData(HTTPClient* p_client);
 extern int TestBaseSite(HTTPClient* p_client);
@@ -29,6 +29,7 @@
 #include "TestClient.h"
 #include "HTTPClient.h"
 #include "EventSource.h"
+#include <vector>
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -223,3 +224,95 @@ TestEvents(HTTPClient* p_client)
 
   return result ? 0 : 1;
 }
+
+//////////////////////////////////////////////////////////////////////////
+//
+// SUBSCRIBER SCALING OF THE BROADCAST
+// Subscribers are opened in rounds. The server broadcasts to all of them
+// when a round is complete and ends it with a 'round' event.
+//
+//////////////////////////////////////////////////////////////////////////
+
+// Must match the server test set
+static const int ScaleRounds[] = { 1, 8, 64 };   // Subscribers in each round
+static const int ScaleEvents   = 100;            // Broadcast events per round
+static long scaleMessages      = 0;              // Broadcast events received
+static long scaleRoundsSeen    = 0;              // Round-ends received
+
+void OnScaleMessage(ServerEvent* p_event,void* p_data)
+{
+  UNREFERENCED_PARAMETER(p_data);
+  InterlockedIncrement(&scaleMessages);
+  delete p_event;
+}
+
+void OnScaleRound(ServerEvent* p_event,void* p_data)
+{
+  UNREFERENCED_PARAMETER(p_data);
+  InterlockedIncrement(&scaleRoundsSeen);
+  delete p_event;
+}
+
+int
+TestEventScaling(HTTPClient* p_client)
+{
+  xprintf(_T("TESTING SUBSCRIBER SCALING OF THE SSE BROADCAST\n"));
+  xprintf(_T("===============================================\n"));
+
+  XString url;
+  url.Format(_T("http://%s:%d/MarlinTest/EventScale/"),MARLIN_HOST,TESTING_HTTP_PORT);
+
+  std::vector<HTTPClient*> clients;
+  long expectedMessages = 0;
+  long expectedRounds   = 0;
+  int  errors = 0;
+
+  for(int round = 0; round < _countof(ScaleRounds); ++round)
+  {
+    // Open the subscribers of this round
+    ULONGLONG start = GetTickCount64();
+    while((int)clients.size() < ScaleRounds[round])
+    {
+      HTTPClient* client = new HTTPClient();
+      client->SetLogging(p_client->GetLogging());
+      client->SetLogLevel(p_client->GetLogLevel());
+
+      EventSource* source = client->CreateEventSource(url);
+      source->m_onmessage = OnScaleMessage;
+      source->AddEventListener(_T("round"),OnScaleRound);
+      source->SetReconnectionTime(1000);
+      source->EventSourceInit(false);
+      clients.push_back(client);
+    }
+    expectedMessages += ScaleRounds[round] * ScaleEvents;
+    expectedRounds   += ScaleRounds[round];
+
+    // Wait for the broadcast to reach all subscribers (max 1 minute)
+    int maxWait = 60 * 5;
+    while(scaleRoundsSeen < expectedRounds && maxWait-- > 0)
+    {
+      Sleep(200);
+    }
+    double seconds = (double)(GetTickCount64() - start) / 1000.0;
+    bool result = scaleMessages == expectedMessages && scaleRoundsSeen == expectedRounds;
+
+    // SUMMARY OF THE TEST
+    // --- "---------------------------------------------- - ------
+    _tprintf(_T("SSE broadcast received by %2d subscribers       : %s\n"),ScaleRounds[round],result ? _T("OK") : _T("ERROR"));
+    xprintf(_T("Round of %d subscribers complete in %.1f seconds\n"),ScaleRounds[round],seconds);
+    if(!result)
+    {
+      xerror();
+      ++errors;
+      break;
+    }
+  }
+
+  // Stopping all subscribers
+  for(auto& client : clients)
+  {
+    client->StopClient();
+    delete client;
+  }
+  return errors;
+}
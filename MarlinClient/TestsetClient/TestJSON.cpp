@@ -124,3 +124,52 @@ int TestJsonData(HTTPClient* p_client)
 
   return errors;
 }
+
+// A big array of objects, read on the server side by the JSON reader
+int TestJsonStream(HTTPClient* p_client)
+{
+  int errors = 1;
+  const int count = 100000;
+  XString url;
+  url.Format(_T("http://%s:%d/MarlinTest/JsonStream/"),MARLIN_HOST,TESTING_HTTP_PORT);
+
+  xprintf(_T("TESTING BIG JSON ARRAY TO /MarlinTest/JsonStream/\n"));
+  xprintf(_T("=================================================\n"));
+
+  JSONMessage msg;
+  msg.SetURL(url);
+  JSONvalue& array = msg.GetValue();
+  array.SetDatatype(JsonType::JDT_array);
+  for(int ind = 0;ind < count;++ind)
+  {
+    JSONvalue object(JsonType::JDT_object);
+    JSONpair  id  (_T("id"),ind);
+    JSONpair  name(_T("name"),_T("Some name of an element of a big array"));
+    object.Add(id);
+    object.Add(name);
+    array.Add(object);
+  }
+
+  if(p_client->Send(&msg))
+  {
+    JSONvalue& answer = msg.GetValue();
+    if(answer.GetDataType() == JsonType::JDT_object)
+    {
+      int index = answer.GetObject().FindName(_T("count"));
+      if(index >= 0 && answer.GetObject()[index].m_value.GetNumberInt() == count)
+      {
+        --errors;
+      }
+    }
+  }
+  else
+  {
+    // Raw HTTP error
+    _tprintf(_T("HTTP Client error: %s\n"),p_client->GetStatusText().GetString());
+  }
+
+  // --- "---------------------------------------------- - ------
+  _tprintf(_T("Send: Big JSON array read by the JSON reader   : %s\n"), errors ? _T("ERROR") : _T("OK"));
+
+  return errors;
+}
@@ -31,11 +31,20 @@
 #include <MarlinServer.h>
 #include <HTTPServer.h>
 #include <HTTPSite.h>
+#include <HPFCounter.h>
+#include <ConvertWideString.h>
 
 static int EventTests  = 3;              // OnMessage
 static int totalChecks = EventTests + 3; // OnOther + OnError + OnClose
 
+// Subscriber scaling of the broadcast. Must match the client test set
+static const int ScaleRounds[] = { 1, 8, 64 };   // Subscribers in each round
+static const int ScaleEvents   = 100;            // Broadcast events per round
+static long      scaleStreams  = 0;              // Subscribers seen so far
+static int       scaleChecks   = _countof(ScaleRounds);
+
 void SendSSEMessages(void* p_data);
+void SendScaleMessages(void* p_data);
 
 
 //////////////////////////////////////////////////////////////////////////
@@ -167,6 +176,236 @@ void SendSSEMessages(void* p_data)
   }
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// SUBSCRIBER SCALING OF THE BROADCAST
+// The client opens the subscribers in rounds. As soon as all subscribers
+// of a round are connected, the server broadcasts to all of them and
+// measures the cost of SendEvent for the publisher.
+//
+//////////////////////////////////////////////////////////////////////////
+
+class SiteHandlerScale: public SiteHandler
+{
+public:
+  bool HandleStream(HTTPMessage* p_message,EventStream* p_stream) override;
+};
+
+bool
+SiteHandlerScale::HandleStream(HTTPMessage* p_message,EventStream* p_stream)
+{
+  UNREFERENCED_PARAMETER(p_message);
+
+  long streams = InterlockedIncrement(&scaleStreams);
+  for(int round = 0; round < _countof(ScaleRounds); ++round)
+  {
+    if(streams == ScaleRounds[round])
+    {
+      HTTPServer* server = p_stream->m_site->GetHTTPServer();
+      server->GetThreadPool()->SubmitWork(SendScaleMessages,p_stream->m_site);
+    }
+  }
+  return true;
+}
+
+void SendScaleMessages(void* p_data)
+{
+  HTTPSite*   site   = reinterpret_cast<HTTPSite*>(p_data);
+  HTTPServer* server = site->GetHTTPServer();
+  XString     url(_T("/MarlinTest/EventScale/"));
+  long        subscribers = scaleStreams;
+  bool        result = true;
+
+  // Wait until the last connection is established
+  Sleep(1000);
+
+  HPFCounter counter;
+  for(int x = 1; x <= ScaleEvents; ++x)
+  {
+    ServerEvent* event = alloc_new ServerEvent(_T("message"));
+    event->m_id = x;
+    event->m_data.Format(_T("Broadcast number: %d"),x);
+    result = server->SendEvent(TESTING_HTTP_PORT,url,event) && result;
+  }
+  double seconds = counter.GetCounter();
+
+  // Tell the subscribers that the round is complete
+  ServerEvent* round = alloc_new ServerEvent(_T("round"));
+  round->m_data.Format(_T("%d"),subscribers);
+  result = server->SendEvent(TESTING_HTTP_PORT,url,round) && result;
+
+  // --- "---------------------------------------------- - ------
+  qprintf(_T("SSE broadcast to %2d subscribers: %7.1f us/event : %s\n")
+         ,subscribers
+         ,seconds * 1e6 / ScaleEvents
+         ,result ? _T("OK") : _T("ERROR"));
+  if(result)
+  {
+    --scaleChecks;
+  }
+  else
+  {
+    xerror();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// SSE FRAME ENCODER
+// Checks the single pass encoder against the former Left/Mid splitting
+// of the data lines, and measures both on 1 KB and 1 MB multi-line data.
+//
+//////////////////////////////////////////////////////////////////////////
+
+constexpr auto FRAME_LINE = 100;   // Characters per data line (+ CR/LF)
+
+// The encoder before the single pass version
+static void
+ReferenceEventFrame(ServerEvent* p_event,BYTE** p_buffer,int& p_length)
+{
+  XString stream;
+  if(!p_event->m_event.IsEmpty() && p_event->m_event.CompareNoCase(_T("message")))
+  {
+    stream.AppendFormat(_T("event:%s\n"),p_event->m_event.GetString());
+  }
+  if(!p_event->m_data.IsEmpty())
+  {
+    XString buffer = p_event->m_data;
+    if(buffer.Find('\r') >= 0)
+    {
+      buffer.Replace(_T("\r\n"),_T("\n"));
+      buffer.Replace(_T("\r"),_T("\n"));
+    }
+    while(!buffer.IsEmpty())
+    {
+      int pos = buffer.Find('\n');
+      if(pos < 0)
+      {
+        stream += _T("data:") + buffer + _T("\n");
+        buffer.Empty();
+      }
+      else
+      {
+        ++pos;
+        stream += _T("data:") + buffer.Left(pos);
+        buffer = buffer.Mid(pos);
+      }
+    }
+    if(stream.Right(1) != _T("\n"))
+    {
+      stream += _T("\n");
+    }
+  }
+  stream += _T("\n");
+
+#ifdef _UNICODE
+  TryCreateNarrowString(stream,_T("utf-8"),false,p_buffer,p_length);
+#else
+  XString utf8stream = EncodeStringForTheWire(stream,_T("utf-8"));
+  p_length  = utf8stream.GetLength();
+  *p_buffer = alloc_new BYTE[p_length + 1];
+  memcpy_s(*p_buffer,p_length + 1,utf8stream.GetString(),p_length);
+  (*p_buffer)[p_length] = 0;
+#endif
+}
+
+static bool
+SameEventFrame(HTTPServer* p_server,ServerEvent* p_event)
+{
+  BYTE* reference = nullptr;
+  int   length    = 0;
+  ReferenceEventFrame(p_event,&reference,length);
+
+  EventBuffer* buffer = p_server->EventBodyToBuffer(p_event);
+  bool same = buffer->m_length == length && memcmp(buffer->m_buffer,reference,length) == 0;
+
+  buffer->DropReference();
+  delete [] reference;
+  return same;
+}
+
+// Event with 'p_lines' data lines of FRAME_LINE characters
+static void
+MultiLineEvent(ServerEvent& p_event,int p_lines)
+{
+  XString line;
+  for(int x = 0; x < FRAME_LINE; ++x)
+  {
+    line += (TCHAR)(_T('A') + x % 26);
+  }
+  line += _T("\r\n");
+  for(int x = 0; x < p_lines; ++x)
+  {
+    p_event.m_data += line;
+  }
+}
+
+static void
+BenchEventFrame(HTTPServer* p_server,ServerEvent* p_event,int p_iterations)
+{
+  HPFCounter counter1;
+  for(int x = 0; x < p_iterations; ++x)
+  {
+    BYTE* buffer = nullptr;
+    int   length = 0;
+    ReferenceEventFrame(p_event,&buffer,length);
+    delete [] buffer;
+  }
+  double referenceTime = counter1.GetCounter();
+
+  HPFCounter counter2;
+  for(int x = 0; x < p_iterations; ++x)
+  {
+    p_server->EventBodyToBuffer(p_event)->DropReference();
+  }
+  double encoderTime = counter2.GetCounter();
+
+  int bytes = p_event->m_data.GetLength();
+  xprintf(_T("Event data %8d bytes, former encoder : %10.1f us/event\n"),bytes,referenceTime * 1e6 / p_iterations);
+  xprintf(_T("Event data %8d bytes, single pass    : %10.1f us/event\n"),bytes,encoderTime   * 1e6 / p_iterations);
+}
+
+int
+TestMarlinServer::TestEventFrame()
+{
+  int errors = 0;
+
+  xprintf(_T("TESTING THE SSE FRAME ENCODER\n"));
+  xprintf(_T("=============================\n"));
+
+  // Line breaks of every kind
+  ServerEvent simple(_T("message"));
+  simple.m_data = _T("Just one line");
+  ServerEvent other(_T("other"));
+  other.m_data = _T("one\r\ntwo\rthree\nfour\n\nsix\r");
+  ServerEvent empty(_T("error"));
+
+  // 1 KB and 1 MB of multi-line data
+  ServerEvent kilobyte(_T("message"));
+  ServerEvent megabyte(_T("message"));
+  MultiLineEvent(kilobyte,(1024)        / (FRAME_LINE + 2));
+  MultiLineEvent(megabyte,(1024 * 1024) / (FRAME_LINE + 2));
+
+  bool same = SameEventFrame(m_httpServer,&simple)   &&
+              SameEventFrame(m_httpServer,&other)    &&
+              SameEventFrame(m_httpServer,&empty)    &&
+              SameEventFrame(m_httpServer,&kilobyte) &&
+              SameEventFrame(m_httpServer,&megabyte);
+  if(!same)
+  {
+    ++errors;
+    xerror();
+  }
+  // --- "---------------------------------------------- - ------
+  qprintf(_T("SSE frame encoder equal to the former encoder  : %s\n"),same ? _T("OK") : _T("ERROR"));
+
+  // BENCHMARK: both encoders. The former one is quadratic on the 1 MB event
+  BenchEventFrame(m_httpServer,&kilobyte,10000);
+  BenchEventFrame(m_httpServer,&megabyte,5);
+
+  return errors;
+}
+
 int
 TestMarlinServer::TestPushEvents()
 {
@@ -209,6 +448,26 @@ TestMarlinServer::TestPushEvents()
     xerror();
     qprintf(_T("ERROR STARTING SITE: %s\n"),url.GetString());
   }
+
+  // Site for the subscriber scaling: "http://+:port/MarlinTest/EventScale/"
+  XString scaleURL(_T("/MarlinTest/EventScale/"));
+  HTTPSite* scale = m_httpServer->CreateSite(PrefixType::URLPRE_Strong,false,TESTING_HTTP_PORT,scaleURL,true);
+  if(scale)
+  {
+    scale->SetHandler(HTTPCommand::http_get,alloc_new SiteHandlerScale());
+    scale->AddContentType(true,_T("txt"),_T("text/event-stream"));
+    scale->SetIsEventStream(true);
+  }
+  if(scale && scale->StartSite())
+  {
+    xprintf(_T("Scaling site started correctly\n"));
+  }
+  else
+  {
+    ++error;
+    xerror();
+    qprintf(_T("ERROR STARTING SITE: %s\n"),scaleURL.GetString());
+  }
   return error;
 }
 
@@ -219,5 +478,6 @@ TestMarlinServer::AfterTestEvents()
   // SUMMARY OF THE TEST
   // ---- "---------------------------------------------- - ------
   qprintf(_T("Event streams On-Message/Error/Other/Close     : %s\n"),totalChecks > 0 ? _T("ERROR") : _T("OK"));
-  return totalChecks > 0;
+  qprintf(_T("Event streams broadcast subscriber scaling     : %s\n"),scaleChecks > 0 ? _T("ERROR") : _T("OK"));
+  return (totalChecks > 0) + (scaleChecks > 0);
 }
@@ -30,8 +30,14 @@
 #include "TestPorts.h"
 #include <HTTPSite.h>
 #include <SiteHandlerJson.h>
+#include <SiteHandlerJsonReader.h>
+#include <XMLParser.h>
+#include <HPFCounter.h>
+#include <random>
+#include <thread>
+#include <atomic>
 
-static int totalChecks = 12;
+static int totalChecks = 13;
 
 class SiteHandlerJsonData: public SiteHandlerJson
 {
@@ -105,6 +111,59 @@ SiteHandlerJsonData::Handle(JSONMessage* p_message)
   return true;
 }
 
+// Reading a big array of objects with the JSON reader: one object at a time
+// Answers with the number of objects, if all 'id' numbers were in order
+class SiteHandlerJsonStream: public SiteHandlerJsonReader
+{
+protected:
+  int HandleReader(HTTPMessage* p_message,JSONReader& p_reader) override;
+};
+
+int
+SiteHandlerJsonStream::HandleReader(HTTPMessage* p_message,JSONReader& p_reader)
+{
+  int count = 0;
+  JsonEvent event = p_reader.Next();
+  if(event == JsonEvent::JR_StartArray)
+  {
+    while((event = p_reader.Next()) == JsonEvent::JR_StartObject)
+    {
+      p_reader.Collect();
+      if(p_reader.Next() != JsonEvent::JR_Value)
+      {
+        break;
+      }
+      const JSONobject& object = p_reader.GetValue().GetObject();
+      int index = object.FindName(_T("id"));
+      if(index < 0 || object[index].m_value.GetNumberInt() != count)
+      {
+        break;
+      }
+      ++count;
+    }
+  }
+  bool result = (event == JsonEvent::JR_EndArray) && (p_reader.Next() == JsonEvent::JR_End);
+
+  // SUMMARY OF THE TEST
+  // --- "---------------------------------------------- - ------
+  qprintf(_T("JSON array read by the JSON reader             : %s\n"),result ? _T("OK") : _T("ERROR"));
+  if(!result)
+  {
+    xerror();
+    return 1;
+  }
+  --totalChecks;
+
+  // Now the body has been read, the message can become the answer
+  XString answer;
+  answer.Format(_T("{\"count\":%d}"),count);
+  p_message->Reset();
+  p_message->SetStatus(HTTP_STATUS_OK);
+  p_message->SetContentType(_T("application/json"));
+  p_message->SetBody(answer);
+  return 0;
+}
+
 int
 TestMarlinServer::TestJsonData()
 {
@@ -152,6 +211,36 @@ TestMarlinServer::TestJsonData()
     xerror();
     qprintf(_T("ERROR STARTING SITE: %s\n"),url.GetString());
   }
+
+  // Site for big JSON bodies, read by the JSON reader
+  XString stream(_T("/MarlinTest/JsonStream/"));
+  site = m_httpServer->CreateSite(PrefixType::URLPRE_Strong,false,TESTING_HTTP_PORT,stream,true);
+  if(site)
+  {
+    // SUMMARY OF THE TEST
+    // --- "--------------------------- - ------\n"
+    qprintf(_T("HTTPSite for JSON reader    : OK : %s\n"),site->GetPrefixURL().GetString());
+  }
+  else
+  {
+    ++error;
+    xerror();
+    qprintf(_T("ERROR: Cannot make a HTTP site for: %s\n"),stream.GetString());
+    return error;
+  }
+  site->SetHandler(HTTPCommand::http_post,alloc_new SiteHandlerJsonStream());
+  site->AddContentType(true,_T("json"),_T("application/json"));
+
+  if(site->StartSite())
+  {
+    xprintf(_T("Site started correctly: %s\n"),stream.GetString());
+  }
+  else
+  {
+    ++error;
+    xerror();
+    qprintf(_T("ERROR STARTING SITE: %s\n"),stream.GetString());
+  }
   return error;
 }
 
@@ -167,3 +256,515 @@ TestMarlinServer::AfterTestJsonData()
   }
   return totalChecks > 0;
 }
+
+//////////////////////////////////////////////////////////////////////////
+//
+// The JSON writer against the former recursive serializer
+//
+//////////////////////////////////////////////////////////////////////////
+
+// The former serializer: one string per value, subtrees copied into their parents
+static XString
+ReferenceJson(JSONvalue& p_value,bool p_white,unsigned p_level = 0)
+{
+  XString result;
+  XString separ,less;
+  XString newln = p_white ? _T("\n") : _T("");
+
+  if(p_white)
+  {
+    for(unsigned ind = 0;ind < p_level; ++ind)
+    {
+      less   = separ;
+      separ += _T("\t");
+    }
+  }
+
+  switch(p_value.GetDataType())
+  {
+    case JsonType::JDT_const:       switch(p_value.GetConstant())
+                                    {
+                                      case JsonConst::JSON_NONE:  return _T("");
+                                      case JsonConst::JSON_NULL:  return _T("null");
+                                      case JsonConst::JSON_FALSE: return _T("false");
+                                      case JsonConst::JSON_TRUE:  return _T("true");
+                                    }
+                                    break;
+    case JsonType::JDT_string:      return XMLParser::PrintJsonString(p_value.GetString());
+    case JsonType::JDT_number_int:  result.Format(_T("%d"),p_value.GetNumberInt());
+                                    break;
+    case JsonType::JDT_number_bcd:  result = p_value.GetNumberBcd().AsString(bcd::Format::Bookkeeping,false,0);
+                                    break;
+    case JsonType::JDT_array:       {
+                                      JSONarray& array = p_value.GetArray();
+                                      result = XString(_T("[")) + newln;
+                                      for(unsigned ind = 0;ind < array.size();++ind)
+                                      {
+                                        result += separ;
+                                        result += ReferenceJson(array[ind],p_white,p_level + 1);
+                                        if(ind < array.size() - 1)
+                                        {
+                                          result += _T(",");
+                                        }
+                                        result += newln;
+                                      }
+                                      result += separ;
+                                      result += _T("]");
+                                    }
+                                    break;
+    case JsonType::JDT_object:      {
+                                      const JSONobject& object = p_value.GetObject();
+                                      result = less + _T("{") + newln;
+                                      for(unsigned ind = 0;ind < object.size();++ind)
+                                      {
+                                        // Check for empty object
+                                        if(object.size() == 1 && object[0].m_name.IsEmpty() &&
+                                           object[0].m_value.GetDataType() == JsonType::JDT_const &&
+                                           object[0].m_value.GetConstant() == JsonConst::JSON_NONE)
+                                        {
+                                          break;
+                                        }
+                                        result += separ;
+                                        result += p_white ? _T("\t") : _T("");
+                                        result += XMLParser::PrintJsonString(object[ind].m_name);
+                                        result += _T(":");
+                                        result += ReferenceJson(const_cast<JSONvalue&>(object[ind].m_value),p_white,p_level + 1).TrimLeft('\t');
+                                        if(ind < object.size() - 1)
+                                        {
+                                          result += _T(",");
+                                        }
+                                        result += newln;
+                                      }
+                                      result += separ;
+                                      result += _T("}");
+                                    }
+                                    break;
+  }
+  return result;
+}
+
+// An array of 'p_count' small objects of every data type
+static void
+JsonTestArray(JSONvalue& p_array,int p_count)
+{
+  p_array.SetDatatype(JsonType::JDT_array);
+  for(int ind = 0;ind < p_count;++ind)
+  {
+    XString name;
+    name.Format(_T("Item number %d with \"quotes\", a tab\tand a \\ backslash"),ind);
+
+    JSONvalue object(JsonType::JDT_object);
+    JSONpair  id   (_T("id"),    ind);
+    JSONpair  text (_T("name"),  name);
+    JSONpair  price(_T("price"), bcd(ind) / bcd(7));
+    JSONpair  valid(_T("valid"), (ind % 2) == 0);
+    JSONpair  none (_T("none"),  JsonConst::JSON_NULL);
+    object.Add(id);
+    object.Add(text);
+    object.Add(price);
+    object.Add(valid);
+    object.Add(none);
+    p_array.Add(object);
+  }
+}
+
+int
+TestMarlinServer::TestJsonWriter()
+{
+  int errors = 0;
+
+  xprintf(_T("TESTING THE JSON WRITER\n"));
+  xprintf(_T("=======================\n"));
+
+  // Same text as the former serializer, with and without whitespace
+  JSONvalue array;
+  JsonTestArray(array,100);
+  bool same = array.GetAsJsonString(false) == ReferenceJson(array,false) &&
+              array.GetAsJsonString(true)  == ReferenceJson(array,true);
+  if(!same)
+  {
+    ++errors;
+    xerror();
+  }
+  // --- "---------------------------------------------- - ------
+  qprintf(_T("JSON writer equal to the former serializer     : %s\n"),same ? _T("OK") : _T("ERROR"));
+
+  // BENCHMARK: 10 MB array, to text and to a compressed HTTP body
+  JSONMessage json;
+  JsonTestArray(json.GetValue(),100000);
+
+  HPFCounter counter1;
+  XString reference = ReferenceJson(json.GetValue(),false);
+  double referenceTime = counter1.GetCounter();
+
+  HPFCounter counter2;
+  XString text = json.GetJsonMessage();
+  double writerTime = counter2.GetCounter();
+
+  if(text != reference)
+  {
+    ++errors;
+    xerror();
+  }
+
+  HPFCounter counter3;
+  HTTPMessage http(HTTPCommand::http_response,&json);
+  double bodyTime = counter3.GetCounter();
+  size_t length = http.GetFileBuffer()->GetLength();
+  int    parts  = http.GetFileBuffer()->GetNumberOfParts();
+
+  HPFCounter counter4;
+  bool zipped = http.GetFileBuffer()->ZipBuffer();
+  double zipTime = counter4.GetCounter();
+  if(!zipped)
+  {
+    ++errors;
+    xerror();
+  }
+
+  xprintf(_T("JSON text %8d chars, former serializer : %10.1f ms\n"),reference.GetLength(),referenceTime * 1000.0);
+  xprintf(_T("JSON text %8d chars, JSON writer       : %10.1f ms\n"),text.GetLength(),     writerTime    * 1000.0);
+  xprintf(_T("HTTP body %8zu bytes, %d parts          : %10.1f ms\n"),length,parts,            bodyTime      * 1000.0);
+  xprintf(_T("HTTP body %8zu bytes, gzip of the parts : %10.1f ms\n"),http.GetFileBuffer()->GetLength(),zipTime * 1000.0);
+
+  return errors;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// The JSON reader: the same values as written, fed in parts of any size
+//
+//////////////////////////////////////////////////////////////////////////
+
+static std::mt19937 jsonRandom(11);
+
+static XString
+JsonRandomString()
+{
+  LPCTSTR pool[] = { _T("a"),_T("bc"),_T("\""),_T("\\"),_T("\n"),_T("\t"),_T("\r"),_T("\b"),_T("\f"),_T("/"),_T("x y") };
+  XString string;
+  int count = jsonRandom() % 6;
+  for(int ind = 0;ind < count;++ind)
+  {
+    string += pool[jsonRandom() % 11];
+  }
+  return string;
+}
+
+// A random tree of values, at most 5 levels deep
+static JSONvalue
+JsonRandomValue(int p_depth)
+{
+  switch(jsonRandom() % (p_depth > 3 ? 5 : 7))
+  {
+    case 0:  return JSONvalue(JsonRandomString());
+    case 1:  return JSONvalue((int)(jsonRandom() % 200000) - 100000);
+    case 2:  return JSONvalue(bcd((int)(jsonRandom() % 100000)) / bcd(8));
+    case 3:  return JSONvalue((jsonRandom() % 2) == 0);
+    case 4:  return JSONvalue(JsonConst::JSON_NULL);
+    case 5:  {
+               JSONvalue array(JsonType::JDT_array);
+               int count = jsonRandom() % 4;
+               for(int ind = 0;ind < count;++ind)
+               {
+                 JSONvalue element = JsonRandomValue(p_depth + 1);
+                 array.Add(element);
+               }
+               return array;
+             }
+    default: {
+               JSONvalue object(JsonType::JDT_object);
+               int count = jsonRandom() % 4;
+               for(int ind = 0;ind < count;++ind)
+               {
+                 JSONpair pair(JsonRandomString(),JsonRandomValue(p_depth + 1));
+                 object.Add(pair);
+               }
+               return object;
+             }
+  }
+}
+
+// Read the text as one collected value. Either from the buffer in one go,
+// or fed byte-wise in random slices of 1 to 7 bytes
+static bool
+JsonReadAll(FileBuffer& p_buffer,bool p_sliced,JSONvalue& p_value)
+{
+  uchar* text   = nullptr;
+  size_t length = 0;
+  size_t pos    = 0;
+  p_buffer.GetBuffer(text,length);
+
+  JSONReader reader;
+  if(!p_sliced)
+  {
+    reader.Feed(p_buffer);
+    reader.Finish();
+  }
+  while(true)
+  {
+    switch(reader.Next())
+    {
+      case JsonEvent::JR_NeedMore:    if(pos >= length)
+                                      {
+                                        reader.Finish();
+                                      }
+                                      else
+                                      {
+                                        size_t slice = min((size_t)(1 + jsonRandom() % 7),length - pos);
+                                        reader.Feed(text + pos,slice);
+                                        pos += slice;
+                                      }
+                                      break;
+      case JsonEvent::JR_StartObject: [[fallthrough]];
+      case JsonEvent::JR_StartArray:  reader.Collect();
+                                      break;
+      case JsonEvent::JR_Value:       p_value = std::move(reader.GetValue());
+                                      break;
+      case JsonEvent::JR_End:         return true;
+      default:                        return false;
+    }
+  }
+}
+
+// Read all events of a text, up to the end or an error
+static JsonEvent
+JsonReadEvents(const char* p_text,size_t p_maximum = 0)
+{
+  JSONReader reader;
+  if(p_maximum)
+  {
+    reader.SetMaximumToken(p_maximum);
+  }
+  reader.Feed(reinterpret_cast<const uchar*>(p_text),strlen(p_text));
+  reader.Finish();
+
+  JsonEvent event;
+  while((event = reader.Next()) != JsonEvent::JR_End && event != JsonEvent::JR_Error)
+  {
+    if(event == JsonEvent::JR_Key && reader.GetKey() == _T("skipped"))
+    {
+      reader.Next();
+      reader.Skip();
+    }
+  }
+  return event;
+}
+
+int
+TestMarlinServer::TestJsonReader()
+{
+  int errors = 0;
+
+  xprintf(_T("TESTING THE JSON READER\n"));
+  xprintf(_T("=======================\n"));
+
+  // Random trees: written as a HTTP body, and read back the same
+  int wrong = 0;
+  for(int test = 0;test < 1000;++test)
+  {
+    JSONMessage json;
+    json.GetValue() = JsonRandomValue(0);
+    json.SetWhitespace((jsonRandom() % 2) == 0);
+    json.SetSendBOM((jsonRandom() % 2) == 0);
+    // Small trees: the body is always one buffer, never in parts
+    HTTPMessage http(HTTPCommand::http_response,&json);
+
+    XString expected = json.GetValue().GetAsJsonString(false);
+    for(int sliced = 0;sliced < 2;++sliced)
+    {
+      JSONvalue value;
+      if(!JsonReadAll(*http.GetFileBuffer(),sliced == 1,value) ||
+         value.GetAsJsonString(false) != expected)
+      {
+        ++wrong;
+      }
+    }
+  }
+  // --- "---------------------------------------------- - ------
+  qprintf(_T("JSON reader reads 1000 random trees            : %s\n"),wrong ? _T("ERROR") : _T("OK"));
+  if(wrong)
+  {
+    ++errors;
+    xerror();
+  }
+
+  // Events, skipping a whole array, and a text that is not JSON
+  bool skipped = JsonReadEvents("{\"skipped\":[1,2,{\"x\":3}],\"b\":{\"c\":[true,false,null]},\"d\":-12.5e1}") == JsonEvent::JR_End;
+  const char* illegal[] = { "[1,2","{\"a\" 1}","[1 2]","\"abc","tru","[1]x","{\"a\":\"\\q\"}","[\"\\u12\"]","","  ","-","{,}" };
+  bool errorsFound = true;
+  for(auto text : illegal)
+  {
+    if(JsonReadEvents(text) != JsonEvent::JR_Error)
+    {
+      errorsFound = false;
+    }
+  }
+  // A string longer than the maximum token
+  std::string longString = "[\"" + std::string(5000,'x') + "\"]";
+  bool limited = JsonReadEvents(longString.c_str(),1000) == JsonEvent::JR_Error;
+
+  // --- "---------------------------------------------- - ------
+  qprintf(_T("JSON reader skips an array                     : %s\n"),skipped     ? _T("OK") : _T("ERROR"));
+  qprintf(_T("JSON reader finds all errors                   : %s\n"),errorsFound ? _T("OK") : _T("ERROR"));
+  qprintf(_T("JSON reader stops on the token limit           : %s\n"),limited     ? _T("OK") : _T("ERROR"));
+  if(!skipped || !errorsFound || !limited)
+  {
+    ++errors;
+    xerror();
+  }
+  return errors;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// The name index of big JSON objects
+//
+//////////////////////////////////////////////////////////////////////////
+
+static XString
+JsonIndexName(int p_number)
+{
+  XString name;
+  name.Format(_T("name%d"),p_number);
+  return name;
+}
+
+int
+TestMarlinServer::TestJsonIndex()
+{
+  int errors = 0;
+  const int pairs = 1000;
+
+  xprintf(_T("TESTING THE NAME INDEX OF JSON OBJECTS\n"));
+  xprintf(_T("======================================\n"));
+
+  JSONMessage json;
+  JSONvalue& value = json.GetValue();
+  value.SetDatatype(JsonType::JDT_object);
+  for(int ind = 0;ind < pairs;++ind)
+  {
+    JSONpair pair(JsonIndexName(ind),ind);
+    value.Add(pair);
+  }
+  JSONobject&       object  = value.GetObject();
+  const JSONobject& reading = object;
+
+  // All names found at their position
+  bool found = true;
+  for(int ind = 0;ind < pairs;++ind)
+  {
+    if(reading.FindName(JsonIndexName(ind)) != ind)
+    {
+      found = false;
+    }
+  }
+
+  // Names changed through a pair: the old name is gone, the new one is found
+  object[500].m_name = _T("renamed");
+  JSONpair* pair = json.FindPair(JsonIndexName(10),false);
+  if(pair)
+  {
+    pair->m_name = _T("other");
+  }
+  bool renamed = pair != nullptr &&
+                 reading.FindName(_T("renamed")) == 500 && reading.FindName(JsonIndexName(500)) < 0 &&
+                 reading.FindName(_T("other"))   == 10  && reading.FindName(JsonIndexName(10))  < 0;
+
+  // Renamed to a name that is already there: always the first one is found
+  object[900].m_name = JsonIndexName(30);
+  object[30].m_name  = _T("gone");
+  renamed = renamed && reading.FindName(JsonIndexName(30)) == 900;
+  object[30].m_name  = JsonIndexName(30);
+  renamed = renamed && reading.FindName(JsonIndexName(30)) == 30 && reading.FindName(JsonIndexName(900)) < 0;
+
+  // Readers of the index, while another thread uses the non-const access to the pairs
+  std::atomic<bool> stop  { false };
+  std::atomic<long> wrong { 0 };
+  std::vector<std::thread> threads;
+  for(int reader = 0;reader < 4;++reader)
+  {
+    threads.emplace_back([&]
+    {
+      while(!stop)
+      {
+        for(int ind = 20;ind < pairs;ind += 7)
+        {
+          if(ind != 500 && reading.FindName(JsonIndexName(ind)) != ind)
+          {
+            ++wrong;
+          }
+        }
+      }
+    });
+  }
+  threads.emplace_back([&]
+  {
+    long total = 0;
+    while(!stop)
+    {
+      for(auto& element : object)
+      {
+        total += element.m_value.GetNumberInt();
+      }
+      total += object[3].m_value.GetNumberInt();
+    }
+  });
+  Sleep(1000);
+  stop = true;
+  for(auto& thread : threads)
+  {
+    thread.join();
+  }
+  bool together = wrong == 0;
+
+  // --- "---------------------------------------------- - ------
+  qprintf(_T("JSON index finds all names                     : %s\n"),found    ? _T("OK") : _T("ERROR"));
+  qprintf(_T("JSON index finds names changed through a pair  : %s\n"),renamed  ? _T("OK") : _T("ERROR"));
+  qprintf(_T("JSON index used while the pairs are accessed   : %s\n"),together ? _T("OK") : _T("ERROR"));
+  if(!found || !renamed || !together)
+  {
+    ++errors;
+    xerror();
+  }
+
+  // BENCHMARK: a hit and a miss through the index, against scanning the pairs
+  const int lookups = 100000;
+  XString hit(JsonIndexName(pairs - 1));
+  XString miss(_T("absent"));
+  int positions = 0;
+
+  HPFCounter counter1;
+  for(int ind = 0;ind < lookups;++ind)
+  {
+    positions += reading.FindName(hit);
+  }
+  double hitTime = counter1.GetCounter();
+
+  HPFCounter counter2;
+  for(int ind = 0;ind < lookups;++ind)
+  {
+    positions += reading.FindName(miss);
+  }
+  double missTime = counter2.GetCounter();
+
+  HPFCounter counter3;
+  for(int ind = 0;ind < lookups;++ind)
+  {
+    for(size_t position = 0;position < reading.size();++position)
+    {
+      if(reading[position].m_name.Compare(hit) == 0)
+      {
+        positions += (int)position;
+        break;
+      }
+    }
+  }
+  double scanTime = counter3.GetCounter();
+
+  xprintf(_T("Object of %d pairs, index hit   : %10.3f us/lookup\n"),pairs,hitTime  * 1e6 / lookups);
+  xprintf(_T("Object of %d pairs, index miss  : %10.3f us/lookup\n"),pairs,missTime * 1e6 / lookups);
+  xprintf(_T("Object of %d pairs, scanning    : %10.3f us/lookup (%d)\n"),pairs,scanTime * 1e6 / lookups,positions);
+
+  return errors;
+}
@@ -0,0 +1,275 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: TestRequestHeaders.cpp
+//
+// Marlin Server: Internet server/client
+// 
+// Copyright (c) 2014-2025 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "TestMarlinServer.h"
+#include "..\..\HTTPSYS\HeaderParser.h"
+#include "..\..\HTTPSYS\RequestArena.h"
+#include <HPFCounter.h>
+#include <string>
+#include <vector>
+
+static int totalChecks = 3;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// The header line parser of HTTPSYS on its own
+//
+//////////////////////////////////////////////////////////////////////////
+
+const USHORT   RH_INLINE = 32;        // As REQUEST_UNKNOWN_HEADERS of the request object
+const unsigned RH_ROUNDS = 100000;    // Header blocks for the benchmark
+
+// Header block of an everyday browser request, with three unknown headers
+static const char rh_block[] =
+  "Host: localhost:1200\r\n"
+  "Connection: keep-alive\r\n"
+  "Cache-Control: max-age=0\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Accept-Language: nl-NL,nl;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+  "Cookie: session=8d6e4a1f0b2c; theme=dark\r\n"
+  "If-None-Match: \"5f3c-1a2b\"\r\n"
+  "Referer: http://localhost:1200/MarlinTest/\r\n"
+  "Sec-Fetch-Mode: navigate\r\n"
+  "Sec-Fetch-Site: same-origin\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "\r\n";
+
+// Everything a request does with its header lines, up to the empty line.
+// Returns the number of headers, or -1 if the block is refused.
+static int ParseBlock(std::string&         p_block
+                     ,HTTP_REQUEST_HEADERS& p_headers
+                     ,HTTP_UNKNOWN_HEADER*  p_inline
+                     ,RequestArena&         p_arena)
+{
+  USHORT capacity = RH_INLINE;
+  ZeroMemory(&p_headers,sizeof(HTTP_REQUEST_HEADERS));
+  LPSTR buffer = (LPSTR)p_block.data();
+  ULONG left   = (ULONG)p_block.size();
+  int   count  = 0;
+  try
+  {
+    while(true)
+    {
+      ULONG length = 0;
+      LPSTR line = HeaderParser::ReadLine(buffer,left,length);
+      buffer += length + 2;
+      left   -= length + 2;
+      if(length == 0)
+      {
+        return count;
+      }
+      HeaderLine header;
+      HeaderParser::SplitLine(line,length,header);
+      if(header.h_known >= 0)
+      {
+        p_headers.KnownHeaders[header.h_known].pRawValue      = header.h_value;
+        p_headers.KnownHeaders[header.h_known].RawValueLength = header.h_valueLength;
+      }
+      else
+      {
+        HeaderParser::AddUnknownHeader(p_headers,p_inline,capacity,p_arena,header);
+      }
+      ++count;
+    }
+  }
+  catch(int)
+  {
+    return -1;
+  }
+}
+
+// A single line in a block of its own, as the request parses it
+static bool LineRefused(std::string p_line)
+{
+  HTTP_REQUEST_HEADERS headers;
+  HTTP_UNKNOWN_HEADER  table[RH_INLINE];
+  RequestArena* arena = alloc_new RequestArena();
+  std::string block = p_line + "\r\n\r\n";
+  bool refused = ParseBlock(block,headers,table,*arena) < 0;
+  delete arena;
+  return refused;
+}
+
+// Known headers in their slot, unknown ones in order, values trimmed
+static bool HeadersCorrect()
+{
+  HTTP_REQUEST_HEADERS headers;
+  HTTP_UNKNOWN_HEADER  table[RH_INLINE];
+  RequestArena* arena = alloc_new RequestArena();
+  std::string block(rh_block);
+
+  bool result = ParseBlock(block,headers,table,*arena) == 12                                   &&
+                strcmp(headers.KnownHeaders[HttpHeaderHost].pRawValue,"localhost:1200") == 0   &&
+                headers.KnownHeaders[HttpHeaderHost].RawValueLength == 14                       &&
+                strcmp(headers.KnownHeaders[HttpHeaderConnection].pRawValue,"keep-alive") == 0  &&
+                headers.UnknownHeaderCount == 3                                                 &&
+                strcmp(headers.pUnknownHeaders[0].pName,"Sec-Fetch-Mode") == 0                  &&
+                strcmp(headers.pUnknownHeaders[2].pRawValue,"1") == 0                           &&
+                headers.pUnknownHeaders == table;
+
+  // Surrounding whitespace of a value is not part of it
+  std::string spaces("X-Spaces:   \t value \t \r\n\r\n");
+  result = result && ParseBlock(spaces,headers,table,*arena) == 1 &&
+                     strcmp(headers.pUnknownHeaders[0].pRawValue,"value") == 0;
+  delete arena;
+  return result;
+}
+
+// Lines that must be refused with a 400, and lines at the edge that must not
+static bool HeadersMalformed()
+{
+  std::string longest(HEADER_MAXIMUM_LENGTH,'v');
+  std::string toolong(HEADER_MAXIMUM_LENGTH + 1,'v');
+
+  return LineRefused("X-Name" + toolong.substr(6) + ": value")       &&  // Name over USHORT
+        !LineRefused("X-Value: " + longest)                          &&  // Value just fits
+         LineRefused("X-Value: " + toolong)                          &&  // Value over USHORT
+         LineRefused("Host: localhost\nX-Smuggled: yes")             &&  // Bare LF in a line
+         LineRefused("Host: localhost\rX-Smuggled: yes")             &&  // Bare CR in a line
+         LineRefused("X-Folded: one\r\n two")                        &&  // Obsolete line folding
+         LineRefused("X-Folded: one\r\n\ttwo")                       &&
+         LineRefused("Host : localhost")                             &&  // Whitespace before colon
+         LineRefused(": no name")                                    &&
+         LineRefused("No colon at all");
+}
+
+// More unknown headers than the request object holds grow into the arena.
+// The USHORT count of headers may never wrap around.
+static bool HeadersUnknownMany()
+{
+  HTTP_REQUEST_HEADERS headers;
+  HTTP_UNKNOWN_HEADER  table[RH_INLINE];
+  RequestArena* arena = alloc_new RequestArena();
+  ZeroMemory(&headers,sizeof(HTTP_REQUEST_HEADERS));
+
+  char name[] = "X-Unknown";
+  char value[] = "value";
+  HeaderLine header { name,(USHORT)strlen(name),value,(USHORT)strlen(value),-1 };
+  USHORT capacity = RH_INLINE;
+  bool   result   = true;
+  try
+  {
+    for(ULONG index = 0;index < HEADER_MAXIMUM_LENGTH;++index)
+    {
+      HeaderParser::AddUnknownHeader(headers,table,capacity,*arena,header);
+      if(index == RH_INLINE)
+      {
+        // First one past the table of the request object
+        result = result && headers.pUnknownHeaders != table && capacity == 2 * RH_INLINE;
+      }
+    }
+  }
+  catch(int)
+  {
+    result = false;
+  }
+  result = result && headers.UnknownHeaderCount == HEADER_MAXIMUM_LENGTH &&
+                     strcmp(headers.pUnknownHeaders[HEADER_MAXIMUM_LENGTH - 1].pName,name) == 0;
+  try
+  {
+    HeaderParser::AddUnknownHeader(headers,table,capacity,*arena,header);
+    result = false;
+  }
+  catch(int)
+  {
+    // Count would wrap around: refused
+  }
+  delete arena;
+  return result;
+}
+
+// Test the header line parser of HTTPSYS on correct, malformed and
+// very many headers. Prints the time to parse an everyday header block.
+int
+TestMarlinServer::TestRequestHeaders()
+{
+  int errors = 0;
+
+  xprintf(_T("TESTING THE HEADER LINE PARSER OF HTTPSYS\n"));
+  xprintf(_T("=========================================\n"));
+
+  bool correct = HeadersCorrect();
+  if(!correct)
+  {
+    ++errors;
+  }
+  // SUMMARY OF THE TEST
+  // --- "--------------------------- - ------\n"
+  qprintf(_T("Header lines split in place : %s\n"),correct ? _T("OK") : _T("ERROR"));
+
+  bool malformed = HeadersMalformed();
+  if(!malformed)
+  {
+    ++errors;
+  }
+  qprintf(_T("Header lines malformed/limit: %s\n"),malformed ? _T("OK") : _T("ERROR"));
+
+  bool many = HeadersUnknownMany();
+  if(!many)
+  {
+    ++errors;
+  }
+  qprintf(_T("Header lines unknown to max : %s\n"),many ? _T("OK") : _T("ERROR"));
+
+  // BENCHMARK: every round copies the block, as it is parsed in place
+  HTTP_REQUEST_HEADERS headers;
+  HTTP_UNKNOWN_HEADER  table[RH_INLINE];
+  RequestArena* arena = alloc_new RequestArena();
+  std::string block;
+  block.reserve(sizeof(rh_block));
+  HPFCounter counter;
+  for(unsigned round = 0;round < RH_ROUNDS;++round)
+  {
+    block.assign(rh_block,sizeof(rh_block) - 1);
+    ParseBlock(block,headers,table,*arena);
+    arena->Reset();
+  }
+  double seconds = counter.GetCounter();
+  delete arena;
+  xprintf(_T("Header block of 12 lines    : %.1f ns/block\n"),seconds * 1e9 / RH_ROUNDS);
+
+  if(errors)
+  {
+    xerror();
+  }
+  else
+  {
+    totalChecks -= 3;
+  }
+  return errors;
+}
+
+int
+TestMarlinServer::AfterTestRequestHeaders()
+{
+  // SUMMARY OF THE TEST
+  // ---- "---------------------------------------------- - ------
+  qprintf(_T("HTTPSYS header lines malformed and limits      : %s\n"),totalChecks > 0 ? _T("ERROR") : _T("OK"));
+  return totalChecks > 0;
+}
@@ -0,0 +1,416 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: TestRequestQueue.cpp
+//
+// Marlin Server: Internet server/client
+// 
+// Copyright (c) 2014-2025 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "TestMarlinServer.h"
+#include "..\..\HTTPSYS\RequestShard.h"
+#include "..\..\HTTPSYS\RequestArena.h"
+#include <HPFCounter.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+static int totalChecks = 4;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// A shard of the HTTPSYS request queue on its own.
+// The requests are stand-ins: the shard never looks inside a request.
+//
+//////////////////////////////////////////////////////////////////////////
+
+const unsigned RQ_PRODUCERS =      4;   // Threads adding and cancelling requests
+const unsigned RQ_CONSUMERS =      4;   // Threads popping requests, as GetNextRequest does
+const unsigned RQ_REQUESTS  = 200000;   // Requests queued per producer
+const unsigned RQ_POOLSIZE  =      8;   // Request objects per producer, reused lowest first
+
+// Stand-in for a pooled request object
+typedef struct _test_request
+{
+  std::atomic<LONG64> t_ticket { 0 };   // Ticket of the last queueing
+  std::atomic<int>    t_state  { 0 };   // 0 = free, 1 = queued, 2 = being serviced
+}
+TestRequest;
+
+static Request* AsRequest(TestRequest* p_request)
+{
+  return reinterpret_cast<Request*>(p_request);
+}
+
+// Queue one request, remove it again, and queue the same object again.
+// The first cell on the ring belongs to the removed queueing and may not
+// be handed out: only the second one can be claimed.
+static bool ShardReusedAddress()
+{
+  RequestShard shard(QUEUE_MIN_RING_SIZE);
+  TestRequest  request;
+  LONG64 ticket   = 0;
+  bool   incoming = false;
+
+  LONG64 first = shard.IndexIncoming(AsRequest(&request));
+  shard.m_incoming.Push(AsRequest(&request),first);
+  shard.RemoveIndex(AsRequest(&request),incoming);
+  if(!incoming)
+  {
+    return false;
+  }
+  LONG64 second = shard.IndexIncoming(AsRequest(&request));
+  shard.m_incoming.Push(AsRequest(&request),second);
+
+  bool result = shard.m_incoming.Pop(ticket) == AsRequest(&request) && ticket == first  &&
+               !shard.ClaimIncoming(AsRequest(&request),ticket)                         &&
+                shard.m_incoming.Pop(ticket) == AsRequest(&request) && ticket == second &&
+                shard.ClaimIncoming(AsRequest(&request),ticket)                         &&
+                shard.IsServicing(AsRequest(&request))                                  &&
+                shard.m_incoming.Pop(ticket) == nullptr                                 &&
+                shard.ResetServicing(AsRequest(&request))                               &&
+                shard.m_index.empty();
+  return result;
+}
+
+// Producers queue requests and cancel half of them straight away. A cancelled
+// request object is free at once, and is queued again while its old cell is
+// still on the ring. Consumers may only ever claim the live queueing.
+// Every queued request is either serviced or cancelled, every cancelled
+// one leaves exactly one cell behind that nobody claims.
+static bool ShardCancelWhileQueued(double& p_seconds)
+{
+  RequestShard shard(QUEUE_MIN_RING_SIZE);
+  std::vector<TestRequest> requests(RQ_PRODUCERS * RQ_POOLSIZE);
+  std::atomic<LONG64> serviced  { 0 };
+  std::atomic<LONG64> cancelled { 0 };
+  std::atomic<LONG64> skipped   { 0 };
+  std::atomic<LONG64> wrong     { 0 };
+  std::atomic<int>    producing { (int)RQ_PRODUCERS };
+
+  auto producer = [&](unsigned p_number)
+  {
+    TestRequest* pool = &requests[p_number * RQ_POOLSIZE];
+    unsigned queued = 0;
+    while(queued < RQ_REQUESTS)
+    {
+      // Take the lowest free object, as the request pool hands out the last freed
+      TestRequest* request = nullptr;
+      for(unsigned index = 0;index < RQ_POOLSIZE;++index)
+      {
+        if(pool[index].t_state.load() == 0)
+        {
+          request = &pool[index];
+          break;
+        }
+      }
+      if(request == nullptr)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+      request->t_state = 1;
+      LONG64 ticket = shard.IndexIncoming(AsRequest(request));
+      request->t_ticket = ticket;
+      if(!shard.m_incoming.Push(AsRequest(request),ticket))
+      {
+        // Ring is full: refuse the request, as the queue does with a 503
+        bool incoming = false;
+        shard.RemoveIndex(AsRequest(request),incoming);
+        request->t_state = 0;
+        std::this_thread::yield();
+        continue;
+      }
+      ++queued;
+      if(queued & 1)
+      {
+        bool incoming = false;
+        if(shard.RemoveIndex(AsRequest(request),incoming) && incoming)
+        {
+          ++cancelled;
+          request->t_state = 0;
+        }
+        // Otherwise a consumer has it, and frees it when done
+      }
+    }
+    --producing;
+  };
+
+  auto consumer = [&]()
+  {
+    while(true)
+    {
+      LONG64   ticket  = 0;
+      Request* popped  = shard.m_incoming.Pop(ticket);
+      if(popped == nullptr)
+      {
+        if(producing.load() == 0)
+        {
+          break;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+      TestRequest* request = reinterpret_cast<TestRequest*>(popped);
+      if(!shard.ClaimIncoming(popped,ticket))
+      {
+        ++skipped;
+        continue;
+      }
+      // Must be the live queueing of a queued request
+      int queued = 1;
+      if(request->t_ticket.load() != ticket || !request->t_state.compare_exchange_strong(queued,2))
+      {
+        ++wrong;
+      }
+      ++serviced;
+      shard.ResetServicing(popped);
+      request->t_state = 0;
+    }
+  };
+
+  HPFCounter counter;
+  std::vector<std::thread> threads;
+  for(unsigned index = 0;index < RQ_PRODUCERS;++index)
+  {
+    threads.emplace_back(producer,index);
+  }
+  for(unsigned index = 0;index < RQ_CONSUMERS;++index)
+  {
+    threads.emplace_back(consumer);
+  }
+  for(auto& thread : threads)
+  {
+    thread.join();
+  }
+  p_seconds = counter.GetCounter();
+
+  LONG64 total = (LONG64)RQ_PRODUCERS * RQ_REQUESTS;
+  return wrong.load() == 0                              &&
+         serviced.load() + cancelled.load() == total    &&
+         skipped.load() == cancelled.load()             &&
+         shard.m_index.empty();
+}
+
+// Test that a removed request that still sits in a ring of the queue
+// is never handed out, also not when its object is queued again.
+int
+TestMarlinServer::TestRequestQueue()
+{
+  int errors = 0;
+
+  xprintf(_T("TESTING THE SHARDS OF THE HTTPSYS REQUEST QUEUE\n"));
+  xprintf(_T("===============================================\n"));
+
+  bool reused = ShardReusedAddress();
+  if(!reused)
+  {
+    ++errors;
+  }
+  // SUMMARY OF THE TEST
+  // --- "--------------------------- - ------\n"
+  qprintf(_T("Queue shard reused address  : %s\n"),reused ? _T("OK") : _T("ERROR"));
+
+  double seconds = 0.0;
+  bool cancel = ShardCancelWhileQueued(seconds);
+  if(!cancel)
+  {
+    ++errors;
+  }
+  qprintf(_T("Queue shard cancel + reuse  : %s\n"),cancel ? _T("OK") : _T("ERROR"));
+  xprintf(_T("%d producers + %d consumers: %d requests in %.3f sec\n"),RQ_PRODUCERS,RQ_CONSUMERS,RQ_PRODUCERS * RQ_REQUESTS,seconds);
+
+  if(errors)
+  {
+    xerror();
+  }
+  else
+  {
+    totalChecks -= 2;
+  }
+  return errors;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// The arena and the pool of the HTTPSYS requests on their own
+//
+//////////////////////////////////////////////////////////////////////////
+
+const unsigned RA_REQUESTS = 100000;    // Keep-alive requests on one connection
+const size_t   RA_OBJECT   = sizeof(RequestArena) + 1024;  // About a request object
+const ULONG    RA_BUFFER   = 8 * 1024;  // Message buffer for the header lines
+
+static LPCSTR  ra_rawUrl  =  "/MarlinTest/Site/Products/Customer/12345?select=name,address&top=10";
+static PCWSTR  ra_fullUrl = L"http://localhost:1200/MarlinTest/Site/Products/Customer/12345?select=name,address&top=10";
+
+// What the header parsing takes from the arena for one request:
+// raw URL, full URL, the unknown headers table and the data chunks
+static void ArenaRequest(RequestArena* p_arena,size_t p_urlRepeat)
+{
+  for(size_t index = 0;index < p_urlRepeat;++index)
+  {
+    p_arena->Duplicate(ra_rawUrl,strlen(ra_rawUrl));
+  }
+  p_arena->Duplicate(ra_fullUrl,wcslen(ra_fullUrl));
+  p_arena->Allocate(16 * 4 * sizeof(void*));
+  p_arena->Allocate( 2 * 4 * sizeof(void*));
+}
+
+// Keeps the optimizer from skipping the heap allocations
+static void* volatile ra_sink = nullptr;
+
+// The same allocations from the process heap, as before the arena
+static void HeapRequest()
+{
+  size_t rawLength  = strlen(ra_rawUrl);
+  size_t fullLength = wcslen(ra_fullUrl);
+  char*    raw     = new char[rawLength + 1];
+  wchar_t* full    = new wchar_t[fullLength + 1];
+  void**   headers = new void*[16 * 4];
+  void**   chunks  = new void*[ 2 * 4];
+  memcpy(raw, ra_rawUrl, rawLength + 1);
+  memcpy(full,ra_fullUrl,(fullLength + 1) * sizeof(wchar_t));
+  ra_sink = raw;
+  ra_sink = full;
+  ra_sink = headers;
+  ra_sink = chunks;
+  delete [] chunks;
+  delete [] headers;
+  delete [] full;
+  delete [] raw;
+}
+
+// Normal requests must never leave the inline block of the arena.
+// A request with a very long URL takes exactly one block from the heap.
+static bool ArenaKeepAlive(ULONGLONG& p_allocations,double& p_arenaTime,double& p_heapTime)
+{
+  RequestArena* arena = alloc_new RequestArena();
+  p_allocations = 0;
+
+  HPFCounter counter1;
+  for(unsigned request = 0;request < RA_REQUESTS;++request)
+  {
+    ArenaRequest(arena,1);
+    p_allocations += arena->GetAllocations();
+    arena->Reset();
+  }
+  p_arenaTime = counter1.GetCounter();
+  bool result = arena->GetHeapBlocks() == 0;
+
+  // Far over the inline block of 4K
+  ArenaRequest(arena,100);
+  arena->Reset();
+  result = result && arena->GetHeapBlocks() == 1;
+  delete arena;
+
+  HPFCounter counter2;
+  for(unsigned request = 0;request < RA_REQUESTS;++request)
+  {
+    HeapRequest();
+  }
+  p_heapTime = counter2.GetCounter();
+  return result;
+}
+
+// Every keep-alive request after the first gets its object and
+// buffer from the pool. The last freed object comes back first:
+// that is why the request queue must ticket its ring cells.
+static bool PoolKeepAlive(RequestPool& p_pool)
+{
+  for(unsigned request = 0;request < RA_REQUESTS;++request)
+  {
+    void* object = p_pool.AllocateRequest(RA_OBJECT);
+    BYTE* buffer = p_pool.AllocateBuffer(RA_BUFFER);
+    p_pool.ReleaseBuffer(buffer,RA_BUFFER);
+    p_pool.ReleaseRequest(object);
+  }
+  bool result = p_pool.GetCreated()        == 1 && p_pool.GetReused()        == RA_REQUESTS - 1 &&
+                p_pool.GetBuffersCreated() == 1 && p_pool.GetBuffersReused() == RA_REQUESTS - 1;
+
+  void* first  = p_pool.AllocateRequest(RA_OBJECT);
+  void* second = p_pool.AllocateRequest(RA_OBJECT);
+  p_pool.ReleaseRequest(first);
+  p_pool.ReleaseRequest(second);
+  result = result && p_pool.AllocateRequest(RA_OBJECT) == second
+                  && p_pool.AllocateRequest(RA_OBJECT) == first;
+  p_pool.ReleaseRequest(first);
+  p_pool.ReleaseRequest(second);
+  return result;
+}
+
+// Test that keep-alive requests run on the arena and the pool,
+// and not on the process heap. Prints the time per request
+// for the arena against the same allocations from the heap.
+int
+TestMarlinServer::TestRequestArena()
+{
+  int errors = 0;
+
+  xprintf(_T("TESTING THE ARENA AND POOL OF THE HTTPSYS REQUESTS\n"));
+  xprintf(_T("==================================================\n"));
+
+  ULONGLONG allocations = 0;
+  double arenaTime = 0.0;
+  double heapTime  = 0.0;
+  bool arena = ArenaKeepAlive(allocations,arenaTime,heapTime);
+  if(!arena)
+  {
+    ++errors;
+  }
+  // SUMMARY OF THE TEST
+  // --- "--------------------------- - ------\n"
+  qprintf(_T("Request arena no heap blocks: %s\n"),arena ? _T("OK") : _T("ERROR"));
+  xprintf(_T("%d requests: %I64u arena allocations, 0 from the heap\n"),RA_REQUESTS,allocations);
+  xprintf(_T("Allocations by the arena    : %.1f ns/request\n"),arenaTime * 1e9 / RA_REQUESTS);
+  xprintf(_T("Allocations by the heap     : %.1f ns/request\n"),heapTime  * 1e9 / RA_REQUESTS);
+
+  RequestPool* pool = alloc_new RequestPool();
+  bool reuse = PoolKeepAlive(*pool);
+  if(!reuse)
+  {
+    ++errors;
+  }
+  qprintf(_T("Request pool reuse          : %s\n"),reuse ? _T("OK") : _T("ERROR"));
+  xprintf(_T("Objects created/reused: %I64u/%I64u Buffers created/reused: %I64u/%I64u\n")
+         ,pool->GetCreated(),pool->GetReused(),pool->GetBuffersCreated(),pool->GetBuffersReused());
+  delete pool;
+
+  if(errors)
+  {
+    xerror();
+  }
+  else
+  {
+    totalChecks -= 2;
+  }
+  return errors;
+}
+
+int
+TestMarlinServer::AfterTestRequestQueue()
+{
+  // SUMMARY OF THE TEST
+  // ---- "---------------------------------------------- - ------
+  qprintf(_T("HTTPSYS request queue, arena and pool          : %s\n"),totalChecks > 0 ? _T("ERROR") : _T("OK"));
+  return totalChecks > 0;
+}
@@ -0,0 +1,192 @@
+/////////////////////////////////////////////////////////////////////////////////
+//
+// SourceFile: TestSiteRouter.cpp
+//
+// Marlin Server: Internet server/client
+// 
+// Copyright (c) 2014-2025 ir. W.E. Huisman
+// All rights reserved
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "pch.h"
+#include "TestMarlinServer.h"
+#include <SiteRouter.h>
+#include <HPFCounter.h>
+#include <vector>
+#include <map>
+
+static int totalChecks = 2;
+
+//////////////////////////////////////////////////////////////////////////
+//
+// The site router of the server on its own.
+// The sites are stand-ins: the router never looks inside a site.
+//
+//////////////////////////////////////////////////////////////////////////
+
+const int SR_SITES   =   1000;    // Registered sites: 100 main sites with 9 sub-sites each
+const int SR_LOOKUPS = 200000;    // Lookups for the benchmark
+
+static HTTPSite* AsSite(INT_PTR p_number)
+{
+  return reinterpret_cast<HTTPSite*>(p_number + 1);
+}
+
+// Registration name of a main site (p_sub == 0) or of one of its sub-sites
+static XString SiteName(int p_main,int p_sub)
+{
+  XString name;
+  if(p_sub)
+  {
+    name.Format(_T("1200:/marlintest/site%d/sub%d"),p_main,p_sub);
+  }
+  else
+  {
+    name.Format(_T("1200:/marlintest/site%d"),p_main);
+  }
+  return name;
+}
+
+// As the server looked up the sites before the router: probing the
+// site map with every shorter prefix of the name on a segment boundary
+static HTTPSite* ProbeSiteMap(const std::map<XString,HTTPSite*>& p_sites,const XString& p_name)
+{
+  int pos = p_name.GetLength();
+  while(pos > 0)
+  {
+    auto it = p_sites.find(p_name.Left(pos));
+    if(it != p_sites.end())
+    {
+      return it->second;
+    }
+    while(--pos > 0)
+    {
+      if(p_name.GetAt(pos) == _T('/') || p_name.GetAt(pos) == _T('\\'))
+      {
+        break;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Longest match on a segment boundary, with the matched length
+static bool RouterMatches(SiteRouter& p_router)
+{
+  int matched = 0;
+  XString name(_T("1200:/marlintest/site12/sub3/route/part"));
+  bool result = p_router.FindSite(name,&matched) == AsSite(12 * 10 + 3) &&
+                matched == SiteName(12,3).GetLength();
+
+  // Main site, but no sub-site on a partial segment
+  result = result && p_router.FindSite(_T("1200:/marlintest/site12/sub30"),&matched) == AsSite(12 * 10) &&
+                     matched == SiteName(12,0).GetLength();
+  // Both separators count
+  result = result && p_router.FindSite(_T("1200:/marlintest\\site7\\sub9\\x")) == AsSite(7 * 10 + 9);
+  // Other port or no site at all
+  result = result && p_router.FindSite(_T("1201:/marlintest/site12")) == nullptr &&
+                     p_router.FindSite(_T("1200:/marlintest/site1000")) == nullptr &&
+                     p_router.FindSite(_T("1200:/marlintest")) == nullptr;
+  return result;
+}
+
+// Test the site router with 1000 sites: correct longest matches and the
+// time of a lookup, compared to probing the site map with the prefixes
+int
+TestMarlinServer::TestSiteRouter()
+{
+  int errors = 0;
+
+  xprintf(_T("TESTING THE SITE ROUTER WITH %d SITES\n"),SR_SITES);
+  xprintf(_T("=======================================\n"));
+
+  SiteRouter* router = alloc_new SiteRouter();
+  std::map<XString,HTTPSite*> sites;
+  for(int main = 0;main < SR_SITES / 10;++main)
+  {
+    for(int sub = 0;sub < 10;++sub)
+    {
+      XString name = SiteName(main,sub);
+      router->AddSite(name,AsSite(main * 10 + sub));
+      sites[name] = AsSite(main * 10 + sub);
+    }
+  }
+
+  bool matches = RouterMatches(*router);
+  if(!matches)
+  {
+    ++errors;
+  }
+  // SUMMARY OF THE TEST
+  // --- "--------------------------- - ------\n"
+  qprintf(_T("Site router longest match   : %s\n"),matches ? _T("OK") : _T("ERROR"));
+
+  // Requests to a sub-site with a route behind it, spread over all sites
+  std::vector<XString> urls;
+  for(int ind = 0;ind < SR_SITES;++ind)
+  {
+    XString url;
+    url.Format(_T("%s/customers/%d/orders"),SiteName(ind / 10,ind % 10).GetString(),ind);
+    urls.push_back(url);
+  }
+
+  bool same = true;
+  HPFCounter counter1;
+  for(int ind = 0;ind < SR_LOOKUPS;++ind)
+  {
+    same = (router->FindSite(urls[ind % SR_SITES]) == AsSite(ind % SR_SITES)) && same;
+  }
+  double routerTime = counter1.GetCounter();
+
+  HPFCounter counter2;
+  for(int ind = 0;ind < SR_LOOKUPS;++ind)
+  {
+    same = (ProbeSiteMap(sites,urls[ind % SR_SITES]) == AsSite(ind % SR_SITES)) && same;
+  }
+  double probeTime = counter2.GetCounter();
+  delete router;
+
+  if(!same)
+  {
+    ++errors;
+  }
+  qprintf(_T("Site router as the site map : %s\n"),same ? _T("OK") : _T("ERROR"));
+  xprintf(_T("Lookup by the site router   : %.1f ns/lookup\n"),routerTime * 1e9 / SR_LOOKUPS);
+  xprintf(_T("Lookup by prefixes in a map : %.1f ns/lookup\n"),probeTime  * 1e9 / SR_LOOKUPS);
+
+  if(errors)
+  {
+    xerror();
+  }
+  else
+  {
+    totalChecks -= 2;
+  }
+  return errors;
+}
+
+int
+TestMarlinServer::AfterTestSiteRouter()
+{
+  // SUMMARY OF THE TEST
+  // ---- "---------------------------------------------- - ------
+  qprintf(_T("Site router with 1000 sites                    : %s\n"),totalChecks > 0 ? _T("ERROR") : _T("OK"));
+  return totalChecks > 0;
+}
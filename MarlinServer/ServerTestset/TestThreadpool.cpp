@@ -28,8 +28,14 @@
 #include "pch.h"
 #include "TestMarlinServer.h"
 #include <ThreadPool.h>
+#include <WorkDeque.h>
+#include <HPFCounter.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <deque>
 
-static int totalChecks = 2;
+static int totalChecks = 3;
 static unsigned number = 0;
 static ThreadPool* pool = nullptr;
 const  unsigned TH_SLEEP =  314;
@@ -117,11 +123,194 @@ TestMarlinServer::TestThreadPool(ThreadPool* p_pool)
   return errors;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// The work stealing deque of the ThreadPool on its own
+//
+//////////////////////////////////////////////////////////////////////////
+
+const unsigned DQ_ITEMS   = 1000000;  // Work items per run
+const unsigned DQ_THIEVES =       3;  // Stealing threads besides the owner
+
+static std::atomic<unsigned char>* dequeTaken = nullptr;
+
+static void DequeWork(void* p_argument)
+{
+  dequeTaken[reinterpret_cast<size_t>(p_argument)]++;
+}
+
+// Owner pushes all items, popping one after every second push.
+// The thieves steal until the owner is done. Every item must be done once.
+static bool DequeOwnerAndThieves(double& p_seconds)
+{
+  WorkDeque deque;
+  std::atomic<bool> done { false };
+  std::vector<std::atomic<unsigned char>> taken(DQ_ITEMS);
+  dequeTaken = taken.data();
+
+  auto thief = [&]()
+  {
+    WorkDeque::WorkCallback callback = nullptr;
+    void* argument = nullptr;
+    while(!done.load() || deque.GetSize() > 0)
+    {
+      if(deque.Steal(callback,argument) == StealResult::Success)
+      {
+        (*callback)(argument);
+      }
+    }
+  };
+  HPFCounter counter;
+  std::vector<std::thread> thieves;
+  for(unsigned ind = 0;ind < DQ_THIEVES; ++ind)
+  {
+    thieves.emplace_back(thief);
+  }
+  WorkDeque::WorkCallback callback = nullptr;
+  void* argument = nullptr;
+  for(size_t item = 0;item < DQ_ITEMS; ++item)
+  {
+    while(!deque.Push(DequeWork,reinterpret_cast<void*>(item)))
+    {
+      // Full: do some work ourselves
+      if(deque.Pop(callback,argument))
+      {
+        (*callback)(argument);
+      }
+    }
+    if((item & 1) && deque.Pop(callback,argument))
+    {
+      (*callback)(argument);
+    }
+  }
+  while(deque.Pop(callback,argument))
+  {
+    (*callback)(argument);
+  }
+  done = true;
+  for(auto& thread : thieves)
+  {
+    thread.join();
+  }
+  p_seconds = counter.GetCounter();
+
+  bool result = true;
+  for(size_t item = 0;item < DQ_ITEMS; ++item)
+  {
+    if(taken[item] != 1)
+    {
+      result = false;
+    }
+  }
+  dequeTaken = nullptr;
+  return result;
+}
+
+// Test that the deque keeps LIFO for the owner and FIFO for the thieves,
+// refuses work when full, and loses or doubles no work under contention.
+// Prints the time per item for the deque against a locked std::deque,
+// as the global work queue of the ThreadPool is.
+int
+TestMarlinServer::TestWorkDeque()
+{
+  int errors = 0;
+  WorkDeque::WorkCallback callback = nullptr;
+  void* argument = nullptr;
+
+  xprintf(_T("TESTING THE WORK STEALING DEQUE OF THE THREADPOOL\n"));
+  xprintf(_T("=================================================\n"));
+
+  // Order: owner pops the last, thief steals the first
+  WorkDeque* deque = alloc_new WorkDeque();
+  for(size_t item = 1;item <= 3; ++item)
+  {
+    deque->Push(DequeWork,reinterpret_cast<void*>(item));
+  }
+  if(!deque->Pop(callback,argument) || argument != reinterpret_cast<void*>(3) ||
+     deque->Steal(callback,argument) != StealResult::Success || argument != reinterpret_cast<void*>(1) ||
+     !deque->Pop(callback,argument) || argument != reinterpret_cast<void*>(2) ||
+     deque->Pop(callback,argument)  || deque->Steal(callback,argument) != StealResult::Empty)
+  {
+    ++errors;
+  }
+  // SUMMARY OF THE TEST
+  // --- "--------------------------- - ------\n"
+  qprintf(_T("Work deque LIFO/FIFO order  : %s\n"),errors ? _T("ERROR") : _T("OK"));
+
+  // Full deque refuses work, and is usable again after a pop
+  bool full = true;
+  for(int item = 0;item < WORKDEQUE_CAPACITY; ++item)
+  {
+    full = full && deque->Push(DequeWork,nullptr);
+  }
+  full = full && !deque->Push(DequeWork,nullptr);
+  full = full && deque->Pop(callback,argument) && deque->Push(DequeWork,nullptr);
+  while(deque->Pop(callback,argument));
+  delete deque;
+  if(!full)
+  {
+    ++errors;
+  }
+  qprintf(_T("Work deque full/refuse      : %s\n"),full ? _T("OK") : _T("ERROR"));
+
+  // Owner and thieves all at once
+  double seconds = 0.0;
+  bool once = DequeOwnerAndThieves(seconds);
+  if(!once)
+  {
+    ++errors;
+  }
+  qprintf(_T("Work deque owner + %d thieves: %s\n"),DQ_THIEVES,once ? _T("OK") : _T("ERROR"));
+  xprintf(_T("Owner + %d thieves: %d items in %.3f sec (%.1f ns/item)\n"),DQ_THIEVES,DQ_ITEMS,seconds,seconds * 1e9 / DQ_ITEMS);
+
+  // BENCHMARK: owner only, against the locked queue
+  deque = alloc_new WorkDeque();
+  HPFCounter counter1;
+  for(size_t item = 0;item < DQ_ITEMS; ++item)
+  {
+    deque->Push(DequeWork,reinterpret_cast<void*>(item));
+    deque->Pop(callback,argument);
+  }
+  double dequeTime = counter1.GetCounter();
+  delete deque;
+
+  CRITICAL_SECTION lock;
+  InitializeCriticalSection(&lock);
+  std::deque<ThreadWork> queue;
+  HPFCounter counter2;
+  for(size_t item = 0;item < DQ_ITEMS; ++item)
+  {
+    ThreadWork work { DequeWork,reinterpret_cast<void*>(item) };
+    EnterCriticalSection(&lock);
+    queue.push_back(work);
+    LeaveCriticalSection(&lock);
+    EnterCriticalSection(&lock);
+    work = queue.front();
+    queue.pop_front();
+    LeaveCriticalSection(&lock);
+  }
+  double queueTime = counter2.GetCounter();
+  DeleteCriticalSection(&lock);
+
+  xprintf(_T("Push+pop by the owner  : %.1f ns/item\n"),dequeTime * 1e9 / DQ_ITEMS);
+  xprintf(_T("Push+pop locked queue  : %.1f ns/item\n"),queueTime * 1e9 / DQ_ITEMS);
+
+  if(errors)
+  {
+    xerror();
+  }
+  else
+  {
+    --totalChecks;
+  }
+  return errors;
+}
+
 int 
 TestMarlinServer::AfterTestThreadpool()
 {
   // SUMMARY OF THE TEST
   // ---- "---------------------------------------------- - ------
-  qprintf(_T("(HTTP)Threadpool sleeping/waking/submitwork    : %s\n"),totalChecks > 0 ? _T("ERROR") : _T("OK"));
+  qprintf(_T("(HTTP)Threadpool sleeping/waking/work deque    : %s\n"),totalChecks > 0 ? _T("ERROR") : _T("OK"));
   return totalChecks > 0;
 }
@@ -466,6 +466,7 @@ TestMarlinServer::RegisterSiteHandlers()
   TestCookies();
   TestCrackURL();
   TestPushEvents();
+  TestEventFrame();
   TestEventDriver();
   TestFilter();
   TestFormData();
@@ -474,6 +475,9 @@ TestMarlinServer::RegisterSiteHandlers()
   TestSecureSite       (m_runAsService != RUNAS_IISAPPPOOL);
   TestClientCertificate(m_runAsService != RUNAS_IISAPPPOOL);
   TestJsonData();
+  TestJsonWriter();
+  TestJsonReader();
+  TestJsonIndex();
   TestPatch();
   TestChunking();
   TestCompression();
@@ -481,6 +485,11 @@ TestMarlinServer::RegisterSiteHandlers()
   TestReliable();
   TestReliableBA();
   TestThreadPool(m_pool);
+  TestWorkDeque();
+  TestRequestQueue();
+  TestRequestArena();
+  TestRequestHeaders();
+  TestSiteRouter();
   TestHTTPTime();
   TestToken();
   TestSubSites();
@@ -513,6 +522,9 @@ TestMarlinServer::AfterTests()
   AfterTestMessageEncryption();
   AfterTestReliable();
   AfterTestThreadpool();
+  AfterTestRequestQueue();
+  AfterTestRequestHeaders();
+  AfterTestSiteRouter();
   AfterTestHTTPTime();
   AfterTestToken();
   AfterTestSubSites();
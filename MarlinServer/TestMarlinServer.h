@@ -108,10 +108,14 @@ private:
   int TestCookies();
   int TestCrackURL();
   int TestPushEvents();
+  int TestEventFrame();
   int TestFilter();
   int TestFormData();
   int TestInsecure();
   int TestJsonData();
+  int TestJsonWriter();
+  int TestJsonReader();
+  int TestJsonIndex();
   int TestMessageEncryption();
   int TestPatch();
   int TestReliable();
@@ -119,7 +123,12 @@ private:
   int TestSecureSite(bool p_standalone);
   int TestClientCertificate(bool p_standalone);
   int TestSubSites();
+  int TestSiteRouter();
   int TestThreadPool(ThreadPool* p_pool);
+  int TestWorkDeque();
+  int TestRequestQueue();
+  int TestRequestArena();
+  int TestRequestHeaders();
   int TestHTTPTime();
   int TestToken();
   int TestWebSocket();
@@ -153,7 +162,10 @@ private:
   int AfterTestReliable();
   int AfterTestSecureSite();
   int AfterTestSubSites();
+  int AfterTestSiteRouter();
   int AfterTestThreadpool();
+  int AfterTestRequestQueue();
+  int AfterTestRequestHeaders();
   int AfterTestHTTPTime();
   int AfterTestToken();
   int AfterTestWebSocket();